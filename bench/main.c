@@ -0,0 +1,716 @@
+#define GFX_IMPLEMENTATION
+#include "gfx.h"
+
+// Benchmarks of the hot paths of the library. Rendering is headless, so the
+// numbers are not tied to a window or vsync and any Vulkan driver works,
+// including lavapipe. Results are written as JSON, by default to
+// gfx_bench.json.
+//
+// Usage: gfx_bench [output path] [physical device index]
+
+#define MAX_RESULTS 32
+#define MAX_ITERATIONS 128
+
+#define FRAME_WIDTH 1280
+#define FRAME_HEIGHT 720
+#define DRAWS_PER_FRAME 1000
+#define RECORDING_THREADS 4
+#define DRAW_COLORS 16
+
+typedef struct {
+    char name[64];
+    uint32_t iterations;
+    double minMs;
+    double medianMs;
+    double meanMs;
+
+    // Optional throughput derived from the median, such as GB/s
+    double rate;
+    const char* pRateUnit;
+} BenchResult;
+
+typedef struct {
+    float offset[2];
+    float scale;
+    // Index of the draw's color buffer in the bindless heap
+    uint32_t colorIndex;
+} DrawConstants;
+
+// Range of draws of a frame, recorded either into the frame's command buffer
+// or into a secondary command buffer on a worker thread
+typedef struct {
+    const GfxLayout* pLayout;
+    const GfxShader* pVertexShader;
+    const GfxShader* pFragmentShader;
+    const GfxAttachment* pAttachment;
+    const GfxBuffer* pUniformBuffer;
+    const GfxBuffer* pColorBuffers;
+    const GfxDescriptorBuffer* pDescriptorBuffer;
+    uint32_t threadIndex;
+    uint32_t firstDraw;
+    uint32_t drawCount;
+    VkCommandBuffer cmd;
+} DrawRange;
+
+static BenchResult results[MAX_RESULTS];
+static uint32_t resultCount;
+
+static void framebufferSizeCallback(uint32_t* pWidth, uint32_t* pHeight)
+{
+    *pWidth = FRAME_WIDTH;
+    *pHeight = FRAME_HEIGHT;
+}
+
+// Milliseconds since a start time taken with getTimeNs()
+static double elapsedMs(uint64_t start)
+{
+    return (double)(getTimeNs() - start) / 1e6;
+}
+
+static BenchResult* addResult(const char* pName, double* pSamples, uint32_t count)
+{
+    if (resultCount == MAX_RESULTS) {
+        GFX_ERROR("Too many benchmark results");
+    }
+
+    qsort(pSamples, count, sizeof *pSamples, compareDoubles);
+
+    double sum = 0.0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += pSamples[i];
+    }
+
+    BenchResult* pResult = &results[resultCount++];
+    *pResult = (BenchResult){
+        .iterations = count,
+        .minMs = pSamples[0],
+        .medianMs = pSamples[count / 2],
+        .meanMs = sum / count,
+    };
+    snprintf(pResult->name, sizeof pResult->name, "%s", pName);
+
+    return pResult;
+}
+
+static bool hasDeviceExtension(VkPhysicalDevice physicalDevice, const char* pName)
+{
+    uint32_t count = 0;
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &count, NULL));
+    VkExtensionProperties* pExtensions = GFX_MALLOC(count * sizeof *pExtensions);
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &count, pExtensions));
+
+    bool found = false;
+    for (uint32_t i = 0; i < count && !found; i++) {
+        found = !strcmp(pExtensions[i].extensionName, pName);
+    }
+
+    GFX_FREE(pExtensions);
+
+    return found;
+}
+
+static void createDevice(uint32_t physicalDeviceIndex)
+{
+    const char* deviceExtensions[] = {
+        VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
+        VK_EXT_SHADER_OBJECT_EXTENSION_NAME,
+        VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME,
+    };
+    // The last extension is only enabled if the device has it
+    uint32_t deviceExtensionCount = GFX_ARRAY_LEN(deviceExtensions) - 1;
+
+    // The bindless heap and descriptor buffers are benchmarked where the
+    // device has the features they need
+    uint32_t physicalDeviceCount = 0;
+    VK_CHECK(vkEnumeratePhysicalDevices(gfxDevice.instance, &physicalDeviceCount, NULL));
+    VkPhysicalDevice* pPhysicalDevices = GFX_MALLOC(physicalDeviceCount * sizeof *pPhysicalDevices);
+    VK_CHECK(vkEnumeratePhysicalDevices(gfxDevice.instance, &physicalDeviceCount, pPhysicalDevices));
+
+    VkPhysicalDeviceDescriptorBufferFeaturesEXT supportedDescriptorBuffer = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+    };
+    VkPhysicalDeviceVulkan12Features supported12 = {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
+    VkPhysicalDeviceFeatures2 supported = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported12,
+    };
+    if (physicalDeviceIndex < physicalDeviceCount) {
+        VkPhysicalDevice physicalDevice = pPhysicalDevices[physicalDeviceIndex];
+        if (hasDeviceExtension(physicalDevice, VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME)) {
+            supported12.pNext = &supportedDescriptorBuffer;
+            deviceExtensionCount++;
+        }
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supported);
+    }
+    GFX_FREE(pPhysicalDevices);
+
+    VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT,
+        .descriptorBuffer = supportedDescriptorBuffer.descriptorBuffer,
+    };
+
+    VkPhysicalDeviceShaderObjectFeaturesEXT shaderObjectFeatures = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT,
+        .pNext = supported12.pNext ? &descriptorBufferFeatures : NULL,
+        .shaderObject = VK_TRUE,
+    };
+
+    VkPhysicalDeviceVulkan12Features vk12Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = &shaderObjectFeatures,
+        .timelineSemaphore = VK_TRUE,
+        .bufferDeviceAddress = supported12.bufferDeviceAddress,
+        .runtimeDescriptorArray = supported12.runtimeDescriptorArray,
+        .descriptorBindingPartiallyBound = supported12.descriptorBindingPartiallyBound,
+        .descriptorBindingUpdateUnusedWhilePending = supported12.descriptorBindingUpdateUnusedWhilePending,
+        .descriptorBindingSampledImageUpdateAfterBind = supported12.descriptorBindingSampledImageUpdateAfterBind,
+        .descriptorBindingStorageBufferUpdateAfterBind = supported12.descriptorBindingStorageBufferUpdateAfterBind,
+    };
+
+    VkPhysicalDeviceVulkan13Features vk13Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+        .pNext = &vk12Features,
+        .synchronization2 = VK_TRUE,
+        .dynamicRendering = VK_TRUE,
+    };
+
+    VkPhysicalDeviceFeatures2 features = {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                                          .pNext = &vk13Features,
+                                          .features = {
+                                              .samplerAnisotropy = VK_TRUE,
+                                              .shaderStorageBufferArrayDynamicIndexing =
+                                                  supported.features.shaderStorageBufferArrayDynamicIndexing,
+                                          }};
+
+    // No surface, so frames are presented to offscreen images
+    gfxCreateDevice(physicalDeviceIndex, deviceExtensionCount, deviceExtensions, &features, VK_NULL_HANDLE);
+}
+
+// Host to device-local buffer uploads through the staging ring, including the
+// wait for the copy to complete
+static void benchBufferUpload()
+{
+    const VkDeviceSize sizes[] = {64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+    const uint32_t iterations = 32;
+    const VkDeviceSize maxSize = sizes[GFX_ARRAY_LEN(sizes) - 1];
+
+    unsigned char* pData = GFX_MALLOC(maxSize);
+    for (VkDeviceSize i = 0; i < maxSize; i++) {
+        pData[i] = (unsigned char)(i * 31);
+    }
+
+    GfxBuffer buffer;
+    gfxCreateBuffer(maxSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffer);
+
+    double samples[MAX_ITERATIONS];
+
+    for (uint32_t s = 0; s < GFX_ARRAY_LEN(sizes); s++) {
+        // Warm up the staging ring and the driver
+        gfxCopyBufferFromHost(&buffer, pData, sizes[s], 0);
+        gfxWaitTicket(gfxFlushUploads());
+
+        for (uint32_t i = 0; i < iterations; i++) {
+            uint64_t start = getTimeNs();
+            gfxCopyBufferFromHost(&buffer, pData, sizes[s], 0);
+            gfxWaitTicket(gfxFlushUploads());
+            samples[i] = elapsedMs(start);
+        }
+
+        char name[64];
+        snprintf(name, sizeof name, "buffer_upload_%" PRIu64 "_kib", (uint64_t)(sizes[s] / 1024));
+
+        BenchResult* pResult = addResult(name, samples, iterations);
+        pResult->rate = (double)sizes[s] / (pResult->medianMs * 1e6);
+        pResult->pRateUnit = "GB/s";
+    }
+
+    gfxDestroyBuffer(&buffer);
+    GFX_FREE(pData);
+}
+
+// Texture creation from host data until the texture is ready to be sampled
+static void benchTextureCreation()
+{
+    const VkExtent3D extent = {.width = 1024, .height = 1024, .depth = 1};
+    const uint32_t iterations = 32;
+    const size_t size = (size_t)extent.width * extent.height * 4;
+
+    unsigned char* pPixels = GFX_MALLOC(size);
+    for (size_t i = 0; i < size; i++) {
+        pPixels[i] = (unsigned char)(i * 17);
+    }
+
+    double samples[MAX_ITERATIONS];
+
+    for (uint32_t mipmaps = 0; mipmaps < 2; mipmaps++) {
+        GfxTexture texture;
+
+        // Warm up, which also creates the sampler of the texture
+        gfxCreateTexture(GFX_TEXTURE_2D, VK_FORMAT_R8G8B8A8_UNORM, pPixels, extent, 4, mipmaps, &texture);
+        gfxWaitTicket(gfxFlushUploads());
+        gfxDestroyTexture(&texture);
+
+        for (uint32_t i = 0; i < iterations; i++) {
+            uint64_t start = getTimeNs();
+            gfxCreateTexture(GFX_TEXTURE_2D, VK_FORMAT_R8G8B8A8_UNORM, pPixels, extent, 4, mipmaps, &texture);
+            gfxWaitTicket(gfxFlushUploads());
+            samples[i] = elapsedMs(start);
+
+            gfxDestroyTexture(&texture);
+        }
+
+        addResult(mipmaps ? "texture_create_1024_mipmaps" : "texture_create_1024", samples, iterations);
+    }
+
+    GFX_FREE(pPixels);
+}
+
+// GLSL to SPIR-V compilation, and building the linked shader objects. The
+// shaders of the last build are kept for the draw benchmark.
+static void benchShaders(const GfxLayout* pLayout, GfxShader* pVertexShader, GfxShader* pFragmentShader)
+{
+    const uint32_t iterations = 16;
+    char name[64];
+
+    double vertexSamples[MAX_ITERATIONS];
+    double fragmentSamples[MAX_ITERATIONS];
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint64_t start = getTimeNs();
+        gfxCreateShaderFromFileGLSL("shader.vert", VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT, pLayout,
+                                    pVertexShader);
+        vertexSamples[i] = elapsedMs(start);
+
+        start = getTimeNs();
+        gfxCreateShaderFromFileGLSL("shader.frag", VK_SHADER_STAGE_FRAGMENT_BIT, 0, pLayout, pFragmentShader);
+        fragmentSamples[i] = elapsedMs(start);
+
+        if (i + 1 < iterations) {
+            gfxDestroyShader(pVertexShader);
+            gfxDestroyShader(pFragmentShader);
+        }
+    }
+
+    addResult("glsl_compile_vertex", vertexSamples, iterations);
+    addResult("glsl_compile_fragment", fragmentSamples, iterations);
+
+    double buildSamples[MAX_ITERATIONS];
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        // The shader objects are not in use yet, so they can go right away
+        if (i) {
+            gfxDevice.fn.vkDestroyShaderEXT(gfxDevice.device, pVertexShader->shader, NULL);
+            gfxDevice.fn.vkDestroyShaderEXT(gfxDevice.device, pFragmentShader->shader, NULL);
+        }
+
+        uint64_t start = getTimeNs();
+        gfxBuildLinkedShaders(pVertexShader, pFragmentShader);
+        buildSamples[i] = elapsedMs(start);
+    }
+
+    addResult("shader_build_linked", buildSamples, iterations);
+
+    // The same files compiled and built as one batch on worker threads
+    GfxShaderFileInfo infos[16];
+    GfxShader shaders[GFX_ARRAY_LEN(infos)];
+
+    for (uint32_t i = 0; i < GFX_ARRAY_LEN(infos); i++) {
+        bool vertex = i % 2 == 0;
+
+        infos[i] = (GfxShaderFileInfo){
+            .pPath = vertex ? "shader.vert" : "shader.frag",
+            .stage = vertex ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT,
+            .nextStage = vertex ? VK_SHADER_STAGE_FRAGMENT_BIT : 0,
+            .pLayout = pLayout,
+        };
+    }
+
+    double batchSamples[MAX_ITERATIONS];
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint64_t start = getTimeNs();
+        uint32_t failedCount = gfxCreateShadersFromFilesGLSL(GFX_ARRAY_LEN(infos), infos, shaders, NULL);
+        batchSamples[i] = elapsedMs(start);
+
+        if (failedCount) {
+            GFX_ERROR("%" PRIu32 " shaders failed to build", failedCount);
+        }
+
+        for (uint32_t j = 0; j < GFX_ARRAY_LEN(shaders); j++) {
+            gfxDestroyShader(&shaders[j]);
+        }
+    }
+
+    snprintf(name, sizeof name, "glsl_compile_batch_%" PRIu32, GFX_ARRAY_LEN(infos));
+    addResult(name, batchSamples, iterations);
+}
+
+// Headless frames of many small draws, each one setting the default states.
+// Uses the frame timings of the library, so recording is measured from
+// acquire to the end of the command buffer.
+static void recordDraws(VkCommandBuffer cmd, const DrawRange* pRange)
+{
+    // Bindless draws bind the heap once and only push an index per draw, and
+    // descriptor buffer draws bind the buffer once and pick a set per draw
+    if (pRange->pLayout->bindless) {
+        gfxCmdBindBindlessHeap(cmd, pRange->pLayout);
+    } else if (pRange->pDescriptorBuffer) {
+        gfxCmdBindDescriptorBuffer(cmd, pRange->pDescriptorBuffer);
+    } else {
+        VkDescriptorBufferInfo bufferInfo;
+        VkWriteDescriptorSet write = gfxGetBufferDescriptor(pRange->pUniformBuffer, 0,
+                                                            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, VK_WHOLE_SIZE,
+                                                            &bufferInfo);
+        gfxDevice.fn.vkCmdPushDescriptorSetKHR(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pRange->pLayout->pipelineLayout,
+                                               0, 1, &write);
+    }
+
+    gfxCmdBindShader(cmd, pRange->pVertexShader);
+    gfxCmdBindShader(cmd, pRange->pFragmentShader);
+
+    // States are set for every draw, as a renderer with varied materials
+    // would. The tracker only records the first draw's states.
+    GfxStateTracker tracker;
+    gfxResetStateTracker(&tracker, cmd);
+
+    for (uint32_t i = pRange->firstDraw; i < pRange->firstDraw + pRange->drawCount; i++) {
+        gfxCmdSetDefaultStates(&tracker, pRange->pAttachment, 0, NULL, 0, NULL);
+
+        // Small triangles on a grid, so that rasterization stays cheap
+        DrawConstants constants = {
+            .offset = {(float)(i % 40) / 20.0f - 1.0f, (float)(i / 40) / 12.5f - 1.0f},
+            .scale = 0.02f,
+            .colorIndex = pRange->pLayout->bindless ? pRange->pColorBuffers[i % DRAW_COLORS].bindlessIndex : 0,
+        };
+        vkCmdPushConstants(cmd, pRange->pLayout->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof constants,
+                           &constants);
+
+        if (pRange->pDescriptorBuffer) {
+            gfxCmdSetDescriptorBufferSet(cmd, pRange->pLayout, pRange->pDescriptorBuffer, i % DRAW_COLORS);
+        }
+
+        vkCmdDraw(cmd, 3, 1, 0, 0);
+    }
+}
+
+// Record a range of draws into a secondary command buffer. Runs as a job of
+// the library's thread pool.
+static void recordSecondary(void* pData)
+{
+    DrawRange* pRange = pData;
+
+    pRange->cmd = gfxCmdBeginSecondary(pRange->threadIndex, pRange->pAttachment);
+    recordDraws(pRange->cmd, pRange);
+    gfxCmdEndSecondary(pRange->cmd);
+}
+
+// Record the draws of each frame directly, or split over threadCount
+// secondary command buffers if it is not 0. With a bindless or a descriptor
+// buffer layout, the color of each draw comes from one of several buffers:
+// storage buffers in the heap, or uniform buffers in the sets of a descriptor
+// buffer.
+static void benchDraws(const GfxLayout* pLayout, const GfxShader* pVertexShader, const GfxShader* pFragmentShader,
+                       uint32_t threadCount)
+{
+    const uint32_t warmupFrames = 16;
+    const uint32_t frames = MAX_ITERATIONS;
+
+    VkExtent3D extent = {.width = gfxSwapchain.extent.width, .height = gfxSwapchain.extent.height, .depth = 1};
+
+    GfxImage colorAttachment;
+    gfxCreateImage(extent, 1, 1, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+                   VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 0, VK_IMAGE_TYPE_2D,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colorAttachment);
+    gfxCreateImageView(&colorAttachment, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D);
+
+    GfxAttachment attachment;
+    gfxCreateAttachment(1, &colorAttachment, NULL, NULL, &attachment);
+
+    GfxBuffer uniformBuffer;
+    gfxCreateBuffer(4 * sizeof(float), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uniformBuffer);
+
+    const float color[4] = {0.2f, 0.6f, 1.0f, 1.0f};
+    gfxCopyBufferFromHost(&uniformBuffer, color, sizeof color, 0);
+
+    bool perDrawColors = pLayout->bindless || pLayout->descriptorBuffer;
+    VkBufferUsageFlags colorUsage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    if (pLayout->bindless) {
+        colorUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    }
+
+    GfxBuffer colorBuffers[DRAW_COLORS];
+    GfxDescriptorBuffer descriptorBuffer;
+
+    if (perDrawColors) {
+        for (uint32_t i = 0; i < DRAW_COLORS; i++) {
+            gfxCreateBuffer(sizeof color, colorUsage,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                            &colorBuffers[i]);
+
+            if (pLayout->bindless && colorBuffers[i].bindlessIndex == GFX_BINDLESS_NONE) {
+                GFX_ERROR("Color buffer is not in the bindless heap");
+            }
+
+            const float shade[4] = {color[0], color[1], (float)i / DRAW_COLORS, 1.0f};
+            gfxCopyBufferFromHost(&colorBuffers[i], shade, sizeof shade, 0);
+        }
+    }
+
+    // One set per color, written once
+    if (pLayout->descriptorBuffer) {
+        gfxCreateDescriptorBuffer(pLayout, DRAW_COLORS, &descriptorBuffer);
+
+        for (uint32_t i = 0; i < DRAW_COLORS; i++) {
+            VkDescriptorBufferInfo bufferInfo;
+            VkWriteDescriptorSet write = gfxGetBufferDescriptor(&colorBuffers[i], 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                                                0, sizeof color, &bufferInfo);
+            gfxWriteDescriptorBuffer(&descriptorBuffer, pLayout, i, 1, &write);
+        }
+    }
+
+    double recordSamples[MAX_ITERATIONS];
+    double frameSamples[MAX_ITERATIONS];
+    uint32_t measured = 0;
+
+    // Start the worker threads before measuring, rather than on the first
+    // frame that records on them
+    if (threadCount) {
+        getThreadPool();
+    }
+
+    for (uint32_t frame = 0; measured < frames; frame++) {
+        gfxWaitForFrameInFlight();
+
+        // The framebuffer size never changes, so an image is always acquired
+        VkCommandBuffer cmd = gfxAcquireNextImage();
+        if (!cmd) {
+            continue;
+        }
+
+        gfxTransitionForColorAttachment(cmd, &colorAttachment);
+
+        // Without threads, the first range covers all draws
+        uint32_t rangeCount = GFX_MAX(threadCount, 1);
+        DrawRange ranges[RECORDING_THREADS];
+        for (uint32_t i = 0; i < rangeCount; i++) {
+            ranges[i] = (DrawRange){
+                .pLayout = pLayout,
+                .pVertexShader = pVertexShader,
+                .pFragmentShader = pFragmentShader,
+                .pAttachment = &attachment,
+                .pUniformBuffer = &uniformBuffer,
+                .pColorBuffers = perDrawColors ? colorBuffers : NULL,
+                .pDescriptorBuffer = pLayout->descriptorBuffer ? &descriptorBuffer : NULL,
+                .threadIndex = i,
+                .firstDraw = i * DRAWS_PER_FRAME / rangeCount,
+                .drawCount = (i + 1) * DRAWS_PER_FRAME / rangeCount - i * DRAWS_PER_FRAME / rangeCount,
+            };
+        }
+
+        VkClearValue clearValue = {.color = {{0.0f, 0.0f, 0.0f, 1.0f}}};
+
+        if (!threadCount) {
+            gfxCmdBeginRendering(cmd, &attachment, clearValue, VK_ATTACHMENT_LOAD_OP_CLEAR);
+            recordDraws(cmd, &ranges[0]);
+        } else {
+            gfxCmdBeginRenderingSecondaries(cmd, &attachment, clearValue, VK_ATTACHMENT_LOAD_OP_CLEAR);
+
+            // The calling thread records ranges too while it waits
+            struct GfxJobGroup group = {0};
+            for (uint32_t i = 0; i < threadCount; i++) {
+                submitJob(&group, recordSecondary, &ranges[i]);
+            }
+            waitJobGroup(&group);
+
+            VkCommandBuffer secondaries[RECORDING_THREADS];
+            for (uint32_t i = 0; i < threadCount; i++) {
+                secondaries[i] = ranges[i].cmd;
+            }
+            gfxCmdExecuteSecondaries(cmd, threadCount, secondaries);
+        }
+
+        gfxCmdEndRendering(cmd, &attachment);
+        gfxTransitionForBlitting(cmd, &colorAttachment);
+        gfxPresent(cmd, &colorAttachment);
+
+        if (frame < warmupFrames) {
+            continue;
+        }
+
+        const GfxFrameTimings* pTimings = gfxGetFrameTimings(0);
+
+        double total = 0.0;
+        for (uint32_t i = 0; i < GFX_FRAME_PHASE_COUNT; i++) {
+            total += pTimings->milliseconds[i];
+        }
+
+        recordSamples[measured] = pTimings->milliseconds[GFX_FRAME_PHASE_RECORD];
+        frameSamples[measured] = total;
+        measured++;
+    }
+
+    char name[64];
+    char suffix[32] = "";
+    if (threadCount) {
+        snprintf(suffix, sizeof suffix, "_threads_%" PRIu32, threadCount);
+    }
+    if (pLayout->bindless) {
+        snprintf(suffix + strlen(suffix), sizeof suffix - strlen(suffix), "_bindless");
+    } else if (pLayout->descriptorBuffer) {
+        snprintf(suffix + strlen(suffix), sizeof suffix - strlen(suffix), "_descriptor_buffer");
+    }
+
+    snprintf(name, sizeof name, "draw_record_%d%s", DRAWS_PER_FRAME, suffix);
+    BenchResult* pRecord = addResult(name, recordSamples, frames);
+    pRecord->rate = DRAWS_PER_FRAME / (pRecord->medianMs / 1e3);
+    pRecord->pRateUnit = "draws/s";
+
+    snprintf(name, sizeof name, "draw_frame_%d%s", DRAWS_PER_FRAME, suffix);
+    BenchResult* pFrame = addResult(name, frameSamples, frames);
+    pFrame->rate = 1e3 / pFrame->medianMs;
+    pFrame->pRateUnit = "frames/s";
+
+    if (pLayout->descriptorBuffer) {
+        gfxDestroyDescriptorBuffer(&descriptorBuffer);
+    }
+
+    if (perDrawColors) {
+        for (uint32_t i = 0; i < DRAW_COLORS; i++) {
+            gfxDestroyBuffer(&colorBuffers[i]);
+        }
+    }
+
+    gfxDestroyBuffer(&uniformBuffer);
+    gfxDestroyAttachment(&attachment);
+    gfxDestroyImage(&colorAttachment);
+}
+
+static void writeResults(const char* pPath)
+{
+    FILE* file = fopen(pPath, "w");
+    if (!file) {
+        GFX_ERROR("Unable to open %s", pPath);
+    }
+
+    uint32_t apiVersion = gfxDevice.properties.physicalDevice.apiVersion;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"device\": \"%s\",\n", gfxDevice.properties.physicalDevice.deviceName);
+    fprintf(file, "  \"api_version\": \"%d.%d.%d\",\n", VK_API_VERSION_MAJOR(apiVersion),
+            VK_API_VERSION_MINOR(apiVersion), VK_API_VERSION_PATCH(apiVersion));
+    fprintf(file, "  \"driver_version\": %" PRIu32 ",\n", gfxDevice.properties.physicalDevice.driverVersion);
+    fprintf(file, "  \"benchmarks\": [\n");
+
+    for (uint32_t i = 0; i < resultCount; i++) {
+        const BenchResult* pResult = &results[i];
+
+        fprintf(file,
+                "    {\"name\": \"%s\", \"iterations\": %" PRIu32
+                ", \"min_ms\": %.6f, \"median_ms\": %.6f, \"mean_ms\": %.6f",
+                pResult->name, pResult->iterations, pResult->minMs, pResult->medianMs, pResult->meanMs);
+
+        if (pResult->pRateUnit) {
+            fprintf(file, ", \"rate\": %.3f, \"rate_unit\": \"%s\"", pResult->rate, pResult->pRateUnit);
+        }
+
+        fprintf(file, "}%s\n", i + 1 < resultCount ? "," : "");
+    }
+
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+
+    fclose(file);
+
+    GFX_INFO("Wrote %" PRIu32 " benchmark results to %s", resultCount, pPath);
+}
+
+int main(int argc, char** argv)
+{
+    const char* pOutputPath = argc > 1 ? argv[1] : "gfx_bench.json";
+    uint32_t physicalDeviceIndex = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 0;
+
+    gfxCreateInstance(VK_API_VERSION_1_3, 0, NULL);
+    createDevice(physicalDeviceIndex);
+    gfxCreateSwapchain(2, framebufferSizeCallback);
+
+    VkDescriptorType types[] = {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER};
+    VkShaderStageFlags stages[] = {VK_SHADER_STAGE_VERTEX_BIT};
+    uint32_t counts[] = {1};
+    VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(DrawConstants),
+    };
+
+    GfxLayout layout;
+    gfxCreateLayout(GFX_ARRAY_LEN(types), types, stages, counts, 1, &pushConstantRange, &layout);
+
+    GfxShader vertexShader;
+    GfxShader fragmentShader;
+
+    benchBufferUpload();
+    benchTextureCreation();
+    benchShaders(&layout, &vertexShader, &fragmentShader);
+    benchDraws(&layout, &vertexShader, &fragmentShader, 0);
+    benchDraws(&layout, &vertexShader, &fragmentShader, RECORDING_THREADS);
+
+    // The heap is only created now, so the resources of the other benchmarks
+    // are not written to it
+    if (gfxDevice.bindlessFeatures) {
+        gfxCreateBindlessHeap();
+
+        GfxLayout bindlessLayout;
+        gfxCreateBindlessLayout(1, &pushConstantRange, &bindlessLayout);
+
+        GfxShader bindlessVertexShader;
+        GfxShader bindlessFragmentShader;
+        gfxCreateShaderFromFileGLSL("shader_bindless.vert", VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT,
+                                    &bindlessLayout, &bindlessVertexShader);
+        gfxCreateShaderFromFileGLSL("shader.frag", VK_SHADER_STAGE_FRAGMENT_BIT, 0, &bindlessLayout,
+                                    &bindlessFragmentShader);
+        gfxBuildLinkedShaders(&bindlessVertexShader, &bindlessFragmentShader);
+
+        benchDraws(&bindlessLayout, &bindlessVertexShader, &bindlessFragmentShader, 0);
+
+        gfxDestroyShader(&bindlessVertexShader);
+        gfxDestroyShader(&bindlessFragmentShader);
+        gfxDestroyLayout(&bindlessLayout);
+    } else {
+        GFX_WARNING("Skipping the bindless draw benchmark, the device lacks descriptor indexing features");
+    }
+
+    if (gfxDevice.descriptorBuffer) {
+        GfxLayout descriptorBufferLayout;
+        gfxCreateDescriptorBufferLayout(GFX_ARRAY_LEN(types), types, stages, counts, 1, &pushConstantRange,
+                                        &descriptorBufferLayout);
+
+        GfxShader descriptorBufferVertexShader;
+        GfxShader descriptorBufferFragmentShader;
+        gfxCreateShaderFromFileGLSL("shader.vert", VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_FRAGMENT_BIT,
+                                    &descriptorBufferLayout, &descriptorBufferVertexShader);
+        gfxCreateShaderFromFileGLSL("shader.frag", VK_SHADER_STAGE_FRAGMENT_BIT, 0, &descriptorBufferLayout,
+                                    &descriptorBufferFragmentShader);
+        gfxBuildLinkedShaders(&descriptorBufferVertexShader, &descriptorBufferFragmentShader);
+
+        benchDraws(&descriptorBufferLayout, &descriptorBufferVertexShader, &descriptorBufferFragmentShader, 0);
+
+        gfxDestroyShader(&descriptorBufferVertexShader);
+        gfxDestroyShader(&descriptorBufferFragmentShader);
+        gfxDestroyLayout(&descriptorBufferLayout);
+    } else {
+        GFX_WARNING("Skipping the descriptor buffer draw benchmark, the device lacks VK_EXT_descriptor_buffer");
+    }
+
+    writeResults(pOutputPath);
+
+    gfxDestroyShader(&vertexShader);
+    gfxDestroyShader(&fragmentShader);
+
+    gfxDestroyLayout(&layout);
+
+    gfxDestroySwapchain();
+    gfxDestroyDevice();
+    gfxDestroyInstance();
+}
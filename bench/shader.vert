@@ -0,0 +1,19 @@
+#version 460
+
+layout(set = 0, binding = 0) uniform BenchUniforms {
+    vec4 color;
+} bench;
+
+layout(push_constant) uniform DrawConstants {
+    vec2 offset;
+    float scale;
+} draw;
+
+layout(location = 0) out vec4 vertexColor;
+
+void main() {
+    // Fullscreen-ish triangle from the vertex index, no vertex buffers needed
+    vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2) - 1.0;
+    vertexColor = bench.color;
+    gl_Position = vec4(position * draw.scale + draw.offset, 0.0, 1.0);
+}
@@ -0,0 +1,22 @@
+#version 460
+
+// Colors are storage buffers in the bindless heap, picked per draw through an
+// index in the push constants
+layout(set = 0, binding = 2) readonly buffer BenchColors {
+    vec4 color;
+} colors[];
+
+layout(push_constant) uniform DrawConstants {
+    vec2 offset;
+    float scale;
+    uint colorIndex;
+} draw;
+
+layout(location = 0) out vec4 vertexColor;
+
+void main() {
+    // Fullscreen-ish triangle from the vertex index, no vertex buffers needed
+    vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2) - 1.0;
+    vertexColor = colors[draw.colorIndex].color;
+    gl_Position = vec4(position * draw.scale + draw.offset, 0.0, 1.0);
+}
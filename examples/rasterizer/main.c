@@ -72,9 +72,15 @@ static void createDevice(VkSurfaceKHR surface)
         .shaderObject = VK_TRUE,
     };
 
+    VkPhysicalDeviceVulkan12Features vk12Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = &shaderObjectFeatures,
+        .timelineSemaphore = VK_TRUE,
+    };
+
     VkPhysicalDeviceVulkan13Features vk13Features = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
-        .pNext = &shaderObjectFeatures,
+        .pNext = &vk12Features,
         .synchronization2 = VK_TRUE,
         .dynamicRendering = VK_TRUE,
         .shaderDemoteToHelperInvocation = VK_TRUE,
@@ -118,7 +124,8 @@ static void createAttachments(GfxImage* pColorAttachment, GfxImage* pDepthAttach
                     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
                     VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, pDepthAttachment->image,
                     &depthSubresourceRange);
-    gfxCmdEnd(cmd);
+    // The frames that use the attachment are submitted after the transition
+    gfxCmdSubmitAsync(cmd);
 }
 
 static void createLayout(GfxLayout* pLayout)
@@ -162,7 +169,7 @@ static void createVertexAndIndexBuffers(GfxBuffer* pVertexBuffer, GfxBuffer* pIn
     gfxCopyBufferFromHost(pIndexBuffer, indices, sizeof(indices), 0);
 }
 
-static void cmdSetRenderingStates(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet)
+static void cmdSetRenderingStates(GfxStateTracker* pTracker, const GfxAttachment* pAttachmentSet)
 {
     const VkVertexInputBindingDescription2EXT vertexBindingDescription[] = {{
         .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT,
@@ -189,7 +196,7 @@ static void cmdSetRenderingStates(VkCommandBuffer cmd, const GfxAttachment* pAtt
         },
     };
 
-    gfxCmdSetDefaultStates(cmd, pAttachmentSet, GFX_ARRAY_LEN(vertexBindingDescription), vertexBindingDescription,
+    gfxCmdSetDefaultStates(pTracker, pAttachmentSet, GFX_ARRAY_LEN(vertexBindingDescription), vertexBindingDescription,
                            GFX_ARRAY_LEN(vertexAttributeDescription), vertexAttributeDescription);
 }
 
@@ -223,6 +230,10 @@ int main()
     gfxCreateShaderFromFileGLSL("shader.frag", VK_SHADER_STAGE_FRAGMENT_BIT, 0, &layout, &fragmentShader);
     gfxBuildLinkedShaders(&vertexShader, &fragmentShader);
 
+    // Pick up edits to the shaders while running
+    gfxWatchShader(&vertexShader);
+    gfxWatchShader(&fragmentShader);
+
     GfxBuffer cameraBuffer;
     gfxCreateBuffer(sizeof(CameraMatrices), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &cameraBuffer);
@@ -248,14 +259,15 @@ int main()
     GfxBuffer indexBuffer;
     createVertexAndIndexBuffers(&vertexBuffer, &indexBuffer);
 
-    // Seconds since last game loop
+    // Seconds since last game loop, and since frame timings were last printed
     float delta = 0.0f;
+    float zoneTimer = 0.0f;
     while (!glfwWindowShouldClose(pWindow)) {
         delta = (float)glfwGetTime();
         glfwSetTime(0.0);
 
         // Wait for shared resources to be available
-        gfxWaitForFence();
+        gfxWaitForFrameInFlight();
 
         // Rotate model
         angle += delta;
@@ -269,6 +281,9 @@ int main()
             gfxRecreateAttachment(&attachment, 1, &colorAttachment, &depthAttachment, NULL);
         }
 
+        // Swap in shaders that were edited, between frames
+        gfxReloadShaders();
+
         // Start new frame. No command buffer means the swapchain was out of
         // date and got recreated, so skip this frame.
         VkCommandBuffer cmd = gfxAcquireNextImage();
@@ -277,25 +292,30 @@ int main()
             continue;
         }
 
+        gfxCmdBeginZone(cmd, "Frame");
+        gfxCmdBeginZone(cmd, "Main pass");
+
         gfxTransitionForColorAttachment(cmd, &colorAttachment);
 
         VkClearValue clearValue = {.color = {{0.0f, 0.0f, 0.0f, 1.0f}}};
         gfxCmdBeginRendering(cmd, &attachment, clearValue, VK_ATTACHMENT_LOAD_OP_CLEAR);
 
         // Set rendering states. Depth writes are on by default.
-        cmdSetRenderingStates(cmd, &attachment);
-
-        // Push descriptor. The buffer infos have to outlive the writes.
-        VkDescriptorBufferInfo bufferInfos[2];
-        VkWriteDescriptorSet writes[] = {
-            gfxGetBufferDescriptor(&cameraBuffer, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, VK_WHOLE_SIZE,
-                                   &bufferInfos[0]),
-            gfxGetBufferDescriptor(&modelBuffer, 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, VK_WHOLE_SIZE,
-                                   &bufferInfos[1]),
-            gfxGetTextureDescriptor(&texture, 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+        GfxStateTracker tracker;
+        gfxResetStateTracker(&tracker, cmd);
+        cmdSetRenderingStates(&tracker, &attachment);
+
+        // Push descriptor, packed in binding order for the layout's template
+        struct {
+            VkDescriptorBufferInfo camera;
+            VkDescriptorBufferInfo model;
+            VkDescriptorImageInfo texture;
+        } descriptors = {
+            .camera = {.buffer = cameraBuffer.buffer, .offset = 0, .range = VK_WHOLE_SIZE},
+            .model = {.buffer = modelBuffer.buffer, .offset = 0, .range = VK_WHOLE_SIZE},
+            .texture = texture.imageInfo,
         };
-        gfxDevice.fn.vkCmdPushDescriptorSetKHR(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout.pipelineLayout, 0,
-                                               GFX_ARRAY_LEN(writes), writes);
+        gfxCmdPushDescriptors(cmd, &layout, &descriptors);
 
         // Bind shaders
         gfxCmdBindShader(cmd, &vertexShader);
@@ -311,9 +331,33 @@ int main()
 
         // End and present frame
         gfxCmdEndRendering(cmd, &attachment);
+        gfxCmdEndZone(cmd);
         gfxTransitionForBlitting(cmd, &colorAttachment);
+        gfxCmdEndZone(cmd);
         gfxPresent(cmd, &colorAttachment);
 
+        // Print GPU time of the zones and CPU frame phases about once a second
+        zoneTimer += delta;
+        if (zoneTimer >= 1.0f) {
+            zoneTimer = 0.0f;
+
+            const GfxZoneResult* pResults;
+            uint32_t resultCount = gfxGetZoneResults(&pResults, NULL);
+            for (uint32_t i = 0; i < resultCount; i++) {
+                GFX_INFO("%*s%s: %.3f ms", (int)(2 * pResults[i].depth), "", pResults[i].pName,
+                         pResults[i].milliseconds);
+            }
+
+            // CPU side of the frame, to tell waiting on the GPU from presenting
+            const char* phaseNames[GFX_FRAME_PHASE_COUNT] = {"Wait", "Acquire", "Record", "Submit", "Present"};
+            GfxFramePhaseStats stats[GFX_FRAME_PHASE_COUNT];
+            gfxGetFramePhaseStats(stats);
+            for (uint32_t i = 0; i < GFX_FRAME_PHASE_COUNT; i++) {
+                GFX_INFO("%s: min %.3f ms, avg %.3f ms, p99 %.3f ms", phaseNames[i], stats[i].min, stats[i].avg,
+                         stats[i].p99);
+            }
+        }
+
         glfwPollEvents();
     }
 
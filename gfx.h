@@ -46,6 +46,7 @@ extern "C" {
 
 #include <glslang/Include/glslang_c_interface.h>
 #include <glslang/Public/resource_limits_c.h>
+#include <spirv-tools/libspirv.h>
 
 // Define GFX_USE_STB_IMAGE if stb_image.h is available. This allows for
 // texture loading from file.
@@ -56,11 +57,13 @@ extern "C" {
 #include <assert.h>
 #include <inttypes.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #if GFX_LINUX
 #include <signal.h>
@@ -69,19 +72,115 @@ extern "C" {
 // Get the length of an array. Don't use for pointers!
 #define GFX_ARRAY_LEN(x) (uint32_t)(sizeof(x) / sizeof *(x))
 
+// Mark a function that is kept for compatibility, with what to use instead
+#if defined(_MSC_VER)
+#define GFX_DEPRECATED(msg) __declspec(deprecated(msg))
+#elif defined(__GNUC__)
+#define GFX_DEPRECATED(msg) __attribute__((deprecated(msg)))
+#else
+#define GFX_DEPRECATED(msg)
+#endif
+
 // Memory allocation macros. Overload to use custom allocations.
 #ifndef GFX_MALLOC
 #define GFX_MALLOC(sz) gfxCheckedMalloc(sz)
 #endif
 
 #ifndef GFX_REALLOC
-#define GFX_REALLOC(p, sz) realloc(p, sz)
+#define GFX_REALLOC(p, sz) gfxCheckedRealloc(p, sz)
 #endif
 
 #ifndef GFX_FREE
 #define GFX_FREE(p) free(p)
 #endif
 
+// Size of the device memory blocks that buffers and images are sub-allocated
+// from. Resources larger than this get a block of their own.
+#ifndef GFX_MEMORY_BLOCK_SIZE
+#define GFX_MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)
+#endif
+
+// Size of the persistently mapped staging ring that uploads to device local
+// memory go through. Larger uploads are split to fit.
+#ifndef GFX_STAGING_RING_SIZE
+#define GFX_STAGING_RING_SIZE (32ull * 1024 * 1024)
+#endif
+
+// Number of upload batches that can be in flight at once
+#define GFX_STAGING_BATCH_COUNT 8
+
+// Sizes of the arrays of the bindless descriptor heap, see
+// gfxCreateBindlessHeap(). They are reduced to the limits of the device.
+#ifndef GFX_BINDLESS_IMAGE_COUNT
+#define GFX_BINDLESS_IMAGE_COUNT 16384
+#endif
+
+#ifndef GFX_BINDLESS_SAMPLER_COUNT
+#define GFX_BINDLESS_SAMPLER_COUNT 256
+#endif
+
+#ifndef GFX_BINDLESS_BUFFER_COUNT
+#define GFX_BINDLESS_BUFFER_COUNT 16384
+#endif
+
+// Number of color attachments whose blend state a GfxStateTracker filters
+#ifndef GFX_MAX_COLOR_ATTACHMENTS
+#define GFX_MAX_COLOR_ATTACHMENTS 8
+#endif
+
+// Number of vertex bindings and of vertex attributes whose descriptions a
+// GfxStateTracker keeps. Larger vertex inputs are recorded every time.
+#ifndef GFX_MAX_TRACKED_VERTEX_INPUTS
+#define GFX_MAX_TRACKED_VERTEX_INPUTS 16
+#endif
+
+// Number of worker threads for parallel work such as shader compilation. 0
+// uses one less than the number of processors, as the waiting thread helps.
+#ifndef GFX_THREAD_COUNT
+#define GFX_THREAD_COUNT 0
+#endif
+
+// Number of threads that can record secondary command buffers of a frame at
+// the same time, see gfxCmdBeginSecondary()
+#ifndef GFX_MAX_RECORDING_THREADS
+#define GFX_MAX_RECORDING_THREADS 16
+#endif
+
+// Run SPIR-V compiled from GLSL through the performance passes of the
+// SPIRV-Tools optimizer, such as inlining, dead code elimination, constant
+// folding and scalar replacement. GFX_SPIRV_STRIP_DEBUG additionally removes
+// debug information like names, which shader debuggers rely on. Both default
+// to release builds only.
+#ifndef GFX_SPIRV_OPTIMIZE
+#ifdef NDEBUG
+#define GFX_SPIRV_OPTIMIZE 1
+#else
+#define GFX_SPIRV_OPTIMIZE 0
+#endif
+#endif
+
+#ifndef GFX_SPIRV_STRIP_DEBUG
+#ifdef NDEBUG
+#define GFX_SPIRV_STRIP_DEBUG 1
+#else
+#define GFX_SPIRV_STRIP_DEBUG 0
+#endif
+#endif
+
+// Maximum number of GPU profiling zones per frame, and how deep they can nest
+#ifndef GFX_PROFILER_MAX_ZONES
+#define GFX_PROFILER_MAX_ZONES 64
+#endif
+#define GFX_PROFILER_MAX_DEPTH 16
+
+// Number of recent frames that CPU frame phase statistics are computed over
+#ifndef GFX_FRAME_STATS_COUNT
+#define GFX_FRAME_STATS_COUNT 128
+#endif
+
+// Uploads use a dedicated transfer queue when the device exposes one. Define
+// GFX_NO_TRANSFER_QUEUE to keep all work on the graphics queue.
+
 
 // Error handling and logging //
 
@@ -204,6 +303,9 @@ typedef struct GfxDeviceProperties {
     VkPhysicalDeviceProperties physicalDevice;
     VkPhysicalDeviceMemoryProperties memory;
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingPipeline;
+    VkPhysicalDeviceShaderObjectPropertiesEXT shaderObject;
+    VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptorBuffer;
+    VkPhysicalDeviceDescriptorIndexingProperties descriptorIndexing;
 } GfxDeviceProperties;
 
 // Device level function pointers for extensions that the Vulkan loader does not
@@ -213,6 +315,7 @@ typedef struct GfxDeviceProperties {
 typedef struct GfxDeviceFunctions {
     PFN_vkCreateShadersEXT vkCreateShadersEXT;
     PFN_vkDestroyShaderEXT vkDestroyShaderEXT;
+    PFN_vkGetShaderBinaryDataEXT vkGetShaderBinaryDataEXT;
     PFN_vkCmdBindShadersEXT vkCmdBindShadersEXT;
     PFN_vkCmdSetVertexInputEXT vkCmdSetVertexInputEXT;
     PFN_vkCmdSetRasterizationSamplesEXT vkCmdSetRasterizationSamplesEXT;
@@ -222,9 +325,62 @@ typedef struct GfxDeviceFunctions {
     PFN_vkCmdSetLogicOpEnableEXT vkCmdSetLogicOpEnableEXT;
     PFN_vkCmdSetColorBlendEnableEXT vkCmdSetColorBlendEnableEXT;
     PFN_vkCmdSetColorWriteMaskEXT vkCmdSetColorWriteMaskEXT;
+    PFN_vkCmdSetColorBlendEquationEXT vkCmdSetColorBlendEquationEXT;
     PFN_vkCmdPushDescriptorSetKHR vkCmdPushDescriptorSetKHR;
+    PFN_vkCmdPushDescriptorSetWithTemplateKHR vkCmdPushDescriptorSetWithTemplateKHR;
+    PFN_vkGetDescriptorSetLayoutSizeEXT vkGetDescriptorSetLayoutSizeEXT;
+    PFN_vkGetDescriptorSetLayoutBindingOffsetEXT vkGetDescriptorSetLayoutBindingOffsetEXT;
+    PFN_vkGetDescriptorEXT vkGetDescriptorEXT;
+    PFN_vkCmdBindDescriptorBuffersEXT vkCmdBindDescriptorBuffersEXT;
+    PFN_vkCmdSetDescriptorBufferOffsetsEXT vkCmdSetDescriptorBufferOffsetsEXT;
 } GfxDeviceFunctions;
 
+// Memory block is a large device memory allocation that buffers and images are
+// sub-allocated from. Blocks are internally managed by the device.
+typedef struct GfxMemoryBlock GfxMemoryBlock;
+
+// Allocation describes the range of a memory block that a buffer or image is
+// bound to. Many resources share the same VkDeviceMemory at different offsets,
+// so always bind and map with both memory and offset.
+typedef struct GfxAllocation {
+    GfxMemoryBlock* pBlock;
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} GfxAllocation;
+
+// Deferred destroy is a resource handle or memory allocation that is released
+// once the GPU has finished with it. Entries are internally managed by the
+// device.
+typedef struct GfxDeferredDestroy GfxDeferredDestroy;
+
+// Sampler key holds the sampler state that can differ between textures. The
+// device keeps one sampler per distinct key, shared by all textures using it.
+typedef struct GfxSamplerKey {
+    VkFilter magFilter;
+    VkFilter minFilter;
+    VkSamplerMipmapMode mipmapMode;
+    VkSamplerAddressMode addressModeU;
+    VkSamplerAddressMode addressModeV;
+    VkSamplerAddressMode addressModeW;
+} GfxSamplerKey;
+
+// Index of a texture, sampler or buffer that has no descriptor in the bindless
+// descriptor heap
+#define GFX_BINDLESS_NONE UINT32_MAX
+
+// Bindings of the descriptor arrays in the set of bindless layouts
+enum GfxBindlessBinding {
+    GFX_BINDLESS_IMAGES,
+    GFX_BINDLESS_SAMPLERS,
+    GFX_BINDLESS_BUFFERS,
+};
+
+// Ticket identifies a submission to the graphics queue. Tickets increase
+// monotonically, so a completed ticket implies that all earlier ones have
+// completed too. Query and wait with gfxIsTicketComplete() and gfxWaitTicket().
+typedef uint64_t GfxTicket;
+
 // Device contains a Vulkan context for rendering. The GFX device is
 // monolithic and is setup through gfxCreateInstance() and gfxCreateDevice().
 // Release resources with gfxDestroyDevice() and gfxDestroyInstance().
@@ -235,17 +391,185 @@ typedef struct GfxDevice {
     VkSurfaceKHR surface;
     GfxDeviceProperties properties;
     GfxDeviceFunctions fn;
+    // Command buffers of gfxCmdBegin() are not tied to a frame, so they come
+    // from this pool and are reset one at a time once their ticket completes.
+    // Frames use the transient pools of GfxSwapchain instead.
     VkCommandPool commandPool;
     VkQueue queue;
+    // Uploads run on a dedicated transfer-only queue family when the device
+    // has one. Otherwise these alias the pool and queue above.
+    VkCommandPool transferCommandPool;
+    VkQueue transferQueue;
 #ifndef NDEBUG
     VkDebugUtilsMessengerEXT debugMessenger;
 #endif
     uint32_t queueFamilyIndex;
+    uint32_t transferQueueFamilyIndex;
     uint32_t apiVersion;
     bool vsync;
     bool samplerAnisotropy;
+    bool descriptorBuffer;
+    bool bindlessFeatures;
+
+    // Timeline semaphore that every submission to the graphics queue signals
+    // with its ticket. Command buffers from gfxCmdBegin() are recycled once the
+    // ticket of their last submission has completed.
+    struct GfxTimeline {
+        VkSemaphore semaphore;
+        GfxTicket submitted;
+        GfxTicket completed;
+
+        struct GfxImmediateCommandBuffer {
+            VkCommandBuffer cmd;
+            GfxTicket ticket;
+        }* pCommandBuffers;
+        uint32_t commandBufferCount;
+        uint32_t commandBufferCapacity;
+    } timeline;
+
+    // Samplers created so far, one for each distinct key. They are shared and
+    // live until the device is destroyed.
+    struct GfxSamplerCache {
+        struct GfxCachedSampler {
+            GfxSamplerKey key;
+            VkSampler sampler;
+        }* pEntries;
+        uint32_t count;
+        uint32_t capacity;
+    } samplerCache;
+
+    // Descriptor set with large arrays of sampled images, samplers and
+    // storage buffers, which textures, cached samplers and storage buffers are
+    // written to when they are created. It is only created on request, see
+    // gfxCreateBindlessHeap().
+    struct GfxBindlessHeap {
+        VkDescriptorSetLayout setLayout;
+        VkDescriptorPool pool;
+        VkDescriptorSet set;
+        uint32_t samplerCount;
+
+        // Released indices are reused before new ones are handed out. Samplers
+        // are never released, so their index is their place in the cache.
+        struct GfxBindlessArray {
+            uint32_t* pFree;
+            uint32_t freeCount;
+            uint32_t freeCapacity;
+            uint32_t used;
+            uint32_t capacity;
+        } images, buffers;
+    } bindless;
+
+    // Resources destroyed through gfxDestroy*() that earlier submissions may
+    // still use, in the order they were destroyed
+    struct GfxDeletionQueue {
+        GfxDeferredDestroy* pEntries;
+        uint32_t count;
+        uint32_t capacity;
+    } deletionQueue;
+
+    // Memory blocks currently allocated from the device, and the number of
+    // buffers and images sub-allocated from them
+    struct GfxMemoryAllocator {
+        GfxMemoryBlock* pBlocks;
+        uint32_t blockCount;
+        uint32_t allocationCount;
+    } allocator;
+
+    // Persistently mapped ring that gfxCopyBufferFromHost() stages uploads
+    // through. Copies are recorded into the pending batch, which is submitted
+    // by gfxFlushUploads(). Each batch owns the range of the ring up to its
+    // end until its ticket has completed. With a dedicated transfer queue, a
+    // batch only waits for the graphics work that may still read one of its
+    // destinations, up to hazardTicket. Buffers are shared by both queue
+    // families, images are released to the graphics family. The next
+    // submission to the graphics queue waits for the signal semaphore at the
+    // stages that consume uploads and acquires the images, so the batch
+    // ticket is the ticket of that submission.
+    struct GfxStagingRing {
+        VkBuffer buffer;
+        GfxAllocation allocation;
+        char* pHostMap;
+        VkDeviceSize size;
+        VkDeviceSize head;
+        VkDeviceSize tail;
+        VkDeviceSize alignment;
+
+        struct GfxStagingBatch {
+            VkCommandBuffer cmd;
+            VkCommandBuffer acquireCmd;
+            VkSemaphore signalSemaphore;
+            GfxTicket ticket;
+            VkDeviceSize end;
+            bool acquireImages;
+            bool acquirePending;
+        } batches[GFX_STAGING_BATCH_COUNT];
+        uint32_t firstInFlight;
+        uint32_t inFlightCount;
+        uint32_t acquireCount;
+        bool recording;
+        GfxTicket hazardTicket;
+
+        // Barriers that transition the images written by the pending batch,
+        // and hand them over to the graphics queue
+        VkImageMemoryBarrier2* pImageBarriers;
+        uint32_t imageBarrierCount;
+        uint32_t imageBarrierCapacity;
+    } staging;
+
+    // On-disk cache of SPIR-V compiled from GLSL and of the driver binaries
+    // of built shaders, disabled while pDirectory is NULL
+    struct GfxShaderCache {
+        char* pDirectory;
+        uint32_t hits;
+        uint32_t misses;
+        uint32_t binaryHits;
+        uint32_t binaryMisses;
+    } shaderCache;
+
+    // Worker threads, only started when there is parallel work
+    struct GfxThreadPool* pThreadPool;
+
+    // Shader builds whose results have not been collected yet
+    struct GfxShaderBuild* pShaderBuilds;
+
+    // Shaders watched for changes with gfxWatchShader(), created on first use
+    struct GfxShaderWatcher* pShaderWatcher;
 } GfxDevice;
 
+// Zone result is the GPU time of a zone recorded with gfxCmdBeginZone() and
+// gfxCmdEndZone(). Depth is the number of zones the zone is nested in.
+typedef struct GfxZoneResult {
+    const char* pName;
+    uint32_t depth;
+    double milliseconds;
+} GfxZoneResult;
+
+// Frame phases are the parts of a frame that CPU time is measured for:
+// waiting for the frame in flight, acquiring the swapchain image, recording
+// between gfxAcquireNextImage() and gfxPresent(), submitting (including
+// pending uploads) and presenting.
+enum GfxFramePhase {
+    GFX_FRAME_PHASE_WAIT,
+    GFX_FRAME_PHASE_ACQUIRE,
+    GFX_FRAME_PHASE_RECORD,
+    GFX_FRAME_PHASE_SUBMIT,
+    GFX_FRAME_PHASE_PRESENT,
+    GFX_FRAME_PHASE_COUNT,
+};
+
+// Frame timings hold the CPU time in milliseconds of each phase of a frame
+typedef struct GfxFrameTimings {
+    uint64_t frame;
+    double milliseconds[GFX_FRAME_PHASE_COUNT];
+} GfxFrameTimings;
+
+// Frame phase stats summarize a phase over recent frames, in milliseconds
+typedef struct GfxFramePhaseStats {
+    double min;
+    double avg;
+    double p99;
+} GfxFramePhaseStats;
+
 // Swapchain abstracts the handling of swapchain images and frames in flight.
 // The GFX swapchain is monolithic and is setup through
 // gfxCreateSwapchain(). Use gfxAcquireNextImage() and gfxPresent() to acquire and
@@ -277,37 +601,99 @@ typedef struct GfxSwapchain {
     uint32_t imageCount;
     uint32_t imageIndex;
 
-    VkCommandBuffer* commandBuffers;
+    // Without a surface, frames are blitted to a ring of offscreen images
+    // instead, one per frame in flight. images and imageViews alias them.
+    bool headless;
+    struct GfxImage* pOffscreenImages;
+
+    // Transient command pools of each frame in flight. Pools are created on
+    // first use and reset with a single vkResetCommandPool() when their frame
+    // in flight comes around again, after which their command buffers are
+    // handed out again in order. The primary pool holds the frame's command
+    // buffer. Each thread that records secondary command buffers has its own
+    // pool, so that threads never share one.
+    struct GfxFrameCommands {
+        struct GfxCommandArena {
+            VkCommandPool pool;
+            VkCommandBuffer* pCommandBuffers;
+            uint32_t used;
+            uint32_t count;
+            uint32_t capacity;
+        } primary, secondaries[GFX_MAX_RECORDING_THREADS];
+    }* pFrameCommands;
+
     VkSemaphore* renderFinishedSemaphores;
     VkSemaphore* inFlightSemaphores;
-    VkFence* inFlightFences;
     uint32_t framesInFlight;
     uint32_t inFlightIndex;
+
+    // Timeline semaphore that the submission of each frame signals with its
+    // frame number. Frame numbers start at 1 and survive recreation.
+    VkSemaphore frameTimeline;
+    uint64_t frame;
+    uint64_t completedFrame;
+
+    // Timestamp queries of the profiling zones, with one query pool per frame
+    // in flight. A pool is read back and reset when its frame in flight comes
+    // around again, so results arrive framesInFlight frames later.
+    struct GfxProfiler {
+        struct GfxProfilerFrame {
+            VkQueryPool queryPool;
+            const char* pNames[GFX_PROFILER_MAX_ZONES];
+            uint32_t depths[GFX_PROFILER_MAX_ZONES];
+            uint32_t zoneCount;
+            uint32_t openZones[GFX_PROFILER_MAX_DEPTH];
+            uint32_t openCount;
+            uint32_t ignoredCount;
+            uint64_t frame;
+        }* pFrames;
+        GfxZoneResult results[GFX_PROFILER_MAX_ZONES];
+        uint32_t resultCount;
+        uint64_t resultFrame;
+        uint64_t timestampMask;
+        // Zones ignored since the swapchain was created
+        uint64_t ignoredTotal;
+    } profiler;
+
+    // CPU time of the phases of recent frames, in a ring indexed by frame
+    // number. The current frame accumulates until gfxPresent() stores it.
+    struct GfxFrameStats {
+        GfxFrameTimings timings[GFX_FRAME_STATS_COUNT];
+        GfxFrameTimings current;
+        uint64_t recordStart;
+    } frameStats;
 } GfxSwapchain;
 
-// Buffer abstracts a Vulkan buffer and memory allocation. Prefer to use large
-// buffers and offsets than many small buffers, that would cause many small
-// allocations. Buffers are created with gfxCreateBuffer(). Copy data from host
+// Buffer abstracts a Vulkan buffer and memory allocation. The memory is
+// sub-allocated from a larger memory block shared with other resources, see
+// GfxAllocation. Buffers are created with gfxCreateBuffer(). Copy data from host
 // to the device allocated buffer with gfxCopyBufferFromHost(). A buffer with
 // host coherent memory will always be mapped on pHostMap. When copying buffers
-// from host to device with a non-host coherent memory, a staging buffer will be
-// used. Release resources with gfxDestroyBuffer().
+// from host to device with a non-host coherent memory, the device's staging
+// ring will be used. Storage buffers created while the bindless descriptor
+// heap exists are also written to it, at bindlessIndex, unless they are larger
+// than the device's maxStorageBufferRange. Release resources with
+// gfxDestroyBuffer().
 typedef struct GfxBuffer {
     VkBuffer buffer;
-    VkDeviceMemory memory;
+    GfxAllocation allocation;
     VkBufferUsageFlags usage;
     VkMemoryPropertyFlags properties;
     VkDeviceSize size;
     void* pHostMap;
+    uint32_t bindlessIndex;
+    // Latest ticket when the buffer was created, no earlier work can use it
+    GfxTicket createTicket;
 } GfxBuffer;
 
-// Image abstracts a Vulkan image, image view and memory allocation. Use
+// Image abstracts a Vulkan image, image view and memory allocation. Like for
+// buffers, the memory is sub-allocated from a shared memory block. Use
 // gfxCreateImage() to create a new image and gfxCreateImageView() to create an
 // image view for a created image. Release resources with gfxDestroyImage().
 typedef struct GfxImage {
     VkImage image;
     VkImageView imageView;
-    VkDeviceMemory memory;
+    GfxAllocation allocation;
     uint32_t width;
     uint32_t height;
     uint32_t depth;
@@ -333,15 +719,20 @@ enum GfxTextureType {
 // texture with gfxCreateTexture() and passing it a pointer to the texture data.
 // If stb_image.h is available and GFX_USE_STB_IMAGE has been defined,
 // textures can be created from files using gfxCreateTextureFromFile(). Mipmaps
-// are automatically generated if specified. A sampler is created with the
-// texture; use the gfxSetTexture*() functions to reconfigure it. The write
+// are automatically generated if specified. The texture uses a sampler from
+// the device's sampler cache; use the gfxSetTexture*() functions to switch it
+// to another sampler state. The write
 // descriptor for the texture can be
-// retrieved with gfxGetTextureDescriptor(). Release resources with
+// retrieved with gfxGetTextureDescriptor(). When the texture is created while
+// the bindless descriptor heap exists, the image and sampler are at
+// bindlessImageIndex and bindlessSamplerIndex of its arrays. Release resources with
 // gfxDestroyTexture().
 typedef struct GfxTexture {
     GfxImage image;
     VkDescriptorImageInfo imageInfo;
     VkSampler sampler;
+    uint32_t bindlessImageIndex;
+    uint32_t bindlessSamplerIndex;
     VkFilter minFilter;
     VkFilter magFilter;
     VkSamplerAddressMode addressModeU;
@@ -369,21 +760,100 @@ typedef struct GfxAttachment {
 
 // Layout abstracts the use of descriptor set layouts and pipeline layouts.
 // Create a new layout with gfxCreateLayout(). Only one descriptor set is
-// supported and it is a push descriptor. Release resources with
-// gfxDestroyLayout().
+// supported and it is a push descriptor, which can be pushed from packed data
+// of pushDataSize bytes with gfxCmdPushDescriptors(). Alternatively, gfxCreateBindlessLayout()
+// creates a layout whose set is the device's bindless descriptor heap, and
+// gfxCreateDescriptorBufferLayout() one whose set lives in a
+// GfxDescriptorBuffer. Release resources with gfxDestroyLayout().
 typedef struct GfxLayout {
     VkDescriptorSetLayout setLayout;
     uint32_t pushConstantRangeCount;
     VkPushConstantRange* pPushConstantRanges;
     VkPipelineLayout pipelineLayout;
+    uint64_t hash;
+    VkShaderStageFlags stages;
+    // Push descriptor templates for the graphics, compute and ray tracing
+    // bind points, where the stages of the layout use them
+    VkDescriptorUpdateTemplate updateTemplates[3];
+    size_t pushDataSize;
+    bool bindless;
+    // Only set for descriptor buffer layouts. The set size is aligned to
+    // descriptorBufferOffsetAlignment, so that sets can be packed together.
+    bool descriptorBuffer;
+    VkDeviceSize setSize;
+    uint32_t bindingCount;
+    VkDeviceSize* pBindingOffsets;
 } GfxLayout;
 
+// Descriptor buffer holds descriptor sets of one descriptor buffer layout in
+// host visible memory. Sets are written once with gfxWriteDescriptorBuffer(),
+// so that draws only select a set by offset. Create a new descriptor buffer
+// with gfxCreateDescriptorBuffer(). Release resources with
+// gfxDestroyDescriptorBuffer().
+typedef struct GfxDescriptorBuffer {
+    GfxBuffer buffer;
+    VkDeviceAddress address;
+    VkDeviceSize setSize;
+    uint32_t setCount;
+} GfxDescriptorBuffer;
+
+// State tracker remembers the dynamic states recorded to a command buffer, so
+// that setting a state to the value it already has records nothing. With
+// shader objects every state is dynamic, which would otherwise make recording
+// cost grow with the number of states times the number of draws. Start
+// tracking a command buffer with gfxResetStateTracker(), then set states with
+// gfxCmdSetDefaultStates() and the gfxCmdSet* functions that take a tracker.
+// Vulkan calls made directly on the command buffer bypass the tracker. After
+// vkCmdExecuteCommands(), including through gfxCmdExecuteSecondaries(), the
+// dynamic states of the primary command buffer are undefined, so its tracker
+// must be reset before recording more draws.
+typedef struct GfxStateTracker {
+    VkCommandBuffer cmd;
+    // Bit per state whose value below has been recorded
+    uint32_t recorded;
+    uint32_t blendEnableRecorded;
+    uint32_t blendEquationRecorded;
+    uint32_t writeMaskRecorded;
+
+    VkViewport viewport;
+    VkRect2D scissor;
+    // Vertex input descriptions without their padding and pNext
+    uint32_t vertexBindingCount;
+    uint32_t vertexAttributeCount;
+    uint32_t vertexBindings[GFX_MAX_TRACKED_VERTEX_INPUTS][4];
+    uint32_t vertexAttributes[GFX_MAX_TRACKED_VERTEX_INPUTS][4];
+    VkPrimitiveTopology topology;
+    VkSampleCountFlagBits rasterizationSamples;
+    VkPolygonMode polygonMode;
+    VkCullModeFlags cullMode;
+    VkFrontFace frontFace;
+    VkCompareOp depthCompareOp;
+    VkBool32 rasterizerDiscardEnable;
+    VkBool32 primitiveRestartEnable;
+    VkBool32 alphaToCoverageEnable;
+    VkBool32 depthTestEnable;
+    VkBool32 depthWriteEnable;
+    VkBool32 depthBoundsTestEnable;
+    VkBool32 depthBiasEnable;
+    VkBool32 stencilTestEnable;
+    VkBool32 logicOpEnable;
+    VkBool32 blendEnable[GFX_MAX_COLOR_ATTACHMENTS];
+    VkColorBlendEquationEXT blendEquation[GFX_MAX_COLOR_ATTACHMENTS];
+    VkColorComponentFlags writeMask[GFX_MAX_COLOR_ATTACHMENTS];
+} GfxStateTracker;
+
 // Shader abstracts the handling of shaders and builds ontop of Vulkans shader
 // objects. Create a new shader from SPIR-V code with gfxCreateShader(). To load
 // a shader from GLSL source code, use gfxCreateShaderFromFileGLSL(). Before
 // using the shader, the shader has to be build. Either use gfxBuildShader(), or
 // use gfxBuildLinkedShaders() to build an optimized vertex-fragment shader pair.
 // For rendering, the active shader has to be bound: use gfxCmdBindShader().
+// Shaders loaded from GLSL can be reloaded when their file is edited, see
+// gfxWatchShader(). A linked shader refers to the shader it was linked with.
+// Specialization constants are set with gfxSetShaderSpecialization(), or
+// several specialized variants are built at once with
+// gfxBuildShaderVariants(). Shaders can also be built on worker threads, see
+// gfxBuildShaderAsync().
 // The shader takes its own copy of the layout's descriptor set layout handle
 // and push constant ranges, but the underlying VkDescriptorSetLayout is still
 // owned by the GfxLayout and must not be destroyed before the shader is built.
@@ -393,10 +863,48 @@ typedef struct GfxShader {
     VkShaderCreateInfoEXT createInfo;
     VkDescriptorSetLayout setLayout;
     VkPushConstantRange* pPushConstantRanges;
+    uint64_t layoutHash;
+    VkSpecializationInfo specializationInfo;
+    VkSpecializationMapEntry* pSpecializationEntries;
+    void* pSpecializationData;
+    struct GfxShader* pLinkedShader;
     char* pPath;
+    char* pPreamble;
     void* pCode;
+    struct GfxShaderBuild* pBuild;
 } GfxShader;
 
+// Description of a shader to create from a GLSL file with
+// gfxCreateShadersFromFilesGLSL().
+typedef struct GfxShaderFileInfo {
+    const char* pPath;
+    VkShaderStageFlagBits stage;
+    VkShaderStageFlags nextStage;
+    const GfxLayout* pLayout;
+} GfxShaderFileInfo;
+
+// Shader permutations are variants of one GLSL file that differ in which of
+// a set of preprocessor defines are defined. A variant is selected by a mask
+// with a bit for each define, and is only compiled and built when it is first
+// requested. Create permutations with gfxCreateShaderPermutations(), get a
+// variant with gfxGetShaderPermutation(). Release resources with
+// gfxDestroyShaderPermutations().
+typedef struct GfxShaderPermutations {
+    char* pPath;
+    VkShaderStageFlagBits stage;
+    VkShaderStageFlags nextStage;
+    const GfxLayout* pLayout;
+    char** ppDefines;
+    uint32_t defineCount;
+
+    // Variants built so far. Shaders are allocated one by one, so that they
+    // keep their address as more variants are added.
+    uint64_t* pMasks;
+    GfxShader** ppShaders;
+    uint32_t variantCount;
+    uint32_t variantCapacity;
+} GfxShaderPermutations;
+
 
 // Monolithic global variables //
 
@@ -437,7 +945,7 @@ void gfxDestroyInstance();
 /// <param name="deviceExtensionCount">Number of device extensions</param>
 /// <param name="ppDeviceExtensions">List of device extensions to use</param>
 /// <param name="features">Pointer to features that will be put in pNext of VkDeviceCreateInfo, can be NULL</param>
-/// <param name="surface">Surface to use</param>
+/// <param name="surface">Surface to use, or VK_NULL_HANDLE to render headless without presenting</param>
 void gfxCreateDevice(uint32_t physicalDeviceIndex, uint32_t deviceExtensionCount, const char** ppDeviceExtensions,
                      VkPhysicalDeviceFeatures2* features, VkSurfaceKHR surface);
 
@@ -454,7 +962,9 @@ VkSampleCountFlagBits gfxGetDeviceSampleCount();
 
 /// <summary>
 /// Create a new swapchain. Handle is internally managed and accessible through
-/// gfxSwapchain.
+/// gfxSwapchain. If the device was created without a surface, frames are
+/// presented to a ring of offscreen images instead, which are left in
+/// VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL for reading back.
 /// </summary>
 /// <param name="framesInFlight">Number of frames in flight to use</param>
 /// <param name="framebufferSizeCallback">Callback function where the current framebuffer size can be retrieved</param>
@@ -472,10 +982,30 @@ void gfxDestroySwapchain();
 void gfxRecreateSwapchain();
 
 /// <summary>
-/// Wait for the fence of the current frame in flight to be signaled.
+/// Wait for the frame that last used the current frame in flight to complete.
 /// Call this before accessing any shared resources.
 /// </summary>
-void gfxWaitForFence();
+void gfxWaitForFrameInFlight();
+
+/// <summary>
+/// Deprecated name of gfxWaitForFrameInFlight(), from when frames were paced
+/// with fences.
+/// </summary>
+GFX_DEPRECATED("Use gfxWaitForFrameInFlight() instead") void gfxWaitForFence();
+
+/// <summary>
+/// Get the number of the frame that is currently being recorded. Frame
+/// numbers start at 1 and increase by one with every gfxPresent().
+/// </summary>
+/// <returns>Current frame number</returns>
+uint64_t gfxGetCurrentFrame();
+
+/// <summary>
+/// Get the number of the latest frame that has completed on the GPU, or 0 if
+/// none has.
+/// </summary>
+/// <returns>Completed frame number</returns>
+uint64_t gfxGetCompletedFrame();
 
 /// <summary>
 /// Acquire a new image from the swapchain. This call will block until an image
@@ -493,6 +1023,81 @@ VkCommandBuffer gfxAcquireNextImage();
 /// gfxAcquireNextImage()</param> <param name="pImage"></param>
 void gfxPresent(VkCommandBuffer cmd, GfxImage* pImage);
 
+/// <summary>
+/// Get the CPU timings of a recently presented frame.
+/// </summary>
+/// <param name="framesAgo">0 for the last presented frame, 1 for the one before it and so on</param>
+/// <returns>Timings of the frame, or NULL if it is not available</returns>
+const GfxFrameTimings* gfxGetFrameTimings(uint32_t framesAgo);
+
+/// <summary>
+/// Get min, average and 99th percentile CPU time of every frame phase over
+/// the last GFX_FRAME_STATS_COUNT presented frames.
+/// </summary>
+/// <param name="pStats">Array of GFX_FRAME_PHASE_COUNT stats, indexed by enum GfxFramePhase</param>
+/// <returns>Number of frames the stats are computed over</returns>
+uint32_t gfxGetFramePhaseStats(GfxFramePhaseStats* pStats);
+
+/// <summary>
+/// Begin a GPU profiling zone in the command buffer of the current frame.
+/// Zones can be nested and must be ended in the same frame.
+/// </summary>
+/// <param name="cmd">Command buffer from gfxAcquireNextImage()</param>
+/// <param name="pName">Name of the zone, must stay valid until its results have been read</param>
+void gfxCmdBeginZone(VkCommandBuffer cmd, const char* pName);
+
+/// <summary>
+/// End the innermost open GPU profiling zone.
+/// </summary>
+/// <param name="cmd">Command buffer from gfxAcquireNextImage()</param>
+void gfxCmdEndZone(VkCommandBuffer cmd);
+
+/// <summary>
+/// Get the GPU time of the zones of the latest completed frame, in the order
+/// the zones were begun. Results are read back without stalling and stay
+/// valid until the next gfxAcquireNextImage().
+/// </summary>
+/// <param name="ppResults">Where a pointer to the results will be stored</param>
+/// <param name="pFrame">Where the frame number of the results will be stored, can be NULL</param>
+/// <returns>Number of results</returns>
+uint32_t gfxGetZoneResults(const GfxZoneResult** ppResults, uint64_t* pFrame);
+
+/// <summary>
+/// Begin a command buffer for immediate work outside of the frame loop.
+/// Command buffers are recycled once their previous submission has completed.
+/// </summary>
+/// <returns>A command buffer in the recording state</returns>
+VkCommandBuffer gfxCmdBegin();
+
+/// <summary>
+/// End and submit a command buffer from gfxCmdBegin() without waiting for it.
+/// Pending uploads are flushed first, so the work sees them. Later submissions
+/// to the graphics queue are ordered after this one.
+/// </summary>
+/// <param name="cmd">Command buffer to submit</param>
+/// <returns>Ticket that completes when the command buffer has executed</returns>
+GfxTicket gfxCmdSubmitAsync(VkCommandBuffer cmd);
+
+/// <summary>
+/// End and submit a command buffer from gfxCmdBegin(), and wait for it to
+/// complete.
+/// </summary>
+/// <param name="cmd">Command buffer to submit</param>
+void gfxCmdEnd(VkCommandBuffer cmd);
+
+/// <summary>
+/// Check whether the submission of a ticket has completed, without blocking.
+/// </summary>
+/// <param name="ticket">Ticket to check</param>
+/// <returns>True if the submission has completed</returns>
+bool gfxIsTicketComplete(GfxTicket ticket);
+
+/// <summary>
+/// Block until the submission of a ticket has completed.
+/// </summary>
+/// <param name="ticket">Ticket to wait for</param>
+void gfxWaitTicket(GfxTicket ticket);
+
 /// <summary>
 /// Create a new buffer.
 /// </summary>
@@ -510,7 +1115,13 @@ void gfxDestroyBuffer(GfxBuffer* pBuffer);
 
 /// <summary>
 /// Copy data from host memory to a buffer's device memory. If buffer's memory
-/// is not host coherent, a staging buffer will be used.
+/// is not host coherent, the data is copied to the staging ring and the
+/// transfer is recorded into the pending upload batch. The batch is submitted
+/// with gfxFlushUploads(), which happens automatically before gfxCmdEnd() and
+/// gfxPresent() submit their work. On devices with a dedicated transfer queue,
+/// the batch runs there. It only waits for earlier graphics work if a buffer
+/// it writes existed when that work was submitted, and only the stages of the
+/// next graphics submission that can read uploads wait for it.
 /// </summary>
 /// <param name="pBuffer">Buffer to use</param>
 /// <param name="pData">Pointer to data to copy</param>
@@ -518,6 +1129,16 @@ void gfxDestroyBuffer(GfxBuffer* pBuffer);
 /// <param name="offset">Offset into buffer's device memory to put the data</param>
 void gfxCopyBufferFromHost(const GfxBuffer* pBuffer, const void* pData, VkDeviceSize size, VkDeviceSize offset);
 
+/// <summary>
+/// Submit the uploads recorded by gfxCopyBufferFromHost() since the last
+/// flush. Work submitted afterwards sees the uploaded data. Does not wait for
+/// the uploads to complete. On devices with a dedicated transfer queue, the
+/// ticket is that of the next submission to the graphics queue, which
+/// gfxWaitTicket() makes if there is none.
+/// </summary>
+/// <returns>Ticket that completes when all uploads so far have completed</returns>
+GfxTicket gfxFlushUploads();
+
 /// <summary>
 /// Get the write descriptor of a buffer. The returned write points at
 /// pBufferInfo, which must stay alive until the write has been consumed.
@@ -684,6 +1305,50 @@ void gfxCmdBeginRendering(VkCommandBuffer cmd, const GfxAttachment* pAttachmentS
 /// <param name="pAttachmentSet">Attachment set to use</param>
 void gfxCmdEndRendering(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet);
 
+/// <summary>
+/// Begin dynamic rendering whose draws are recorded in secondary command
+/// buffers, see gfxCmdBeginSecondary(). Only gfxCmdExecuteSecondaries() may
+/// be recorded until gfxCmdEndRendering().
+/// </summary>
+/// <param name="cmd">Command buffer to use</param>
+/// <param name="pAttachmentSet">Attachment set to use</param>
+/// <param name="clearValue">Clear value for attachments</param>
+/// <param name="loadOp">Load operation for attachments</param>
+void gfxCmdBeginRenderingSecondaries(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet,
+                                     VkClearValue clearValue, VkAttachmentLoadOp loadOp);
+
+/// <summary>
+/// Begin a secondary command buffer for drawing to an attachment set during
+/// the current frame. Each thread that records at the same time has to use a
+/// different thread index, as every index has its own command pool per frame
+/// in flight. Dynamic states, shaders and descriptors are not inherited from
+/// the primary command buffer, so each secondary command buffer sets its own.
+/// The command buffer is recycled when its frame in flight comes around again,
+/// so it has to be executed in the frame it was begun in. End it with
+/// gfxCmdEndSecondary().
+/// </summary>
+/// <param name="threadIndex">Index of the recording thread, less than GFX_MAX_RECORDING_THREADS</param>
+/// <param name="pAttachmentSet">Attachment set that will be rendered to</param>
+/// <returns>A secondary command buffer in the recording state</returns>
+VkCommandBuffer gfxCmdBeginSecondary(uint32_t threadIndex, const GfxAttachment* pAttachmentSet);
+
+/// <summary>
+/// End a secondary command buffer from gfxCmdBeginSecondary().
+/// </summary>
+/// <param name="cmd">Secondary command buffer to end</param>
+void gfxCmdEndSecondary(VkCommandBuffer cmd);
+
+/// <summary>
+/// Execute secondary command buffers inside rendering that was begun with
+/// gfxCmdBeginRenderingSecondaries(). Secondaries execute in the given order.
+/// The dynamic states of the primary command buffer are undefined afterwards,
+/// so reset its state tracker, if any, with gfxResetStateTracker().
+/// </summary>
+/// <param name="cmd">Primary command buffer to use</param>
+/// <param name="count">Number of secondary command buffers</param>
+/// <param name="pSecondaries">List of secondary command buffers</param>
+void gfxCmdExecuteSecondaries(VkCommandBuffer cmd, uint32_t count, const VkCommandBuffer* pSecondaries);
+
 /// <summary>
 /// Create a new layout.
 /// </summary>
@@ -697,12 +1362,151 @@ void gfxCmdEndRendering(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet
 void gfxCreateLayout(uint32_t bindingCount, VkDescriptorType* pTypes, VkShaderStageFlags* pStages, uint32_t* pCounts,
                      uint32_t pushConstantRangeCount, VkPushConstantRange* pPushConstantRanges, GfxLayout* pLayout);
 
+/// <summary>
+/// Create the bindless descriptor heap of the device, a descriptor set with
+/// arrays of GFX_BINDLESS_IMAGE_COUNT sampled images, GFX_BINDLESS_SAMPLER_COUNT
+/// samplers and GFX_BINDLESS_BUFFER_COUNT storage buffers, reduced to the
+/// update-after-bind limits of the device with a warning. Once it exists,
+/// every texture and storage buffer created is also written to it, and so are
+/// cached samplers, including those created before. Resources created before
+/// the heap are not in it. The device must have been created with the
+/// runtimeDescriptorArray, descriptorBindingPartiallyBound,
+/// descriptorBindingUpdateUnusedWhilePending,
+/// descriptorBindingSampledImageUpdateAfterBind and
+/// descriptorBindingStorageBufferUpdateAfterBind features. The heap is
+/// released with the device.
+/// </summary>
+void gfxCreateBindlessHeap();
+
+/// <summary>
+/// Create a new layout whose descriptor set is the bindless descriptor heap.
+/// Textures and storage buffers are then accessed through their index into
+/// the arrays of the heap, typically passed as push constants, instead of
+/// pushing descriptors for each draw. In GLSL, with GL_EXT_nonuniform_qualifier
+/// if indices are not dynamically uniform, the set is declared as:
+///     layout(set = 0, binding = 0) uniform texture2D textures[];
+///     layout(set = 0, binding = 1) uniform sampler samplers[];
+///     layout(set = 0, binding = 2) buffer Buffers { ... } buffers[];
+/// The heap must have been created with gfxCreateBindlessHeap(). Bind it with
+/// gfxCmdBindBindlessHeap().
+/// </summary>
+/// <param name="pushConstantRangeCount">Number of push constant ranges</param>
+/// <param name="pPushConstantRanges">List of push constant ranges</param>
+/// <param name="pLayout">Where the created layout will be stored</param>
+void gfxCreateBindlessLayout(uint32_t pushConstantRangeCount, VkPushConstantRange* pPushConstantRanges,
+                             GfxLayout* pLayout);
+
+/// <summary>
+/// Bind the bindless descriptor heap for graphics and compute work. Binding
+/// it once per command buffer is enough, as long as the layouts of bound
+/// shaders are bindless layouts.
+/// </summary>
+/// <param name="cmd">Command buffer to use</param>
+/// <param name="pLayout">Bindless layout to bind the heap with</param>
+void gfxCmdBindBindlessHeap(VkCommandBuffer cmd, const GfxLayout* pLayout);
+
 /// <summary>
 /// Release resources for a layout.
 /// </summary>
 /// <param name="pLayout">Layout to destroy</param>
 void gfxDestroyLayout(GfxLayout* pLayout);
 
+/// <summary>
+/// Push the descriptor set of a layout from packed data, using the update
+/// template of the layout. This avoids building VkWriteDescriptorSet arrays
+/// on every draw. The data holds the descriptors of each binding in order,
+/// pCounts[i] of them per binding, without padding: a VkDescriptorBufferInfo
+/// for buffers, a VkDescriptorImageInfo for images and samplers, a
+/// VkBufferView for texel buffers and a VkAccelerationStructureKHR for
+/// acceleration structures. As these are all multiples of 8 bytes, a plain C
+/// struct with one member per binding has this layout, for instance:
+///     struct {
+///         VkDescriptorBufferInfo camera;
+///         VkDescriptorImageInfo texture;
+///     } data = {{cameraBuffer.buffer, 0, VK_WHOLE_SIZE}, texture.imageInfo};
+/// The descriptors are pushed to every bind point whose stages the layout
+/// uses, so one push serves both draws and dispatches of a layout shared by
+/// graphics and compute shaders.
+/// </summary>
+/// <param name="cmd">Command buffer to use</param>
+/// <param name="pLayout">Layout created with gfxCreateLayout(), with at least one binding</param>
+/// <param name="pData">Packed descriptors, pLayout->pushDataSize bytes</param>
+void gfxCmdPushDescriptors(VkCommandBuffer cmd, const GfxLayout* pLayout, const void* pData);
+
+/// <summary>
+/// Create a new layout for descriptor sets that are stored in a descriptor
+/// buffer rather than pushed. Takes the same bindings as gfxCreateLayout().
+/// Needs the descriptorBuffer and bufferDeviceAddress device features. Mixing
+/// descriptor buffers with push descriptors or the bindless descriptor heap in
+/// a command buffer is restricted, see gfxCmdBindDescriptorBuffer().
+/// </summary>
+/// <param name="bindingCount">Number of bindings</param>
+/// <param name="pTypes">List of descriptor types, one per binding</param>
+/// <param name="pStages">List of shader stages, one per binding</param>
+/// <param name="pCounts">List of descriptor counts, one per binding</param>
+/// <param name="pushConstantRangeCount">Number of push constant ranges</param>
+/// <param name="pPushConstantRanges">List of push constant ranges</param>
+/// <param name="pLayout">Where the created layout will be stored</param>
+void gfxCreateDescriptorBufferLayout(uint32_t bindingCount, VkDescriptorType* pTypes, VkShaderStageFlags* pStages,
+                                     uint32_t* pCounts, uint32_t pushConstantRangeCount,
+                                     VkPushConstantRange* pPushConstantRanges, GfxLayout* pLayout);
+
+/// <summary>
+/// Create a new descriptor buffer with room for a number of descriptor sets of
+/// a descriptor buffer layout.
+/// </summary>
+/// <param name="pLayout">Descriptor buffer layout of the sets</param>
+/// <param name="setCount">Number of sets</param>
+/// <param name="pDescriptorBuffer">Where the created descriptor buffer will be stored</param>
+void gfxCreateDescriptorBuffer(const GfxLayout* pLayout, uint32_t setCount, GfxDescriptorBuffer* pDescriptorBuffer);
+
+/// <summary>
+/// Write descriptors to a set of a descriptor buffer. The writes are the same
+/// as for push descriptors, see gfxGetBufferDescriptor() and
+/// gfxGetTextureDescriptor(). Buffers must have been created with
+/// VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT and bound with an explicit range.
+/// The set must not be in use by pending work.
+/// </summary>
+/// <param name="pDescriptorBuffer">Descriptor buffer to write to</param>
+/// <param name="pLayout">Descriptor buffer layout of the set</param>
+/// <param name="setIndex">Set to write</param>
+/// <param name="writeCount">Number of writes</param>
+/// <param name="pWrites">List of writes</param>
+void gfxWriteDescriptorBuffer(GfxDescriptorBuffer* pDescriptorBuffer, const GfxLayout* pLayout, uint32_t setIndex,
+                              uint32_t writeCount, const VkWriteDescriptorSet* pWrites);
+
+/// <summary>
+/// Bind a descriptor buffer. Only one descriptor buffer is bound at a time, and
+/// binding it is only needed once per command buffer. Binding it invalidates
+/// the sets bound before, including the bindless descriptor heap, so bind the
+/// heap again with gfxCmdBindBindlessHeap() before drawing with a bindless
+/// layout; binding the heap in turn invalidates the descriptor buffer sets.
+/// Unless the device has bufferlessPushDescriptors, push descriptors cannot
+/// be recorded for the rest of the command buffer once a descriptor buffer is
+/// bound, so use either descriptor buffers or push descriptors in a command
+/// buffer. Debug builds check this in gfxCmdPushDescriptors().
+/// </summary>
+/// <param name="cmd">Command buffer to use</param>
+/// <param name="pDescriptorBuffer">Descriptor buffer to bind</param>
+void gfxCmdBindDescriptorBuffer(VkCommandBuffer cmd, const GfxDescriptorBuffer* pDescriptorBuffer);
+
+/// <summary>
+/// Use a set of the bound descriptor buffer for the following draws or
+/// dispatches, depending on the stages of the layout.
+/// </summary>
+/// <param name="cmd">Command buffer to use</param>
+/// <param name="pLayout">Descriptor buffer layout of the set</param>
+/// <param name="pDescriptorBuffer">Bound descriptor buffer</param>
+/// <param name="setIndex">Set to use</param>
+void gfxCmdSetDescriptorBufferSet(VkCommandBuffer cmd, const GfxLayout* pLayout,
+                                  const GfxDescriptorBuffer* pDescriptorBuffer, uint32_t setIndex);
+
+/// <summary>
+/// Release resources for a descriptor buffer.
+/// </summary>
+/// <param name="pDescriptorBuffer">Descriptor buffer to destroy</param>
+void gfxDestroyDescriptorBuffer(GfxDescriptorBuffer* pDescriptorBuffer);
+
 /// <summary>
 /// Create a new shader from SPIR-V byte code.
 /// </summary>
@@ -716,7 +1520,8 @@ void gfxCreateShader(const void* pCode, size_t codeSize, VkShaderStageFlagBits s
                      const GfxLayout* pLayout, GfxShader* pShader);
 
 /// <summary>
-/// Create a new shader from GLSL source code.
+/// Create a new shader from GLSL source code. Files included with
+/// GL_GOOGLE_include_directive are resolved relative to the including file.
 /// </summary>
 /// <param name="pPath">Path to GLSL source code</param>
 /// <param name="stage">Which stage the shader represents</param>
@@ -726,12 +1531,128 @@ void gfxCreateShader(const void* pCode, size_t codeSize, VkShaderStageFlagBits s
 void gfxCreateShaderFromFileGLSL(const char* pPath, VkShaderStageFlagBits stage, VkShaderStageFlags nextStage,
                                  const GfxLayout* pLayout, GfxShader* pShader);
 
+/// <summary>
+/// Create and build several shaders from GLSL source code. Files are compiled
+/// and built concurrently on worker threads. A shader that fails does not
+/// abort the others, it is left zeroed and its error is reported instead.
+/// </summary>
+/// <param name="count">Number of shaders</param>
+/// <param name="pInfos">List of shaders to create</param>
+/// <param name="pShaders">Where the created shaders will be stored, one per info</param>
+/// <param name="ppErrors">Where an error message per shader will be stored, NULL if it succeeded. Can be NULL, in
+/// which case errors are logged. Release messages with gfxFreeShaderErrors()</param>
+/// <returns>Number of shaders that failed</returns>
+uint32_t gfxCreateShadersFromFilesGLSL(uint32_t count, const GfxShaderFileInfo* pInfos, GfxShader* pShaders,
+                                       char** ppErrors);
+
+/// <summary>
+/// Release error messages returned by gfxCreateShadersFromFilesGLSL().
+/// </summary>
+/// <param name="count">Number of messages</param>
+/// <param name="ppErrors">List of messages, entries can be NULL</param>
+void gfxFreeShaderErrors(uint32_t count, char** ppErrors);
+
+/// <summary>
+/// Create permutations of a GLSL shader. Nothing is compiled until a variant
+/// is requested with gfxGetShaderPermutation(). The layout must outlive the
+/// permutations.
+/// </summary>
+/// <param name="pPath">Path to GLSL source code</param>
+/// <param name="stage">Which stage the shader represents</param>
+/// <param name="nextStage">Which stages can come after this shader</param>
+/// <param name="pLayout">Layout to use</param>
+/// <param name="defineCount">Number of defines, at most 64</param>
+/// <param name="ppDefines">Names of the defines that variants can enable</param>
+/// <param name="pPermutations">Where the created permutations will be stored</param>
+void gfxCreateShaderPermutations(const char* pPath, VkShaderStageFlagBits stage, VkShaderStageFlags nextStage,
+                                 const GfxLayout* pLayout, uint32_t defineCount, const char* const* ppDefines,
+                                 GfxShaderPermutations* pPermutations);
+
+/// <summary>
+/// Get a built variant of shader permutations. The variant is compiled with
+/// the selected defines set to 1 and built the first time it is requested.
+/// Compiled variants are also kept in the shader cache, if it is enabled. The
+/// shader is owned by the permutations.
+/// </summary>
+/// <param name="pPermutations">Permutations to get a variant of</param>
+/// <param name="defineMask">Mask of the defines to enable, bit i selects define i</param>
+/// <returns>The variant, or NULL if it failed to compile</returns>
+GfxShader* gfxGetShaderPermutation(GfxShaderPermutations* pPermutations, uint64_t defineMask);
+
+/// <summary>
+/// Release resources for shader permutations, including all their variants.
+/// </summary>
+/// <param name="pPermutations">Permutations to destroy</param>
+void gfxDestroyShaderPermutations(GfxShaderPermutations* pPermutations);
+
+/// <summary>
+/// Set the directory of the on-disk cache for SPIR-V compiled by
+/// gfxCreateShaderFromFileGLSL(). Entries are keyed by the source, the
+/// contents of included files, the stage and the compiler and target
+/// versions, so stale entries are never used. The same directory caches the
+/// driver binaries of shaders built with gfxBuildShader() and
+/// gfxBuildLinkedShaders(), which are only used while the driver's
+/// shaderBinaryUUID and shaderBinaryVersion match; otherwise shaders are
+/// built from SPIR-V again. The directory must exist. Caching is disabled by
+/// default.
+/// </summary>
+/// <param name="pDirectory">Directory to store compiled shaders in, or NULL to disable caching</param>
+void gfxSetShaderCacheDirectory(const char* pDirectory);
+
+/// <summary>
+/// Get the number of shaders that were loaded from the shader cache and the
+/// number that had to be compiled, since the device was created.
+/// </summary>
+/// <param name="pHits">Where the number of cache hits will be stored, can be NULL</param>
+/// <param name="pMisses">Where the number of cache misses will be stored, can be NULL</param>
+void gfxGetShaderCacheStats(uint32_t* pHits, uint32_t* pMisses);
+
+/// <summary>
+/// Get the number of shader builds that created their shader objects from
+/// cached driver binaries and the number that had to create them from
+/// SPIR-V, since the device was created. A linked build counts once.
+/// </summary>
+/// <param name="pHits">Where the number of cache hits will be stored, can be NULL</param>
+/// <param name="pMisses">Where the number of cache misses will be stored, can be NULL</param>
+void gfxGetShaderBinaryCacheStats(uint32_t* pHits, uint32_t* pMisses);
+
+/// <summary>
+/// Watch the GLSL file of a shader for changes. Edited shaders are recompiled
+/// and built in the background, and swapped in by gfxReloadShaders(). Changes
+/// to other files in the same directory, such as included files, recompile
+/// the shader too, but it is only replaced if its SPIR-V changed. The shader
+/// must stay at the same address while it is watched, and stops being watched
+/// when it is destroyed. Watching is only supported on Linux.
+/// </summary>
+/// <param name="pShader">Shader created from a GLSL file to watch</param>
+void gfxWatchShader(GfxShader* pShader);
+
+/// <summary>
+/// Swap in the watched shaders that have been rebuilt since the last call,
+/// and start rebuilding the ones edited since. Call this once per frame while
+/// no command buffer is being recorded, for instance before
+/// gfxAcquireNextImage(). Replaced shader objects are destroyed once the
+/// frames using them have completed. A shader that fails to compile keeps its
+/// previous version. Linked shaders are rebuilt linked, with their partner.
+/// </summary>
+/// <returns>Number of shaders that were swapped in</returns>
+uint32_t gfxReloadShaders();
+
 /// <summary>
 /// Release resources for a shader.
 /// </summary>
 /// <param name="pShader">Shader to destroy</param>
 void gfxDestroyShader(GfxShader* pShader);
 
+/// <summary>
+/// Set the values of specialization constants of a shader, which are applied
+/// when it is next built. The map entries and data are copied. A rebuild of
+/// the shader by gfxReloadShaders() that is still pending is dropped.
+/// </summary>
+/// <param name="pShader">Shader to specialize</param>
+/// <param name="pSpecializationInfo">Constants to use, or NULL for the defaults in the shader</param>
+void gfxSetShaderSpecialization(GfxShader* pShader, const VkSpecializationInfo* pSpecializationInfo);
+
 /// <summary>
 /// Build a shader.
 /// </summary>
@@ -746,117 +1667,254 @@ void gfxBuildShader(GfxShader* pShader);
 void gfxBuildLinkedShaders(GfxShader* pVertexShader, GfxShader* pFragmentShader);
 
 /// <summary>
-/// Bind a shader for rendering.
+/// Build variants of a shader that only differ in their specialization
+/// constants, with a single call to the driver. Each variant is a new shader
+/// with its own copy of the code and layout of pShader, which itself does not
+/// have to be built. Release variants with gfxDestroyShader().
 /// </summary>
-/// <param name="cmd">Command buffer to use</param>
-/// <param name="pShader">Shader to bind</param>
-void gfxCmdBindShader(VkCommandBuffer cmd, const GfxShader* pShader);
+/// <param name="pShader">Shader to build variants of</param>
+/// <param name="variantCount">Number of variants to build</param>
+/// <param name="pSpecializationInfos">Constants of each variant, an entry can be NULL for the shader's own</param>
+/// <param name="pVariants">Where the built variants will be stored</param>
+void gfxBuildShaderVariants(const GfxShader* pShader, uint32_t variantCount,
+                            const VkSpecializationInfo* const* pSpecializationInfos, GfxShader* pVariants);
 
 /// <summary>
-/// Set default states for rendering using shader objects. Viewport, scissor and
-/// sample count are taken from the attachment set's first color attachment.
-/// Depth testing is enabled with a reverse Z convention: the depth attachment is
-/// cleared to 0.0 and VK_COMPARE_OP_GREATER wins.
+/// Build a shader on a worker thread. The call returns right away, and the
+/// shader must not be bound until gfxIsShaderReady() returns true. Other
+/// functions that need the built shader wait for the build to complete.
 /// </summary>
-/// <param name="cmd">Command buffer to use</param>
-/// <param name="pAttachmentSet">Attachment set being rendered to</param>
-/// <param name="vertexBindingDescriptionCount">Number of vertex binding descriptions</param>
-/// <param name="vertexBindingDescriptions">List of vertex binding descriptions</param>
-/// <param name="vertexAttributeDescriptionCount">Number of vertex attribute descriptions</param>
-/// <param name="vertexAttributeDescriptions">List of vertex attribute descriptions</param>
-void gfxCmdSetDefaultStates(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet,
-                            uint32_t vertexBindingDescriptionCount,
-                            const VkVertexInputBindingDescription2EXT* vertexBindingDescriptions,
-                            uint32_t vertexAttributeDescriptionCount,
-                            const VkVertexInputAttributeDescription2EXT* vertexAttributeDescriptions);
+/// <param name="pShader">Shader to build, must stay at the same address until it is ready</param>
+void gfxBuildShaderAsync(GfxShader* pShader);
 
 /// <summary>
-/// Set whether the swapchain should present with vertical synchronization. If a
-/// swapchain already exists it is recreated to pick up the new present mode.
-/// Off by default.
+/// Build a linked vertex and fragment shader on a worker thread. Both
+/// become ready at the same time.
 /// </summary>
-/// <param name="vsync">Whether to wait for vertical blank when presenting</param>
-void gfxSetVsync(bool vsync);
-
-// Inlined helper functions //
+/// <param name="pVertexShader">Vertex shader to build</param>
+/// <param name="pFragmentShader">Fragment shader to build</param>
+void gfxBuildLinkedShadersAsync(GfxShader* pVertexShader, GfxShader* pFragmentShader);
 
 /// <summary>
-/// Call malloc and check for valid pointer.
+/// Create a new shader from GLSL source code, and compile and build it on a
+/// worker thread. If compiling fails the error is logged and the shader never
+/// becomes ready, but it still has to be destroyed.
 /// </summary>
-/// <param name="sz">Size in bytes to allocate</param>
-/// <returns>Pointer to allocated memory</returns>
-static inline void* gfxCheckedMalloc(size_t sz)
-{
-    void* p = malloc(sz);
-    if (!p) {
-        GFX_ERROR("Unable to allocate memory");
-    }
-    return p;
-}
+/// <param name="pPath">Path to GLSL source code</param>
+/// <param name="stage">Which stage the shader represents</param>
+/// <param name="nextStage">Which stages can come after this shader</param>
+/// <param name="pLayout">Layout to use, must stay valid until the shader is ready</param>
+/// <param name="pShader">Where the created shader will be stored</param>
+void gfxCreateShaderFromFileGLSLAsync(const char* pPath, VkShaderStageFlagBits stage, VkShaderStageFlags nextStage,
+                                      const GfxLayout* pLayout, GfxShader* pShader);
 
 /// <summary>
-/// Align value to alignment.
+/// Check whether a shader has been built and can be bound, without waiting.
+/// Use this to skip draws or substitute a fallback shader while a shader is
+/// built in the background.
 /// </summary>
-/// <param name="value">Value to align</param>
-/// <param name="alignment">Required alignment</param>
-/// <returns></returns>
-static inline VkDeviceSize gfxAlignTo(VkDeviceSize value, VkDeviceSize alignment)
-{
-    return (value + alignment - 1) & ~(alignment - 1);
-}
+/// <param name="pShader">Shader to check</param>
+/// <returns>True if the shader can be bound</returns>
+bool gfxIsShaderReady(GfxShader* pShader);
 
 /// <summary>
-/// Create and begin a new one-time-use command buffer.
+/// Bind a shader for rendering.
 /// </summary>
-/// <returns>A new command buffer</returns>
-static inline VkCommandBuffer gfxCmdBegin()
-{
-    if (!gfxDevice.device) {
-        GFX_ERROR("Device not initialized");
-    }
+/// <param name="cmd">Command buffer to use</param>
+/// <param name="pShader">Shader to bind</param>
+void gfxCmdBindShader(VkCommandBuffer cmd, const GfxShader* pShader);
 
-    VkCommandBufferAllocateInfo ai = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = gfxDevice.commandPool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = 1,
-    };
+/// <summary>
+/// Start tracking the dynamic states of a command buffer. Call this when
+/// recording of the command buffer begins, as no state is known at that point,
+/// and again after executing secondary command buffers from it.
+/// </summary>
+/// <param name="pTracker">State tracker to reset</param>
+/// <param name="cmd">Command buffer whose states are tracked</param>
+void gfxResetStateTracker(GfxStateTracker* pTracker, VkCommandBuffer cmd);
 
-    VkCommandBuffer cmd;
-    VK_CHECK(vkAllocateCommandBuffers(gfxDevice.device, &ai, &cmd));
+/// <summary>
+/// Set the viewport, if it differs from the recorded one.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="pViewport">Viewport to use</param>
+void gfxCmdSetViewport(GfxStateTracker* pTracker, const VkViewport* pViewport);
 
-    VkCommandBufferBeginInfo bi = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-    };
+/// <summary>
+/// Set the scissor rectangle, if it differs from the recorded one.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="pScissor">Scissor rectangle to use</param>
+void gfxCmdSetScissor(GfxStateTracker* pTracker, const VkRect2D* pScissor);
 
-    VK_CHECK(vkBeginCommandBuffer(cmd, &bi));
+/// <summary>
+/// Set the vertex input, if it differs from the recorded one. Vertex inputs
+/// with more than GFX_MAX_TRACKED_VERTEX_INPUTS bindings or attributes are
+/// always recorded.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="bindingCount">Number of vertex binding descriptions</param>
+/// <param name="pBindings">List of vertex binding descriptions</param>
+/// <param name="attributeCount">Number of vertex attribute descriptions</param>
+/// <param name="pAttributes">List of vertex attribute descriptions</param>
+void gfxCmdSetVertexInput(GfxStateTracker* pTracker, uint32_t bindingCount,
+                          const VkVertexInputBindingDescription2EXT* pBindings, uint32_t attributeCount,
+                          const VkVertexInputAttributeDescription2EXT* pAttributes);
 
-    return cmd;
-}
+/// <summary>
+/// Set the primitive topology, if it differs from the recorded one.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="topology">Primitive topology to use</param>
+void gfxCmdSetPrimitiveTopology(GfxStateTracker* pTracker, VkPrimitiveTopology topology);
 
 /// <summary>
-/// Submit and destroy a one-time-use command buffer.
+/// Set the rasterization sample count, if it differs from the recorded one. The
+/// sample mask is set to cover all samples along with it.
 /// </summary>
-/// <param name="cmd">Command buffer to submit and destroy</param>
-static inline void gfxCmdEnd(VkCommandBuffer cmd)
-{
-    if (!gfxDevice.device) {
-        GFX_ERROR("Device not initialized");
-    }
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="samples">Sample count to use</param>
+void gfxCmdSetRasterizationSamples(GfxStateTracker* pTracker, VkSampleCountFlagBits samples);
 
-    VK_CHECK(vkEndCommandBuffer(cmd));
+/// <summary>
+/// Set the polygon mode, if it differs from the recorded one.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="polygonMode">Polygon mode to use</param>
+void gfxCmdSetPolygonMode(GfxStateTracker* pTracker, VkPolygonMode polygonMode);
 
-    VkSubmitInfo si = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &cmd,
-    };
+/// <summary>
+/// Set the cull mode, if it differs from the recorded one.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="cullMode">Cull mode to use</param>
+void gfxCmdSetCullMode(GfxStateTracker* pTracker, VkCullModeFlags cullMode);
+
+/// <summary>
+/// Set the front face, if it differs from the recorded one.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="frontFace">Front face winding to use</param>
+void gfxCmdSetFrontFace(GfxStateTracker* pTracker, VkFrontFace frontFace);
+
+/// <summary>
+/// Set the depth test state, if it differs from the recorded one.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="testEnable">Whether depth testing is enabled</param>
+/// <param name="writeEnable">Whether depth writes are enabled</param>
+/// <param name="compareOp">Depth compare operation</param>
+void gfxCmdSetDepthState(GfxStateTracker* pTracker, VkBool32 testEnable, VkBool32 writeEnable,
+                         VkCompareOp compareOp);
+
+/// <summary>
+/// Set whether rasterization, primitive restart, alpha to coverage, depth
+/// bounds testing, depth bias, stencil testing and logic operations are
+/// enabled. Only the toggles that differ from the recorded ones are recorded.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="rasterizerDiscardEnable">Whether primitives are discarded before rasterization</param>
+/// <param name="primitiveRestartEnable">Whether primitive restart is enabled</param>
+/// <param name="alphaToCoverageEnable">Whether alpha to coverage is enabled</param>
+/// <param name="depthBoundsTestEnable">Whether the depth bounds test is enabled</param>
+/// <param name="depthBiasEnable">Whether depth bias is enabled</param>
+/// <param name="stencilTestEnable">Whether the stencil test is enabled</param>
+/// <param name="logicOpEnable">Whether logic operations are enabled</param>
+void gfxCmdSetEnables(GfxStateTracker* pTracker, VkBool32 rasterizerDiscardEnable, VkBool32 primitiveRestartEnable,
+                      VkBool32 alphaToCoverageEnable, VkBool32 depthBoundsTestEnable, VkBool32 depthBiasEnable,
+                      VkBool32 stencilTestEnable, VkBool32 logicOpEnable);
+
+/// <summary>
+/// Set the blend state of a color attachment, if it differs from the recorded
+/// one. The equation is only recorded if blending is enabled.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="attachment">Index of the color attachment, less than GFX_MAX_COLOR_ATTACHMENTS</param>
+/// <param name="blendEnable">Whether blending is enabled</param>
+/// <param name="pEquation">Blend equation to use, can be NULL if blending is disabled</param>
+void gfxCmdSetBlend(GfxStateTracker* pTracker, uint32_t attachment, VkBool32 blendEnable,
+                    const VkColorBlendEquationEXT* pEquation);
+
+/// <summary>
+/// Set the color write mask of a color attachment, if it differs from the
+/// recorded one.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer</param>
+/// <param name="attachment">Index of the color attachment, less than GFX_MAX_COLOR_ATTACHMENTS</param>
+/// <param name="writeMask">Color components to write</param>
+void gfxCmdSetColorWriteMask(GfxStateTracker* pTracker, uint32_t attachment, VkColorComponentFlags writeMask);
+
+/// <summary>
+/// Set default states for rendering using shader objects. Viewport, scissor and
+/// sample count are taken from the attachment set's first color attachment.
+/// Depth testing is enabled with a reverse Z convention: the depth attachment is
+/// cleared to 0.0 and VK_COMPARE_OP_GREATER wins. States that already have
+/// their default value are not recorded again, so calling this for every draw
+/// is cheap once the states are set.
+/// </summary>
+/// <param name="pTracker">State tracker of the command buffer to use</param>
+/// <param name="pAttachmentSet">Attachment set being rendered to</param>
+/// <param name="vertexBindingDescriptionCount">Number of vertex binding descriptions</param>
+/// <param name="vertexBindingDescriptions">List of vertex binding descriptions</param>
+/// <param name="vertexAttributeDescriptionCount">Number of vertex attribute descriptions</param>
+/// <param name="vertexAttributeDescriptions">List of vertex attribute descriptions</param>
+void gfxCmdSetDefaultStates(GfxStateTracker* pTracker, const GfxAttachment* pAttachmentSet,
+                            uint32_t vertexBindingDescriptionCount,
+                            const VkVertexInputBindingDescription2EXT* vertexBindingDescriptions,
+                            uint32_t vertexAttributeDescriptionCount,
+                            const VkVertexInputAttributeDescription2EXT* vertexAttributeDescriptions);
+
+/// <summary>
+/// Set whether the swapchain should present with vertical synchronization. If a
+/// swapchain already exists it is recreated to pick up the new present mode.
+/// Off by default.
+/// </summary>
+/// <param name="vsync">Whether to wait for vertical blank when presenting</param>
+void gfxSetVsync(bool vsync);
+
+// Inlined helper functions //
+
+/// <summary>
+/// Call malloc and check for valid pointer.
+/// </summary>
+/// <param name="sz">Size in bytes to allocate</param>
+/// <returns>Pointer to allocated memory</returns>
+static inline void* gfxCheckedMalloc(size_t sz)
+{
+    void* p = malloc(sz);
+    if (!p) {
+        GFX_ERROR("Unable to allocate memory");
+    }
+    return p;
+}
 
-    VK_CHECK(vkQueueSubmit(gfxDevice.queue, 1, &si, NULL));
-    VK_CHECK(vkQueueWaitIdle(gfxDevice.queue));
+/// <summary>
+/// Call realloc and check for valid pointer. Never returns NULL, so that the
+/// result can be assigned to the pointer that was passed in: on failure the
+/// process aborts, even when the error breakpoint is continued from.
+/// </summary>
+/// <param name="p">Memory to reallocate, can be NULL</param>
+/// <param name="sz">Size in bytes to allocate</param>
+/// <returns>Pointer to reallocated memory</returns>
+static inline void* gfxCheckedRealloc(void* p, size_t sz)
+{
+    void* pNew = realloc(p, sz);
+    if (!pNew) {
+        GFX_ERROR("Unable to allocate memory");
+        abort();
+    }
+    return pNew;
+}
 
-    vkFreeCommandBuffers(gfxDevice.device, gfxDevice.commandPool, 1, &cmd);
+/// <summary>
+/// Align value to alignment.
+/// </summary>
+/// <param name="value">Value to align</param>
+/// <param name="alignment">Required alignment</param>
+/// <returns></returns>
+static inline VkDeviceSize gfxAlignTo(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
 }
 
 /// <summary>
@@ -1009,6 +2067,21 @@ static inline void gfxTransitionForBlitting(VkCommandBuffer cmd, GfxImage* pImag
 // including gfx.h
 #ifdef GFX_IMPLEMENTATION
 
+// Needed for the high resolution performance counter, threads and process ids
+#if GFX_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Needed to watch shader files for changes
+#if GFX_LINUX
+#include <errno.h>
+#include <sys/inotify.h>
+#endif
+
 
 // Monolithic global variables //
 
@@ -1017,6 +2090,16 @@ static inline void gfxTransitionForBlitting(VkCommandBuffer cmd, GfxImage* pImag
 GfxDevice gfxDevice;
 GfxSwapchain gfxSwapchain;
 
+#ifndef NDEBUG
+// Command buffer that the calling thread last bound descriptor buffers to, to
+// catch push descriptors recorded after them
+#ifdef _MSC_VER
+static __declspec(thread) VkCommandBuffer gfxDescriptorBufferCmd;
+#else
+static _Thread_local VkCommandBuffer gfxDescriptorBufferCmd;
+#endif
+#endif
+
 
 // Helper macros //
 
@@ -1156,1429 +2239,6043 @@ void gfxDestroyInstance()
     GFX_RESET(&gfxDevice);
 }
 
-static bool checkDeviceExtensionSupport(uint32_t deviceExtensionCount, const char** ppDeviceExtensions)
+// Buffers and images are sub-allocated from large memory blocks instead of
+// getting a vkAllocateMemory() each. Linear and optimal tiling resources are
+// kept in separate blocks, so that neighbours never have to be padded to
+// bufferImageGranularity. Buffers with a device address need the memory to be
+// allocated with VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, so they get blocks of
+// their own as well.
+enum GfxMemoryKind {
+    GFX_MEMORY_KIND_LINEAR,
+    GFX_MEMORY_KIND_LINEAR_DEVICE_ADDRESS,
+    GFX_MEMORY_KIND_OPTIMAL,
+};
+
+typedef struct GfxMemoryRange {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} GfxMemoryRange;
+
+struct GfxMemoryBlock {
+    GfxMemoryBlock* pNext;
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memoryTypeIndex;
+    enum GfxMemoryKind kind;
+    bool dedicated;
+    void* pHostMap;
+    uint32_t allocationCount;
+
+    // Free ranges sorted by offset. Adjacent ranges are always merged.
+    GfxMemoryRange* pFreeRanges;
+    uint32_t freeRangeCount;
+    uint32_t freeRangeCapacity;
+};
+
+static GfxMemoryBlock* createMemoryBlock(VkDeviceSize size, uint32_t memoryTypeIndex, enum GfxMemoryKind kind,
+                                         bool dedicated)
 {
-    uint32_t n;
-    VK_CHECK(vkEnumerateDeviceExtensionProperties(gfxDevice.physicalDevice, NULL, &n, NULL));
-    VkExtensionProperties* pAvailable = GFX_MALLOC(n * sizeof *pAvailable);
-    VK_CHECK(vkEnumerateDeviceExtensionProperties(gfxDevice.physicalDevice, NULL, &n, pAvailable));
+    GfxMemoryBlock* pBlock = GFX_MALLOC(sizeof *pBlock);
+    *pBlock = (GfxMemoryBlock){
+        .size = size,
+        .memoryTypeIndex = memoryTypeIndex,
+        .kind = kind,
+        .dedicated = dedicated,
+        .pFreeRanges = GFX_MALLOC(4 * sizeof *pBlock->pFreeRanges),
+        .freeRangeCount = 1,
+        .freeRangeCapacity = 4,
+    };
+    pBlock->pFreeRanges[0] = (GfxMemoryRange){.offset = 0, .size = size};
 
-    GFX_DEBUG("Requesting device extensions (%d):", deviceExtensionCount);
-    for (uint32_t i = 0; i < deviceExtensionCount; i++) {
-        GFX_DEBUG(" * %s", ppDeviceExtensions[i]);
-    }
+    VkMemoryAllocateFlagsInfo allocFlagInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+    };
 
-    GFX_DEBUG("Available device extensions (%d):", n);
-    for (uint32_t i = 0; i < n; i++) {
-        GFX_DEBUG(" * %s", pAvailable[i].extensionName);
+    VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = memoryTypeIndex,
+    };
+
+    if (kind == GFX_MEMORY_KIND_LINEAR_DEVICE_ADDRESS) {
+        allocInfo.pNext = &allocFlagInfo;
     }
 
-    bool result = true;
-    for (uint32_t i = 0; i < deviceExtensionCount; i++) {
-        bool found = false;
-        for (uint32_t j = 0; j < n; j++) {
-            if (!strcmp(ppDeviceExtensions[i], pAvailable[j].extensionName)) {
-                found = true;
-                break;
-            }
-        }
+    VK_CHECK(vkAllocateMemory(gfxDevice.device, &allocInfo, NULL, &pBlock->memory));
 
-        if (!found) {
-            GFX_ERROR("The requested extension %s is not available", ppDeviceExtensions[i]);
-            result = false;
-        }
+    // Host visible blocks stay mapped for as long as they live
+    if (gfxDevice.properties.memory.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        VK_CHECK(vkMapMemory(gfxDevice.device, pBlock->memory, 0, VK_WHOLE_SIZE, 0, &pBlock->pHostMap));
     }
 
-    GFX_FREE(pAvailable);
+    pBlock->pNext = gfxDevice.allocator.pBlocks;
+    gfxDevice.allocator.pBlocks = pBlock;
+    gfxDevice.allocator.blockCount++;
 
-    return result;
+    GFX_DEBUG("Allocated memory block of %" PRIu64 " bytes from memory type %" PRIu32 " (%" PRIu32 " blocks)",
+              (uint64_t)size, memoryTypeIndex, gfxDevice.allocator.blockCount);
+
+    return pBlock;
 }
 
-static uint32_t getQueueFamilyIndex(VkSurfaceKHR surface, uint32_t requiredFamilyFlags)
+static void destroyMemoryBlock(GfxMemoryBlock* pBlock)
 {
-    uint32_t n;
-    vkGetPhysicalDeviceQueueFamilyProperties(gfxDevice.physicalDevice, &n, NULL);
-    VkQueueFamilyProperties* pProps = GFX_MALLOC(n * sizeof *pProps);
-    vkGetPhysicalDeviceQueueFamilyProperties(gfxDevice.physicalDevice, &n, pProps);
+    GfxMemoryBlock** ppLink = &gfxDevice.allocator.pBlocks;
+    while (*ppLink != pBlock) {
+        ppLink = &(*ppLink)->pNext;
+    }
+    *ppLink = pBlock->pNext;
+    gfxDevice.allocator.blockCount--;
 
-    if (!n) {
-        GFX_ERROR("No Vulkan queue family available");
+    if (pBlock->pHostMap) {
+        vkUnmapMemory(gfxDevice.device, pBlock->memory);
     }
+    vkFreeMemory(gfxDevice.device, pBlock->memory, NULL);
 
-    struct VulkanQueue {
-        VkQueueFlagBits flagBit;
-        const char* string;
-    } vulkanQueues[] = {
-        {VK_QUEUE_GRAPHICS_BIT, "VK_QUEUE_GRAPHICS_BIT"},
-        {VK_QUEUE_COMPUTE_BIT, "VK_QUEUE_COMPUTE_BIT"},
-        {VK_QUEUE_TRANSFER_BIT, "VK_QUEUE_TRANSFER_BIT"},
-        {VK_QUEUE_SPARSE_BINDING_BIT, "VK_QUEUE_SPARSE_BINDING_BIT"},
-        {VK_QUEUE_PROTECTED_BIT, "VK_QUEUE_PROTECTED_BIT"},
-        {VK_QUEUE_VIDEO_DECODE_BIT_KHR, "VK_QUEUE_VIDEO_DECODE_BIT_KHR"},
-        {VK_QUEUE_VIDEO_ENCODE_BIT_KHR, "VK_QUEUE_VIDEO_ENCODE_BIT_KHR"},
-        {VK_QUEUE_OPTICAL_FLOW_BIT_NV, "VK_QUEUE_OPTICAL_FLOW_BIT_NV"},
-    };
+    GFX_FREE(pBlock->pFreeRanges);
+    GFX_FREE(pBlock);
+}
 
-    GFX_DEBUG("Available queue families for selected device (%d):", n);
-    for (uint32_t i = 0; i < n; i++) {
-        GFX_DEBUG(" * [%d]:", i);
-        for (uint32_t j = 0; j < GFX_ARRAY_LEN(vulkanQueues); j++) {
-            if (pProps[i].queueFlags & vulkanQueues[j].flagBit) {
-                GFX_DEBUG("         %s", vulkanQueues[j].string);
-            }
+static void insertFreeRange(GfxMemoryBlock* pBlock, uint32_t index, GfxMemoryRange range)
+{
+    if (pBlock->freeRangeCount == pBlock->freeRangeCapacity) {
+        pBlock->freeRangeCapacity *= 2;
+        pBlock->pFreeRanges =
+            GFX_REALLOC(pBlock->pFreeRanges, pBlock->freeRangeCapacity * sizeof *pBlock->pFreeRanges);
+    }
+
+    memmove(&pBlock->pFreeRanges[index + 1], &pBlock->pFreeRanges[index],
+            (pBlock->freeRangeCount - index) * sizeof *pBlock->pFreeRanges);
+    pBlock->pFreeRanges[index] = range;
+    pBlock->freeRangeCount++;
+}
+
+static void removeFreeRange(GfxMemoryBlock* pBlock, uint32_t index)
+{
+    memmove(&pBlock->pFreeRanges[index], &pBlock->pFreeRanges[index + 1],
+            (pBlock->freeRangeCount - index - 1) * sizeof *pBlock->pFreeRanges);
+    pBlock->freeRangeCount--;
+}
+
+// Find the first free range that fits size at the given alignment. Any space
+// left on either side of the allocation stays free.
+static bool allocateFromBlock(GfxMemoryBlock* pBlock, VkDeviceSize size, VkDeviceSize alignment,
+                              VkDeviceSize* pOffset)
+{
+    for (uint32_t i = 0; i < pBlock->freeRangeCount; i++) {
+        GfxMemoryRange range = pBlock->pFreeRanges[i];
+        VkDeviceSize offset = gfxAlignTo(range.offset, alignment);
+        VkDeviceSize end = range.offset + range.size;
+
+        if (offset + size > end) {
+            continue;
+        }
+
+        VkDeviceSize padding = offset - range.offset;
+        VkDeviceSize remainder = end - (offset + size);
+
+        if (padding && remainder) {
+            pBlock->pFreeRanges[i].size = padding;
+            insertFreeRange(pBlock, i + 1, (GfxMemoryRange){.offset = offset + size, .size = remainder});
+        } else if (padding) {
+            pBlock->pFreeRanges[i].size = padding;
+        } else if (remainder) {
+            pBlock->pFreeRanges[i] = (GfxMemoryRange){.offset = offset + size, .size = remainder};
+        } else {
+            removeFreeRange(pBlock, i);
         }
+
+        *pOffset = offset;
+        return true;
     }
 
-    uint32_t index = 0;
-    for (; index < n; index++) {
-        if ((pProps[index].queueFlags & requiredFamilyFlags) == requiredFamilyFlags) {
+    return false;
+}
+
+static void releaseToBlock(GfxMemoryBlock* pBlock, VkDeviceSize offset, VkDeviceSize size)
+{
+    uint32_t i = 0;
+    while (i < pBlock->freeRangeCount && pBlock->pFreeRanges[i].offset < offset) {
+        i++;
+    }
+
+    GfxMemoryRange* pPrev = i > 0 ? &pBlock->pFreeRanges[i - 1] : NULL;
+    GfxMemoryRange* pNext = i < pBlock->freeRangeCount ? &pBlock->pFreeRanges[i] : NULL;
+    bool mergePrev = pPrev && pPrev->offset + pPrev->size == offset;
+    bool mergeNext = pNext && offset + size == pNext->offset;
+
+    if (mergePrev && mergeNext) {
+        pPrev->size += size + pNext->size;
+        removeFreeRange(pBlock, i);
+    } else if (mergePrev) {
+        pPrev->size += size;
+    } else if (mergeNext) {
+        pNext->offset = offset;
+        pNext->size += size;
+    } else {
+        insertFreeRange(pBlock, i, (GfxMemoryRange){.offset = offset, .size = size});
+    }
+}
+
+static void allocateMemory(const VkMemoryRequirements* pMemReqs, VkMemoryPropertyFlags properties,
+                           enum GfxMemoryKind kind, GfxAllocation* pAllocation)
+{
+    uint32_t memoryTypeIndex = gfxFindMemoryType(pMemReqs->memoryTypeBits, properties);
+
+    VkDeviceSize offset = 0;
+    GfxMemoryBlock* pBlock = gfxDevice.allocator.pBlocks;
+    for (; pBlock; pBlock = pBlock->pNext) {
+        if (pBlock->memoryTypeIndex == memoryTypeIndex && pBlock->kind == kind &&
+            allocateFromBlock(pBlock, pMemReqs->size, pMemReqs->alignment, &offset)) {
             break;
         }
     }
 
-    if (index == n) {
-        GFX_FREE(pProps);
-        GFX_ERROR("No Vulkan queue found for requested families");
-    }
+    if (!pBlock) {
+        // Keep blocks to a fraction of small heaps, such as the host visible
+        // device local heap of discrete GPUs
+        uint32_t heapIndex = gfxDevice.properties.memory.memoryTypes[memoryTypeIndex].heapIndex;
+        VkDeviceSize heapSize = gfxDevice.properties.memory.memoryHeaps[heapIndex].size;
+        VkDeviceSize blockSize = GFX_MIN((VkDeviceSize)GFX_MEMORY_BLOCK_SIZE, heapSize / 8);
+
+        bool dedicated = pMemReqs->size > blockSize;
+        pBlock = createMemoryBlock(dedicated ? pMemReqs->size : blockSize, memoryTypeIndex, kind, dedicated);
 
-    // Check that the selected queue family supports PRESENT
-    VkBool32 supported;
-    VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(gfxDevice.physicalDevice, index, surface, &supported));
-    if (!supported) {
-        GFX_ERROR("Selected queue family does not support PRESENT");
+        // A fresh block always fits, offset 0 satisfies any alignment
+        allocateFromBlock(pBlock, pMemReqs->size, pMemReqs->alignment, &offset);
     }
 
-    GFX_FREE(pProps);
+    pBlock->allocationCount++;
+    gfxDevice.allocator.allocationCount++;
 
-    return index;
+    *pAllocation = (GfxAllocation){
+        .pBlock = pBlock,
+        .memory = pBlock->memory,
+        .offset = offset,
+        .size = pMemReqs->size,
+    };
 }
 
-void gfxCreateDevice(uint32_t physicalDeviceIndex, uint32_t deviceExtensionCount, const char** ppDeviceExtensions,
-                     VkPhysicalDeviceFeatures2* features, VkSurfaceKHR surface)
+static void freeMemory(GfxAllocation* pAllocation)
 {
-    if (!gfxDevice.instance) {
-        GFX_ERROR("Instance not initialized");
+    GfxMemoryBlock* pBlock = pAllocation->pBlock;
+    if (!pBlock) {
+        return;
     }
 
-    if (gfxDevice.device) {
-        GFX_ERROR("Device already created");
+    releaseToBlock(pBlock, pAllocation->offset, pAllocation->size);
+    pBlock->allocationCount--;
+    gfxDevice.allocator.allocationCount--;
+
+    // Release empty blocks, but keep the last one of each memory type and kind
+    // so that creating and destroying a single resource does not allocate a
+    // new block every time
+    if (!pBlock->allocationCount) {
+        bool last = !pBlock->dedicated;
+        for (GfxMemoryBlock* p = gfxDevice.allocator.pBlocks; p && last; p = p->pNext) {
+            if (p != pBlock && p->memoryTypeIndex == pBlock->memoryTypeIndex && p->kind == pBlock->kind) {
+                last = false;
+            }
+        }
+
+        if (!last) {
+            destroyMemoryBlock(pBlock);
+        }
     }
 
-    gfxDevice.surface = surface;
+    GFX_RESET(pAllocation);
+}
 
-    // Iterate all physical devices
-    uint32_t n;
-    VK_CHECK(vkEnumeratePhysicalDevices(gfxDevice.instance, &n, NULL));
-    VkPhysicalDevice* pPhysicalDevices = GFX_MALLOC(n * sizeof *pPhysicalDevices);
-    VK_CHECK(vkEnumeratePhysicalDevices(gfxDevice.instance, &n, pPhysicalDevices));
+// Get the host address of an allocation, if its memory block is mapped
+static void* getHostMap(const GfxAllocation* pAllocation)
+{
+    if (!pAllocation->pBlock->pHostMap) {
+        return NULL;
+    }
+    return (char*)pAllocation->pBlock->pHostMap + pAllocation->offset;
+}
 
-    GFX_INFO("Available devices (%d):", n);
-    for (uint32_t i = 0; i < n; i++) {
-        VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtp = {
-            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
-        };
+// Hand out an index of a bindless array. Returns GFX_BINDLESS_NONE if there
+// is no bindless heap, or the array is full.
+static uint32_t allocateBindlessIndex(struct GfxBindlessArray* pArray)
+{
+    if (!gfxDevice.bindless.set) {
+        return GFX_BINDLESS_NONE;
+    }
 
-        VkPhysicalDeviceDriverProperties driver = {
-            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DRIVER_PROPERTIES,
-            .pNext = &rtp,
-        };
+    if (pArray->freeCount) {
+        return pArray->pFree[--pArray->freeCount];
+    }
 
-        VkPhysicalDeviceProperties2 prop = {
-            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
-            .pNext = &driver,
-        };
+    if (pArray->used == pArray->capacity) {
+        GFX_WARNING("All %" PRIu32 " descriptors of a bindless array are in use", pArray->capacity);
+        return GFX_BINDLESS_NONE;
+    }
 
-        vkGetPhysicalDeviceProperties2(pPhysicalDevices[i], &prop);
+    return pArray->used++;
+}
 
-        if (i == physicalDeviceIndex) {
-            gfxDevice.physicalDevice = pPhysicalDevices[i];
-            vkGetPhysicalDeviceProperties(gfxDevice.physicalDevice, &gfxDevice.properties.physicalDevice);
-            vkGetPhysicalDeviceMemoryProperties(gfxDevice.physicalDevice, &gfxDevice.properties.memory);
-            gfxDevice.properties.rayTracingPipeline = rtp;
-        }
+// Return an index to its bindless array, once no submitted work uses it
+static void freeBindlessIndex(struct GfxBindlessArray* pArray, uint32_t index)
+{
+    if (pArray->freeCount == pArray->freeCapacity) {
+        pArray->freeCapacity = GFX_MAX(64, 2 * pArray->freeCapacity);
+        pArray->pFree = GFX_REALLOC(pArray->pFree, pArray->freeCapacity * sizeof *pArray->pFree);
+    }
 
-        GFX_INFO(" * [%d] %s, driver: %s %s, Vulkan %d.%d.%d %s", i, prop.properties.deviceName, driver.driverName,
-                 driver.driverInfo, VK_API_VERSION_MAJOR(prop.properties.apiVersion),
-                 VK_API_VERSION_MINOR(prop.properties.apiVersion), VK_API_VERSION_PATCH(prop.properties.apiVersion),
-                 i == physicalDeviceIndex ? "(chosen)" : "");
+    pArray->pFree[pArray->freeCount++] = index;
+}
+
+// Write a descriptor to the bindless heap. The heap is update-after-bind, so
+// this is fine while command buffers using other indices are pending.
+static void writeBindlessDescriptor(enum GfxBindlessBinding binding, uint32_t index, VkDescriptorType type,
+                                    const VkDescriptorImageInfo* pImageInfo, const VkDescriptorBufferInfo* pBufferInfo)
+{
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = gfxDevice.bindless.set,
+        .dstBinding = binding,
+        .dstArrayElement = index,
+        .descriptorCount = 1,
+        .descriptorType = type,
+        .pImageInfo = pImageInfo,
+        .pBufferInfo = pBufferInfo,
+    };
+
+    vkUpdateDescriptorSets(gfxDevice.device, 1, &write, 0, NULL);
+}
+
+void gfxCreateBindlessHeap()
+{
+    struct GfxBindlessHeap* pHeap = &gfxDevice.bindless;
+
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
     }
 
-    GFX_FREE(pPhysicalDevices);
+    if (!gfxDevice.bindlessFeatures) {
+        GFX_ERROR("The bindless descriptor heap needs the runtimeDescriptorArray, descriptorBindingPartiallyBound, "
+                  "descriptorBindingUpdateUnusedWhilePending, descriptorBindingSampledImageUpdateAfterBind and "
+                  "descriptorBindingStorageBufferUpdateAfterBind features");
+        return;
+    }
 
-    checkDeviceExtensionSupport(deviceExtensionCount, ppDeviceExtensions);
+    if (pHeap->set) {
+        return;
+    }
 
-    uint32_t queueFamilyIndex =
-        getQueueFamilyIndex(surface, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
+    // The arrays are visible to every stage, so the per-stage limits apply as
+    // well as the per-set ones. All three arrays also count towards the limit
+    // of resources per stage.
+    const VkPhysicalDeviceDescriptorIndexingProperties* pLimits = &gfxDevice.properties.descriptorIndexing;
+    uint32_t maxResources =
+        GFX_MIN(pLimits->maxPerStageUpdateAfterBindResources, pLimits->maxUpdateAfterBindDescriptorsInAllPools);
+
+    uint32_t samplerCount = GFX_MIN(GFX_BINDLESS_SAMPLER_COUNT, pLimits->maxDescriptorSetUpdateAfterBindSamplers);
+    samplerCount = GFX_MIN(samplerCount, pLimits->maxPerStageDescriptorUpdateAfterBindSamplers);
+    samplerCount = GFX_MIN(samplerCount, maxResources / 3);
+
+    uint32_t imageCount = GFX_MIN(GFX_BINDLESS_IMAGE_COUNT, pLimits->maxDescriptorSetUpdateAfterBindSampledImages);
+    imageCount = GFX_MIN(imageCount, pLimits->maxPerStageDescriptorUpdateAfterBindSampledImages);
+    imageCount = GFX_MIN(imageCount, (maxResources - samplerCount) / 2);
+
+    uint32_t bufferCount = GFX_MIN(GFX_BINDLESS_BUFFER_COUNT, pLimits->maxDescriptorSetUpdateAfterBindStorageBuffers);
+    bufferCount = GFX_MIN(bufferCount, pLimits->maxPerStageDescriptorUpdateAfterBindStorageBuffers);
+    bufferCount = GFX_MIN(bufferCount, maxResources - samplerCount - imageCount);
+
+    if (imageCount < GFX_BINDLESS_IMAGE_COUNT || samplerCount < GFX_BINDLESS_SAMPLER_COUNT ||
+        bufferCount < GFX_BINDLESS_BUFFER_COUNT) {
+        GFX_WARNING("Bindless descriptor heap reduced to the device limits: %" PRIu32 " images, %" PRIu32
+                    " samplers and %" PRIu32 " buffers",
+                    imageCount, samplerCount, bufferCount);
+    }
 
-    float queuePriority = 1.0f;
-    VkDeviceQueueCreateInfo queueCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = queueFamilyIndex,
-        .queueCount = 1,
-        .pQueuePriorities = &queuePriority,
+    VkDescriptorSetLayoutBinding bindings[] = {
+        {
+            .binding = GFX_BINDLESS_IMAGES,
+            .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+            .descriptorCount = imageCount,
+            .stageFlags = VK_SHADER_STAGE_ALL,
+        },
+        {
+            .binding = GFX_BINDLESS_SAMPLERS,
+            .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+            .descriptorCount = samplerCount,
+            .stageFlags = VK_SHADER_STAGE_ALL,
+        },
+        {
+            .binding = GFX_BINDLESS_BUFFERS,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = bufferCount,
+            .stageFlags = VK_SHADER_STAGE_ALL,
+        },
     };
 
-    VkDeviceCreateInfo ci = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .pNext = features,
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queueCreateInfo,
-        .enabledExtensionCount = deviceExtensionCount,
-        .ppEnabledExtensionNames = ppDeviceExtensions,
+    // Unwritten descriptors are fine as long as shaders do not access them
+    VkDescriptorBindingFlags bindingFlags[GFX_ARRAY_LEN(bindings)];
+    for (uint32_t i = 0; i < GFX_ARRAY_LEN(bindings); i++) {
+        bindingFlags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                          VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    }
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = GFX_ARRAY_LEN(bindingFlags),
+        .pBindingFlags = bindingFlags,
     };
 
-    VK_CHECK(vkCreateDevice(gfxDevice.physicalDevice, &ci, NULL, &gfxDevice.device));
+    VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &bindingFlagsCreateInfo,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = GFX_ARRAY_LEN(bindings),
+        .pBindings = bindings,
+    };
 
-    // Remember whether anisotropic filtering was requested, so that samplers
-    // are not created with a feature that the device was not created with
-    gfxDevice.samplerAnisotropy = features && features->features.samplerAnisotropy;
+    VK_CHECK(vkCreateDescriptorSetLayout(gfxDevice.device, &setLayoutCreateInfo, NULL, &pHeap->setLayout));
 
-    // Resolve extension entry points once, rather than on every call
-#define GFX_LOAD_FN(name) gfxDevice.fn.name = (PFN_##name)vkGetDeviceProcAddr(gfxDevice.device, #name)
-    GFX_LOAD_FN(vkCreateShadersEXT);
-    GFX_LOAD_FN(vkDestroyShaderEXT);
-    GFX_LOAD_FN(vkCmdBindShadersEXT);
-    GFX_LOAD_FN(vkCmdSetVertexInputEXT);
-    GFX_LOAD_FN(vkCmdSetRasterizationSamplesEXT);
-    GFX_LOAD_FN(vkCmdSetSampleMaskEXT);
-    GFX_LOAD_FN(vkCmdSetAlphaToCoverageEnableEXT);
-    GFX_LOAD_FN(vkCmdSetPolygonModeEXT);
-    GFX_LOAD_FN(vkCmdSetLogicOpEnableEXT);
-    GFX_LOAD_FN(vkCmdSetColorBlendEnableEXT);
-    GFX_LOAD_FN(vkCmdSetColorWriteMaskEXT);
-    GFX_LOAD_FN(vkCmdPushDescriptorSetKHR);
-#undef GFX_LOAD_FN
+    VkDescriptorPoolSize poolSizes[GFX_ARRAY_LEN(bindings)];
+    for (uint32_t i = 0; i < GFX_ARRAY_LEN(bindings); i++) {
+        poolSizes[i] = (VkDescriptorPoolSize){
+            .type = bindings[i].descriptorType,
+            .descriptorCount = bindings[i].descriptorCount,
+        };
+    }
 
-    VkCommandPoolCreateInfo commandPoolCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = queueFamilyIndex,
+    VkDescriptorPoolCreateInfo poolCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = GFX_ARRAY_LEN(poolSizes),
+        .pPoolSizes = poolSizes,
     };
 
-    VK_CHECK(vkCreateCommandPool(gfxDevice.device, &commandPoolCreateInfo, NULL, &gfxDevice.commandPool));
-    vkGetDeviceQueue(gfxDevice.device, queueFamilyIndex, 0, &gfxDevice.queue);
-}
-
-void gfxDestroyDevice()
-{
-    if (!gfxDevice.device) {
-        GFX_ERROR("Device not initialized");
-    }
+    VK_CHECK(vkCreateDescriptorPool(gfxDevice.device, &poolCreateInfo, NULL, &pHeap->pool));
 
-    vkDeviceWaitIdle(gfxDevice.device);
+    VkDescriptorSetAllocateInfo allocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = pHeap->pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &pHeap->setLayout,
+    };
 
-    if (gfxDevice.commandPool) {
-        vkDestroyCommandPool(gfxDevice.device, gfxDevice.commandPool, NULL);
-    }
-    if (gfxDevice.device) {
-        vkDestroyDevice(gfxDevice.device, NULL);
-    }
-    if (gfxDevice.surface) {
-        vkDestroySurfaceKHR(gfxDevice.instance, gfxDevice.surface, NULL);
-    }
+    VK_CHECK(vkAllocateDescriptorSets(gfxDevice.device, &allocateInfo, &pHeap->set));
 
-    // Only reset the device owned state. The instance is still alive and is
-    // released by gfxDestroyInstance().
-    VkInstance instance = gfxDevice.instance;
-    uint32_t apiVersion = gfxDevice.apiVersion;
-#ifndef NDEBUG
-    VkDebugUtilsMessengerEXT debugMessenger = gfxDevice.debugMessenger;
-#endif
+    pHeap->images.capacity = imageCount;
+    pHeap->samplerCount = samplerCount;
+    pHeap->buffers.capacity = bufferCount;
 
-    GFX_RESET(&gfxDevice);
+    // Samplers keep their place in the cache, so those created before the
+    // heap are written now
+    for (uint32_t i = 0; i < GFX_MIN(gfxDevice.samplerCache.count, samplerCount); i++) {
+        VkDescriptorImageInfo imageInfo = {.sampler = gfxDevice.samplerCache.pEntries[i].sampler};
+        writeBindlessDescriptor(GFX_BINDLESS_SAMPLERS, i, VK_DESCRIPTOR_TYPE_SAMPLER, &imageInfo, NULL);
+    }
 
-    gfxDevice.instance = instance;
-    gfxDevice.apiVersion = apiVersion;
-#ifndef NDEBUG
-    gfxDevice.debugMessenger = debugMessenger;
-#endif
+    GFX_DEBUG("Created bindless descriptor heap");
 }
 
-VkSampleCountFlagBits gfxGetDeviceSampleCount()
+static void destroyBindlessHeap()
 {
-    VkSampleCountFlags counts = gfxDevice.properties.physicalDevice.limits.framebufferColorSampleCounts &
-                                gfxDevice.properties.physicalDevice.limits.framebufferDepthSampleCounts;
+    struct GfxBindlessHeap* pHeap = &gfxDevice.bindless;
 
-    if (counts & VK_SAMPLE_COUNT_64_BIT) {
-        return VK_SAMPLE_COUNT_64_BIT;
-    }
-    if (counts & VK_SAMPLE_COUNT_32_BIT) {
-        return VK_SAMPLE_COUNT_32_BIT;
-    }
-    if (counts & VK_SAMPLE_COUNT_16_BIT) {
-        return VK_SAMPLE_COUNT_16_BIT;
-    }
-    if (counts & VK_SAMPLE_COUNT_8_BIT) {
-        return VK_SAMPLE_COUNT_8_BIT;
-    }
-    if (counts & VK_SAMPLE_COUNT_4_BIT) {
-        return VK_SAMPLE_COUNT_4_BIT;
+    if (pHeap->pool) {
+        vkDestroyDescriptorPool(gfxDevice.device, pHeap->pool, NULL);
     }
-    if (counts & VK_SAMPLE_COUNT_2_BIT) {
-        return VK_SAMPLE_COUNT_2_BIT;
+    if (pHeap->setLayout) {
+        vkDestroyDescriptorSetLayout(gfxDevice.device, pHeap->setLayout, NULL);
     }
 
-    return VK_SAMPLE_COUNT_1_BIT;
+    GFX_FREE(pHeap->images.pFree);
+    GFX_FREE(pHeap->buffers.pFree);
 }
 
-static void querySupport()
+enum GfxDeferredType {
+    GFX_DEFERRED_BUFFER,
+    GFX_DEFERRED_IMAGE,
+    GFX_DEFERRED_IMAGE_VIEW,
+    GFX_DEFERRED_PIPELINE_LAYOUT,
+    GFX_DEFERRED_DESCRIPTOR_SET_LAYOUT,
+    GFX_DEFERRED_DESCRIPTOR_UPDATE_TEMPLATE,
+    GFX_DEFERRED_SHADER,
+    GFX_DEFERRED_MEMORY,
+    GFX_DEFERRED_BINDLESS_IMAGE,
+    GFX_DEFERRED_BINDLESS_BUFFER,
+};
+
+struct GfxDeferredDestroy {
+    enum GfxDeferredType type;
+    GfxTicket ticket;
+    union {
+        VkBuffer buffer;
+        VkImage image;
+        VkImageView imageView;
+        VkPipelineLayout pipelineLayout;
+        VkDescriptorSetLayout setLayout;
+        VkDescriptorUpdateTemplate updateTemplate;
+        VkShaderEXT shader;
+        GfxAllocation allocation;
+        uint32_t bindlessIndex;
+    };
+};
+
+// Release queued resources whose ticket has completed. Tickets are queued in
+// increasing order, so stop at the first one still in flight. If all is set,
+// everything is released, which requires the device to be idle.
+static void releaseDeferred(bool all)
 {
-    VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gfxDevice.physicalDevice, gfxDevice.surface,
-                                                       &gfxSwapchain.supportDetails.capabilities));
+    struct GfxDeletionQueue* pQueue = &gfxDevice.deletionQueue;
 
-    VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(gfxDevice.physicalDevice, gfxDevice.surface,
-                                                  &gfxSwapchain.supportDetails.formatCount, NULL));
-    gfxSwapchain.supportDetails.formats =
-        GFX_MALLOC(gfxSwapchain.supportDetails.formatCount * sizeof *gfxSwapchain.supportDetails.formats);
-    VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(gfxDevice.physicalDevice, gfxDevice.surface,
-                                                  &gfxSwapchain.supportDetails.formatCount,
-                                                  gfxSwapchain.supportDetails.formats));
+    uint32_t i = 0;
+    for (; i < pQueue->count; i++) {
+        GfxDeferredDestroy* pEntry = &pQueue->pEntries[i];
 
-    VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(gfxDevice.physicalDevice, gfxDevice.surface,
-                                                       &gfxSwapchain.supportDetails.presentCount, NULL));
-    gfxSwapchain.supportDetails.presentModes =
-        GFX_MALLOC(gfxSwapchain.supportDetails.presentCount * sizeof *gfxSwapchain.supportDetails.presentModes);
-    VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(gfxDevice.physicalDevice, gfxDevice.surface,
-                                                       &gfxSwapchain.supportDetails.presentCount,
-                                                       gfxSwapchain.supportDetails.presentModes));
-}
+        if (!all && !gfxIsTicketComplete(pEntry->ticket)) {
+            break;
+        }
 
-// Iterate through available formats and return the one that matches what we
-// want. If what we want is not available, the first format in the array is
-// returned.
-static VkSurfaceFormatKHR chooseSurfaceFormat(uint32_t availableFormatsCount,
-                                              const VkSurfaceFormatKHR* availableFormats)
-{
-    for (uint32_t i = 0; i < availableFormatsCount; i++) {
-        if (availableFormats[i].format == VK_FORMAT_B8G8R8A8_UNORM &&
-            availableFormats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-            return availableFormats[i];
+        switch (pEntry->type) {
+        case GFX_DEFERRED_BUFFER:
+            vkDestroyBuffer(gfxDevice.device, pEntry->buffer, NULL);
+            break;
+        case GFX_DEFERRED_IMAGE:
+            vkDestroyImage(gfxDevice.device, pEntry->image, NULL);
+            break;
+        case GFX_DEFERRED_IMAGE_VIEW:
+            vkDestroyImageView(gfxDevice.device, pEntry->imageView, NULL);
+            break;
+        case GFX_DEFERRED_PIPELINE_LAYOUT:
+            vkDestroyPipelineLayout(gfxDevice.device, pEntry->pipelineLayout, NULL);
+            break;
+        case GFX_DEFERRED_DESCRIPTOR_SET_LAYOUT:
+            vkDestroyDescriptorSetLayout(gfxDevice.device, pEntry->setLayout, NULL);
+            break;
+        case GFX_DEFERRED_DESCRIPTOR_UPDATE_TEMPLATE:
+            vkDestroyDescriptorUpdateTemplate(gfxDevice.device, pEntry->updateTemplate, NULL);
+            break;
+        case GFX_DEFERRED_SHADER:
+            gfxDevice.fn.vkDestroyShaderEXT(gfxDevice.device, pEntry->shader, NULL);
+            break;
+        case GFX_DEFERRED_MEMORY:
+            freeMemory(&pEntry->allocation);
+            break;
+        case GFX_DEFERRED_BINDLESS_IMAGE:
+            freeBindlessIndex(&gfxDevice.bindless.images, pEntry->bindlessIndex);
+            break;
+        case GFX_DEFERRED_BINDLESS_BUFFER:
+            freeBindlessIndex(&gfxDevice.bindless.buffers, pEntry->bindlessIndex);
+            break;
         }
     }
-    return availableFormats[0];
+
+    memmove(pQueue->pEntries, pQueue->pEntries + i, (pQueue->count - i) * sizeof *pQueue->pEntries);
+    pQueue->count -= i;
 }
 
-// Iterate through available present modes and see if a no v-sync mode is
-// available, otherwise go for VK_PRESENT_MODE_FIFO_KHR. If vsync is requested,
-// just go for VK_PRESENT_MODE_FIFO_KHR.
-static VkPresentModeKHR choosePresentMode(uint32_t availablePresentModeCount,
-                                          const VkPresentModeKHR* availablePresentModes, bool vsync)
+// Queue a resource for release once all work submitted so far has completed.
+// Pending uploads may refer to the resource, so they are submitted first.
+static void deferDestroy(GfxDeferredDestroy entry)
 {
-    if (vsync) {
-        return VK_PRESENT_MODE_MAILBOX_KHR;
-    }
+    struct GfxDeletionQueue* pQueue = &gfxDevice.deletionQueue;
 
-    for (uint32_t i = 0; i < availablePresentModeCount; i++) {
-        if (availablePresentModes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-            return availablePresentModes[i];
-        }
+    // The ticket of pending uploads also covers all work submitted before
+    entry.ticket = gfxFlushUploads();
+
+    // Keep the queue short when there is no frame loop releasing it
+    releaseDeferred(false);
+
+    if (pQueue->count == pQueue->capacity) {
+        pQueue->capacity = GFX_MAX(64, 2 * pQueue->capacity);
+        pQueue->pEntries = GFX_REALLOC(pQueue->pEntries, pQueue->capacity * sizeof *pQueue->pEntries);
     }
 
-    return VK_PRESENT_MODE_FIFO_KHR;
+    pQueue->pEntries[pQueue->count++] = entry;
 }
 
-// Set the resolution of the swapchain images. Use the size of the framebuffer
-// from the window.
-static VkExtent2D chooseExtent(const VkSurfaceCapabilitiesKHR* capabilities, uint32_t width, uint32_t height)
+// Stages that can consume uploaded data, which wait for uploads from the
+// transfer queue. Everything else in the same submission runs ahead.
+#define GFX_UPLOAD_CONSUMER_STAGES                                                                                     \
+    (VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |  \
+     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT)
+
+// Submit to the graphics queue, additionally signaling the timeline with the
+// next ticket. pSignalValues holds the values of the semaphores signaled by the
+// submit info, and can be NULL if they are all binary. Uploads flushed to the
+// transfer queue since the last submission are waited for and acquired first.
+static GfxTicket submitWithTicket(const VkSubmitInfo* pSubmitInfo, const uint64_t* pSignalValues)
 {
-    if (capabilities->currentExtent.width != UINT32_MAX) {
-        return capabilities->currentExtent;
-    } else {
-        VkExtent2D actualExtent = {
-            .width = (uint32_t)width,
-            .height = (uint32_t)height,
+    struct GfxStagingRing* pRing = &gfxDevice.staging;
+
+    VkSubmitInfo submitInfos[GFX_STAGING_BATCH_COUNT + 1];
+    uint32_t submitCount = 0;
+
+    const VkPipelineStageFlags acquireStages = GFX_UPLOAD_CONSUMER_STAGES;
+
+    for (uint32_t i = 0; pRing->acquireCount && i < pRing->inFlightCount; i++) {
+        struct GfxStagingBatch* pBatch = &pRing->batches[(pRing->firstInFlight + i) % GFX_STAGING_BATCH_COUNT];
+        if (!pBatch->acquirePending) {
+            continue;
+        }
+
+        submitInfos[submitCount++] = (VkSubmitInfo){
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &pBatch->signalSemaphore,
+            .pWaitDstStageMask = &acquireStages,
+            .commandBufferCount = pBatch->acquireImages ? 1 : 0,
+            .pCommandBuffers = &pBatch->acquireCmd,
         };
 
-        actualExtent.width =
-            GFX_CLAMP(actualExtent.width, capabilities->minImageExtent.width, capabilities->maxImageExtent.width);
-        actualExtent.height =
-            GFX_CLAMP(actualExtent.height, capabilities->minImageExtent.height, capabilities->maxImageExtent.height);
+        pBatch->acquirePending = false;
+        pRing->acquireCount--;
+    }
 
-        return actualExtent;
+    GfxTicket ticket = gfxDevice.timeline.submitted + 1;
+
+    VkSemaphore signalSemaphores[4] = {gfxDevice.timeline.semaphore};
+    uint64_t signalValues[4] = {ticket};
+    uint32_t signalCount = 1;
+
+    assert(pSubmitInfo->signalSemaphoreCount < GFX_ARRAY_LEN(signalSemaphores));
+    for (uint32_t i = 0; i < pSubmitInfo->signalSemaphoreCount; i++) {
+        signalSemaphores[signalCount] = pSubmitInfo->pSignalSemaphores[i];
+        signalValues[signalCount++] = pSignalValues ? pSignalValues[i] : 0;
     }
-}
 
-static void createSwapchain()
-{
-    uint32_t width;
-    uint32_t height;
-    gfxSwapchain.framebufferSizeCallback(&width, &height);
+    // Values of binary semaphores are ignored
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = signalCount,
+        .pSignalSemaphoreValues = signalValues,
+    };
 
-    VkSurfaceFormatKHR surfaceFormat =
-        chooseSurfaceFormat(gfxSwapchain.supportDetails.formatCount, gfxSwapchain.supportDetails.formats);
-    VkPresentModeKHR presentMode = choosePresentMode(gfxSwapchain.supportDetails.presentCount,
-                                                     gfxSwapchain.supportDetails.presentModes, gfxDevice.vsync);
-    VkExtent2D extent = chooseExtent(&gfxSwapchain.supportDetails.capabilities, width, height);
+    VkSubmitInfo* pSi = &submitInfos[submitCount++];
+    *pSi = *pSubmitInfo;
+    pSi->pNext = &timelineInfo;
+    pSi->signalSemaphoreCount = signalCount;
+    pSi->pSignalSemaphores = signalSemaphores;
 
-    // Using at least minImageCount number of images is required but using one
-    // extra can avoid unnecessary waits on the driver
-    gfxSwapchain.imageCount = gfxSwapchain.supportDetails.capabilities.minImageCount + 1;
+    VK_CHECK(vkQueueSubmit(gfxDevice.queue, submitCount, submitInfos, VK_NULL_HANDLE));
 
-    // Also make sure that we are not exceeding the maximum number of images
-    if (gfxSwapchain.supportDetails.capabilities.maxImageCount > 0 &&
-        gfxSwapchain.imageCount > gfxSwapchain.supportDetails.capabilities.maxImageCount) {
-        gfxSwapchain.imageCount = gfxSwapchain.supportDetails.capabilities.maxImageCount;
-    }
+    gfxDevice.timeline.submitted = ticket;
 
-    VkSwapchainCreateInfoKHR ci = {
-        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-        .surface = gfxDevice.surface,
-        .minImageCount = gfxSwapchain.imageCount,
-        .imageFormat = surfaceFormat.format,
-        .imageColorSpace = surfaceFormat.colorSpace,
-        .imageExtent = extent,
-        .imageArrayLayers = 1, // Unless rendering stereoscopically
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
-                      VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-        .preTransform = gfxSwapchain.supportDetails.capabilities.currentTransform,
-        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-        .presentMode = presentMode,
-        .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE,
-    };
+    return ticket;
+}
 
-    gfxSwapchain.format = surfaceFormat.format;
-    gfxSwapchain.extent = extent;
+static bool hasTransferQueue()
+{
+    return gfxDevice.transferQueueFamilyIndex != gfxDevice.queueFamilyIndex;
+}
 
-    VK_CHECK(vkCreateSwapchainKHR(gfxDevice.device, &ci, NULL, &gfxSwapchain.swapchain));
+static void createStagingRing()
+{
+    struct GfxStagingRing* pRing = &gfxDevice.staging;
 
-    VK_CHECK(vkGetSwapchainImagesKHR(gfxDevice.device, gfxSwapchain.swapchain, &gfxSwapchain.imageCount, NULL));
-    gfxSwapchain.images = GFX_MALLOC(gfxSwapchain.imageCount * sizeof *gfxSwapchain.images);
-    gfxSwapchain.imageViews = GFX_MALLOC(gfxSwapchain.imageCount * sizeof *gfxSwapchain.imageViews);
-    VK_CHECK(vkGetSwapchainImagesKHR(gfxDevice.device, gfxSwapchain.swapchain, &gfxSwapchain.imageCount,
-                                     gfxSwapchain.images));
+    VkBufferCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = GFX_STAGING_RING_SIZE,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
 
-    for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
-        VkImageViewCreateInfo ci = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            .image = gfxSwapchain.images[i],
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = gfxSwapchain.format,
-            .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                           .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                           .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                           .a = VK_COMPONENT_SWIZZLE_IDENTITY},
-            .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                                 .baseMipLevel = 0,
-                                 .levelCount = 1,
-                                 .baseArrayLayer = 0,
-                                 .layerCount = 1},
-        };
+    VK_CHECK(vkCreateBuffer(gfxDevice.device, &ci, NULL, &pRing->buffer));
 
-        VK_CHECK(vkCreateImageView(gfxDevice.device, &ci, NULL, &gfxSwapchain.imageViews[i]));
-    }
-}
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(gfxDevice.device, pRing->buffer, &memReqs);
 
-static void destroySwapchain()
-{
-    vkDeviceWaitIdle(gfxDevice.device);
+    allocateMemory(&memReqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   GFX_MEMORY_KIND_LINEAR, &pRing->allocation);
 
-    // Swapchain images are destroyed in vkDestroySwapchainKHR()
-    for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
-        vkDestroyImageView(gfxDevice.device, gfxSwapchain.imageViews[i], NULL);
-    }
+    VK_CHECK(vkBindBufferMemory(gfxDevice.device, pRing->buffer, pRing->allocation.memory, pRing->allocation.offset));
 
-    vkDestroySwapchainKHR(gfxDevice.device, gfxSwapchain.swapchain, NULL);
+    pRing->pHostMap = getHostMap(&pRing->allocation);
+    pRing->size = GFX_STAGING_RING_SIZE;
 
-    GFX_FREE(gfxSwapchain.images);
-    GFX_FREE(gfxSwapchain.imageViews);
-}
+    // Keep offsets usable as the source of buffer to image copies too
+    pRing->alignment = GFX_MAX(16, gfxDevice.properties.physicalDevice.limits.optimalBufferCopyOffsetAlignment);
 
-static void createSyncObjects()
-{
     VkCommandBufferAllocateInfo ai = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = gfxDevice.commandPool,
+        .commandPool = gfxDevice.transferCommandPool,
         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = gfxSwapchain.framesInFlight,
+        .commandBufferCount = 1,
     };
 
-    gfxSwapchain.renderFinishedSemaphores =
-        GFX_MALLOC(gfxSwapchain.imageCount * sizeof *gfxSwapchain.renderFinishedSemaphores);
-    gfxSwapchain.commandBuffers = GFX_MALLOC(gfxSwapchain.framesInFlight * sizeof *gfxSwapchain.commandBuffers);
-    gfxSwapchain.inFlightSemaphores = GFX_MALLOC(gfxSwapchain.framesInFlight * sizeof *gfxSwapchain.inFlightSemaphores);
-    gfxSwapchain.inFlightFences = GFX_MALLOC(gfxSwapchain.framesInFlight * sizeof *gfxSwapchain.inFlightFences);
-
-    VK_CHECK(vkAllocateCommandBuffers(gfxDevice.device, &ai, gfxSwapchain.commandBuffers));
+    VkCommandBufferAllocateInfo acquireAi = ai;
+    acquireAi.commandPool = gfxDevice.commandPool;
 
     VkSemaphoreCreateInfo sci = {
         .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
     };
 
-    VkFenceCreateInfo fci = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
-    };
+    for (uint32_t i = 0; i < GFX_STAGING_BATCH_COUNT; i++) {
+        struct GfxStagingBatch* pBatch = &pRing->batches[i];
 
-    for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
-        VK_CHECK(vkCreateSemaphore(gfxDevice.device, &sci, NULL, &gfxSwapchain.renderFinishedSemaphores[i]));
-    }
+        VK_CHECK(vkAllocateCommandBuffers(gfxDevice.device, &ai, &pBatch->cmd));
 
-    for (uint32_t i = 0; i < gfxSwapchain.framesInFlight; i++) {
-        VK_CHECK(vkCreateSemaphore(gfxDevice.device, &sci, NULL, &gfxSwapchain.inFlightSemaphores[i]));
-        VK_CHECK(vkCreateFence(gfxDevice.device, &fci, NULL, &gfxSwapchain.inFlightFences[i]));
+        if (hasTransferQueue()) {
+            VK_CHECK(vkAllocateCommandBuffers(gfxDevice.device, &acquireAi, &pBatch->acquireCmd));
+            VK_CHECK(vkCreateSemaphore(gfxDevice.device, &sci, NULL, &pBatch->signalSemaphore));
+        }
     }
 }
 
-static void destroySyncObjects()
+static void destroyStagingRing()
 {
-    vkDeviceWaitIdle(gfxDevice.device);
+    struct GfxStagingRing* pRing = &gfxDevice.staging;
 
-    vkFreeCommandBuffers(gfxDevice.device, gfxDevice.commandPool, gfxSwapchain.framesInFlight,
-                         gfxSwapchain.commandBuffers);
+    for (uint32_t i = 0; i < GFX_STAGING_BATCH_COUNT; i++) {
+        struct GfxStagingBatch* pBatch = &pRing->batches[i];
 
-    for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
-        vkDestroySemaphore(gfxDevice.device, gfxSwapchain.renderFinishedSemaphores[i], NULL);
-    }
+        vkFreeCommandBuffers(gfxDevice.device, gfxDevice.transferCommandPool, 1, &pBatch->cmd);
 
-    for (uint32_t i = 0; i < gfxSwapchain.framesInFlight; i++) {
-        vkDestroySemaphore(gfxDevice.device, gfxSwapchain.inFlightSemaphores[i], NULL);
-        vkDestroyFence(gfxDevice.device, gfxSwapchain.inFlightFences[i], NULL);
+        if (hasTransferQueue()) {
+            vkFreeCommandBuffers(gfxDevice.device, gfxDevice.commandPool, 1, &pBatch->acquireCmd);
+            vkDestroySemaphore(gfxDevice.device, pBatch->signalSemaphore, NULL);
+        }
     }
 
-    GFX_FREE(gfxSwapchain.renderFinishedSemaphores);
-    GFX_FREE(gfxSwapchain.commandBuffers);
-    GFX_FREE(gfxSwapchain.inFlightSemaphores);
-    GFX_FREE(gfxSwapchain.inFlightFences);
+    vkDestroyBuffer(gfxDevice.device, pRing->buffer, NULL);
+    freeMemory(&pRing->allocation);
+
+    GFX_FREE(pRing->pImageBarriers);
+
+    GFX_RESET(pRing);
 }
 
-void gfxCreateSwapchain(uint32_t framesInFlight, void (*framebufferSizeCallback)(uint32_t*, uint32_t*))
+// Give back the ring ranges of batches that have completed. If wait is set,
+// block until at least the oldest batch has completed.
+static void retireStagingBatches(bool wait)
 {
-    GFX_RESET(&gfxSwapchain);
-
-    if (!gfxDevice.device) {
-        GFX_ERROR("Device not initialized");
-    }
+    struct GfxStagingRing* pRing = &gfxDevice.staging;
 
-    if (!framebufferSizeCallback) {
-        GFX_ERROR("Framebuffer size callback function must be specified");
-    }
+    while (pRing->inFlightCount) {
+        struct GfxStagingBatch* pBatch = &pRing->batches[pRing->firstInFlight];
 
-    gfxSwapchain.framesInFlight = framesInFlight;
-    gfxSwapchain.framebufferSizeCallback = framebufferSizeCallback;
+        if (wait) {
+            gfxWaitTicket(pBatch->ticket);
+            wait = false;
+        } else if (!gfxIsTicketComplete(pBatch->ticket)) {
+            break;
+        }
 
-    querySupport();
-    createSwapchain();
-    createSyncObjects();
+        pRing->tail = pBatch->end;
+        pRing->firstInFlight = (pRing->firstInFlight + 1) % GFX_STAGING_BATCH_COUNT;
+        pRing->inFlightCount--;
+    }
 }
 
-void gfxDestroySwapchain()
+// Reserve size bytes of the staging ring for the pending batch and return the
+// offset of the reservation. Waits for older batches if the ring is full. The
+// head never catches up with the tail, so head == tail always means empty.
+static VkDeviceSize allocateStaging(VkDeviceSize size)
 {
-    if (!gfxDevice.device) {
-        GFX_ERROR("Device not initialized");
-    }
+    struct GfxStagingRing* pRing = &gfxDevice.staging;
 
-    vkDeviceWaitIdle(gfxDevice.device);
+    size = gfxAlignTo(size, pRing->alignment);
 
-    destroySyncObjects();
-    destroySwapchain();
+    retireStagingBatches(false);
 
-    GFX_FREE(gfxSwapchain.supportDetails.formats);
-    GFX_FREE(gfxSwapchain.supportDetails.presentModes);
+    for (;;) {
+        // Start over from the beginning once nothing references the ring
+        if (!pRing->inFlightCount && !pRing->recording) {
+            pRing->head = 0;
+            pRing->tail = 0;
+        }
 
-    GFX_RESET(&gfxSwapchain);
-}
+        VkDeviceSize offset = UINT64_MAX;
 
-void gfxSetVsync(bool vsync)
-{
-    if (gfxDevice.vsync == vsync) {
-        return;
-    }
+        if (pRing->head >= pRing->tail) {
+            if (pRing->size - pRing->head >= size) {
+                offset = pRing->head;
+            } else if (size < pRing->tail) {
+                // Wrap around, the end of the ring is left unused
+                offset = 0;
+            }
+        } else if (pRing->tail - pRing->head > size) {
+            offset = pRing->head;
+        }
 
-    gfxDevice.vsync = vsync;
+        if (offset != UINT64_MAX) {
+            pRing->head = offset + size;
+            return offset;
+        }
 
-    // Present mode is baked into the swapchain, so it has to be rebuilt
-    if (gfxSwapchain.swapchain) {
-        gfxRecreateSwapchain();
+        // The pending batch might be what is holding on to the ring
+        if (!pRing->inFlightCount) {
+            gfxFlushUploads();
+        }
+        retireStagingBatches(true);
     }
 }
 
-void gfxRecreateSwapchain()
+// Get the command buffer of the pending upload batch, beginning a new batch if
+// there is none
+static VkCommandBuffer getUploadCommandBuffer()
 {
-    uint32_t width, height;
-    gfxSwapchain.framebufferSizeCallback(&width, &height);
+    struct GfxStagingRing* pRing = &gfxDevice.staging;
 
-    GFX_DEBUG("Recreating swapchain %" PRIu32 "x%" PRIu32, width, height);
+    uint32_t index = (pRing->firstInFlight + pRing->inFlightCount) % GFX_STAGING_BATCH_COUNT;
 
-    destroySyncObjects();
-    destroySwapchain();
+    if (!pRing->recording) {
+        if (pRing->inFlightCount == GFX_STAGING_BATCH_COUNT) {
+            retireStagingBatches(true);
+            index = (pRing->firstInFlight + pRing->inFlightCount) % GFX_STAGING_BATCH_COUNT;
+        }
 
-    GFX_FREE(gfxSwapchain.supportDetails.formats);
-    GFX_FREE(gfxSwapchain.supportDetails.presentModes);
+        VkCommandBufferBeginInfo bi = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
 
-    querySupport();
-    createSwapchain();
-    createSyncObjects();
+        VK_CHECK(vkBeginCommandBuffer(pRing->batches[index].cmd, &bi));
 
-    gfxSwapchain.recreated = true;
-}
+        // Do not overwrite buffers that earlier submissions are still reading
+        VkMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        };
 
-void gfxWaitForFence()
-{
-    VK_CHECK(vkWaitForFences(gfxDevice.device, 1, &gfxSwapchain.inFlightFences[gfxSwapchain.inFlightIndex], VK_TRUE,
-                             UINT64_MAX));
-}
+        VkDependencyInfo dependencyInfo = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &barrier,
+        };
 
-VkCommandBuffer gfxAcquireNextImage()
-{
-    // The caller has had a full iteration to react to a recreated swapchain
-    gfxSwapchain.recreated = false;
+        vkCmdPipelineBarrier2(pRing->batches[index].cmd, &dependencyInfo);
 
-    // Wait for the current frame to not be in flight
-    gfxWaitForFence();
-    VK_CHECK(vkResetFences(gfxDevice.device, 1, &gfxSwapchain.inFlightFences[gfxSwapchain.inFlightIndex]));
+        pRing->recording = true;
+    }
 
-    // Acquire index of next image in the swapchain
-    VkResult result = vkAcquireNextImageKHR(gfxDevice.device, gfxSwapchain.swapchain, UINT64_MAX,
-                                            gfxSwapchain.inFlightSemaphores[gfxSwapchain.inFlightIndex], NULL,
-                                            &gfxSwapchain.imageIndex);
+    return pRing->batches[index].cmd;
+}
 
-    // Check if swapchain needs to be reconstructed. No image was acquired and
-    // no semaphore was signaled, so this frame cannot be rendered.
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-        gfxRecreateSwapchain();
-        return VK_NULL_HANDLE;
-    } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-        GFX_ERROR("Failed to acquire next swapchain image");
+// Transition all subresources of an image written by the pending batch to
+// their final layout, and hand the image over to the graphics queue
+static void releaseImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+    struct GfxStagingRing* pRing = &gfxDevice.staging;
+
+    if (pRing->imageBarrierCount == pRing->imageBarrierCapacity) {
+        pRing->imageBarrierCapacity = GFX_MAX(16, 2 * pRing->imageBarrierCapacity);
+        pRing->pImageBarriers =
+            GFX_REALLOC(pRing->pImageBarriers, pRing->imageBarrierCapacity * sizeof *pRing->pImageBarriers);
     }
 
-    VkCommandBufferBeginInfo bi = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    pRing->pImageBarriers[pRing->imageBarrierCount++] = (VkImageMemoryBarrier2){
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+        .oldLayout = oldLayout,
+        .newLayout = newLayout,
+        .srcQueueFamilyIndex = hasTransferQueue() ? gfxDevice.transferQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = hasTransferQueue() ? gfxDevice.queueFamilyIndex : VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .baseMipLevel = 0,
+                             .levelCount = VK_REMAINING_MIP_LEVELS,
+                             .baseArrayLayer = 0,
+                             .layerCount = VK_REMAINING_ARRAY_LAYERS},
     };
-
-    VK_CHECK(vkBeginCommandBuffer(gfxSwapchain.commandBuffers[gfxSwapchain.inFlightIndex], &bi));
-
-    return gfxSwapchain.commandBuffers[gfxSwapchain.inFlightIndex];
 }
 
-void gfxPresent(VkCommandBuffer cmd, GfxImage* pImage)
+// Upload the first mip level of a color image through the staging ring. The
+// image is left in layout once the pending batch has been flushed. Returns
+// false without recording anything if the data does not fit in the ring.
+static bool uploadImage(const GfxImage* pImage, const void* pData, VkDeviceSize size, VkImageLayout layout)
 {
-    // Transition swapchain image for blitting. The image comes from the
-    // presentation engine, so the acquire semaphore provides the source
-    // dependency.
+    if (size > gfxDevice.staging.size / 2) {
+        return false;
+    }
+
+    VkDeviceSize stagingOffset = allocateStaging(size);
+    memcpy(gfxDevice.staging.pHostMap + stagingOffset, pData, size);
+
+    VkCommandBuffer cmd = getUploadCommandBuffer();
+
     gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
                     VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    gfxSwapchain.images[gfxSwapchain.imageIndex], NULL);
+                    pImage->image, NULL);
 
-    // Blit image to current swapchain image
-    VkImageSubresourceLayers subresourceLayers = {
-        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .mipLevel = 0,
-        .baseArrayLayer = 0,
-        .layerCount = 1,
-    };
-    int32_t srcWidth = pImage->width;
-    int32_t srcHeight = pImage->height;
-    int32_t dstWidth = (int32_t)(gfxSwapchain.extent.width);
-    int32_t dstHeight = (int32_t)(gfxSwapchain.extent.height);
-    VkImageBlit2 region = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2,
-        .srcSubresource = subresourceLayers,
-        .srcOffsets = {{0, 0, 0}, {srcWidth, srcHeight, 1}},
-        .dstSubresource = subresourceLayers,
-        .dstOffsets = {{0, 0, 0}, {dstWidth, dstHeight, 1}},
+    VkBufferImageCopy region = {
+        .bufferOffset = stagingOffset,
+        .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                             .mipLevel = 0,
+                             .baseArrayLayer = 0,
+                             .layerCount = pImage->arrayLayers},
+        .imageExtent = {pImage->width, pImage->height, pImage->depth},
     };
 
-    VkBlitImageInfo2 blitImageInfo = {
-        .sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2,
-        .srcImage = pImage->image,
-        .srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        .dstImage = gfxSwapchain.images[gfxSwapchain.imageIndex],
-        .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        .regionCount = 1,
-        .pRegions = &region,
-        .filter = VK_FILTER_NEAREST,
-    };
+    vkCmdCopyBufferToImage(cmd, gfxDevice.staging.buffer, pImage->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                           &region);
 
-    vkCmdBlitImage2(cmd, &blitImageInfo);
+    releaseImage(pImage->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout);
 
-    // Transition swapchain image for presenting
-    gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, gfxSwapchain.images[gfxSwapchain.imageIndex], NULL);
+    return true;
+}
 
-    VK_CHECK(vkEndCommandBuffer(cmd));
+#if GFX_WINDOWS
+typedef HANDLE GfxThread;
+typedef CRITICAL_SECTION GfxMutex;
+typedef CONDITION_VARIABLE GfxCondition;
+#else
+typedef pthread_t GfxThread;
+typedef pthread_mutex_t GfxMutex;
+typedef pthread_cond_t GfxCondition;
+#endif
 
-    // The first use of the acquired image is the blit above, so the acquire
-    // semaphore has to be waited on before the transfer stage
-    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+// Jobs of a group can be waited on together
+struct GfxJobGroup {
+    uint32_t remaining;
+};
 
-    VkSubmitInfo si = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &gfxSwapchain.inFlightSemaphores[gfxSwapchain.inFlightIndex],
-        .pWaitDstStageMask = &waitStage,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &cmd,
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &gfxSwapchain.renderFinishedSemaphores[gfxSwapchain.imageIndex],
-    };
+struct GfxJob {
+    void (*pFunction)(void*);
+    void* pData;
+    struct GfxJobGroup* pGroup;
+};
 
-    VK_CHECK(vkQueueSubmit(gfxDevice.queue, 1, &si, gfxSwapchain.inFlightFences[gfxSwapchain.inFlightIndex]));
+struct GfxThreadPool {
+    GfxThread* pThreads;
+    uint32_t threadCount;
 
-    VkPresentInfoKHR pi = {
-        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &gfxSwapchain.renderFinishedSemaphores[gfxSwapchain.imageIndex],
-        .swapchainCount = 1,
-        .pSwapchains = &gfxSwapchain.swapchain,
-        .pImageIndices = &gfxSwapchain.imageIndex,
-    };
+    GfxMutex mutex;
+    GfxCondition jobAvailable;
+    GfxCondition jobDone;
 
-    VkResult result = vkQueuePresentKHR(gfxDevice.queue, &pi);
+    // Jobs that have not started yet, in a ring that grows when full
+    struct GfxJob* pJobs;
+    uint32_t jobHead;
+    uint32_t jobCount;
+    uint32_t jobCapacity;
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-        gfxRecreateSwapchain();
-    } else if (result != VK_SUCCESS) {
-        GFX_ERROR("Failed to present swapchain image");
-    }
+    bool quit;
+};
 
-    gfxSwapchain.inFlightIndex = (gfxSwapchain.inFlightIndex + 1) % gfxSwapchain.framesInFlight;
+static void lockMutex(GfxMutex* pMutex)
+{
+#if GFX_WINDOWS
+    EnterCriticalSection(pMutex);
+#else
+    pthread_mutex_lock(pMutex);
+#endif
 }
 
-void gfxCreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, GfxBuffer* pBuffer)
+static void unlockMutex(GfxMutex* pMutex)
 {
-    if (!gfxDevice.device) {
-        GFX_ERROR("Device not initialized");
-    }
+#if GFX_WINDOWS
+    LeaveCriticalSection(pMutex);
+#else
+    pthread_mutex_unlock(pMutex);
+#endif
+}
 
-    *pBuffer = (GfxBuffer){
-        .usage = usage,
+static void waitCondition(GfxCondition* pCondition, GfxMutex* pMutex)
+{
+#if GFX_WINDOWS
+    SleepConditionVariableCS(pCondition, pMutex, INFINITE);
+#else
+    pthread_cond_wait(pCondition, pMutex);
+#endif
+}
+
+static void wakeCondition(GfxCondition* pCondition, bool all)
+{
+#if GFX_WINDOWS
+    if (all) {
+        WakeAllConditionVariable(pCondition);
+    } else {
+        WakeConditionVariable(pCondition);
+    }
+#else
+    if (all) {
+        pthread_cond_broadcast(pCondition);
+    } else {
+        pthread_cond_signal(pCondition);
+    }
+#endif
+}
+
+// Take the oldest job off the queue. The pool mutex must be held.
+static struct GfxJob popJob(struct GfxThreadPool* pPool)
+{
+    struct GfxJob job = pPool->pJobs[pPool->jobHead];
+    pPool->jobHead = (pPool->jobHead + 1) % pPool->jobCapacity;
+    pPool->jobCount--;
+
+    return job;
+}
+
+// Take the oldest queued job of a group off the queue, keeping the order of
+// the others. The pool mutex must be held.
+static bool popGroupJob(struct GfxThreadPool* pPool, struct GfxJobGroup* pGroup, struct GfxJob* pJob)
+{
+    for (uint32_t i = 0; i < pPool->jobCount; i++) {
+        uint32_t index = (pPool->jobHead + i) % pPool->jobCapacity;
+        if (pPool->pJobs[index].pGroup != pGroup) {
+            continue;
+        }
+
+        *pJob = pPool->pJobs[index];
+        for (uint32_t j = i + 1; j < pPool->jobCount; j++) {
+            uint32_t next = (pPool->jobHead + j) % pPool->jobCapacity;
+            pPool->pJobs[index] = pPool->pJobs[next];
+            index = next;
+        }
+        pPool->jobCount--;
+
+        return true;
+    }
+
+    return false;
+}
+
+// Run a job outside of the lock. The pool mutex must be held, and is held
+// again on return.
+static void runJob(struct GfxThreadPool* pPool, struct GfxJob job)
+{
+    unlockMutex(&pPool->mutex);
+    job.pFunction(job.pData);
+    lockMutex(&pPool->mutex);
+
+    if (--job.pGroup->remaining == 0) {
+        wakeCondition(&pPool->jobDone, true);
+    }
+}
+
+static void runWorker(struct GfxThreadPool* pPool)
+{
+    lockMutex(&pPool->mutex);
+
+    while (true) {
+        while (!pPool->jobCount && !pPool->quit) {
+            waitCondition(&pPool->jobAvailable, &pPool->mutex);
+        }
+
+        // Every group has been waited on before the pool is destroyed, so
+        // there are no jobs left behind
+        if (pPool->quit) {
+            break;
+        }
+
+        runJob(pPool, popJob(pPool));
+    }
+
+    unlockMutex(&pPool->mutex);
+}
+
+#if GFX_WINDOWS
+static DWORD WINAPI workerThread(LPVOID pData)
+{
+    runWorker(pData);
+    return 0;
+}
+#else
+static void* workerThread(void* pData)
+{
+    runWorker(pData);
+    return NULL;
+}
+#endif
+
+static uint32_t getProcessorCount()
+{
+#if GFX_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+#else
+    return 1;
+#endif
+}
+
+// Start the worker threads on first use
+static struct GfxThreadPool* getThreadPool()
+{
+    if (gfxDevice.pThreadPool) {
+        return gfxDevice.pThreadPool;
+    }
+
+    struct GfxThreadPool* pPool = GFX_MALLOC(sizeof *pPool);
+    memset(pPool, 0, sizeof *pPool);
+
+    pPool->threadCount = GFX_THREAD_COUNT ? GFX_THREAD_COUNT : GFX_MAX(getProcessorCount(), 2) - 1;
+    pPool->pThreads = GFX_MALLOC(pPool->threadCount * sizeof *pPool->pThreads);
+
+#if GFX_WINDOWS
+    InitializeCriticalSection(&pPool->mutex);
+    InitializeConditionVariable(&pPool->jobAvailable);
+    InitializeConditionVariable(&pPool->jobDone);
+#else
+    pthread_mutex_init(&pPool->mutex, NULL);
+    pthread_cond_init(&pPool->jobAvailable, NULL);
+    pthread_cond_init(&pPool->jobDone, NULL);
+#endif
+
+    for (uint32_t i = 0; i < pPool->threadCount; i++) {
+#if GFX_WINDOWS
+        pPool->pThreads[i] = CreateThread(NULL, 0, workerThread, pPool, 0, NULL);
+        bool started = pPool->pThreads[i] != NULL;
+#else
+        bool started = pthread_create(&pPool->pThreads[i], NULL, workerThread, pPool) == 0;
+#endif
+        if (!started) {
+            GFX_ERROR("Unable to start worker thread");
+        }
+    }
+
+    GFX_DEBUG("Started %" PRIu32 " worker threads", pPool->threadCount);
+
+    gfxDevice.pThreadPool = pPool;
+
+    return pPool;
+}
+
+static void destroyThreadPool()
+{
+    struct GfxThreadPool* pPool = gfxDevice.pThreadPool;
+    if (!pPool) {
+        return;
+    }
+
+    lockMutex(&pPool->mutex);
+    pPool->quit = true;
+    wakeCondition(&pPool->jobAvailable, true);
+    unlockMutex(&pPool->mutex);
+
+    for (uint32_t i = 0; i < pPool->threadCount; i++) {
+#if GFX_WINDOWS
+        WaitForSingleObject(pPool->pThreads[i], INFINITE);
+        CloseHandle(pPool->pThreads[i]);
+#else
+        pthread_join(pPool->pThreads[i], NULL);
+#endif
+    }
+
+#if GFX_WINDOWS
+    DeleteCriticalSection(&pPool->mutex);
+#else
+    pthread_mutex_destroy(&pPool->mutex);
+    pthread_cond_destroy(&pPool->jobAvailable);
+    pthread_cond_destroy(&pPool->jobDone);
+#endif
+
+    GFX_FREE(pPool->pJobs);
+    GFX_FREE(pPool->pThreads);
+    GFX_FREE(pPool);
+
+    gfxDevice.pThreadPool = NULL;
+}
+
+// Queue a job to run on a worker thread as part of a group
+static void submitJob(struct GfxJobGroup* pGroup, void (*pFunction)(void*), void* pData)
+{
+    struct GfxThreadPool* pPool = getThreadPool();
+
+    lockMutex(&pPool->mutex);
+
+    // Grow the ring, moving the queued jobs to the front
+    if (pPool->jobCount == pPool->jobCapacity) {
+        uint32_t capacity = GFX_MAX(16, 2 * pPool->jobCapacity);
+        struct GfxJob* pJobs = GFX_MALLOC(capacity * sizeof *pJobs);
+
+        for (uint32_t i = 0; i < pPool->jobCount; i++) {
+            pJobs[i] = pPool->pJobs[(pPool->jobHead + i) % pPool->jobCapacity];
+        }
+
+        GFX_FREE(pPool->pJobs);
+        pPool->pJobs = pJobs;
+        pPool->jobHead = 0;
+        pPool->jobCapacity = capacity;
+    }
+
+    uint32_t tail = (pPool->jobHead + pPool->jobCount) % pPool->jobCapacity;
+    pPool->pJobs[tail] = (struct GfxJob){
+        .pFunction = pFunction,
+        .pData = pData,
+        .pGroup = pGroup,
+    };
+    pPool->jobCount++;
+    pGroup->remaining++;
+
+    wakeCondition(&pPool->jobAvailable, false);
+    unlockMutex(&pPool->mutex);
+}
+
+// Wait for every job of a group to complete. The calling thread runs queued
+// jobs of the same group in the meantime rather than sitting idle; jobs of
+// other groups could take arbitrarily long, or wait on this one.
+static void waitJobGroup(struct GfxJobGroup* pGroup)
+{
+    struct GfxThreadPool* pPool = getThreadPool();
+
+    lockMutex(&pPool->mutex);
+
+    while (pGroup->remaining) {
+        struct GfxJob job;
+        if (popGroupJob(pPool, pGroup, &job)) {
+            runJob(pPool, job);
+        } else {
+            waitCondition(&pPool->jobDone, &pPool->mutex);
+        }
+    }
+
+    unlockMutex(&pPool->mutex);
+}
+
+// Check whether every job of a group has completed, without waiting
+static bool isJobGroupDone(struct GfxJobGroup* pGroup)
+{
+    struct GfxThreadPool* pPool = getThreadPool();
+
+    lockMutex(&pPool->mutex);
+    bool done = pGroup->remaining == 0;
+    unlockMutex(&pPool->mutex);
+
+    return done;
+}
+
+// Build of shaders on a worker thread. The shaders refer to it until the
+// results are collected on the calling thread by gfxIsShaderReady(), or by a
+// function that has to wait for them.
+struct GfxShaderBuild {
+    GfxShader* pShaders[2];
+    uint32_t shaderCount;
+    struct GfxJobGroup group;
+
+    // Set to compile the shader from its GLSL file first
+    bool compile;
+    VkShaderStageFlagBits stage;
+    VkShaderStageFlags nextStage;
+    const GfxLayout* pLayout;
+
+    // What to build, taken from the shaders when the build starts, or from
+    // the compiled code
+    VkShaderCreateInfoEXT createInfos[2];
+    uint64_t layoutHashes[2];
+
+    // Results, set by the job. Compiled code is handed to the shader by the
+    // calling thread, which owns it.
+    void* pCode;
+    size_t codeSize;
+    VkShaderEXT shaders[2];
+    char* pError;
+    bool cacheHit;
+    bool cacheMiss;
+    bool binaryCacheHit;
+    bool binaryCacheMiss;
+
+    // Outstanding builds of the device
+    struct GfxShaderBuild* pPrev;
+    struct GfxShaderBuild* pNext;
+};
+
+static void removeShaderBuild(struct GfxShaderBuild* pBuild)
+{
+    if (pBuild->pPrev) {
+        pBuild->pPrev->pNext = pBuild->pNext;
+    } else {
+        gfxDevice.pShaderBuilds = pBuild->pNext;
+    }
+    if (pBuild->pNext) {
+        pBuild->pNext->pPrev = pBuild->pPrev;
+    }
+}
+
+// Wait for a build and drop its results, leaving its shaders as they were
+static void discardShaderBuild(struct GfxShaderBuild* pBuild)
+{
+    waitJobGroup(&pBuild->group);
+    removeShaderBuild(pBuild);
+
+    for (uint32_t i = 0; i < pBuild->shaderCount; i++) {
+        if (pBuild->shaders[i]) {
+            gfxDevice.fn.vkDestroyShaderEXT(gfxDevice.device, pBuild->shaders[i], NULL);
+        }
+        pBuild->pShaders[i]->pBuild = NULL;
+    }
+
+    GFX_FREE(pBuild->pCode);
+    GFX_FREE(pBuild->pError);
+    GFX_FREE(pBuild);
+}
+
+// Rebuild of a watched shader, together with the shader it was linked with
+// if any. Shaders that are not recompiled keep their code.
+struct GfxShaderReload {
+    GfxShader* pShaders[2];
+    uint32_t shaderCount;
+    bool recompile[2];
+
+    // Results, set by the job
+    uint32_t* pCode[2];
+    size_t codeSize[2];
+    VkShaderEXT shaders[2];
+    char* pError;
+    uint32_t cacheHits;
+    uint32_t cacheMisses;
+    bool binaryCacheHit;
+    bool binaryCacheMiss;
+};
+
+struct GfxShaderWatcher {
+    // inotify instance, or -1 if watching is not supported
+    int fd;
+
+    struct GfxWatchedShader {
+        GfxShader* pShader;
+        int watch;
+        bool changed;
+    }* pShaders;
+    uint32_t shaderCount;
+    uint32_t shaderCapacity;
+
+    // Reloads that are being rebuilt and have not been swapped in yet
+    struct GfxShaderReload* pReloads;
+    uint32_t reloadCount;
+    struct GfxJobGroup group;
+};
+
+// Release the results of a reload that will not be swapped in
+static void discardShaderReload(struct GfxShaderReload* pReload)
+{
+    for (uint32_t i = 0; i < pReload->shaderCount; i++) {
+        // The new shader objects were never used
+        if (pReload->shaders[i]) {
+            gfxDevice.fn.vkDestroyShaderEXT(gfxDevice.device, pReload->shaders[i], NULL);
+        }
+        GFX_FREE(pReload->pCode[i]);
+    }
+    GFX_FREE(pReload->pError);
+
+    GFX_RESET(pReload);
+}
+
+// Wait for and drop the pending reloads of a shader. Reloads read the shader
+// on a worker thread, so this has to happen before it is changed.
+static void discardPendingReloads(GfxShader* pShader)
+{
+    struct GfxShaderWatcher* pWatcher = gfxDevice.pShaderWatcher;
+    if (!pWatcher) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < pWatcher->reloadCount; i++) {
+        struct GfxShaderReload* pReload = &pWatcher->pReloads[i];
+
+        for (uint32_t j = 0; j < pReload->shaderCount; j++) {
+            if (pReload->pShaders[j] == pShader) {
+                waitJobGroup(&pWatcher->group);
+                discardShaderReload(pReload);
+                break;
+            }
+        }
+    }
+}
+
+static void destroyShaderWatcher()
+{
+    struct GfxShaderWatcher* pWatcher = gfxDevice.pShaderWatcher;
+    if (!pWatcher) {
+        return;
+    }
+
+    waitJobGroup(&pWatcher->group);
+
+    for (uint32_t i = 0; i < pWatcher->reloadCount; i++) {
+        discardShaderReload(&pWatcher->pReloads[i]);
+    }
+
+#if GFX_LINUX
+    if (pWatcher->fd >= 0) {
+        close(pWatcher->fd);
+    }
+#endif
+
+    GFX_FREE(pWatcher->pReloads);
+    GFX_FREE(pWatcher->pShaders);
+    GFX_FREE(pWatcher);
+
+    gfxDevice.pShaderWatcher = NULL;
+}
+
+static bool checkDeviceExtensionSupport(uint32_t deviceExtensionCount, const char** ppDeviceExtensions)
+{
+    uint32_t n;
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(gfxDevice.physicalDevice, NULL, &n, NULL));
+    VkExtensionProperties* pAvailable = GFX_MALLOC(n * sizeof *pAvailable);
+    VK_CHECK(vkEnumerateDeviceExtensionProperties(gfxDevice.physicalDevice, NULL, &n, pAvailable));
+
+    GFX_DEBUG("Requesting device extensions (%d):", deviceExtensionCount);
+    for (uint32_t i = 0; i < deviceExtensionCount; i++) {
+        GFX_DEBUG(" * %s", ppDeviceExtensions[i]);
+    }
+
+    GFX_DEBUG("Available device extensions (%d):", n);
+    for (uint32_t i = 0; i < n; i++) {
+        GFX_DEBUG(" * %s", pAvailable[i].extensionName);
+    }
+
+    bool result = true;
+    for (uint32_t i = 0; i < deviceExtensionCount; i++) {
+        bool found = false;
+        for (uint32_t j = 0; j < n; j++) {
+            if (!strcmp(ppDeviceExtensions[i], pAvailable[j].extensionName)) {
+                found = true;
+                break;
+            }
+        }
+
+        if (!found) {
+            GFX_ERROR("The requested extension %s is not available", ppDeviceExtensions[i]);
+            result = false;
+        }
+    }
+
+    GFX_FREE(pAvailable);
+
+    return result;
+}
+
+static uint32_t getQueueFamilyIndex(VkSurfaceKHR surface, uint32_t requiredFamilyFlags)
+{
+    uint32_t n;
+    vkGetPhysicalDeviceQueueFamilyProperties(gfxDevice.physicalDevice, &n, NULL);
+    VkQueueFamilyProperties* pProps = GFX_MALLOC(n * sizeof *pProps);
+    vkGetPhysicalDeviceQueueFamilyProperties(gfxDevice.physicalDevice, &n, pProps);
+
+    if (!n) {
+        GFX_ERROR("No Vulkan queue family available");
+    }
+
+    struct VulkanQueue {
+        VkQueueFlagBits flagBit;
+        const char* string;
+    } vulkanQueues[] = {
+        {VK_QUEUE_GRAPHICS_BIT, "VK_QUEUE_GRAPHICS_BIT"},
+        {VK_QUEUE_COMPUTE_BIT, "VK_QUEUE_COMPUTE_BIT"},
+        {VK_QUEUE_TRANSFER_BIT, "VK_QUEUE_TRANSFER_BIT"},
+        {VK_QUEUE_SPARSE_BINDING_BIT, "VK_QUEUE_SPARSE_BINDING_BIT"},
+        {VK_QUEUE_PROTECTED_BIT, "VK_QUEUE_PROTECTED_BIT"},
+        {VK_QUEUE_VIDEO_DECODE_BIT_KHR, "VK_QUEUE_VIDEO_DECODE_BIT_KHR"},
+        {VK_QUEUE_VIDEO_ENCODE_BIT_KHR, "VK_QUEUE_VIDEO_ENCODE_BIT_KHR"},
+        {VK_QUEUE_OPTICAL_FLOW_BIT_NV, "VK_QUEUE_OPTICAL_FLOW_BIT_NV"},
+    };
+
+    GFX_DEBUG("Available queue families for selected device (%d):", n);
+    for (uint32_t i = 0; i < n; i++) {
+        GFX_DEBUG(" * [%d]:", i);
+        for (uint32_t j = 0; j < GFX_ARRAY_LEN(vulkanQueues); j++) {
+            if (pProps[i].queueFlags & vulkanQueues[j].flagBit) {
+                GFX_DEBUG("         %s", vulkanQueues[j].string);
+            }
+        }
+    }
+
+    uint32_t index = 0;
+    for (; index < n; index++) {
+        if ((pProps[index].queueFlags & requiredFamilyFlags) == requiredFamilyFlags) {
+            break;
+        }
+    }
+
+    if (index == n) {
+        GFX_FREE(pProps);
+        GFX_ERROR("No Vulkan queue found for requested families");
+    }
+
+    // Check that the selected queue family supports PRESENT, unless there is
+    // nothing to present to
+    if (surface) {
+        VkBool32 supported;
+        VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(gfxDevice.physicalDevice, index, surface, &supported));
+        if (!supported) {
+            GFX_ERROR("Selected queue family does not support PRESENT");
+        }
+    }
+
+    GFX_FREE(pProps);
+
+    return index;
+}
+
+// Find a queue family that supports transfers but neither graphics nor
+// compute, which usually maps to a dedicated copy engine. Returns fallback if
+// the device has none.
+static uint32_t getTransferQueueFamilyIndex(uint32_t fallback)
+{
+    uint32_t n;
+    vkGetPhysicalDeviceQueueFamilyProperties(gfxDevice.physicalDevice, &n, NULL);
+    VkQueueFamilyProperties* pProps = GFX_MALLOC(n * sizeof *pProps);
+    vkGetPhysicalDeviceQueueFamilyProperties(gfxDevice.physicalDevice, &n, pProps);
+
+    uint32_t index = fallback;
+    for (uint32_t i = 0; i < n; i++) {
+        VkQueueFlags flags = pProps[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            index = i;
+            break;
+        }
+    }
+
+    GFX_FREE(pProps);
+
+    return index;
+}
+
+void gfxCreateDevice(uint32_t physicalDeviceIndex, uint32_t deviceExtensionCount, const char** ppDeviceExtensions,
+                     VkPhysicalDeviceFeatures2* features, VkSurfaceKHR surface)
+{
+    if (!gfxDevice.instance) {
+        GFX_ERROR("Instance not initialized");
+    }
+
+    if (gfxDevice.device) {
+        GFX_ERROR("Device already created");
+    }
+
+    gfxDevice.surface = surface;
+
+    // Iterate all physical devices
+    uint32_t n;
+    VK_CHECK(vkEnumeratePhysicalDevices(gfxDevice.instance, &n, NULL));
+    VkPhysicalDevice* pPhysicalDevices = GFX_MALLOC(n * sizeof *pPhysicalDevices);
+    VK_CHECK(vkEnumeratePhysicalDevices(gfxDevice.instance, &n, pPhysicalDevices));
+
+    GFX_INFO("Available devices (%d):", n);
+    for (uint32_t i = 0; i < n; i++) {
+        VkPhysicalDeviceDescriptorIndexingProperties descriptorIndexing = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES,
+        };
+
+        VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptorBuffer = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT,
+            .pNext = &descriptorIndexing,
+        };
+
+        VkPhysicalDeviceShaderObjectPropertiesEXT shaderObject = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_PROPERTIES_EXT,
+            .pNext = &descriptorBuffer,
+        };
+
+        VkPhysicalDeviceRayTracingPipelinePropertiesKHR rtp = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR,
+            .pNext = &shaderObject,
+        };
+
+        VkPhysicalDeviceDriverProperties driver = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DRIVER_PROPERTIES,
+            .pNext = &rtp,
+        };
+
+        VkPhysicalDeviceProperties2 prop = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &driver,
+        };
+
+        vkGetPhysicalDeviceProperties2(pPhysicalDevices[i], &prop);
+
+        if (i == physicalDeviceIndex) {
+            gfxDevice.physicalDevice = pPhysicalDevices[i];
+            vkGetPhysicalDeviceProperties(gfxDevice.physicalDevice, &gfxDevice.properties.physicalDevice);
+            vkGetPhysicalDeviceMemoryProperties(gfxDevice.physicalDevice, &gfxDevice.properties.memory);
+            gfxDevice.properties.rayTracingPipeline = rtp;
+            gfxDevice.properties.rayTracingPipeline.pNext = NULL;
+            gfxDevice.properties.shaderObject = shaderObject;
+            gfxDevice.properties.shaderObject.pNext = NULL;
+            gfxDevice.properties.descriptorBuffer = descriptorBuffer;
+            gfxDevice.properties.descriptorBuffer.pNext = NULL;
+            gfxDevice.properties.descriptorIndexing = descriptorIndexing;
+            gfxDevice.properties.descriptorIndexing.pNext = NULL;
+        }
+
+        GFX_INFO(" * [%d] %s, driver: %s %s, Vulkan %d.%d.%d %s", i, prop.properties.deviceName, driver.driverName,
+                 driver.driverInfo, VK_API_VERSION_MAJOR(prop.properties.apiVersion),
+                 VK_API_VERSION_MINOR(prop.properties.apiVersion), VK_API_VERSION_PATCH(prop.properties.apiVersion),
+                 i == physicalDeviceIndex ? "(chosen)" : "");
+    }
+
+    GFX_FREE(pPhysicalDevices);
+
+    checkDeviceExtensionSupport(deviceExtensionCount, ppDeviceExtensions);
+
+    uint32_t queueFamilyIndex =
+        getQueueFamilyIndex(surface, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
+
+#ifdef GFX_NO_TRANSFER_QUEUE
+    uint32_t transferQueueFamilyIndex = queueFamilyIndex;
+#else
+    uint32_t transferQueueFamilyIndex = getTransferQueueFamilyIndex(queueFamilyIndex);
+#endif
+
+    if (transferQueueFamilyIndex != queueFamilyIndex) {
+        GFX_INFO("Using queue family %" PRIu32 " for uploads", transferQueueFamilyIndex);
+    }
+
+    float queuePriority = 1.0f;
+    VkDeviceQueueCreateInfo queueCreateInfos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = queueFamilyIndex,
+            .queueCount = 1,
+            .pQueuePriorities = &queuePriority,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = transferQueueFamilyIndex,
+            .queueCount = 1,
+            .pQueuePriorities = &queuePriority,
+        },
+    };
+
+    VkDeviceCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = features,
+        .queueCreateInfoCount = transferQueueFamilyIndex != queueFamilyIndex ? 2 : 1,
+        .pQueueCreateInfos = queueCreateInfos,
+        .enabledExtensionCount = deviceExtensionCount,
+        .ppEnabledExtensionNames = ppDeviceExtensions,
+    };
+
+    // Tickets are timeline semaphore values, so the feature is required. The
+    // bindless descriptor heap is optional and can only be created if the
+    // descriptor indexing features that it relies on are enabled. Descriptor buffer
+    // layouts need the descriptorBuffer and bufferDeviceAddress features.
+    bool timelineSemaphore = false;
+    bool bindless = false;
+    bool descriptorBuffer = false;
+    bool bufferDeviceAddress = false;
+    for (const VkBaseInStructure* p = features ? features->pNext : NULL; p; p = p->pNext) {
+        if (p->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES) {
+            const VkPhysicalDeviceVulkan12Features* pVulkan12 = (const VkPhysicalDeviceVulkan12Features*)p;
+            timelineSemaphore |= pVulkan12->timelineSemaphore;
+            bufferDeviceAddress |= pVulkan12->bufferDeviceAddress;
+            bindless |= pVulkan12->runtimeDescriptorArray && pVulkan12->descriptorBindingPartiallyBound &&
+                        pVulkan12->descriptorBindingUpdateUnusedWhilePending &&
+                        pVulkan12->descriptorBindingSampledImageUpdateAfterBind &&
+                        pVulkan12->descriptorBindingStorageBufferUpdateAfterBind;
+        } else if (p->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES) {
+            timelineSemaphore |= ((const VkPhysicalDeviceTimelineSemaphoreFeatures*)p)->timelineSemaphore;
+        } else if (p->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES) {
+            const VkPhysicalDeviceDescriptorIndexingFeatures* pIndexing =
+                (const VkPhysicalDeviceDescriptorIndexingFeatures*)p;
+            bindless |= pIndexing->runtimeDescriptorArray && pIndexing->descriptorBindingPartiallyBound &&
+                        pIndexing->descriptorBindingUpdateUnusedWhilePending &&
+                        pIndexing->descriptorBindingSampledImageUpdateAfterBind &&
+                        pIndexing->descriptorBindingStorageBufferUpdateAfterBind;
+        } else if (p->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES) {
+            bufferDeviceAddress |= ((const VkPhysicalDeviceBufferDeviceAddressFeatures*)p)->bufferDeviceAddress;
+        } else if (p->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT) {
+            descriptorBuffer |= ((const VkPhysicalDeviceDescriptorBufferFeaturesEXT*)p)->descriptorBuffer;
+        }
+    }
+
+    if (!timelineSemaphore) {
+        GFX_ERROR("The timelineSemaphore device feature must be enabled");
+    }
+
+    VK_CHECK(vkCreateDevice(gfxDevice.physicalDevice, &ci, NULL, &gfxDevice.device));
+
+    // Remember whether anisotropic filtering was requested, so that samplers
+    // are not created with a feature that the device was not created with
+    gfxDevice.samplerAnisotropy = features && features->features.samplerAnisotropy;
+    gfxDevice.descriptorBuffer = descriptorBuffer && bufferDeviceAddress;
+    gfxDevice.bindlessFeatures = bindless;
+
+    // Resolve extension entry points once, rather than on every call
+#define GFX_LOAD_FN(name) gfxDevice.fn.name = (PFN_##name)vkGetDeviceProcAddr(gfxDevice.device, #name)
+    GFX_LOAD_FN(vkCreateShadersEXT);
+    GFX_LOAD_FN(vkDestroyShaderEXT);
+    GFX_LOAD_FN(vkGetShaderBinaryDataEXT);
+    GFX_LOAD_FN(vkCmdBindShadersEXT);
+    GFX_LOAD_FN(vkCmdSetVertexInputEXT);
+    GFX_LOAD_FN(vkCmdSetRasterizationSamplesEXT);
+    GFX_LOAD_FN(vkCmdSetSampleMaskEXT);
+    GFX_LOAD_FN(vkCmdSetAlphaToCoverageEnableEXT);
+    GFX_LOAD_FN(vkCmdSetPolygonModeEXT);
+    GFX_LOAD_FN(vkCmdSetLogicOpEnableEXT);
+    GFX_LOAD_FN(vkCmdSetColorBlendEnableEXT);
+    GFX_LOAD_FN(vkCmdSetColorWriteMaskEXT);
+    GFX_LOAD_FN(vkCmdSetColorBlendEquationEXT);
+    GFX_LOAD_FN(vkCmdPushDescriptorSetKHR);
+    GFX_LOAD_FN(vkCmdPushDescriptorSetWithTemplateKHR);
+    GFX_LOAD_FN(vkGetDescriptorSetLayoutSizeEXT);
+    GFX_LOAD_FN(vkGetDescriptorSetLayoutBindingOffsetEXT);
+    GFX_LOAD_FN(vkGetDescriptorEXT);
+    GFX_LOAD_FN(vkCmdBindDescriptorBuffersEXT);
+    GFX_LOAD_FN(vkCmdSetDescriptorBufferOffsetsEXT);
+#undef GFX_LOAD_FN
+
+    VkCommandPoolCreateInfo commandPoolCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = queueFamilyIndex,
+    };
+
+    VK_CHECK(vkCreateCommandPool(gfxDevice.device, &commandPoolCreateInfo, NULL, &gfxDevice.commandPool));
+    vkGetDeviceQueue(gfxDevice.device, queueFamilyIndex, 0, &gfxDevice.queue);
+
+    gfxDevice.queueFamilyIndex = queueFamilyIndex;
+    gfxDevice.transferQueueFamilyIndex = transferQueueFamilyIndex;
+    gfxDevice.transferCommandPool = gfxDevice.commandPool;
+    gfxDevice.transferQueue = gfxDevice.queue;
+
+    if (hasTransferQueue()) {
+        commandPoolCreateInfo.queueFamilyIndex = transferQueueFamilyIndex;
+        VK_CHECK(vkCreateCommandPool(gfxDevice.device, &commandPoolCreateInfo, NULL, &gfxDevice.transferCommandPool));
+        vkGetDeviceQueue(gfxDevice.device, transferQueueFamilyIndex, 0, &gfxDevice.transferQueue);
+    }
+
+    VkSemaphoreTypeCreateInfo typeInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo,
+    };
+
+    VK_CHECK(vkCreateSemaphore(gfxDevice.device, &semaphoreCreateInfo, NULL, &gfxDevice.timeline.semaphore));
+
+    createStagingRing();
+}
+
+void gfxDestroyDevice()
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    // Builds of shaders that were never collected must not outlive the pool
+    while (gfxDevice.pShaderBuilds) {
+        discardShaderBuild(gfxDevice.pShaderBuilds);
+    }
+
+    gfxWaitTicket(gfxFlushUploads());
+    vkDeviceWaitIdle(gfxDevice.device);
+
+    releaseDeferred(true);
+    GFX_FREE(gfxDevice.deletionQueue.pEntries);
+
+    for (uint32_t i = 0; i < gfxDevice.samplerCache.count; i++) {
+        vkDestroySampler(gfxDevice.device, gfxDevice.samplerCache.pEntries[i].sampler, NULL);
+    }
+    GFX_FREE(gfxDevice.samplerCache.pEntries);
+
+    destroyBindlessHeap();
+
+    GFX_FREE(gfxDevice.shaderCache.pDirectory);
+    destroyShaderWatcher();
+    destroyThreadPool();
+
+    destroyStagingRing();
+
+    for (uint32_t i = 0; i < gfxDevice.timeline.commandBufferCount; i++) {
+        vkFreeCommandBuffers(gfxDevice.device, gfxDevice.commandPool, 1, &gfxDevice.timeline.pCommandBuffers[i].cmd);
+    }
+    GFX_FREE(gfxDevice.timeline.pCommandBuffers);
+    vkDestroySemaphore(gfxDevice.device, gfxDevice.timeline.semaphore, NULL);
+
+    if (gfxDevice.allocator.allocationCount) {
+        GFX_WARNING("%" PRIu32 " buffers or images were not destroyed before the device",
+                    gfxDevice.allocator.allocationCount);
+    }
+    while (gfxDevice.allocator.pBlocks) {
+        destroyMemoryBlock(gfxDevice.allocator.pBlocks);
+    }
+
+    if (gfxDevice.transferCommandPool != gfxDevice.commandPool) {
+        vkDestroyCommandPool(gfxDevice.device, gfxDevice.transferCommandPool, NULL);
+    }
+    if (gfxDevice.commandPool) {
+        vkDestroyCommandPool(gfxDevice.device, gfxDevice.commandPool, NULL);
+    }
+    if (gfxDevice.device) {
+        vkDestroyDevice(gfxDevice.device, NULL);
+    }
+    if (gfxDevice.surface) {
+        vkDestroySurfaceKHR(gfxDevice.instance, gfxDevice.surface, NULL);
+    }
+
+    // Only reset the device owned state. The instance is still alive and is
+    // released by gfxDestroyInstance().
+    VkInstance instance = gfxDevice.instance;
+    uint32_t apiVersion = gfxDevice.apiVersion;
+#ifndef NDEBUG
+    VkDebugUtilsMessengerEXT debugMessenger = gfxDevice.debugMessenger;
+#endif
+
+    GFX_RESET(&gfxDevice);
+
+    gfxDevice.instance = instance;
+    gfxDevice.apiVersion = apiVersion;
+#ifndef NDEBUG
+    gfxDevice.debugMessenger = debugMessenger;
+#endif
+}
+
+VkSampleCountFlagBits gfxGetDeviceSampleCount()
+{
+    VkSampleCountFlags counts = gfxDevice.properties.physicalDevice.limits.framebufferColorSampleCounts &
+                                gfxDevice.properties.physicalDevice.limits.framebufferDepthSampleCounts;
+
+    if (counts & VK_SAMPLE_COUNT_64_BIT) {
+        return VK_SAMPLE_COUNT_64_BIT;
+    }
+    if (counts & VK_SAMPLE_COUNT_32_BIT) {
+        return VK_SAMPLE_COUNT_32_BIT;
+    }
+    if (counts & VK_SAMPLE_COUNT_16_BIT) {
+        return VK_SAMPLE_COUNT_16_BIT;
+    }
+    if (counts & VK_SAMPLE_COUNT_8_BIT) {
+        return VK_SAMPLE_COUNT_8_BIT;
+    }
+    if (counts & VK_SAMPLE_COUNT_4_BIT) {
+        return VK_SAMPLE_COUNT_4_BIT;
+    }
+    if (counts & VK_SAMPLE_COUNT_2_BIT) {
+        return VK_SAMPLE_COUNT_2_BIT;
+    }
+
+    return VK_SAMPLE_COUNT_1_BIT;
+}
+
+static void querySupport()
+{
+    if (gfxSwapchain.headless) {
+        return;
+    }
+
+    VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gfxDevice.physicalDevice, gfxDevice.surface,
+                                                       &gfxSwapchain.supportDetails.capabilities));
+
+    VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(gfxDevice.physicalDevice, gfxDevice.surface,
+                                                  &gfxSwapchain.supportDetails.formatCount, NULL));
+    gfxSwapchain.supportDetails.formats =
+        GFX_MALLOC(gfxSwapchain.supportDetails.formatCount * sizeof *gfxSwapchain.supportDetails.formats);
+    VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(gfxDevice.physicalDevice, gfxDevice.surface,
+                                                  &gfxSwapchain.supportDetails.formatCount,
+                                                  gfxSwapchain.supportDetails.formats));
+
+    VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(gfxDevice.physicalDevice, gfxDevice.surface,
+                                                       &gfxSwapchain.supportDetails.presentCount, NULL));
+    gfxSwapchain.supportDetails.presentModes =
+        GFX_MALLOC(gfxSwapchain.supportDetails.presentCount * sizeof *gfxSwapchain.supportDetails.presentModes);
+    VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(gfxDevice.physicalDevice, gfxDevice.surface,
+                                                       &gfxSwapchain.supportDetails.presentCount,
+                                                       gfxSwapchain.supportDetails.presentModes));
+}
+
+// Iterate through available formats and return the one that matches what we
+// want. If what we want is not available, the first format in the array is
+// returned.
+static VkSurfaceFormatKHR chooseSurfaceFormat(uint32_t availableFormatsCount,
+                                              const VkSurfaceFormatKHR* availableFormats)
+{
+    for (uint32_t i = 0; i < availableFormatsCount; i++) {
+        if (availableFormats[i].format == VK_FORMAT_B8G8R8A8_UNORM &&
+            availableFormats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+            return availableFormats[i];
+        }
+    }
+    return availableFormats[0];
+}
+
+// Iterate through available present modes and see if a no v-sync mode is
+// available, otherwise go for VK_PRESENT_MODE_FIFO_KHR. If vsync is requested,
+// just go for VK_PRESENT_MODE_FIFO_KHR.
+static VkPresentModeKHR choosePresentMode(uint32_t availablePresentModeCount,
+                                          const VkPresentModeKHR* availablePresentModes, bool vsync)
+{
+    if (vsync) {
+        return VK_PRESENT_MODE_MAILBOX_KHR;
+    }
+
+    for (uint32_t i = 0; i < availablePresentModeCount; i++) {
+        if (availablePresentModes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+            return availablePresentModes[i];
+        }
+    }
+
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// Set the resolution of the swapchain images. Use the size of the framebuffer
+// from the window.
+static VkExtent2D chooseExtent(const VkSurfaceCapabilitiesKHR* capabilities, uint32_t width, uint32_t height)
+{
+    if (capabilities->currentExtent.width != UINT32_MAX) {
+        return capabilities->currentExtent;
+    } else {
+        VkExtent2D actualExtent = {
+            .width = (uint32_t)width,
+            .height = (uint32_t)height,
+        };
+
+        actualExtent.width =
+            GFX_CLAMP(actualExtent.width, capabilities->minImageExtent.width, capabilities->maxImageExtent.width);
+        actualExtent.height =
+            GFX_CLAMP(actualExtent.height, capabilities->minImageExtent.height, capabilities->maxImageExtent.height);
+
+        return actualExtent;
+    }
+}
+
+// Create the offscreen images of a headless swapchain. The format matches
+// the preferred surface format, so that rendering is the same with a window.
+static void createOffscreenImages(uint32_t width, uint32_t height)
+{
+    gfxSwapchain.format = VK_FORMAT_B8G8R8A8_UNORM;
+    gfxSwapchain.extent = (VkExtent2D){.width = GFX_MAX(width, 1), .height = GFX_MAX(height, 1)};
+
+    // The frame timeline keeps an image from being reused while in flight
+    gfxSwapchain.imageCount = gfxSwapchain.framesInFlight;
+    gfxSwapchain.pOffscreenImages = GFX_MALLOC(gfxSwapchain.imageCount * sizeof *gfxSwapchain.pOffscreenImages);
+    gfxSwapchain.images = GFX_MALLOC(gfxSwapchain.imageCount * sizeof *gfxSwapchain.images);
+    gfxSwapchain.imageViews = GFX_MALLOC(gfxSwapchain.imageCount * sizeof *gfxSwapchain.imageViews);
+
+    VkExtent3D extent = {gfxSwapchain.extent.width, gfxSwapchain.extent.height, 1};
+
+    for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
+        GfxImage* pImage = &gfxSwapchain.pOffscreenImages[i];
+
+        gfxCreateImage(extent, 1, 1, VK_SAMPLE_COUNT_1_BIT, gfxSwapchain.format, VK_IMAGE_TILING_OPTIMAL,
+                       VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+                           VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                       0, VK_IMAGE_TYPE_2D, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pImage);
+        gfxCreateImageView(pImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D);
+
+        gfxSwapchain.images[i] = pImage->image;
+        gfxSwapchain.imageViews[i] = pImage->imageView;
+    }
+}
+
+static void createSwapchain()
+{
+    uint32_t width;
+    uint32_t height;
+    gfxSwapchain.framebufferSizeCallback(&width, &height);
+
+    if (gfxSwapchain.headless) {
+        createOffscreenImages(width, height);
+        return;
+    }
+
+    VkSurfaceFormatKHR surfaceFormat =
+        chooseSurfaceFormat(gfxSwapchain.supportDetails.formatCount, gfxSwapchain.supportDetails.formats);
+    VkPresentModeKHR presentMode = choosePresentMode(gfxSwapchain.supportDetails.presentCount,
+                                                     gfxSwapchain.supportDetails.presentModes, gfxDevice.vsync);
+    VkExtent2D extent = chooseExtent(&gfxSwapchain.supportDetails.capabilities, width, height);
+
+    // Using at least minImageCount number of images is required but using one
+    // extra can avoid unnecessary waits on the driver
+    gfxSwapchain.imageCount = gfxSwapchain.supportDetails.capabilities.minImageCount + 1;
+
+    // Also make sure that we are not exceeding the maximum number of images
+    if (gfxSwapchain.supportDetails.capabilities.maxImageCount > 0 &&
+        gfxSwapchain.imageCount > gfxSwapchain.supportDetails.capabilities.maxImageCount) {
+        gfxSwapchain.imageCount = gfxSwapchain.supportDetails.capabilities.maxImageCount;
+    }
+
+    VkSwapchainCreateInfoKHR ci = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .surface = gfxDevice.surface,
+        .minImageCount = gfxSwapchain.imageCount,
+        .imageFormat = surfaceFormat.format,
+        .imageColorSpace = surfaceFormat.colorSpace,
+        .imageExtent = extent,
+        .imageArrayLayers = 1, // Unless rendering stereoscopically
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT |
+                      VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .preTransform = gfxSwapchain.supportDetails.capabilities.currentTransform,
+        .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+        .presentMode = presentMode,
+        .clipped = VK_TRUE,
+        .oldSwapchain = VK_NULL_HANDLE,
+    };
+
+    gfxSwapchain.format = surfaceFormat.format;
+    gfxSwapchain.extent = extent;
+
+    VK_CHECK(vkCreateSwapchainKHR(gfxDevice.device, &ci, NULL, &gfxSwapchain.swapchain));
+
+    VK_CHECK(vkGetSwapchainImagesKHR(gfxDevice.device, gfxSwapchain.swapchain, &gfxSwapchain.imageCount, NULL));
+    gfxSwapchain.images = GFX_MALLOC(gfxSwapchain.imageCount * sizeof *gfxSwapchain.images);
+    gfxSwapchain.imageViews = GFX_MALLOC(gfxSwapchain.imageCount * sizeof *gfxSwapchain.imageViews);
+    VK_CHECK(vkGetSwapchainImagesKHR(gfxDevice.device, gfxSwapchain.swapchain, &gfxSwapchain.imageCount,
+                                     gfxSwapchain.images));
+
+    for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
+        VkImageViewCreateInfo ci = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = gfxSwapchain.images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = gfxSwapchain.format,
+            .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                           .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                           .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                           .a = VK_COMPONENT_SWIZZLE_IDENTITY},
+            .subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                 .baseMipLevel = 0,
+                                 .levelCount = 1,
+                                 .baseArrayLayer = 0,
+                                 .layerCount = 1},
+        };
+
+        VK_CHECK(vkCreateImageView(gfxDevice.device, &ci, NULL, &gfxSwapchain.imageViews[i]));
+    }
+}
+
+static void destroySwapchain()
+{
+    vkDeviceWaitIdle(gfxDevice.device);
+
+    if (gfxSwapchain.headless) {
+        for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
+            gfxDestroyImage(&gfxSwapchain.pOffscreenImages[i]);
+        }
+
+        GFX_FREE(gfxSwapchain.pOffscreenImages);
+        GFX_FREE(gfxSwapchain.images);
+        GFX_FREE(gfxSwapchain.imageViews);
+        return;
+    }
+
+    // Swapchain images are destroyed in vkDestroySwapchainKHR()
+    for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
+        vkDestroyImageView(gfxDevice.device, gfxSwapchain.imageViews[i], NULL);
+    }
+
+    vkDestroySwapchainKHR(gfxDevice.device, gfxSwapchain.swapchain, NULL);
+
+    GFX_FREE(gfxSwapchain.images);
+    GFX_FREE(gfxSwapchain.imageViews);
+}
+
+// Begin recording a command buffer that is handed out to the application
+static void beginCommandBuffer(VkCommandBuffer cmd, const VkCommandBufferBeginInfo* pBeginInfo)
+{
+    VK_CHECK(vkBeginCommandBuffer(cmd, pBeginInfo));
+
+#ifndef NDEBUG
+    // Beginning resets the command buffer, which unbinds descriptor buffers
+    if (gfxDescriptorBufferCmd == cmd) {
+        gfxDescriptorBufferCmd = VK_NULL_HANDLE;
+    }
+#endif
+}
+
+// Hand out the next command buffer of an arena, allocating one if all are in
+// use. Only the thread that owns the arena may call this.
+static VkCommandBuffer allocateFromArena(struct GfxCommandArena* pArena, VkCommandBufferLevel level)
+{
+    if (!pArena->pool) {
+        // Transient, since command buffers only live for one frame
+        VkCommandPoolCreateInfo ci = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = gfxDevice.queueFamilyIndex,
+        };
+
+        VK_CHECK(vkCreateCommandPool(gfxDevice.device, &ci, NULL, &pArena->pool));
+    }
+
+    if (pArena->used == pArena->count) {
+        if (pArena->count == pArena->capacity) {
+            pArena->capacity = GFX_MAX(4, 2 * pArena->capacity);
+            pArena->pCommandBuffers =
+                GFX_REALLOC(pArena->pCommandBuffers, pArena->capacity * sizeof *pArena->pCommandBuffers);
+        }
+
+        VkCommandBufferAllocateInfo ai = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = pArena->pool,
+            .level = level,
+            .commandBufferCount = 1,
+        };
+
+        VK_CHECK(vkAllocateCommandBuffers(gfxDevice.device, &ai, &pArena->pCommandBuffers[pArena->count++]));
+    }
+
+    return pArena->pCommandBuffers[pArena->used++];
+}
+
+// Recycle all command buffers of an arena, once none of them is pending
+static void resetArena(struct GfxCommandArena* pArena)
+{
+    if (pArena->used) {
+        VK_CHECK(vkResetCommandPool(gfxDevice.device, pArena->pool, 0));
+        pArena->used = 0;
+    }
+}
+
+// Destroying the pool frees its command buffers
+static void destroyArena(struct GfxCommandArena* pArena)
+{
+    if (pArena->pool) {
+        vkDestroyCommandPool(gfxDevice.device, pArena->pool, NULL);
+    }
+
+    GFX_FREE(pArena->pCommandBuffers);
+}
+
+static void createSyncObjects()
+{
+    gfxSwapchain.renderFinishedSemaphores =
+        GFX_MALLOC(gfxSwapchain.imageCount * sizeof *gfxSwapchain.renderFinishedSemaphores);
+    gfxSwapchain.inFlightSemaphores = GFX_MALLOC(gfxSwapchain.framesInFlight * sizeof *gfxSwapchain.inFlightSemaphores);
+
+    size_t frameCommandsSize = gfxSwapchain.framesInFlight * sizeof *gfxSwapchain.pFrameCommands;
+    gfxSwapchain.pFrameCommands = GFX_MALLOC(frameCommandsSize);
+    memset(gfxSwapchain.pFrameCommands, 0, frameCommandsSize);
+
+    VkSemaphoreCreateInfo sci = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    };
+
+    for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
+        VK_CHECK(vkCreateSemaphore(gfxDevice.device, &sci, NULL, &gfxSwapchain.renderFinishedSemaphores[i]));
+    }
+
+    for (uint32_t i = 0; i < gfxSwapchain.framesInFlight; i++) {
+        VK_CHECK(vkCreateSemaphore(gfxDevice.device, &sci, NULL, &gfxSwapchain.inFlightSemaphores[i]));
+    }
+}
+
+static void destroySyncObjects()
+{
+    vkDeviceWaitIdle(gfxDevice.device);
+
+    for (uint32_t i = 0; i < gfxSwapchain.framesInFlight; i++) {
+        struct GfxFrameCommands* pFrameCommands = &gfxSwapchain.pFrameCommands[i];
+
+        destroyArena(&pFrameCommands->primary);
+        for (uint32_t j = 0; j < GFX_MAX_RECORDING_THREADS; j++) {
+            destroyArena(&pFrameCommands->secondaries[j]);
+        }
+    }
+    GFX_FREE(gfxSwapchain.pFrameCommands);
+
+    for (uint32_t i = 0; i < gfxSwapchain.imageCount; i++) {
+        vkDestroySemaphore(gfxDevice.device, gfxSwapchain.renderFinishedSemaphores[i], NULL);
+    }
+
+    for (uint32_t i = 0; i < gfxSwapchain.framesInFlight; i++) {
+        vkDestroySemaphore(gfxDevice.device, gfxSwapchain.inFlightSemaphores[i], NULL);
+    }
+
+    GFX_FREE(gfxSwapchain.renderFinishedSemaphores);
+    GFX_FREE(gfxSwapchain.inFlightSemaphores);
+}
+
+// Monotonic time in nanoseconds, for measuring CPU time
+static uint64_t getTimeNs()
+{
+#if GFX_WINDOWS
+    static LARGE_INTEGER frequency;
+    if (!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    // Whole seconds and the remainder are converted separately, which neither
+    // overflows nor loses precision the way a double does as the count grows
+    uint64_t ticks = (uint64_t)counter.QuadPart;
+    uint64_t frequencyHz = (uint64_t)frequency.QuadPart;
+
+    return ticks / frequencyHz * 1000000000ull + ticks % frequencyHz * 1000000000ull / frequencyHz;
+#else
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    // Strict ISO C hides the POSIX clocks, fall back to the C11 wall clock
+    timespec_get(&ts, TIME_UTC);
+#endif
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Add the time since start to a phase of the current frame. Returns the
+// current time, so that consecutive phases can be chained.
+static uint64_t addFramePhase(enum GfxFramePhase phase, uint64_t start)
+{
+    uint64_t now = getTimeNs();
+    gfxSwapchain.frameStats.current.milliseconds[phase] += (double)(now - start) / 1e6;
+
+    return now;
+}
+
+static int compareDoubles(const void* pA, const void* pB)
+{
+    double a = *(const double*)pA;
+    double b = *(const double*)pB;
+
+    return (a > b) - (a < b);
+}
+
+static void createProfiler()
+{
+    struct GfxProfiler* pProfiler = &gfxSwapchain.profiler;
+
+    // Timestamps are masked to the valid bits, no valid bits disables zones
+    uint32_t n;
+    vkGetPhysicalDeviceQueueFamilyProperties(gfxDevice.physicalDevice, &n, NULL);
+    VkQueueFamilyProperties* pProps = GFX_MALLOC(n * sizeof *pProps);
+    vkGetPhysicalDeviceQueueFamilyProperties(gfxDevice.physicalDevice, &n, pProps);
+
+    uint32_t validBits = pProps[gfxDevice.queueFamilyIndex].timestampValidBits;
+    pProfiler->timestampMask = validBits >= 64 ? UINT64_MAX : (1ull << validBits) - 1;
+
+    GFX_FREE(pProps);
+
+    if (!validBits) {
+        GFX_WARNING("Queue does not support timestamps, profiling zones are disabled");
+    }
+
+    pProfiler->pFrames = GFX_MALLOC(gfxSwapchain.framesInFlight * sizeof *pProfiler->pFrames);
+    memset(pProfiler->pFrames, 0, gfxSwapchain.framesInFlight * sizeof *pProfiler->pFrames);
+
+    VkQueryPoolCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = 2 * GFX_PROFILER_MAX_ZONES,
+    };
+
+    for (uint32_t i = 0; i < gfxSwapchain.framesInFlight; i++) {
+        VK_CHECK(vkCreateQueryPool(gfxDevice.device, &ci, NULL, &pProfiler->pFrames[i].queryPool));
+    }
+}
+
+static void destroyProfiler()
+{
+    for (uint32_t i = 0; i < gfxSwapchain.framesInFlight; i++) {
+        vkDestroyQueryPool(gfxDevice.device, gfxSwapchain.profiler.pFrames[i].queryPool, NULL);
+    }
+
+    GFX_FREE(gfxSwapchain.profiler.pFrames);
+}
+
+// Read back the zones of the frame that last used the current frame in
+// flight. That frame has completed, so the results are available.
+static void collectZones()
+{
+    struct GfxProfiler* pProfiler = &gfxSwapchain.profiler;
+    struct GfxProfilerFrame* pFrame = &pProfiler->pFrames[gfxSwapchain.inFlightIndex];
+
+    if (!pFrame->frame || !pFrame->zoneCount) {
+        pFrame->frame = 0;
+        return;
+    }
+
+    uint64_t timestamps[2 * GFX_PROFILER_MAX_ZONES];
+    VkResult result = vkGetQueryPoolResults(gfxDevice.device, pFrame->queryPool, 0, 2 * pFrame->zoneCount,
+                                            sizeof timestamps, timestamps, sizeof *timestamps, VK_QUERY_RESULT_64_BIT);
+
+    if (result == VK_SUCCESS) {
+        // Timestamp period is in nanoseconds per tick
+        double period = gfxDevice.properties.physicalDevice.limits.timestampPeriod;
+
+        for (uint32_t i = 0; i < pFrame->zoneCount; i++) {
+            uint64_t ticks = (timestamps[2 * i + 1] - timestamps[2 * i]) & pProfiler->timestampMask;
+
+            pProfiler->results[i] = (GfxZoneResult){
+                .pName = pFrame->pNames[i],
+                .depth = pFrame->depths[i],
+                .milliseconds = (double)ticks * period / 1e6,
+            };
+        }
+
+        pProfiler->resultCount = pFrame->zoneCount;
+        pProfiler->resultFrame = pFrame->frame;
+    } else if (result != VK_NOT_READY) {
+        VK_CHECK(result);
+    }
+
+    pFrame->frame = 0;
+}
+
+void gfxCreateSwapchain(uint32_t framesInFlight, void (*framebufferSizeCallback)(uint32_t*, uint32_t*))
+{
+    GFX_RESET(&gfxSwapchain);
+
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    if (!framebufferSizeCallback) {
+        GFX_ERROR("Framebuffer size callback function must be specified");
+    }
+
+    gfxSwapchain.framesInFlight = framesInFlight;
+    gfxSwapchain.framebufferSizeCallback = framebufferSizeCallback;
+    gfxSwapchain.frame = 1;
+    gfxSwapchain.headless = !gfxDevice.surface;
+
+    if (gfxSwapchain.headless) {
+        GFX_INFO("No surface, rendering to offscreen images");
+    }
+
+    // Not part of the sync objects, so that frame numbers keep increasing
+    // when the swapchain is recreated
+    VkSemaphoreTypeCreateInfo typeInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+
+    VkSemaphoreCreateInfo sci = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo,
+    };
+
+    VK_CHECK(vkCreateSemaphore(gfxDevice.device, &sci, NULL, &gfxSwapchain.frameTimeline));
+    createProfiler();
+
+    querySupport();
+    createSwapchain();
+    createSyncObjects();
+}
+
+void gfxDestroySwapchain()
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    vkDeviceWaitIdle(gfxDevice.device);
+
+    destroySyncObjects();
+    destroySwapchain();
+
+    vkDestroySemaphore(gfxDevice.device, gfxSwapchain.frameTimeline, NULL);
+    destroyProfiler();
+
+    GFX_FREE(gfxSwapchain.supportDetails.formats);
+    GFX_FREE(gfxSwapchain.supportDetails.presentModes);
+
+    GFX_RESET(&gfxSwapchain);
+}
+
+void gfxSetVsync(bool vsync)
+{
+    if (gfxDevice.vsync == vsync) {
+        return;
+    }
+
+    gfxDevice.vsync = vsync;
+
+    // Present mode is baked into the swapchain, so it has to be rebuilt
+    if (gfxSwapchain.swapchain) {
+        gfxRecreateSwapchain();
+    }
+}
+
+void gfxRecreateSwapchain()
+{
+    uint32_t width, height;
+    gfxSwapchain.framebufferSizeCallback(&width, &height);
+
+    GFX_DEBUG("Recreating swapchain %" PRIu32 "x%" PRIu32, width, height);
+
+    destroySyncObjects();
+    destroySwapchain();
+
+    GFX_FREE(gfxSwapchain.supportDetails.formats);
+    GFX_FREE(gfxSwapchain.supportDetails.presentModes);
+
+    querySupport();
+    createSwapchain();
+    createSyncObjects();
+
+    gfxSwapchain.recreated = true;
+}
+
+void gfxWaitForFrameInFlight()
+{
+    // The first frames have no earlier frame using their resources
+    if (gfxSwapchain.frame <= gfxSwapchain.framesInFlight) {
+        return;
+    }
+
+    uint64_t frame = gfxSwapchain.frame - gfxSwapchain.framesInFlight;
+
+    if (frame <= gfxSwapchain.completedFrame) {
+        return;
+    }
+
+    uint64_t start = getTimeNs();
+
+    VkSemaphoreWaitInfo wi = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &gfxSwapchain.frameTimeline,
+        .pValues = &frame,
+    };
+
+    VK_CHECK(vkWaitSemaphores(gfxDevice.device, &wi, UINT64_MAX));
+
+    gfxSwapchain.completedFrame = frame;
+
+    addFramePhase(GFX_FRAME_PHASE_WAIT, start);
+}
+
+void gfxWaitForFence()
+{
+    gfxWaitForFrameInFlight();
+}
+
+uint64_t gfxGetCurrentFrame()
+{
+    return gfxSwapchain.frame;
+}
+
+uint64_t gfxGetCompletedFrame()
+{
+    VK_CHECK(vkGetSemaphoreCounterValue(gfxDevice.device, gfxSwapchain.frameTimeline, &gfxSwapchain.completedFrame));
+
+    return gfxSwapchain.completedFrame;
+}
+
+VkCommandBuffer gfxAcquireNextImage()
+{
+    // The caller has had a full iteration to react to a recreated swapchain
+    gfxSwapchain.recreated = false;
+
+    // Wait for the current frame to not be in flight
+    gfxWaitForFrameInFlight();
+
+    // Command buffers of the frame that last used this slot have executed,
+    // so their pools can be recycled in one go
+    struct GfxFrameCommands* pFrameCommands = &gfxSwapchain.pFrameCommands[gfxSwapchain.inFlightIndex];
+    resetArena(&pFrameCommands->primary);
+    for (uint32_t i = 0; i < GFX_MAX_RECORDING_THREADS; i++) {
+        resetArena(&pFrameCommands->secondaries[i]);
+    }
+
+    // Resources destroyed during earlier frames may be free to release now
+    releaseDeferred(false);
+    collectZones();
+
+    uint64_t start = getTimeNs();
+
+    VkResult result = VK_SUCCESS;
+
+    if (gfxSwapchain.headless) {
+        // Offscreen images follow the frames in flight. A new framebuffer
+        // size is handled like an out of date swapchain.
+        uint32_t width, height;
+        gfxSwapchain.framebufferSizeCallback(&width, &height);
+
+        if (GFX_MAX(width, 1) != gfxSwapchain.extent.width || GFX_MAX(height, 1) != gfxSwapchain.extent.height) {
+            result = VK_ERROR_OUT_OF_DATE_KHR;
+        }
+
+        gfxSwapchain.imageIndex = gfxSwapchain.inFlightIndex;
+    } else {
+        // Acquire index of next image in the swapchain
+        result = vkAcquireNextImageKHR(gfxDevice.device, gfxSwapchain.swapchain, UINT64_MAX,
+                                       gfxSwapchain.inFlightSemaphores[gfxSwapchain.inFlightIndex], NULL,
+                                       &gfxSwapchain.imageIndex);
+    }
+
+    gfxSwapchain.frameStats.recordStart = addFramePhase(GFX_FRAME_PHASE_ACQUIRE, start);
+
+    // Check if swapchain needs to be reconstructed. No image was acquired and
+    // no semaphore was signaled, so this frame cannot be rendered.
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        gfxRecreateSwapchain();
+        return VK_NULL_HANDLE;
+    } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+        GFX_ERROR("Failed to acquire next swapchain image");
+    }
+
+    VkCommandBufferBeginInfo bi = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    VkCommandBuffer cmd = allocateFromArena(&pFrameCommands->primary, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+    beginCommandBuffer(cmd, &bi);
+
+    // Start over with the zones of this frame
+    struct GfxProfilerFrame* pFrame = &gfxSwapchain.profiler.pFrames[gfxSwapchain.inFlightIndex];
+    vkCmdResetQueryPool(cmd, pFrame->queryPool, 0, 2 * GFX_PROFILER_MAX_ZONES);
+    pFrame->zoneCount = 0;
+    pFrame->openCount = 0;
+    pFrame->ignoredCount = 0;
+    pFrame->frame = gfxSwapchain.frame;
+
+    return cmd;
+}
+
+const GfxFrameTimings* gfxGetFrameTimings(uint32_t framesAgo)
+{
+    // The current frame number has not been presented yet
+    if (framesAgo >= GFX_FRAME_STATS_COUNT || framesAgo + 1 >= gfxSwapchain.frame) {
+        return NULL;
+    }
+
+    uint64_t frame = gfxSwapchain.frame - 1 - framesAgo;
+
+    return &gfxSwapchain.frameStats.timings[frame % GFX_FRAME_STATS_COUNT];
+}
+
+uint32_t gfxGetFramePhaseStats(GfxFramePhaseStats* pStats)
+{
+    uint32_t n = (uint32_t)GFX_MIN(gfxSwapchain.frame - 1, GFX_FRAME_STATS_COUNT);
+
+    for (uint32_t phase = 0; phase < GFX_FRAME_PHASE_COUNT; phase++) {
+        pStats[phase] = (GfxFramePhaseStats){0};
+
+        if (!n) {
+            continue;
+        }
+
+        // Only sorted on request, recording a frame just stores its timings
+        double values[GFX_FRAME_STATS_COUNT];
+        double sum = 0.0;
+        for (uint32_t i = 0; i < n; i++) {
+            values[i] = gfxGetFrameTimings(i)->milliseconds[phase];
+            sum += values[i];
+        }
+
+        qsort(values, n, sizeof *values, compareDoubles);
+
+        pStats[phase].min = values[0];
+        pStats[phase].avg = sum / n;
+        pStats[phase].p99 = values[(uint32_t)ceil(0.99 * n) - 1];
+    }
+
+    return n;
+}
+
+void gfxCmdBeginZone(VkCommandBuffer cmd, const char* pName)
+{
+    struct GfxProfilerFrame* pFrame = &gfxSwapchain.profiler.pFrames[gfxSwapchain.inFlightIndex];
+
+    if (!gfxSwapchain.profiler.timestampMask) {
+        return;
+    }
+
+    if (pFrame->zoneCount == GFX_PROFILER_MAX_ZONES || pFrame->openCount == GFX_PROFILER_MAX_DEPTH) {
+        // The same zones are likely ignored every frame, so only warn once
+        if (!gfxSwapchain.profiler.ignoredTotal++) {
+            GFX_WARNING("Too many profiling zones, ignoring zone %s and any further ones", pName);
+        }
+        pFrame->ignoredCount++;
+        return;
+    }
+
+    uint32_t zone = pFrame->zoneCount++;
+    pFrame->pNames[zone] = pName;
+    pFrame->depths[zone] = pFrame->openCount;
+    pFrame->openZones[pFrame->openCount++] = zone;
+
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, pFrame->queryPool, 2 * zone);
+}
+
+void gfxCmdEndZone(VkCommandBuffer cmd)
+{
+    struct GfxProfilerFrame* pFrame = &gfxSwapchain.profiler.pFrames[gfxSwapchain.inFlightIndex];
+
+    if (!gfxSwapchain.profiler.timestampMask) {
+        return;
+    }
+
+    // Zones can only be ignored while nested in the open ones, so they end first
+    if (pFrame->ignoredCount) {
+        pFrame->ignoredCount--;
+        return;
+    }
+
+    if (!pFrame->openCount) {
+        GFX_WARNING("Profiling zone ended without being begun");
+        return;
+    }
+
+    uint32_t zone = pFrame->openZones[--pFrame->openCount];
+
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, pFrame->queryPool, 2 * zone + 1);
+}
+
+uint32_t gfxGetZoneResults(const GfxZoneResult** ppResults, uint64_t* pFrame)
+{
+    *ppResults = gfxSwapchain.profiler.results;
+
+    if (pFrame) {
+        *pFrame = gfxSwapchain.profiler.resultFrame;
+    }
+
+    return gfxSwapchain.profiler.resultCount;
+}
+
+void gfxPresent(VkCommandBuffer cmd, GfxImage* pImage)
+{
+    // Every zone needs both timestamps to be read back
+    struct GfxProfilerFrame* pFrame = &gfxSwapchain.profiler.pFrames[gfxSwapchain.inFlightIndex];
+    if (pFrame->openCount) {
+        GFX_WARNING("%" PRIu32 " profiling zones were not ended", pFrame->openCount);
+        while (pFrame->openCount) {
+            gfxCmdEndZone(cmd);
+        }
+    }
+
+    // Transition swapchain image for blitting. The image comes from the
+    // presentation engine, so the acquire semaphore provides the source
+    // dependency. An offscreen image was last written by an earlier blit and
+    // read back by copies on the same queue.
+    VkPipelineStageFlags2 srcStage =
+        gfxSwapchain.headless ? VK_PIPELINE_STAGE_2_TRANSFER_BIT : VK_PIPELINE_STAGE_2_NONE;
+    gfxImageBarrier(cmd, srcStage, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                    VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    gfxSwapchain.images[gfxSwapchain.imageIndex], NULL);
+
+    // Blit image to current swapchain image
+    VkImageSubresourceLayers subresourceLayers = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .mipLevel = 0,
+        .baseArrayLayer = 0,
+        .layerCount = 1,
+    };
+    int32_t srcWidth = pImage->width;
+    int32_t srcHeight = pImage->height;
+    int32_t dstWidth = (int32_t)(gfxSwapchain.extent.width);
+    int32_t dstHeight = (int32_t)(gfxSwapchain.extent.height);
+    VkImageBlit2 region = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2,
+        .srcSubresource = subresourceLayers,
+        .srcOffsets = {{0, 0, 0}, {srcWidth, srcHeight, 1}},
+        .dstSubresource = subresourceLayers,
+        .dstOffsets = {{0, 0, 0}, {dstWidth, dstHeight, 1}},
+    };
+
+    VkBlitImageInfo2 blitImageInfo = {
+        .sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2,
+        .srcImage = pImage->image,
+        .srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .dstImage = gfxSwapchain.images[gfxSwapchain.imageIndex],
+        .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .regionCount = 1,
+        .pRegions = &region,
+        .filter = VK_FILTER_NEAREST,
+    };
+
+    vkCmdBlitImage2(cmd, &blitImageInfo);
+
+    // Transition swapchain image for presenting. Offscreen images are left
+    // ready to be copied from instead, for reading back frames.
+    VkImageLayout finalLayout =
+        gfxSwapchain.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    finalLayout, gfxSwapchain.images[gfxSwapchain.imageIndex], NULL);
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    uint64_t start = addFramePhase(GFX_FRAME_PHASE_RECORD, gfxSwapchain.frameStats.recordStart);
+
+    gfxFlushUploads();
+
+    // The first use of the acquired image is the blit above, so the acquire
+    // semaphore has to be waited on before the transfer stage
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    // Besides the binary semaphore for presenting, signal the frame number
+    VkSemaphore signalSemaphores[] = {
+        gfxSwapchain.renderFinishedSemaphores[gfxSwapchain.imageIndex],
+        gfxSwapchain.frameTimeline,
+    };
+    uint64_t signalValues[] = {0, gfxSwapchain.frame};
+
+    VkSubmitInfo si = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &gfxSwapchain.inFlightSemaphores[gfxSwapchain.inFlightIndex],
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd,
+        .signalSemaphoreCount = GFX_ARRAY_LEN(signalSemaphores),
+        .pSignalSemaphores = signalSemaphores,
+    };
+
+    // Nothing was acquired from or will be presented to a surface, so only
+    // the frame number is signaled
+    if (gfxSwapchain.headless) {
+        si.waitSemaphoreCount = 0;
+        si.signalSemaphoreCount = 1;
+        si.pSignalSemaphores = &gfxSwapchain.frameTimeline;
+        signalValues[0] = gfxSwapchain.frame;
+    }
+
+    submitWithTicket(&si, signalValues);
+
+    start = addFramePhase(GFX_FRAME_PHASE_SUBMIT, start);
+
+    VkResult result = VK_SUCCESS;
+
+    if (!gfxSwapchain.headless) {
+        VkPresentInfoKHR pi = {
+            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &gfxSwapchain.renderFinishedSemaphores[gfxSwapchain.imageIndex],
+            .swapchainCount = 1,
+            .pSwapchains = &gfxSwapchain.swapchain,
+            .pImageIndices = &gfxSwapchain.imageIndex,
+        };
+
+        result = vkQueuePresentKHR(gfxDevice.queue, &pi);
+    }
+
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        gfxRecreateSwapchain();
+    } else if (result != VK_SUCCESS) {
+        GFX_ERROR("Failed to present swapchain image");
+    }
+
+    addFramePhase(GFX_FRAME_PHASE_PRESENT, start);
+
+    // Store the timings of the frame and start over with the next one
+    struct GfxFrameStats* pStats = &gfxSwapchain.frameStats;
+    pStats->current.frame = gfxSwapchain.frame;
+    pStats->timings[gfxSwapchain.frame % GFX_FRAME_STATS_COUNT] = pStats->current;
+    pStats->current = (GfxFrameTimings){0};
+
+    gfxSwapchain.inFlightIndex = (gfxSwapchain.inFlightIndex + 1) % gfxSwapchain.framesInFlight;
+    gfxSwapchain.frame++;
+}
+
+VkCommandBuffer gfxCmdBegin()
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    struct GfxTimeline* pTimeline = &gfxDevice.timeline;
+
+    // Refresh the completed ticket once, rather than for every command buffer
+    VK_CHECK(vkGetSemaphoreCounterValue(gfxDevice.device, pTimeline->semaphore, &pTimeline->completed));
+
+    struct GfxImmediateCommandBuffer* pEntry = NULL;
+    for (uint32_t i = 0; i < pTimeline->commandBufferCount; i++) {
+        if (pTimeline->pCommandBuffers[i].ticket <= pTimeline->completed) {
+            pEntry = &pTimeline->pCommandBuffers[i];
+            break;
+        }
+    }
+
+    if (!pEntry) {
+        if (pTimeline->commandBufferCount == pTimeline->commandBufferCapacity) {
+            pTimeline->commandBufferCapacity = GFX_MAX(8, 2 * pTimeline->commandBufferCapacity);
+            pTimeline->pCommandBuffers = GFX_REALLOC(
+                pTimeline->pCommandBuffers, pTimeline->commandBufferCapacity * sizeof *pTimeline->pCommandBuffers);
+        }
+
+        pEntry = &pTimeline->pCommandBuffers[pTimeline->commandBufferCount++];
+
+        VkCommandBufferAllocateInfo ai = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = gfxDevice.commandPool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+
+        VK_CHECK(vkAllocateCommandBuffers(gfxDevice.device, &ai, &pEntry->cmd));
+    }
+
+    // Never complete until submitted, so the entry is not handed out twice
+    pEntry->ticket = UINT64_MAX;
+
+    // Beginning implicitly resets the command buffer
+    VkCommandBufferBeginInfo bi = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+
+    beginCommandBuffer(pEntry->cmd, &bi);
+
+    return pEntry->cmd;
+}
+
+GfxTicket gfxCmdSubmitAsync(VkCommandBuffer cmd)
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    struct GfxTimeline* pTimeline = &gfxDevice.timeline;
+
+    struct GfxImmediateCommandBuffer* pEntry = NULL;
+    for (uint32_t i = 0; i < pTimeline->commandBufferCount; i++) {
+        if (pTimeline->pCommandBuffers[i].cmd == cmd) {
+            pEntry = &pTimeline->pCommandBuffers[i];
+            break;
+        }
+    }
+
+    if (!pEntry) {
+        GFX_ERROR("Command buffer was not created with gfxCmdBegin()");
+    }
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    // Pending uploads have to be submitted before work that may read them
+    gfxFlushUploads();
+
+    VkSubmitInfo si = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd,
+    };
+
+    pEntry->ticket = submitWithTicket(&si, NULL);
+
+    return pEntry->ticket;
+}
+
+void gfxCmdEnd(VkCommandBuffer cmd)
+{
+    gfxWaitTicket(gfxCmdSubmitAsync(cmd));
+}
+
+bool gfxIsTicketComplete(GfxTicket ticket)
+{
+    struct GfxTimeline* pTimeline = &gfxDevice.timeline;
+
+    if (ticket <= pTimeline->completed) {
+        return true;
+    }
+
+    VK_CHECK(vkGetSemaphoreCounterValue(gfxDevice.device, pTimeline->semaphore, &pTimeline->completed));
+
+    return ticket <= pTimeline->completed;
+}
+
+void gfxWaitTicket(GfxTicket ticket)
+{
+    if (gfxIsTicketComplete(ticket)) {
+        return;
+    }
+
+    // Uploads on the transfer queue complete with the next submission, which
+    // may not have happened yet
+    if (ticket == gfxDevice.timeline.submitted + 1 && gfxDevice.staging.acquireCount) {
+        VkSubmitInfo si = {.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO};
+        submitWithTicket(&si, NULL);
+    }
+
+    if (ticket > gfxDevice.timeline.submitted) {
+        GFX_ERROR("Waiting for a ticket that has not been submitted");
+    }
+
+    VkSemaphoreWaitInfo wi = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &gfxDevice.timeline.semaphore,
+        .pValues = &ticket,
+    };
+
+    VK_CHECK(vkWaitSemaphores(gfxDevice.device, &wi, UINT64_MAX));
+
+    gfxDevice.timeline.completed = ticket;
+}
+
+void gfxCreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, GfxBuffer* pBuffer)
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    *pBuffer = (GfxBuffer){
+        .usage = usage,
         .properties = properties,
         .pHostMap = NULL,
+        .bindlessIndex = GFX_BINDLESS_NONE,
+        .createTicket = gfxDevice.timeline.submitted,
+    };
+
+    // Uploads write buffers on the transfer queue, also after the graphics
+    // queue has used them. Sharing them avoids ownership transfers, which
+    // would otherwise be needed in both directions for partial updates.
+    const uint32_t queueFamilyIndices[] = {gfxDevice.queueFamilyIndex, gfxDevice.transferQueueFamilyIndex};
+
+    VkBufferCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = hasTransferQueue() ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = hasTransferQueue() ? 2 : 0,
+        .pQueueFamilyIndices = queueFamilyIndices,
+    };
+
+    VK_CHECK(vkCreateBuffer(gfxDevice.device, &ci, NULL, &pBuffer->buffer));
+
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(gfxDevice.device, pBuffer->buffer, &memReqs);
+
+    pBuffer->size = memReqs.size;
+
+    enum GfxMemoryKind kind = GFX_MEMORY_KIND_LINEAR;
+    if (pBuffer->usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+        kind = GFX_MEMORY_KIND_LINEAR_DEVICE_ADDRESS;
+    }
+
+    allocateMemory(&memReqs, properties, kind, &pBuffer->allocation);
+
+    VK_CHECK(vkBindBufferMemory(gfxDevice.device, pBuffer->buffer, pBuffer->allocation.memory,
+                                pBuffer->allocation.offset));
+
+    // Point into the mapped memory block if memory is host coherent
+    if (pBuffer->properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        pBuffer->pHostMap = getHostMap(&pBuffer->allocation);
+    }
+
+    // A descriptor can't cover more than maxStorageBufferRange, so larger
+    // buffers are left out of the heap rather than exposed in part
+    if ((usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) &&
+        size <= gfxDevice.properties.physicalDevice.limits.maxStorageBufferRange) {
+        pBuffer->bindlessIndex = allocateBindlessIndex(&gfxDevice.bindless.buffers);
+
+        if (pBuffer->bindlessIndex != GFX_BINDLESS_NONE) {
+            VkDescriptorBufferInfo bufferInfo = {.buffer = pBuffer->buffer, .offset = 0, .range = VK_WHOLE_SIZE};
+            writeBindlessDescriptor(GFX_BINDLESS_BUFFERS, pBuffer->bindlessIndex, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                    NULL, &bufferInfo);
+        }
+    }
+}
+
+void gfxDestroyBuffer(GfxBuffer* pBuffer)
+{
+    // Submitted work may still index the descriptor
+    if (pBuffer->bindlessIndex != GFX_BINDLESS_NONE) {
+        deferDestroy(
+            (GfxDeferredDestroy){.type = GFX_DEFERRED_BINDLESS_BUFFER, .bindlessIndex = pBuffer->bindlessIndex});
+    }
+    deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_BUFFER, .buffer = pBuffer->buffer});
+    deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_MEMORY, .allocation = pBuffer->allocation});
+
+    GFX_RESET(pBuffer);
+}
+
+void gfxCopyBufferFromHost(const GfxBuffer* pBuffer, const void* pData, VkDeviceSize size, VkDeviceSize offset)
+{
+    // Transfer directly if the memory is mapped
+    if (pBuffer->properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        char* pOffsettedHostMap = (char*)pBuffer->pHostMap + offset;
+        memcpy(pOffsettedHostMap, pData, size);
+        return;
+    }
+
+    // Split large copies, so that a single chunk never needs the whole ring
+    VkDeviceSize chunkSize = gfxDevice.staging.size / 2;
+
+    for (VkDeviceSize copied = 0; copied < size; copied += chunkSize) {
+        VkDeviceSize n = GFX_MIN(chunkSize, size - copied);
+
+        VkDeviceSize stagingOffset = allocateStaging(n);
+        memcpy(gfxDevice.staging.pHostMap + stagingOffset, (const char*)pData + copied, n);
+
+        // Work submitted since the buffer was created may still read it, so
+        // the batch must not overwrite it before that work has completed
+        if (gfxDevice.timeline.submitted > pBuffer->createTicket) {
+            gfxDevice.staging.hazardTicket = GFX_MAX(gfxDevice.staging.hazardTicket, gfxDevice.timeline.submitted);
+        }
+
+        VkBufferCopy region = {
+            .srcOffset = stagingOffset,
+            .dstOffset = offset + copied,
+            .size = n,
+        };
+        vkCmdCopyBuffer(getUploadCommandBuffer(), gfxDevice.staging.buffer, pBuffer->buffer, 1, &region);
+    }
+}
+
+GfxTicket gfxFlushUploads()
+{
+    struct GfxStagingRing* pRing = &gfxDevice.staging;
+
+    // Earlier batches are covered by the last submitted ticket, or by the
+    // next one if their acquire is still pending
+    if (!pRing->recording) {
+        return gfxDevice.timeline.submitted + (pRing->acquireCount ? 1 : 0);
+    }
+
+    uint32_t index = (pRing->firstInFlight + pRing->inFlightCount) % GFX_STAGING_BATCH_COUNT;
+    struct GfxStagingBatch* pBatch = &pRing->batches[index];
+
+    // Make the uploads visible to everything submitted after this batch. With
+    // a dedicated transfer queue the semaphore makes them visible instead, and
+    // the image barriers release ownership, which the graphics queue acquires.
+    VkMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+    };
+
+    VkDependencyInfo dependencyInfo = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .memoryBarrierCount = hasTransferQueue() ? 0 : 1,
+        .pMemoryBarriers = &barrier,
+        .imageMemoryBarrierCount = pRing->imageBarrierCount,
+        .pImageMemoryBarriers = pRing->pImageBarriers,
+    };
+
+    vkCmdPipelineBarrier2(pBatch->cmd, &dependencyInfo);
+
+    VK_CHECK(vkEndCommandBuffer(pBatch->cmd));
+
+    if (!hasTransferQueue()) {
+        VkSubmitInfo si = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &pBatch->cmd,
+        };
+
+        pBatch->ticket = submitWithTicket(&si, NULL);
+    } else {
+        // Only wait for the graphics work that may read a destination. Images
+        // are always new, their previous contents are discarded.
+        VkPipelineStageFlags transferStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        VkTimelineSemaphoreSubmitInfo timelineInfo = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .waitSemaphoreValueCount = pRing->hazardTicket ? 1 : 0,
+            .pWaitSemaphoreValues = &pRing->hazardTicket,
+        };
+
+        VkSubmitInfo transferSi = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &timelineInfo,
+            .waitSemaphoreCount = pRing->hazardTicket ? 1 : 0,
+            .pWaitSemaphores = &gfxDevice.timeline.semaphore,
+            .pWaitDstStageMask = &transferStage,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &pBatch->cmd,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &pBatch->signalSemaphore,
+        };
+
+        VK_CHECK(vkQueueSubmit(gfxDevice.transferQueue, 1, &transferSi, NULL));
+
+        // Acquire barriers repeat the release barriers, but only block the
+        // stages that consume uploads, which the semaphore wait covers
+        pBatch->acquireImages = pRing->imageBarrierCount > 0;
+
+        if (pBatch->acquireImages) {
+            for (uint32_t i = 0; i < pRing->imageBarrierCount; i++) {
+                pRing->pImageBarriers[i].srcStageMask = GFX_UPLOAD_CONSUMER_STAGES;
+                pRing->pImageBarriers[i].srcAccessMask = VK_ACCESS_2_NONE;
+                pRing->pImageBarriers[i].dstStageMask = GFX_UPLOAD_CONSUMER_STAGES;
+            }
+
+            VkCommandBufferBeginInfo bi = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+            };
+
+            VK_CHECK(vkBeginCommandBuffer(pBatch->acquireCmd, &bi));
+            vkCmdPipelineBarrier2(pBatch->acquireCmd, &dependencyInfo);
+            VK_CHECK(vkEndCommandBuffer(pBatch->acquireCmd));
+        }
+
+        // The acquire goes along with the next submission to the graphics
+        // queue, whose ticket then also covers the transfer
+        pBatch->acquirePending = true;
+        pRing->acquireCount++;
+        pBatch->ticket = gfxDevice.timeline.submitted + 1;
+    }
+
+    pBatch->end = pRing->head;
+    pRing->inFlightCount++;
+    pRing->recording = false;
+    pRing->hazardTicket = 0;
+    pRing->imageBarrierCount = 0;
+
+    return pBatch->ticket;
+}
+
+VkWriteDescriptorSet gfxGetBufferDescriptor(const GfxBuffer* pBuffer, uint32_t binding, VkDescriptorType type,
+                                            VkDeviceSize offset, VkDeviceSize range,
+                                            VkDescriptorBufferInfo* pBufferInfo)
+{
+    *pBufferInfo = (VkDescriptorBufferInfo){
+        .buffer = pBuffer->buffer,
+        .offset = offset,
+        .range = range,
+    };
+
+    return (VkWriteDescriptorSet){
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstBinding = binding,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = type,
+        .pBufferInfo = pBufferInfo,
+    };
+}
+
+void gfxCreateImage(VkExtent3D extent, uint32_t arrayLayers, uint32_t mipLevels, VkSampleCountFlagBits samples,
+                    VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageCreateFlags flags,
+                    VkImageType imageType, VkMemoryPropertyFlags properties, GfxImage* pImage)
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    *pImage = (GfxImage){
+        .width = extent.width,
+        .height = extent.height,
+        .depth = extent.depth,
+        .arrayLayers = arrayLayers,
+        .mipLevels = mipLevels,
+        .format = format,
+        .tiling = tiling,
+        .imageType = imageType,
+        .samples = samples,
+    };
+
+    VkImageCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .flags = flags,
+        .imageType = imageType,
+        .format = format,
+        .extent = extent,
+        .mipLevels = mipLevels,
+        .arrayLayers = arrayLayers,
+        .samples = samples,
+        .tiling = tiling,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+
+    VK_CHECK(vkCreateImage(gfxDevice.device, &ci, NULL, &pImage->image));
+
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(gfxDevice.device, pImage->image, &memReqs);
+
+    enum GfxMemoryKind kind = tiling == VK_IMAGE_TILING_OPTIMAL ? GFX_MEMORY_KIND_OPTIMAL : GFX_MEMORY_KIND_LINEAR;
+    allocateMemory(&memReqs, properties, kind, &pImage->allocation);
+
+    VK_CHECK(vkBindImageMemory(gfxDevice.device, pImage->image, pImage->allocation.memory, pImage->allocation.offset));
+}
+
+void gfxDestroyImage(GfxImage* pImage)
+{
+    if (pImage->imageView) {
+        deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_IMAGE_VIEW, .imageView = pImage->imageView});
+    }
+    deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_IMAGE, .image = pImage->image});
+    deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_MEMORY, .allocation = pImage->allocation});
+
+    GFX_RESET(pImage);
+}
+
+void gfxCreateImageView(GfxImage* pImage, VkImageAspectFlags aspectFlags, VkImageViewType viewType)
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    pImage->viewType = viewType;
+
+    VkImageViewCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = pImage->image,
+        .viewType = viewType,
+        .format = pImage->format,
+        .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+                       .g = VK_COMPONENT_SWIZZLE_IDENTITY,
+                       .b = VK_COMPONENT_SWIZZLE_IDENTITY,
+                       .a = VK_COMPONENT_SWIZZLE_IDENTITY},
+        .subresourceRange = {.aspectMask = aspectFlags,
+                             .baseMipLevel = 0,
+                             .levelCount = pImage->mipLevels,
+                             .baseArrayLayer = 0,
+                             .layerCount = pImage->arrayLayers},
+    };
+
+    VK_CHECK(vkCreateImageView(gfxDevice.device, &ci, NULL, &pImage->imageView));
+}
+
+static void generateMipmaps(GfxTexture* pTexture)
+{
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(gfxDevice.physicalDevice, pTexture->image.format, &props);
+
+    if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+        GFX_ERROR("Texture image format does not support linear blitting");
+    }
+
+    VkCommandBuffer cmd = gfxCmdBegin();
+
+    VkImageSubresourceRange subresourceRange = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .levelCount = 1,
+        .baseArrayLayer = 0,
+        .layerCount = pTexture->image.arrayLayers,
+    };
+
+    int32_t mipWidth = pTexture->image.width;
+    int32_t mipHeight = pTexture->image.height;
+    int32_t mipDepth = pTexture->image.depth;
+
+    for (uint32_t i = 1; i < pTexture->image.mipLevels; i++) {
+        subresourceRange.baseMipLevel = i - 1;
+
+        gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_TRANSFER_WRITE_BIT,
+                        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        pTexture->image.image, &subresourceRange);
+
+        VkImageBlit2 region = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2,
+            .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                               .mipLevel = i - 1,
+                               .baseArrayLayer = 0,
+                               .layerCount = pTexture->image.arrayLayers},
+            .srcOffsets = {{0, 0, 0}, {mipWidth, mipHeight, mipDepth}},
+            .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                               .mipLevel = i,
+                               .baseArrayLayer = 0,
+                               .layerCount = pTexture->image.arrayLayers},
+            .dstOffsets = {{0, 0, 0},
+                           {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1,
+                            mipDepth > 1 ? mipDepth / 2 : 1}},
+        };
+
+        VkBlitImageInfo2 blitImageInfo = {
+            .sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2,
+            .srcImage = pTexture->image.image,
+            .srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            .dstImage = pTexture->image.image,
+            .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .regionCount = 1,
+            .pRegions = &region,
+            .filter = VK_FILTER_LINEAR,
+        };
+
+        vkCmdBlitImage2(cmd, &blitImageInfo);
+
+        gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT,
+                        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        pTexture->image.image, &subresourceRange);
+
+        if (mipWidth > 1) {
+            mipWidth /= 2;
+        }
+        if (mipHeight > 1) {
+            mipHeight /= 2;
+        }
+        if (mipDepth > 1) {
+            mipDepth /= 2;
+        }
+    }
+
+    subresourceRange.baseMipLevel = pTexture->image.mipLevels - 1;
+
+    gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                    VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                    pTexture->image.image, &subresourceRange);
+
+    // Later graphics work is ordered after this, so there is no need to wait
+    gfxCmdSubmitAsync(cmd);
+}
+
+static void createTexture(GfxTexture* pTexture, enum GfxTextureType type, VkFormat format, const void* pData,
+                          VkExtent3D extent, uint32_t channels, bool mipmaps)
+{
+    VkImageType imageType;
+    VkImageViewType viewType;
+    VkImageCreateFlags flags = 0;
+    uint32_t arrayLayers = 1;
+
+    switch (type) {
+    case GFX_TEXTURE_1D:
+        imageType = VK_IMAGE_TYPE_1D;
+        viewType = VK_IMAGE_VIEW_TYPE_1D;
+        break;
+    case GFX_TEXTURE_2D:
+        imageType = VK_IMAGE_TYPE_2D;
+        viewType = VK_IMAGE_VIEW_TYPE_2D;
+        break;
+    case GFX_TEXTURE_3D:
+        imageType = VK_IMAGE_TYPE_3D;
+        viewType = VK_IMAGE_VIEW_TYPE_3D;
+        break;
+    case GFX_TEXTURE_CUBE_MAP:
+        // A cube map is six 2D layers, with pData holding the faces in the
+        // order +X, -X, +Y, -Y, +Z, -Z
+        imageType = VK_IMAGE_TYPE_2D;
+        viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+        flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+        arrayLayers = 6;
+        break;
+    default:
+        GFX_ERROR("Unknown texture type");
+        return;
+    }
+
+    if (imageType != VK_IMAGE_TYPE_3D && extent.depth != 1) {
+        GFX_ERROR("Only 3D textures can have a depth other than 1");
+    }
+    if (imageType == VK_IMAGE_TYPE_1D && extent.height != 1) {
+        GFX_ERROR("1D textures must have a height of 1");
+    }
+
+    uint32_t mipLevels = 1;
+    if (mipmaps) {
+        uint32_t largest = GFX_MAX(extent.width, extent.height);
+        if (imageType == VK_IMAGE_TYPE_3D) {
+            largest = GFX_MAX(largest, extent.depth);
+        }
+        mipLevels = (uint32_t)floor(log2(largest)) + 1;
+    }
+
+    gfxCreateImage(extent, arrayLayers, mipLevels, VK_SAMPLE_COUNT_1_BIT, format, VK_IMAGE_TILING_OPTIMAL,
+                   VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                   flags, imageType, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pTexture->image);
+
+    if (pData) {
+        // Widen before multiplying, so large textures do not overflow. Note
+        // that this assumes one byte per channel.
+        VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * extent.depth * arrayLayers * channels;
+
+        // Mipmaps are generated from a base level still in TRANSFER_DST
+        VkImageLayout layout =
+            mipmaps ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        // Go through the staging ring, so that the copy can run on the
+        // transfer queue without waiting. Textures too large for the ring use
+        // a temporary staging buffer on the graphics queue instead.
+        if (!uploadImage(&pTexture->image, pData, size, layout)) {
+            GfxBuffer staging;
+            gfxCreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging);
+
+            gfxCopyBufferFromHost(&staging, pData, size, 0);
+
+            VkCommandBuffer cmd = gfxCmdBegin();
+
+            gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                            VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, pTexture->image.image, NULL);
+
+            VkBufferImageCopy region = {
+                .bufferOffset = 0,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                     .mipLevel = 0,
+                                     .baseArrayLayer = 0,
+                                     .layerCount = arrayLayers},
+                .imageOffset = {0, 0, 0},
+                .imageExtent = extent,
+            };
+
+            vkCmdCopyBufferToImage(cmd, staging.buffer, pTexture->image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   1, &region);
+
+            if (!mipmaps) {
+                gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                                VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout, pTexture->image.image, NULL);
+            }
+
+            // The staging buffer is only released once the copy has completed
+            gfxCmdSubmitAsync(cmd);
+
+            gfxDestroyBuffer(&staging);
+        }
+
+        // Recorded on the graphics queue, gfxCmdEnd() flushes the upload first
+        if (mipmaps) {
+            generateMipmaps(pTexture);
+        }
+    }
+
+    gfxCreateImageView(&pTexture->image, VK_IMAGE_ASPECT_COLOR_BIT, viewType);
+
+    pTexture->imageInfo = (VkDescriptorImageInfo){
+        .sampler = NULL,
+        .imageView = pTexture->image.imageView,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+}
+
+// Get the cached sampler for a key, creating it on first use. Its place in
+// the cache is also its index in the bindless sampler array.
+static VkSampler getSampler(const GfxSamplerKey* pKey, uint32_t* pIndex)
+{
+    struct GfxSamplerCache* pCache = &gfxDevice.samplerCache;
+
+    for (uint32_t i = 0; i < pCache->count; i++) {
+        if (!memcmp(&pCache->pEntries[i].key, pKey, sizeof *pKey)) {
+            *pIndex = (gfxDevice.bindless.set && i < gfxDevice.bindless.samplerCount) ? i : GFX_BINDLESS_NONE;
+            return pCache->pEntries[i].sampler;
+        }
+    }
+
+    // The LOD is not clamped by the sampler, so that textures with any number
+    // of mip levels can share it. The image view limits the levels instead.
+    VkSamplerCreateInfo ci = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = pKey->magFilter,
+        .minFilter = pKey->minFilter,
+        .addressModeU = pKey->addressModeU,
+        .addressModeV = pKey->addressModeV,
+        .addressModeW = pKey->addressModeW,
+        .anisotropyEnable = gfxDevice.samplerAnisotropy,
+        .maxAnisotropy =
+            gfxDevice.samplerAnisotropy ? gfxDevice.properties.physicalDevice.limits.maxSamplerAnisotropy : 1.0f,
+        .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+        .unnormalizedCoordinates = VK_FALSE,
+        .compareEnable = VK_FALSE,
+        .compareOp = VK_COMPARE_OP_ALWAYS,
+        .mipmapMode = pKey->mipmapMode,
+        .minLod = 0.0f,
+        .maxLod = VK_LOD_CLAMP_NONE,
+        .mipLodBias = 0.0f,
+    };
+
+    if (pCache->count == pCache->capacity) {
+        pCache->capacity = GFX_MAX(16, 2 * pCache->capacity);
+        pCache->pEntries = GFX_REALLOC(pCache->pEntries, pCache->capacity * sizeof *pCache->pEntries);
+    }
+
+    struct GfxCachedSampler* pEntry = &pCache->pEntries[pCache->count++];
+    pEntry->key = *pKey;
+    VK_CHECK(vkCreateSampler(gfxDevice.device, &ci, NULL, &pEntry->sampler));
+
+    GFX_DEBUG("Created sampler %" PRIu32 " for the sampler cache", pCache->count);
+
+    *pIndex = GFX_BINDLESS_NONE;
+    if (gfxDevice.bindless.set && pCache->count <= gfxDevice.bindless.samplerCount) {
+        *pIndex = pCache->count - 1;
+
+        VkDescriptorImageInfo imageInfo = {.sampler = pEntry->sampler};
+        writeBindlessDescriptor(GFX_BINDLESS_SAMPLERS, *pIndex, VK_DESCRIPTOR_TYPE_SAMPLER, &imageInfo, NULL);
+    }
+
+    return pEntry->sampler;
+}
+
+static void createSampler(GfxTexture* pTexture)
+{
+    if (!pTexture->sampler) {
+        /* First time, use defaults */
+        pTexture->magFilter = VK_FILTER_LINEAR;
+        pTexture->minFilter = VK_FILTER_LINEAR;
+        pTexture->addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        pTexture->addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        pTexture->addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        pTexture->mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    }
+
+    // Zero the whole key, so that it compares equal byte for byte
+    GfxSamplerKey key;
+    memset(&key, 0, sizeof key);
+    key.magFilter = pTexture->magFilter;
+    key.minFilter = pTexture->minFilter;
+    key.mipmapMode = pTexture->mipmapMode;
+    key.addressModeU = pTexture->addressModeU;
+    key.addressModeV = pTexture->addressModeV;
+    key.addressModeW = pTexture->addressModeW;
+
+    pTexture->sampler = getSampler(&key, &pTexture->bindlessSamplerIndex);
+    pTexture->imageInfo.sampler = pTexture->sampler;
+}
+
+// Write the image view of a new texture to the bindless heap
+static void registerBindlessTexture(GfxTexture* pTexture)
+{
+    pTexture->bindlessImageIndex = allocateBindlessIndex(&gfxDevice.bindless.images);
+
+    if (pTexture->bindlessImageIndex != GFX_BINDLESS_NONE) {
+        writeBindlessDescriptor(GFX_BINDLESS_IMAGES, pTexture->bindlessImageIndex, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+                                &pTexture->imageInfo, NULL);
+    }
+}
+
+void gfxCreateTexture(enum GfxTextureType type, VkFormat format, const void* pData, VkExtent3D extent,
+                      uint32_t channels, bool generateMipmaps, GfxTexture* pTexture)
+{
+    GFX_RESET(pTexture);
+    pTexture->bindlessImageIndex = GFX_BINDLESS_NONE;
+    pTexture->bindlessSamplerIndex = GFX_BINDLESS_NONE;
+
+    createTexture(pTexture, type, format, pData, extent, channels, generateMipmaps);
+    createSampler(pTexture);
+    registerBindlessTexture(pTexture);
+}
+
+#ifdef GFX_USE_STB_IMAGE
+void gfxCreateTextureFromFile(enum GfxTextureType type, VkFormat format, const char* pPath, bool generateMipmaps,
+                              GfxTexture* pTexture)
+{
+    GFX_RESET(pTexture);
+    pTexture->bindlessImageIndex = GFX_BINDLESS_NONE;
+    pTexture->bindlessSamplerIndex = GFX_BINDLESS_NONE;
+
+    if (type != GFX_TEXTURE_2D) {
+        GFX_ERROR("Only GFX_TEXTURE_2D can be loaded from a single image file");
+        return;
+    }
+
+    GFX_INFO("Loading texture from %s", pPath);
+
+    stbi_set_flip_vertically_on_load(1);
+
+    int width, height, channels;
+
+    stbi_uc* pData = stbi_load(pPath, &width, &height, &channels, STBI_rgb_alpha);
+    channels = STBI_rgb_alpha;
+
+    if (!pData) {
+        GFX_ERROR("Failed to load texture.");
+        return;
+    }
+
+    VkExtent3D extent = {.width = (uint32_t)width, .height = (uint32_t)height, .depth = 1};
+    createTexture(pTexture, type, format, pData, extent, channels, generateMipmaps);
+
+    stbi_image_free(pData);
+
+    createSampler(pTexture);
+    registerBindlessTexture(pTexture);
+}
+#endif
+
+void gfxDestroyTexture(GfxTexture* pTexture)
+{
+    if (pTexture->bindlessImageIndex != GFX_BINDLESS_NONE) {
+        deferDestroy(
+            (GfxDeferredDestroy){.type = GFX_DEFERRED_BINDLESS_IMAGE, .bindlessIndex = pTexture->bindlessImageIndex});
+    }
+
+    // The sampler belongs to the sampler cache
+    gfxDestroyImage(&pTexture->image);
+
+    GFX_RESET(pTexture);
+}
+
+VkWriteDescriptorSet gfxGetTextureDescriptor(const GfxTexture* pTexture, uint32_t binding, VkDescriptorType type)
+{
+    return (VkWriteDescriptorSet){
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstBinding = binding,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = type,
+        .pImageInfo = &pTexture->imageInfo,
+    };
+}
+
+void gfxSetTextureMagFilter(GfxTexture* pTexture, VkFilter magFilter)
+{
+    pTexture->magFilter = magFilter;
+    createSampler(pTexture);
+}
+
+void gfxSetTextureMinFilter(GfxTexture* pTexture, VkFilter minFilter)
+{
+    pTexture->minFilter = minFilter;
+    createSampler(pTexture);
+}
+
+void gfxSetTextureMipmapMode(GfxTexture* pTexture, VkSamplerMipmapMode mipmapMode)
+{
+    pTexture->mipmapMode = mipmapMode;
+    createSampler(pTexture);
+}
+
+void gfxSetTextureAddressMode(GfxTexture* pTexture, VkSamplerAddressMode modeU, VkSamplerAddressMode modeV,
+                              VkSamplerAddressMode modeW)
+{
+    pTexture->addressModeU = modeU;
+    pTexture->addressModeV = modeV;
+    pTexture->addressModeW = modeW;
+    createSampler(pTexture);
+}
+
+static void createAttachmentSet(GfxAttachment* pAttachmentSet, uint32_t colorAttachmentCount,
+                                GfxImage* pColorAttachments, GfxImage* pDepthAttachment, GfxImage* pResolveAttachment)
+{
+    *pAttachmentSet = (GfxAttachment){
+        .pRenderingAttachmentInfos = GFX_MALLOC(colorAttachmentCount * sizeof(VkRenderingAttachmentInfo)),
+        .pFormats = GFX_MALLOC(colorAttachmentCount * sizeof(VkFormat)),
+        .pColorAttachments = pColorAttachments,
+        .colorAttachmentCount = colorAttachmentCount,
+        .pDepthAttachment = pDepthAttachment,
+        .pResolveAttachment = pResolveAttachment,
+    };
+
+    for (uint32_t i = 0; i < colorAttachmentCount; i++) {
+        pAttachmentSet->pRenderingAttachmentInfos[i] = (VkRenderingAttachmentInfo){
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = pAttachmentSet->pColorAttachments[i].imageView,
+            .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .resolveMode = pAttachmentSet->pResolveAttachment ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
+            .resolveImageView =
+                pAttachmentSet->pResolveAttachment ? pAttachmentSet->pResolveAttachment->imageView : NULL,
+            .resolveImageLayout = pAttachmentSet->pResolveAttachment ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                                                                     : VK_IMAGE_LAYOUT_UNDEFINED,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        };
+        pAttachmentSet->pFormats[i] = pAttachmentSet->pColorAttachments[i].format;
+    }
+
+    pAttachmentSet->pipelineRenderingCreateInfo = (VkPipelineRenderingCreateInfo){
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+        .colorAttachmentCount = colorAttachmentCount,
+        .pColorAttachmentFormats = pAttachmentSet->pFormats,
+        .depthAttachmentFormat = pDepthAttachment ? pDepthAttachment->format : VK_FORMAT_UNDEFINED,
+    };
+}
+
+void gfxCreateAttachment(uint32_t colorAttachmentCount, GfxImage* pColorAttachments, GfxImage* pDepthAttachment,
+                         GfxImage* pResolveAttachment, GfxAttachment* pAttachmentSet)
+{
+    createAttachmentSet(pAttachmentSet, colorAttachmentCount, pColorAttachments, pDepthAttachment, pResolveAttachment);
+}
+
+void gfxDestroyAttachment(GfxAttachment* pAttachmentSet)
+{
+    GFX_FREE(pAttachmentSet->pRenderingAttachmentInfos);
+    GFX_FREE(pAttachmentSet->pFormats);
+
+    GFX_RESET(pAttachmentSet);
+}
+
+void gfxRecreateAttachment(GfxAttachment* pAttachmentSet, uint32_t colorAttachmentCount, GfxImage* pColorAttachments,
+                           GfxImage* pDepthAttachment, GfxImage* pResolveAttachment)
+{
+    GFX_FREE(pAttachmentSet->pRenderingAttachmentInfos);
+    GFX_FREE(pAttachmentSet->pFormats);
+    createAttachmentSet(pAttachmentSet, colorAttachmentCount, pColorAttachments, pDepthAttachment, pResolveAttachment);
+}
+
+static void beginRendering(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet, VkClearValue clearValue,
+                           VkAttachmentLoadOp loadOp, VkRenderingFlags flags)
+{
+    for (uint32_t i = 0; i < pAttachmentSet->colorAttachmentCount; i++) {
+        pAttachmentSet->pRenderingAttachmentInfos[i].clearValue = clearValue;
+        pAttachmentSet->pRenderingAttachmentInfos[i].loadOp = loadOp;
+    }
+
+    VkRenderingAttachmentInfo depthAttachmentInfo;
+    if (pAttachmentSet->pDepthAttachment) {
+        depthAttachmentInfo = (VkRenderingAttachmentInfo){
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+            .imageView = pAttachmentSet->pDepthAttachment->imageView,
+            .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .clearValue.depthStencil = {.depth = 0.0f, .stencil = 0},
+        };
+    }
+
+    VkExtent2D extent = {
+        .width = pAttachmentSet->pColorAttachments[0].width,
+        .height = pAttachmentSet->pColorAttachments[0].height,
+    };
+
+    VkRenderingInfo renderingInfo = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .flags = flags,
+        .renderArea = {.offset = {0, 0}, .extent = extent},
+        .layerCount = 1,
+        .colorAttachmentCount = pAttachmentSet->colorAttachmentCount,
+        .pColorAttachments = pAttachmentSet->pRenderingAttachmentInfos,
+        .pDepthAttachment = pAttachmentSet->pDepthAttachment ? &depthAttachmentInfo : NULL,
+        .pStencilAttachment = NULL,
+    };
+
+    vkCmdBeginRendering(cmd, &renderingInfo);
+}
+
+void gfxCmdBeginRendering(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet, VkClearValue clearValue,
+                          VkAttachmentLoadOp loadOp)
+{
+    beginRendering(cmd, pAttachmentSet, clearValue, loadOp, 0);
+}
+
+void gfxCmdEndRendering(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet)
+{
+    GFX_UNUSED(pAttachmentSet);
+    vkCmdEndRendering(cmd);
+}
+
+void gfxCmdBeginRenderingSecondaries(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet,
+                                     VkClearValue clearValue, VkAttachmentLoadOp loadOp)
+{
+    beginRendering(cmd, pAttachmentSet, clearValue, loadOp, VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT);
+}
+
+VkCommandBuffer gfxCmdBeginSecondary(uint32_t threadIndex, const GfxAttachment* pAttachmentSet)
+{
+    if (threadIndex >= GFX_MAX_RECORDING_THREADS) {
+        GFX_ERROR("Thread index %" PRIu32 " is not less than GFX_MAX_RECORDING_THREADS", threadIndex);
+        return VK_NULL_HANDLE;
+    }
+    if (!gfxSwapchain.pFrameCommands) {
+        GFX_ERROR("Swapchain not initialized");
+        return VK_NULL_HANDLE;
+    }
+    if (!pAttachmentSet || (!pAttachmentSet->colorAttachmentCount && !pAttachmentSet->pDepthAttachment)) {
+        GFX_ERROR("An attachment set with at least one color or depth attachment is required");
+        return VK_NULL_HANDLE;
+    }
+
+    // Attachments have to match the rendering the command buffer executes in
+    const GfxImage* pSampledAttachment = pAttachmentSet->colorAttachmentCount ? &pAttachmentSet->pColorAttachments[0]
+                                                                              : pAttachmentSet->pDepthAttachment;
+    const VkSampleCountFlagBits samples =
+        pSampledAttachment->samples ? pSampledAttachment->samples : VK_SAMPLE_COUNT_1_BIT;
+
+    struct GfxCommandArena* pArena = &gfxSwapchain.pFrameCommands[gfxSwapchain.inFlightIndex].secondaries[threadIndex];
+    VkCommandBuffer cmd = allocateFromArena(pArena, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+
+    VkCommandBufferInheritanceRenderingInfo renderingInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+        .colorAttachmentCount = pAttachmentSet->colorAttachmentCount,
+        .pColorAttachmentFormats = pAttachmentSet->pFormats,
+        .depthAttachmentFormat =
+            pAttachmentSet->pDepthAttachment ? pAttachmentSet->pDepthAttachment->format : VK_FORMAT_UNDEFINED,
+        .stencilAttachmentFormat = VK_FORMAT_UNDEFINED,
+        .rasterizationSamples = samples,
+    };
+
+    VkCommandBufferInheritanceInfo inheritanceInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = &renderingInfo,
+    };
+
+    VkCommandBufferBeginInfo bi = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritanceInfo,
+    };
+
+    beginCommandBuffer(cmd, &bi);
+
+    return cmd;
+}
+
+void gfxCmdEndSecondary(VkCommandBuffer cmd)
+{
+    VK_CHECK(vkEndCommandBuffer(cmd));
+}
+
+void gfxCmdExecuteSecondaries(VkCommandBuffer cmd, uint32_t count, const VkCommandBuffer* pSecondaries)
+{
+    vkCmdExecuteCommands(cmd, count, pSecondaries);
+}
+
+// Seed of the 64-bit FNV-1a hash
+#define GFX_HASH_SEED 14695981039346656037ull
+
+static uint64_t hashBytes(uint64_t hash, const void* pData, size_t size)
+{
+    const unsigned char* pBytes = pData;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= pBytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Size of one descriptor in the packed data of gfxCmdPushDescriptors()
+static size_t getPushDataSize(VkDescriptorType type)
+{
+    switch (type) {
+    case VK_DESCRIPTOR_TYPE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+    case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+    case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+        return sizeof(VkDescriptorImageInfo);
+    case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+    case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+        return sizeof(VkBufferView);
+    case VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR:
+        return sizeof(VkAccelerationStructureKHR);
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+        return sizeof(VkDescriptorBufferInfo);
+    default:
+        GFX_ERROR("Descriptor type %d cannot be pushed", type);
+        return 0;
+    }
+}
+
+// Bind points of the update templates of a layout, with the stages that use
+// them
+static const struct GfxTemplateBindPoint {
+    VkPipelineBindPoint bindPoint;
+    VkShaderStageFlags stages;
+} gfxTemplateBindPoints[] = {
+    {VK_PIPELINE_BIND_POINT_GRAPHICS,
+     VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT},
+    {VK_PIPELINE_BIND_POINT_COMPUTE, VK_SHADER_STAGE_COMPUTE_BIT},
+    {VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+     VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR |
+         VK_SHADER_STAGE_MISS_BIT_KHR | VK_SHADER_STAGE_INTERSECTION_BIT_KHR | VK_SHADER_STAGE_CALLABLE_BIT_KHR},
+};
+
+// Create the push descriptor update templates of a layout, with the bindings
+// packed one after another in binding order
+static void createUpdateTemplate(uint32_t bindingCount, const VkDescriptorSetLayoutBinding* pBindings,
+                                 GfxLayout* pLayout)
+{
+    VkDescriptorUpdateTemplateEntry* pEntries = GFX_MALLOC(bindingCount * sizeof *pEntries);
+
+    pLayout->pushDataSize = 0;
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        size_t stride = getPushDataSize(pBindings[i].descriptorType);
+
+        pEntries[i] = (VkDescriptorUpdateTemplateEntry){
+            .dstBinding = pBindings[i].binding,
+            .dstArrayElement = 0,
+            .descriptorCount = pBindings[i].descriptorCount,
+            .descriptorType = pBindings[i].descriptorType,
+            .offset = pLayout->pushDataSize,
+            .stride = stride,
+        };
+
+        pLayout->pushDataSize += pBindings[i].descriptorCount * stride;
+    }
+
+    // A template targets one bind point, so there is one for each bind point
+    // the layout is used at
+    for (uint32_t i = 0; i < GFX_ARRAY_LEN(gfxTemplateBindPoints); i++) {
+        if (!(pLayout->stages & gfxTemplateBindPoints[i].stages)) {
+            continue;
+        }
+
+        VkDescriptorUpdateTemplateCreateInfo ci = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO,
+            .descriptorUpdateEntryCount = bindingCount,
+            .pDescriptorUpdateEntries = pEntries,
+            .templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR,
+            .descriptorSetLayout = pLayout->setLayout,
+            .pipelineBindPoint = gfxTemplateBindPoints[i].bindPoint,
+            .pipelineLayout = pLayout->pipelineLayout,
+            .set = 0,
+        };
+
+        VK_CHECK(vkCreateDescriptorUpdateTemplate(gfxDevice.device, &ci, NULL, &pLayout->updateTemplates[i]));
+    }
+
+    GFX_FREE(pEntries);
+}
+
+static void createLayout(uint32_t bindingCount, VkDescriptorType* pTypes, VkShaderStageFlags* pStages,
+                         uint32_t* pCounts, uint32_t pushConstantRangeCount, VkPushConstantRange* pPushConstantRanges,
+                         VkDescriptorSetLayoutCreateFlags flags, GfxLayout* pLayout)
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    size_t pushConstantRangeSize = pushConstantRangeCount * sizeof(VkPushConstantRange);
+
+    *pLayout = (GfxLayout){
+        .pushConstantRangeCount = pushConstantRangeCount,
+    };
+
+    if (pLayout->pushConstantRangeCount) {
+        pLayout->pPushConstantRanges = GFX_MALLOC(pushConstantRangeSize);
+        memcpy(pLayout->pPushConstantRanges, pPushConstantRanges, pushConstantRangeSize);
+    }
+
+    VkDescriptorSetLayoutBinding* pBindings = GFX_MALLOC(bindingCount * sizeof *pBindings);
+
+    // Handles differ between runs, so shaders identify their layout by its
+    // contents in the shader binary cache
+    pLayout->hash = hashBytes(GFX_HASH_SEED, pPushConstantRanges, pushConstantRangeSize);
+
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        pBindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorType = pTypes[i],
+            .descriptorCount = pCounts[i],
+            .stageFlags = pStages[i],
+        };
+
+        uint32_t binding[] = {pTypes[i], pStages[i], pCounts[i]};
+        pLayout->hash = hashBytes(pLayout->hash, binding, sizeof binding);
+    }
+
+    // Set layouts of push descriptors and descriptor buffers are not
+    // interchangeable, so shaders built for one cannot use the other
+    pLayout->hash = hashBytes(pLayout->hash, &flags, sizeof flags);
+
+    VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = flags,
+        .bindingCount = bindingCount,
+        .pBindings = pBindings,
+    };
+
+    VK_CHECK(vkCreateDescriptorSetLayout(gfxDevice.device, &setLayoutCreateInfo, NULL, &pLayout->setLayout));
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &pLayout->setLayout,
+        .pushConstantRangeCount = pLayout->pushConstantRangeCount,
+        .pPushConstantRanges = pLayout->pPushConstantRanges,
+    };
+    VK_CHECK(vkCreatePipelineLayout(gfxDevice.device, &pipelineLayoutCreateInfo, NULL, &pLayout->pipelineLayout));
+
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        pLayout->stages |= pStages[i];
+    }
+
+    if ((flags & VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT) && bindingCount) {
+        createUpdateTemplate(bindingCount, pBindings, pLayout);
+    }
+
+    GFX_FREE(pBindings);
+}
+
+void gfxCreateLayout(uint32_t bindingCount, VkDescriptorType* pTypes, VkShaderStageFlags* pStages, uint32_t* pCounts,
+                     uint32_t pushConstantRangeCount, VkPushConstantRange* pPushConstantRanges, GfxLayout* pLayout)
+{
+    createLayout(bindingCount, pTypes, pStages, pCounts, pushConstantRangeCount, pPushConstantRanges,
+                 VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT, pLayout);
+}
+
+void gfxCmdPushDescriptors(VkCommandBuffer cmd, const GfxLayout* pLayout, const void* pData)
+{
+#ifndef NDEBUG
+    if (cmd == gfxDescriptorBufferCmd && !gfxDevice.properties.descriptorBuffer.bufferlessPushDescriptors) {
+        GFX_ERROR("Push descriptors cannot be recorded after binding descriptor buffers on this device, which lacks "
+                  "bufferlessPushDescriptors");
+        return;
+    }
+#endif
+
+    // Bindless, descriptor buffer and binding-less layouts have no template
+    bool pushed = false;
+    for (uint32_t i = 0; i < GFX_ARRAY_LEN(pLayout->updateTemplates); i++) {
+        if (pLayout->updateTemplates[i]) {
+            gfxDevice.fn.vkCmdPushDescriptorSetWithTemplateKHR(cmd, pLayout->updateTemplates[i],
+                                                               pLayout->pipelineLayout, 0, pData);
+            pushed = true;
+        }
+    }
+
+    if (!pushed) {
+        GFX_ERROR("Layout has no push descriptor update template");
+    }
+}
+
+void gfxCreateDescriptorBufferLayout(uint32_t bindingCount, VkDescriptorType* pTypes, VkShaderStageFlags* pStages,
+                                     uint32_t* pCounts, uint32_t pushConstantRangeCount,
+                                     VkPushConstantRange* pPushConstantRanges, GfxLayout* pLayout)
+{
+    if (!gfxDevice.descriptorBuffer) {
+        GFX_ERROR("Descriptor buffer layouts need the descriptorBuffer and bufferDeviceAddress features");
+    }
+
+    createLayout(bindingCount, pTypes, pStages, pCounts, pushConstantRangeCount, pPushConstantRanges,
+                 VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT, pLayout);
+
+    pLayout->descriptorBuffer = true;
+    pLayout->bindingCount = bindingCount;
+    pLayout->pBindingOffsets = GFX_MALLOC(bindingCount * sizeof *pLayout->pBindingOffsets);
+
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        gfxDevice.fn.vkGetDescriptorSetLayoutBindingOffsetEXT(gfxDevice.device, pLayout->setLayout, i,
+                                                              &pLayout->pBindingOffsets[i]);
+    }
+
+    VkDeviceSize alignment = gfxDevice.properties.descriptorBuffer.descriptorBufferOffsetAlignment;
+    gfxDevice.fn.vkGetDescriptorSetLayoutSizeEXT(gfxDevice.device, pLayout->setLayout, &pLayout->setSize);
+    pLayout->setSize = (pLayout->setSize + alignment - 1) & ~(alignment - 1);
+}
+
+void gfxCreateBindlessLayout(uint32_t pushConstantRangeCount, VkPushConstantRange* pPushConstantRanges,
+                             GfxLayout* pLayout)
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    if (!gfxDevice.bindless.set) {
+        GFX_ERROR("Bindless layouts need the bindless descriptor heap, see gfxCreateBindlessHeap()");
+    }
+
+    size_t pushConstantRangeSize = pushConstantRangeCount * sizeof(VkPushConstantRange);
+
+    // The set layout belongs to the heap, so it is shared by all bindless
+    // layouts
+    *pLayout = (GfxLayout){
+        .setLayout = gfxDevice.bindless.setLayout,
+        .pushConstantRangeCount = pushConstantRangeCount,
+        .bindless = true,
+    };
+
+    if (pLayout->pushConstantRangeCount) {
+        pLayout->pPushConstantRanges = GFX_MALLOC(pushConstantRangeSize);
+        memcpy(pLayout->pPushConstantRanges, pPushConstantRanges, pushConstantRangeSize);
+    }
+
+    uint32_t counts[] = {gfxDevice.bindless.images.capacity, gfxDevice.bindless.samplerCount,
+                         gfxDevice.bindless.buffers.capacity};
+    pLayout->hash = hashBytes(GFX_HASH_SEED, pPushConstantRanges, pushConstantRangeSize);
+    pLayout->hash = hashBytes(pLayout->hash, counts, sizeof counts);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &pLayout->setLayout,
+        .pushConstantRangeCount = pLayout->pushConstantRangeCount,
+        .pPushConstantRanges = pLayout->pPushConstantRanges,
+    };
+    VK_CHECK(vkCreatePipelineLayout(gfxDevice.device, &pipelineLayoutCreateInfo, NULL, &pLayout->pipelineLayout));
+}
+
+void gfxCmdBindBindlessHeap(VkCommandBuffer cmd, const GfxLayout* pLayout)
+{
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pLayout->pipelineLayout, 0, 1,
+                            &gfxDevice.bindless.set, 0, NULL);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pLayout->pipelineLayout, 0, 1,
+                            &gfxDevice.bindless.set, 0, NULL);
+}
+
+void gfxDestroyLayout(GfxLayout* pLayout)
+{
+    deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_PIPELINE_LAYOUT, .pipelineLayout = pLayout->pipelineLayout});
+    if (!pLayout->bindless) {
+        deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_DESCRIPTOR_SET_LAYOUT, .setLayout = pLayout->setLayout});
+    }
+    for (uint32_t i = 0; i < GFX_ARRAY_LEN(pLayout->updateTemplates); i++) {
+        if (pLayout->updateTemplates[i]) {
+            deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_DESCRIPTOR_UPDATE_TEMPLATE,
+                                              .updateTemplate = pLayout->updateTemplates[i]});
+        }
+    }
+
+    if (pLayout->pPushConstantRanges) {
+        GFX_FREE(pLayout->pPushConstantRanges);
+    }
+
+    if (pLayout->pBindingOffsets) {
+        GFX_FREE(pLayout->pBindingOffsets);
+    }
+
+    GFX_RESET(pLayout);
+}
+
+void gfxCreateDescriptorBuffer(const GfxLayout* pLayout, uint32_t setCount, GfxDescriptorBuffer* pDescriptorBuffer)
+{
+    if (!pLayout->descriptorBuffer) {
+        GFX_ERROR("Descriptor buffers need a layout from gfxCreateDescriptorBufferLayout()");
+    }
+
+    *pDescriptorBuffer = (GfxDescriptorBuffer){
+        .setSize = pLayout->setSize,
+        .setCount = setCount,
+    };
+
+    // Sampler descriptors may only be read from buffers with sampler usage
+    VkBufferUsageFlags usage =
+        VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT |
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    gfxCreateBuffer(GFX_MAX(1, setCount) * pLayout->setSize, usage,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    &pDescriptorBuffer->buffer);
+
+    VkBufferDeviceAddressInfo addressInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = pDescriptorBuffer->buffer.buffer,
+    };
+    pDescriptorBuffer->address = vkGetBufferDeviceAddress(gfxDevice.device, &addressInfo);
+}
+
+// Size of a descriptor in a descriptor buffer, or 0 if the type is not
+// supported
+static size_t getDescriptorSize(VkDescriptorType type)
+{
+    const VkPhysicalDeviceDescriptorBufferPropertiesEXT* pProperties = &gfxDevice.properties.descriptorBuffer;
+
+    switch (type) {
+    case VK_DESCRIPTOR_TYPE_SAMPLER:
+        return pProperties->samplerDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+        return pProperties->combinedImageSamplerDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+        return pProperties->sampledImageDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+        return pProperties->storageImageDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+        return pProperties->uniformBufferDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+        return pProperties->storageBufferDescriptorSize;
+    default:
+        return 0;
+    }
+}
+
+void gfxWriteDescriptorBuffer(GfxDescriptorBuffer* pDescriptorBuffer, const GfxLayout* pLayout, uint32_t setIndex,
+                              uint32_t writeCount, const VkWriteDescriptorSet* pWrites)
+{
+    if (setIndex >= pDescriptorBuffer->setCount) {
+        GFX_ERROR("Set %" PRIu32 " is out of range of a descriptor buffer of %" PRIu32 " sets", setIndex,
+                  pDescriptorBuffer->setCount);
+        return;
+    }
+
+    char* pSet = (char*)pDescriptorBuffer->buffer.pHostMap + setIndex * pDescriptorBuffer->setSize;
+
+    for (uint32_t i = 0; i < writeCount; i++) {
+        const VkWriteDescriptorSet* pWrite = &pWrites[i];
+        size_t descriptorSize = getDescriptorSize(pWrite->descriptorType);
+
+        if (!descriptorSize || pWrite->dstBinding >= pLayout->bindingCount) {
+            GFX_ERROR("Descriptor type %d of binding %" PRIu32 " cannot be written to a descriptor buffer",
+                      pWrite->descriptorType, pWrite->dstBinding);
+            return;
+        }
+
+        for (uint32_t j = 0; j < pWrite->descriptorCount; j++) {
+            VkDescriptorGetInfoEXT getInfo = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT,
+                .type = pWrite->descriptorType,
+            };
+
+            VkDescriptorAddressInfoEXT addressInfo = {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT};
+
+            switch (pWrite->descriptorType) {
+            case VK_DESCRIPTOR_TYPE_SAMPLER:
+                getInfo.data.pSampler = &pWrite->pImageInfo[j].sampler;
+                break;
+            case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+                getInfo.data.pCombinedImageSampler = &pWrite->pImageInfo[j];
+                break;
+            case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+                getInfo.data.pSampledImage = &pWrite->pImageInfo[j];
+                break;
+            case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+                getInfo.data.pStorageImage = &pWrite->pImageInfo[j];
+                break;
+            default: {
+                // Buffer descriptors are made from device addresses, which
+                // have no size to derive VK_WHOLE_SIZE from
+                const VkDescriptorBufferInfo* pBufferInfo = &pWrite->pBufferInfo[j];
+                if (pBufferInfo->range == VK_WHOLE_SIZE) {
+                    GFX_ERROR("Buffers in descriptor buffers need an explicit range");
+                    return;
+                }
+
+                VkBufferDeviceAddressInfo bufferAddressInfo = {
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+                    .buffer = pBufferInfo->buffer,
+                };
+                addressInfo.address = vkGetBufferDeviceAddress(gfxDevice.device, &bufferAddressInfo) +
+                                      pBufferInfo->offset;
+                addressInfo.range = pBufferInfo->range;
+
+                if (pWrite->descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+                    getInfo.data.pUniformBuffer = &addressInfo;
+                } else {
+                    getInfo.data.pStorageBuffer = &addressInfo;
+                }
+                break;
+            }
+            }
+
+            VkDeviceSize offset =
+                pLayout->pBindingOffsets[pWrite->dstBinding] + (pWrite->dstArrayElement + j) * descriptorSize;
+            gfxDevice.fn.vkGetDescriptorEXT(gfxDevice.device, &getInfo, descriptorSize, pSet + offset);
+        }
+    }
+}
+
+void gfxCmdBindDescriptorBuffer(VkCommandBuffer cmd, const GfxDescriptorBuffer* pDescriptorBuffer)
+{
+    VkDescriptorBufferBindingInfoEXT bindingInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT,
+        .address = pDescriptorBuffer->address,
+        .usage = pDescriptorBuffer->buffer.usage,
     };
 
-    VkBufferCreateInfo ci = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    gfxDevice.fn.vkCmdBindDescriptorBuffersEXT(cmd, 1, &bindingInfo);
+
+#ifndef NDEBUG
+    gfxDescriptorBufferCmd = cmd;
+#endif
+}
+
+void gfxCmdSetDescriptorBufferSet(VkCommandBuffer cmd, const GfxLayout* pLayout,
+                                  const GfxDescriptorBuffer* pDescriptorBuffer, uint32_t setIndex)
+{
+    uint32_t bufferIndex = 0;
+    VkDeviceSize offset = setIndex * pDescriptorBuffer->setSize;
+
+    if (pLayout->stages & ~VK_SHADER_STAGE_COMPUTE_BIT) {
+        gfxDevice.fn.vkCmdSetDescriptorBufferOffsetsEXT(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pLayout->pipelineLayout,
+                                                        0, 1, &bufferIndex, &offset);
+    }
+    if (pLayout->stages & VK_SHADER_STAGE_COMPUTE_BIT) {
+        gfxDevice.fn.vkCmdSetDescriptorBufferOffsetsEXT(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pLayout->pipelineLayout,
+                                                        0, 1, &bufferIndex, &offset);
+    }
+}
+
+void gfxDestroyDescriptorBuffer(GfxDescriptorBuffer* pDescriptorBuffer)
+{
+    gfxDestroyBuffer(&pDescriptorBuffer->buffer);
+
+    GFX_RESET(pDescriptorBuffer);
+}
+
+static void createShader(GfxShader* pShader, const void* pCode, size_t codeSize, VkShaderStageFlagBits stage,
+                         VkShaderStageFlags nextStage, const GfxLayout* pLayout)
+{
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
+    pShader->pCode = GFX_MALLOC(codeSize);
+    memcpy(pShader->pCode, pCode, codeSize);
+
+    // Take our own copies, so that createInfo does not point into the layout
+    // until the shader is built
+    pShader->setLayout = pLayout->setLayout;
+    pShader->layoutHash = pLayout->hash;
+    if (pLayout->pushConstantRangeCount) {
+        size_t pushConstantRangeSize = pLayout->pushConstantRangeCount * sizeof *pShader->pPushConstantRanges;
+        pShader->pPushConstantRanges = GFX_MALLOC(pushConstantRangeSize);
+        memcpy(pShader->pPushConstantRanges, pLayout->pPushConstantRanges, pushConstantRangeSize);
+    }
+
+    pShader->createInfo = (VkShaderCreateInfoEXT){
+        .sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
+        .flags = 0,
+        .stage = stage,
+        .nextStage = nextStage,
+        .codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT,
+        .codeSize = codeSize,
+        .pCode = pShader->pCode,
+        .pName = "main",
+        .setLayoutCount = 1,
+        .pSetLayouts = &pShader->setLayout,
+        .pushConstantRangeCount = pLayout->pushConstantRangeCount,
+        .pPushConstantRanges = pShader->pPushConstantRanges,
+        .pSpecializationInfo = NULL,
+    };
+}
+
+void gfxCreateShader(const void* pCode, size_t codeSize, VkShaderStageFlagBits stage, VkShaderStageFlags nextStage,
+                     const GfxLayout* pLayout, GfxShader* pShader)
+{
+    GFX_RESET(pShader);
+
+    createShader(pShader, pCode, codeSize, stage, nextStage, pLayout);
+}
+
+// Hand the results of a completed build to its shaders
+static void finishShaderBuild(struct GfxShaderBuild* pBuild)
+{
+    removeShaderBuild(pBuild);
+
+    gfxDevice.shaderCache.hits += pBuild->cacheHit;
+    gfxDevice.shaderCache.misses += pBuild->cacheMiss;
+    gfxDevice.shaderCache.binaryHits += pBuild->binaryCacheHit;
+    gfxDevice.shaderCache.binaryMisses += pBuild->binaryCacheMiss;
+
+    if (pBuild->pError) {
+        GFX_WARNING("%s", pBuild->pError);
+        GFX_FREE(pBuild->pError);
+    }
+
+    if (pBuild->pCode) {
+        createShader(pBuild->pShaders[0], pBuild->pCode, pBuild->codeSize, pBuild->stage, pBuild->nextStage,
+                     pBuild->pLayout);
+        GFX_FREE(pBuild->pCode);
+    }
+
+    for (uint32_t i = 0; i < pBuild->shaderCount; i++) {
+        GfxShader* pShader = pBuild->pShaders[i];
+        pShader->pBuild = NULL;
+
+        // A failed build keeps the previous shader object, if any
+        if (!pBuild->shaders[i]) {
+            continue;
+        }
+
+        // Frames in flight may still use the previous shader object
+        if (pShader->shader) {
+            deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_SHADER, .shader = pShader->shader});
+        }
+        pShader->shader = pBuild->shaders[i];
+
+        if (pShader->pLinkedShader && pShader->pLinkedShader->pLinkedShader == pShader) {
+            pShader->pLinkedShader->pLinkedShader = NULL;
+        }
+        pShader->pLinkedShader = NULL;
+    }
+
+    if (pBuild->shaderCount > 1 && pBuild->shaders[0]) {
+        pBuild->pShaders[0]->pLinkedShader = pBuild->pShaders[1];
+        pBuild->pShaders[1]->pLinkedShader = pBuild->pShaders[0];
+    }
+
+    GFX_FREE(pBuild);
+}
+
+// Wait for a pending build of a shader, if any
+static void waitShaderBuild(GfxShader* pShader)
+{
+    if (pShader->pBuild) {
+        waitJobGroup(&pShader->pBuild->group);
+        finishShaderBuild(pShader->pBuild);
+    }
+}
+
+void gfxSetShaderSpecialization(GfxShader* pShader, const VkSpecializationInfo* pSpecializationInfo)
+{
+    waitShaderBuild(pShader);
+    discardPendingReloads(pShader);
+
+    GFX_FREE(pShader->pSpecializationEntries);
+    GFX_FREE(pShader->pSpecializationData);
+    pShader->pSpecializationEntries = NULL;
+    pShader->pSpecializationData = NULL;
+    pShader->createInfo.pSpecializationInfo = NULL;
+
+    if (!pSpecializationInfo) {
+        return;
+    }
+
+    size_t entrySize = pSpecializationInfo->mapEntryCount * sizeof *pShader->pSpecializationEntries;
+    if (entrySize) {
+        pShader->pSpecializationEntries = GFX_MALLOC(entrySize);
+        memcpy(pShader->pSpecializationEntries, pSpecializationInfo->pMapEntries, entrySize);
+    }
+
+    if (pSpecializationInfo->dataSize) {
+        pShader->pSpecializationData = GFX_MALLOC(pSpecializationInfo->dataSize);
+        memcpy(pShader->pSpecializationData, pSpecializationInfo->pData, pSpecializationInfo->dataSize);
+    }
+
+    pShader->specializationInfo = (VkSpecializationInfo){
+        .mapEntryCount = pSpecializationInfo->mapEntryCount,
+        .pMapEntries = pShader->pSpecializationEntries,
+        .dataSize = pSpecializationInfo->dataSize,
+        .pData = pShader->pSpecializationData,
+    };
+    pShader->createInfo.pSpecializationInfo = &pShader->specializationInfo;
+}
+
+// Create an unbuilt copy of a shader, including its specialization
+static void copyShader(const GfxShader* pShader, GfxShader* pCopy)
+{
+    *pCopy = (GfxShader){
+        .createInfo = pShader->createInfo,
+        .setLayout = pShader->setLayout,
+        .layoutHash = pShader->layoutHash,
+        .pCode = GFX_MALLOC(pShader->createInfo.codeSize),
+    };
+
+    memcpy(pCopy->pCode, pShader->pCode, pShader->createInfo.codeSize);
+    pCopy->createInfo.pCode = pCopy->pCode;
+    pCopy->createInfo.pSetLayouts = &pCopy->setLayout;
+
+    if (pShader->createInfo.pushConstantRangeCount) {
+        size_t pushConstantRangeSize = pShader->createInfo.pushConstantRangeCount * sizeof *pCopy->pPushConstantRanges;
+        pCopy->pPushConstantRanges = GFX_MALLOC(pushConstantRangeSize);
+        memcpy(pCopy->pPushConstantRanges, pShader->pPushConstantRanges, pushConstantRangeSize);
+        pCopy->createInfo.pPushConstantRanges = pCopy->pPushConstantRanges;
+    }
+
+    if (pShader->pPath) {
+        size_t sz = strlen(pShader->pPath) + 1;
+        pCopy->pPath = GFX_MALLOC(sz);
+        memcpy(pCopy->pPath, pShader->pPath, sz);
+    }
+
+    if (pShader->pPreamble) {
+        size_t sz = strlen(pShader->pPreamble) + 1;
+        pCopy->pPreamble = GFX_MALLOC(sz);
+        memcpy(pCopy->pPreamble, pShader->pPreamble, sz);
+    }
+
+    gfxSetShaderSpecialization(pCopy, pShader->createInfo.pSpecializationInfo);
+}
+
+// Shader cache entries start with this magic and format version, followed by
+// the key, the manifest of included files and the SPIR-V
+#define GFX_SHADER_CACHE_MAGIC 0x43584647u // "GFXC"
+#define GFX_SHADER_CACHE_VERSION 1u
+
+// Files included by a shader being compiled. Their paths and hashes are
+// stored with its cache entry, so that editing them invalidates the entry.
+struct GfxIncludeContext {
+    const char* pRootPath;
+    struct GfxIncludedFile {
+        char* pPath;
+        uint64_t hash;
+    }* pFiles;
+    uint32_t fileCount;
+    uint32_t fileCapacity;
+};
+
+// Read cursor over the contents of a shader cache entry
+struct GfxReader {
+    const char* pData;
+    size_t size;
+    size_t offset;
+};
+
+// Read a whole file and null terminate it. Returns NULL if the file cannot be
+// read.
+static char* readFile(const char* pPath, size_t* pSize)
+{
+    FILE* file = fopen(pPath, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    if (size < 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    char* pData = GFX_MALLOC((size_t)size + 1);
+    size_t n = fread(pData, 1, (size_t)size, file);
+    fclose(file);
+
+    if (n != (size_t)size) {
+        GFX_FREE(pData);
+        return NULL;
+    }
+
+    pData[size] = 0;
+    if (pSize) {
+        *pSize = (size_t)size;
+    }
+
+    return pData;
+}
+
+// Format a message into a newly allocated string
+static char* formatString(const char* pFormat, ...)
+{
+    va_list args;
+    va_start(args, pFormat);
+    int length = vsnprintf(NULL, 0, pFormat, args);
+    va_end(args);
+
+    char* pString = GFX_MALLOC((size_t)length + 1);
+
+    va_start(args, pFormat);
+    vsnprintf(pString, (size_t)length + 1, pFormat, args);
+    va_end(args);
+
+    return pString;
+}
+
+// Resolve pName relative to the directory of pBase, unless it is absolute
+static char* joinRelativePath(const char* pBase, const char* pName)
+{
+    const char* pSlash = strrchr(pBase, '/');
+    const char* pBackslash = strrchr(pBase, '\\');
+    if (!pSlash || (pBackslash && pBackslash > pSlash)) {
+        pSlash = pBackslash;
+    }
+
+    bool absolute = pName[0] == '/' || pName[0] == '\\' || (pName[0] && pName[1] == ':');
+    size_t directoryLength = pSlash && !absolute ? (size_t)(pSlash - pBase) + 1 : 0;
+    size_t nameSize = strlen(pName) + 1;
+
+    char* pPath = GFX_MALLOC(directoryLength + nameSize);
+    memcpy(pPath, pBase, directoryLength);
+    memcpy(pPath + directoryLength, pName, nameSize);
+
+    return pPath;
+}
+
+// Include callback of glslang. The returned header name is the resolved path,
+// so that nested includes are relative to the file that includes them.
+static glsl_include_result_t* includeFile(void* pContext, const char* pHeaderName, const char* pIncluderName,
+                                          size_t includeDepth)
+{
+    GFX_UNUSED(includeDepth);
+
+    struct GfxIncludeContext* pIncludes = pContext;
+
+    // The top level file is not named by glslang
+    const char* pBase = pIncluderName && *pIncluderName ? pIncluderName : pIncludes->pRootPath;
+    char* pPath = joinRelativePath(pBase, pHeaderName);
+
+    size_t size;
+    char* pData = readFile(pPath, &size);
+    if (!pData) {
+        GFX_FREE(pPath);
+        return NULL;
+    }
+
+    if (pIncludes->fileCount == pIncludes->fileCapacity) {
+        pIncludes->fileCapacity = GFX_MAX(8, 2 * pIncludes->fileCapacity);
+        pIncludes->pFiles = GFX_REALLOC(pIncludes->pFiles, pIncludes->fileCapacity * sizeof *pIncludes->pFiles);
+    }
+
+    // The path is owned by the context, glslang may refer to it until the
+    // shader is deleted
+    pIncludes->pFiles[pIncludes->fileCount++] = (struct GfxIncludedFile){
+        .pPath = pPath,
+        .hash = hashBytes(GFX_HASH_SEED, pData, size),
+    };
+
+    glsl_include_result_t* pResult = GFX_MALLOC(sizeof *pResult);
+    *pResult = (glsl_include_result_t){
+        .header_name = pPath,
+        .header_data = pData,
+        .header_length = size,
+    };
+
+    return pResult;
+}
+
+static int freeIncludeResult(void* pContext, glsl_include_result_t* pResult)
+{
+    GFX_UNUSED(pContext);
+
+    GFX_FREE((char*)pResult->header_data);
+    GFX_FREE(pResult);
+
+    return 0;
+}
+
+// Key of everything that affects the generated SPIR-V, apart from the
+// contents of included files, which are checked through the manifest
+static uint64_t getShaderCacheKey(const char* pPath, const char* pPreamble, const glslang_input_t* pInput)
+{
+    glslang_version_t version;
+    glslang_get_version(&version);
+
+    uint32_t values[] = {
+        GFX_SHADER_CACHE_VERSION,
+        (uint32_t)version.major,
+        (uint32_t)version.minor,
+        (uint32_t)version.patch,
+        (uint32_t)pInput->stage,
+        (uint32_t)pInput->client_version,
+        (uint32_t)pInput->target_language_version,
+        (uint32_t)pInput->messages,
+        GFX_SPIRV_OPTIMIZE,
+        GFX_SPIRV_STRIP_DEBUG,
     };
 
-    VK_CHECK(vkCreateBuffer(gfxDevice.device, &ci, NULL, &pBuffer->buffer));
+    uint64_t hash = hashBytes(GFX_HASH_SEED, values, sizeof values);
+    if (version.flavor) {
+        hash = hashBytes(hash, version.flavor, strlen(version.flavor));
+    }
+
+    // Includes are resolved relative to the file, so its path matters too
+    hash = hashBytes(hash, pPath, strlen(pPath) + 1);
+
+    if (pPreamble) {
+        hash = hashBytes(hash, pPreamble, strlen(pPreamble) + 1);
+    }
+
+    return hashBytes(hash, pInput->code, strlen(pInput->code));
+}
+
+static char* getShaderCachePath(uint64_t key, const char* pExtension)
+{
+    size_t size = strlen(gfxDevice.shaderCache.pDirectory) + strlen(pExtension) + 32;
+    char* pPath = GFX_MALLOC(size);
+    snprintf(pPath, size, "%s/%016" PRIx64 "%s", gfxDevice.shaderCache.pDirectory, key, pExtension);
+
+    return pPath;
+}
+
+static bool readBytes(struct GfxReader* pReader, void* pDst, size_t size)
+{
+    if (pReader->size - pReader->offset < size) {
+        return false;
+    }
+
+    memcpy(pDst, pReader->pData + pReader->offset, size);
+    pReader->offset += size;
+
+    return true;
+}
+
+// Load the cached SPIR-V of a key. Returns NULL if there is no valid entry,
+// or if a file it included has changed since it was stored.
+static uint32_t* loadCachedSpirv(uint64_t key, size_t* pCodeSize)
+{
+    char* pPath = getShaderCachePath(key, ".spvcache");
+    size_t size;
+    char* pData = readFile(pPath, &size);
+    GFX_FREE(pPath);
+
+    if (!pData) {
+        return NULL;
+    }
+
+    struct GfxReader reader = {.pData = pData, .size = size};
+
+    uint32_t header[2];
+    uint64_t storedKey;
+    uint32_t includeCount;
+    bool valid = readBytes(&reader, header, sizeof header) && readBytes(&reader, &storedKey, sizeof storedKey) &&
+                 readBytes(&reader, &includeCount, sizeof includeCount);
+    valid = valid && header[0] == GFX_SHADER_CACHE_MAGIC && header[1] == GFX_SHADER_CACHE_VERSION && storedKey == key;
+
+    for (uint32_t i = 0; valid && i < includeCount; i++) {
+        uint32_t pathLength;
+        if (!readBytes(&reader, &pathLength, sizeof pathLength) || pathLength > reader.size - reader.offset) {
+            valid = false;
+            break;
+        }
+
+        char* pIncludePath = GFX_MALLOC(pathLength + 1);
+        readBytes(&reader, pIncludePath, pathLength);
+        pIncludePath[pathLength] = 0;
+
+        uint64_t hash;
+        size_t includeSize;
+        char* pInclude = NULL;
+        valid = readBytes(&reader, &hash, sizeof hash) && (pInclude = readFile(pIncludePath, &includeSize)) &&
+                hashBytes(GFX_HASH_SEED, pInclude, includeSize) == hash;
+
+        GFX_FREE(pInclude);
+        GFX_FREE(pIncludePath);
+    }
+
+    uint64_t codeSize;
+    valid = valid && readBytes(&reader, &codeSize, sizeof codeSize) && codeSize == reader.size - reader.offset &&
+            codeSize >= sizeof(uint32_t) && codeSize % sizeof(uint32_t) == 0;
+
+    uint32_t* pCode = NULL;
+    if (valid) {
+        pCode = GFX_MALLOC(codeSize);
+        readBytes(&reader, pCode, codeSize);
+
+        // A damaged entry is simply compiled again
+        if (pCode[0] == 0x07230203u) {
+            *pCodeSize = codeSize;
+        } else {
+            GFX_FREE(pCode);
+            pCode = NULL;
+        }
+    }
+
+    GFX_FREE(pData);
+
+    return pCode;
+}
+
+// Open a temporary file to write a shader cache entry to, so that an
+// interrupted write never leaves a partial entry behind. The name is made
+// unique by the process id and pUnique, as another process or thread may be
+// storing the same entry.
+static FILE* beginCacheEntry(const char* pPath, const void* pUnique, char** ppTempPath)
+{
+#if GFX_WINDOWS
+    unsigned long processId = GetCurrentProcessId();
+#else
+    unsigned long processId = (unsigned long)getpid();
+#endif
+
+    size_t tempSize = strlen(pPath) + 64;
+    *ppTempPath = GFX_MALLOC(tempSize);
+    snprintf(*ppTempPath, tempSize, "%s.%lu.%p.tmp", pPath, processId, pUnique);
+
+    return fopen(*ppTempPath, "wb");
+}
+
+// Close the temporary file and move it to the entry if everything was
+// written. Returns whether the entry was stored.
+static bool endCacheEntry(FILE* file, char* pTempPath, const char* pPath, bool ok)
+{
+    if (file) {
+        ok = fclose(file) == 0 && ok;
+
+        // On Windows rename() fails if another thread stored the same entry
+        // first, which is fine
+        if (!ok || rename(pTempPath, pPath) != 0) {
+            remove(pTempPath);
+        }
+    } else {
+        ok = false;
+    }
+
+    if (!ok) {
+        GFX_WARNING("Unable to write shader cache entry %s", pPath);
+    }
+
+    GFX_FREE(pTempPath);
+
+    return ok;
+}
+
+static void storeCachedSpirv(uint64_t key, const struct GfxIncludeContext* pIncludes, const uint32_t* pCode,
+                             size_t codeSize)
+{
+    char* pPath = getShaderCachePath(key, ".spvcache");
+    char* pTempPath;
+    FILE* file = beginCacheEntry(pPath, pIncludes, &pTempPath);
+    bool ok = file != NULL;
+
+    if (file) {
+        uint32_t header[] = {GFX_SHADER_CACHE_MAGIC, GFX_SHADER_CACHE_VERSION};
+        ok = fwrite(header, sizeof header, 1, file) == 1 && fwrite(&key, sizeof key, 1, file) == 1 &&
+             fwrite(&pIncludes->fileCount, sizeof pIncludes->fileCount, 1, file) == 1;
+
+        for (uint32_t i = 0; ok && i < pIncludes->fileCount; i++) {
+            const struct GfxIncludedFile* pFile = &pIncludes->pFiles[i];
+            uint32_t pathLength = (uint32_t)strlen(pFile->pPath);
+
+            ok = fwrite(&pathLength, sizeof pathLength, 1, file) == 1 &&
+                 fwrite(pFile->pPath, 1, pathLength, file) == pathLength &&
+                 fwrite(&pFile->hash, sizeof pFile->hash, 1, file) == 1;
+        }
+
+        uint64_t size = codeSize;
+        ok = ok && fwrite(&size, sizeof size, 1, file) == 1 && fwrite(pCode, 1, codeSize, file) == codeSize;
+    }
+
+    endCacheEntry(file, pTempPath, pPath, ok);
+    GFX_FREE(pPath);
+}
+
+// Shader binary cache entries start with this magic and format version,
+// followed by the key, the shaderBinaryUUID and shaderBinaryVersion of the
+// driver that produced them, and the size and data of each binary
+#define GFX_SHADER_BINARY_CACHE_MAGIC 0x42584647u // "GFXB"
+#define GFX_SHADER_BINARY_CACHE_VERSION 1u
+
+// Key of the binaries of shaders created together. The layouts are hashed by
+// their contents. Keeping the driver's UUID into the entry instead of the
+// key means a driver update replaces entries rather than adding new ones.
+static uint64_t getShaderBinaryCacheKey(uint32_t count, const VkShaderCreateInfoEXT* pCreateInfos,
+                                        const uint64_t* pLayoutHashes)
+{
+    uint64_t hash = GFX_HASH_SEED;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const VkShaderCreateInfoEXT* pInfo = &pCreateInfos[i];
+
+        uint32_t state[] = {pInfo->flags, pInfo->stage, pInfo->nextStage, pInfo->codeType};
+        hash = hashBytes(hash, state, sizeof state);
+        hash = hashBytes(hash, &pLayoutHashes[i], sizeof pLayoutHashes[i]);
+        hash = hashBytes(hash, pInfo->pName, strlen(pInfo->pName) + 1);
+        hash = hashBytes(hash, pInfo->pCode, pInfo->codeSize);
+
+        const VkSpecializationInfo* pSpecialization = pInfo->pSpecializationInfo;
+        if (pSpecialization) {
+            hash = hashBytes(hash, pSpecialization->pMapEntries,
+                             pSpecialization->mapEntryCount * sizeof *pSpecialization->pMapEntries);
+            hash = hashBytes(hash, pSpecialization->pData, pSpecialization->dataSize);
+        }
+    }
+
+    return hash;
+}
+
+// Create shader objects from the cached binaries of a key. Returns false if
+// there is no valid entry or the driver rejects the binaries, in which case
+// nothing was created.
+static bool loadCachedShaderBinaries(uint64_t key, uint32_t count, const VkShaderCreateInfoEXT* pCreateInfos,
+                                     VkShaderEXT* pShaders)
+{
+    char* pPath = getShaderCachePath(key, ".bincache");
+    size_t size;
+    char* pData = readFile(pPath, &size);
+    GFX_FREE(pPath);
+
+    if (!pData) {
+        return false;
+    }
+
+    const VkPhysicalDeviceShaderObjectPropertiesEXT* pProperties = &gfxDevice.properties.shaderObject;
+    struct GfxReader reader = {.pData = pData, .size = size};
+
+    uint32_t header[2];
+    uint64_t storedKey;
+    uint8_t uuid[VK_UUID_SIZE];
+    uint32_t binaryVersion;
+    uint32_t storedCount;
+    bool valid = readBytes(&reader, header, sizeof header) && readBytes(&reader, &storedKey, sizeof storedKey) &&
+                 readBytes(&reader, uuid, sizeof uuid) && readBytes(&reader, &binaryVersion, sizeof binaryVersion) &&
+                 readBytes(&reader, &storedCount, sizeof storedCount);
+    valid = valid && header[0] == GFX_SHADER_BINARY_CACHE_MAGIC && header[1] == GFX_SHADER_BINARY_CACHE_VERSION &&
+            storedKey == key && storedCount == count;
+
+    // Binaries of another driver or driver version are stale
+    valid = valid && memcmp(uuid, pProperties->shaderBinaryUUID, sizeof uuid) == 0 &&
+            binaryVersion == pProperties->shaderBinaryVersion;
+
+    VkShaderCreateInfoEXT* pBinaryInfos = GFX_MALLOC(count * sizeof *pBinaryInfos);
+    void** ppBinaries = GFX_MALLOC(count * sizeof *ppBinaries);
+    uint32_t binaryCount = 0;
+
+    for (; valid && binaryCount < count; binaryCount++) {
+        uint64_t binarySize;
+        if (!readBytes(&reader, &binarySize, sizeof binarySize) || binarySize > reader.size - reader.offset) {
+            valid = false;
+            break;
+        }
+
+        // Binary code has to be 16-byte aligned, which GFX_MALLOC does not
+        // guarantee, so the allocation leaves room to align it
+        ppBinaries[binaryCount] = GFX_MALLOC(binarySize + 15);
+        void* pBinary = (void*)(((uintptr_t)ppBinaries[binaryCount] + 15) & ~(uintptr_t)15);
+        readBytes(&reader, pBinary, binarySize);
 
-    VkMemoryRequirements memReqs;
-    vkGetBufferMemoryRequirements(gfxDevice.device, pBuffer->buffer, &memReqs);
+        pBinaryInfos[binaryCount] = pCreateInfos[binaryCount];
+        pBinaryInfos[binaryCount].codeType = VK_SHADER_CODE_TYPE_BINARY_EXT;
+        pBinaryInfos[binaryCount].codeSize = binarySize;
+        pBinaryInfos[binaryCount].pCode = pBinary;
+    }
 
-    pBuffer->size = memReqs.size;
+    valid = valid && reader.offset == reader.size;
 
-    VkMemoryAllocateFlagsInfo allocFlagInfo = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
-    };
+    if (valid) {
+        for (uint32_t i = 0; i < count; i++) {
+            pShaders[i] = VK_NULL_HANDLE;
+        }
 
-    VkMemoryAllocateInfo allocInfo = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memReqs.size,
-        .memoryTypeIndex = gfxFindMemoryType(memReqs.memoryTypeBits, properties),
-    };
+        // The driver may still reject binaries, with
+        // VK_INCOMPATIBLE_SHADER_BINARY_EXT. Shaders that were created
+        // regardless are destroyed, so that all of them come from SPIR-V.
+        VkResult result = gfxDevice.fn.vkCreateShadersEXT(gfxDevice.device, count, pBinaryInfos, NULL, pShaders);
+        valid = result == VK_SUCCESS;
 
-    if (pBuffer->usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-        allocInfo.pNext = &allocFlagInfo;
+        for (uint32_t i = 0; !valid && i < count; i++) {
+            if (pShaders[i]) {
+                gfxDevice.fn.vkDestroyShaderEXT(gfxDevice.device, pShaders[i], NULL);
+                pShaders[i] = VK_NULL_HANDLE;
+            }
+        }
     }
 
-    VK_CHECK(vkAllocateMemory(gfxDevice.device, &allocInfo, NULL, &pBuffer->memory));
+    for (uint32_t i = 0; i < binaryCount; i++) {
+        GFX_FREE(ppBinaries[i]);
+    }
 
-    VK_CHECK(vkBindBufferMemory(gfxDevice.device, pBuffer->buffer, pBuffer->memory, 0));
+    GFX_FREE(ppBinaries);
+    GFX_FREE(pBinaryInfos);
+    GFX_FREE(pData);
 
-    // Map memory if memory is host coherent
-    if (pBuffer->properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
-        VK_CHECK(vkMapMemory(gfxDevice.device, pBuffer->memory, 0, size, 0, &pBuffer->pHostMap));
+    return valid;
+}
+
+static void storeCachedShaderBinaries(uint64_t key, uint32_t count, const VkShaderEXT* pShaders)
+{
+    const VkPhysicalDeviceShaderObjectPropertiesEXT* pProperties = &gfxDevice.properties.shaderObject;
+
+    char* pPath = getShaderCachePath(key, ".bincache");
+    char* pTempPath;
+    FILE* file = beginCacheEntry(pPath, pShaders, &pTempPath);
+    bool ok = file != NULL;
+
+    if (file) {
+        uint32_t header[] = {GFX_SHADER_BINARY_CACHE_MAGIC, GFX_SHADER_BINARY_CACHE_VERSION};
+        ok = fwrite(header, sizeof header, 1, file) == 1 && fwrite(&key, sizeof key, 1, file) == 1 &&
+             fwrite(pProperties->shaderBinaryUUID, sizeof pProperties->shaderBinaryUUID, 1, file) == 1 &&
+             fwrite(&pProperties->shaderBinaryVersion, sizeof pProperties->shaderBinaryVersion, 1, file) == 1 &&
+             fwrite(&count, sizeof count, 1, file) == 1;
+
+        for (uint32_t i = 0; ok && i < count; i++) {
+            size_t binarySize = 0;
+            ok = gfxDevice.fn.vkGetShaderBinaryDataEXT(gfxDevice.device, pShaders[i], &binarySize, NULL) ==
+                 VK_SUCCESS;
+
+            void* pBinary = ok ? GFX_MALLOC(binarySize) : NULL;
+            ok = ok && gfxDevice.fn.vkGetShaderBinaryDataEXT(gfxDevice.device, pShaders[i], &binarySize, pBinary) ==
+                           VK_SUCCESS;
+
+            uint64_t size = binarySize;
+            ok = ok && fwrite(&size, sizeof size, 1, file) == 1 && fwrite(pBinary, 1, binarySize, file) == binarySize;
+
+            GFX_FREE(pBinary);
+        }
     }
+
+    endCacheEntry(file, pTempPath, pPath, ok);
+    GFX_FREE(pPath);
 }
 
-void gfxDestroyBuffer(GfxBuffer* pBuffer)
+// Create shader objects, from their cached driver binaries if the shader
+// cache is enabled and has a valid entry. Otherwise they are created from
+// SPIR-V and their binaries are stored for the next run. pCacheHit and
+// pCacheMiss are set accordingly.
+static VkResult createShaderObjects(uint32_t count, const VkShaderCreateInfoEXT* pCreateInfos,
+                                    const uint64_t* pLayoutHashes, VkShaderEXT* pShaders, bool* pCacheHit,
+                                    bool* pCacheMiss)
 {
-    vkDeviceWaitIdle(gfxDevice.device);
+    *pCacheHit = false;
+    *pCacheMiss = false;
 
-    if (pBuffer->properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
-        vkUnmapMemory(gfxDevice.device, pBuffer->memory);
+    if (!gfxDevice.shaderCache.pDirectory) {
+        return gfxDevice.fn.vkCreateShadersEXT(gfxDevice.device, count, pCreateInfos, NULL, pShaders);
     }
 
-    vkDestroyBuffer(gfxDevice.device, pBuffer->buffer, NULL);
-    vkFreeMemory(gfxDevice.device, pBuffer->memory, NULL);
+    uint64_t key = getShaderBinaryCacheKey(count, pCreateInfos, pLayoutHashes);
 
-    GFX_RESET(pBuffer);
+    if (loadCachedShaderBinaries(key, count, pCreateInfos, pShaders)) {
+        *pCacheHit = true;
+        return VK_SUCCESS;
+    }
+
+    *pCacheMiss = true;
+
+    VkResult result = gfxDevice.fn.vkCreateShadersEXT(gfxDevice.device, count, pCreateInfos, NULL, pShaders);
+    if (result == VK_SUCCESS) {
+        storeCachedShaderBinaries(key, count, pShaders);
+    }
+
+    return result;
 }
 
-void gfxCopyBufferFromHost(const GfxBuffer* pBuffer, const void* pData, VkDeviceSize size, VkDeviceSize offset)
+// Count the instructions of a SPIR-V module. Each instruction starts with a
+// word holding its length in words in the upper half.
+static uint32_t countSpirvInstructions(const uint32_t* pCode, size_t codeSize)
 {
-    // Check if we need a staging buffer or not
-    if (!(pBuffer->properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
-        // Set up staging buffer
-        GfxBuffer staging;
-        gfxCreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging);
+    size_t wordCount = codeSize / sizeof(uint32_t);
+    uint32_t instructionCount = 0;
+
+    // Skip the header of five words
+    for (size_t i = 5; i < wordCount; i += GFX_MAX(pCode[i] >> 16, 1)) {
+        instructionCount++;
+    }
 
-        // Copy to staging buffer
-        gfxCopyBufferFromHost(&staging, pData, size, 0);
+    return instructionCount;
+}
 
-        // Transfer from staging buffer to this buffer
-        VkCommandBuffer cmd = gfxCmdBegin();
+// Optimize SPIR-V in place with SPIRV-Tools. The code is left as it is if the
+// optimizer fails.
+static void optimizeSpirv(const char* pPath, uint32_t** ppCode, size_t* pCodeSize)
+{
+    // The environment that matches the SPIR-V 1.6 target of glslang
+    spv_optimizer_t* optimizer = spvOptimizerCreate(SPV_ENV_VULKAN_1_3);
 
-        VkBufferCopy region = {
-            .dstOffset = offset,
-            .size = size,
-        };
-        vkCmdCopyBuffer(cmd, staging.buffer, pBuffer->buffer, 1, &region);
+    if (GFX_SPIRV_STRIP_DEBUG) {
+        spvOptimizerRegisterPassFromFlag(optimizer, "--strip-debug");
+    }
+    if (GFX_SPIRV_OPTIMIZE) {
+        spvOptimizerRegisterPerformancePasses(optimizer);
+    }
+
+    // glslang emits valid modules, so skip validating them again
+    spv_optimizer_options options = spvOptimizerOptionsCreate();
+    spvOptimizerOptionsSetRunValidator(options, false);
+
+    spv_binary binary = NULL;
+    spv_result_t result = spvOptimizerRun(optimizer, *ppCode, *pCodeSize / sizeof(uint32_t), &binary, options);
 
-        gfxCmdEnd(cmd);
+    if (result == SPV_SUCCESS) {
+        size_t codeSize = binary->wordCount * sizeof(uint32_t);
 
-        gfxDestroyBuffer(&staging);
+        GFX_INFO("Optimized shader: %s, %" PRIu32 " -> %" PRIu32 " instructions", pPath,
+                 countSpirvInstructions(*ppCode, *pCodeSize), countSpirvInstructions(binary->code, codeSize));
+
+        GFX_FREE(*ppCode);
+        *ppCode = GFX_MALLOC(codeSize);
+        memcpy(*ppCode, binary->code, codeSize);
+        *pCodeSize = codeSize;
     } else {
-        // Transfer directly without staging buffer
-        char* pOffsettedHostMap = (char*)pBuffer->pHostMap + offset;
-        memcpy(pOffsettedHostMap, pData, size);
+        GFX_WARNING("Unable to optimize shader %s, using it unoptimized", pPath);
     }
+
+    spvBinaryDestroy(binary);
+    spvOptimizerOptionsDestroy(options);
+    spvOptimizerDestroy(optimizer);
 }
 
-VkWriteDescriptorSet gfxGetBufferDescriptor(const GfxBuffer* pBuffer, uint32_t binding, VkDescriptorType type,
-                                            VkDeviceSize offset, VkDeviceSize range,
-                                            VkDescriptorBufferInfo* pBufferInfo)
+// Outcome of compiling a GLSL file. On failure pCode is NULL and pError says
+// why.
+struct GfxCompileResult {
+    uint32_t* pCode;
+    size_t codeSize;
+    char* pError;
+    bool cacheHit;
+    bool cacheMiss;
+};
+
+// Compile a GLSL file to SPIR-V, through the shader cache if it is enabled.
+// Errors are returned rather than raised and shared state is only read, so
+// several files can be compiled at once.
+static struct GfxCompileResult compileFileGLSL(const char* pPath, VkShaderStageFlagBits stage, const char* pPreamble)
 {
-    *pBufferInfo = (VkDescriptorBufferInfo){
-        .buffer = pBuffer->buffer,
-        .offset = offset,
-        .range = range,
+    struct GfxCompileResult result = {0};
+
+    // Read file
+    char* pShaderSource = readFile(pPath, NULL);
+    if (!pShaderSource) {
+        result.pError = formatString("Unable to open %s", pPath);
+        return result;
+    }
+
+    // Compile GLSL to SPIR-V
+    glslang_target_client_version_t glslangVersion = GLSLANG_TARGET_VULKAN_1_0;
+    switch (VK_VERSION_MAJOR(gfxDevice.apiVersion)) {
+    case 1:
+        switch (VK_VERSION_MINOR(gfxDevice.apiVersion)) {
+        case 0:
+            glslangVersion = GLSLANG_TARGET_VULKAN_1_0;
+            break;
+        case 1:
+            glslangVersion = GLSLANG_TARGET_VULKAN_1_1;
+            break;
+        case 2:
+            glslangVersion = GLSLANG_TARGET_VULKAN_1_2;
+            break;
+        case 3:
+            glslangVersion = GLSLANG_TARGET_VULKAN_1_3;
+            break;
+        case 4:
+            glslangVersion = GLSLANG_TARGET_VULKAN_1_4;
+            break;
+        }
+        break;
+    }
+
+    glslang_stage_t glslangStage = GLSLANG_STAGE_VERTEX;
+    switch (stage) {
+    case VK_SHADER_STAGE_VERTEX_BIT:
+        glslangStage = GLSLANG_STAGE_VERTEX;
+        break;
+    case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
+        glslangStage = GLSLANG_STAGE_TESSCONTROL;
+        break;
+    case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
+        glslangStage = GLSLANG_STAGE_TESSEVALUATION;
+        break;
+    case VK_SHADER_STAGE_GEOMETRY_BIT:
+        glslangStage = GLSLANG_STAGE_GEOMETRY;
+        break;
+    case VK_SHADER_STAGE_FRAGMENT_BIT:
+        glslangStage = GLSLANG_STAGE_FRAGMENT;
+        break;
+    case VK_SHADER_STAGE_COMPUTE_BIT:
+        glslangStage = GLSLANG_STAGE_COMPUTE;
+        break;
+    case VK_SHADER_STAGE_RAYGEN_BIT_KHR:
+        glslangStage = GLSLANG_STAGE_RAYGEN;
+        break;
+    case VK_SHADER_STAGE_INTERSECTION_BIT_KHR:
+        glslangStage = GLSLANG_STAGE_INTERSECT;
+        break;
+    case VK_SHADER_STAGE_ANY_HIT_BIT_NV:
+        glslangStage = GLSLANG_STAGE_ANYHIT;
+        break;
+    case VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR:
+        glslangStage = GLSLANG_STAGE_CLOSESTHIT;
+        break;
+    case VK_SHADER_STAGE_MISS_BIT_KHR:
+        glslangStage = GLSLANG_STAGE_MISS;
+        break;
+    case VK_SHADER_STAGE_CALLABLE_BIT_KHR:
+        glslangStage = GLSLANG_STAGE_CALLABLE;
+        break;
+    case VK_SHADER_STAGE_TASK_BIT_EXT:
+        glslangStage = GLSLANG_STAGE_TASK;
+        break;
+    case VK_SHADER_STAGE_MESH_BIT_EXT:
+        glslangStage = GLSLANG_STAGE_MESH;
+        break;
+    }
+
+    struct GfxIncludeContext includes = {.pRootPath = pPath};
+
+    const glslang_input_t input = {
+        .language = GLSLANG_SOURCE_GLSL,
+        .stage = glslangStage,
+        .client = GLSLANG_CLIENT_VULKAN,
+        .client_version = glslangVersion,
+        .target_language = GLSLANG_TARGET_SPV,
+        .target_language_version = GLSLANG_TARGET_SPV_1_6,
+        .code = pShaderSource,
+        .default_version = 100,
+        .default_profile = GLSLANG_NO_PROFILE,
+        .force_default_version_and_profile = false,
+        .forward_compatible = false,
+        .messages = GLSLANG_MSG_DEFAULT_BIT,
+        .resource = glslang_default_resource(),
+        .callbacks = {.include_system = includeFile,
+                      .include_local = includeFile,
+                      .free_include_result = freeIncludeResult},
+        .callbacks_ctx = &includes,
     };
 
-    return (VkWriteDescriptorSet){
-        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstBinding = binding,
-        .dstArrayElement = 0,
-        .descriptorCount = 1,
-        .descriptorType = type,
-        .pBufferInfo = pBufferInfo,
+    // Skip compilation entirely if the SPIR-V is cached
+    uint64_t key = 0;
+    if (gfxDevice.shaderCache.pDirectory) {
+        key = getShaderCacheKey(pPath, pPreamble, &input);
+        result.pCode = loadCachedSpirv(key, &result.codeSize);
+        result.cacheHit = result.pCode != NULL;
+        result.cacheMiss = !result.cacheHit;
+
+        if (result.cacheHit) {
+            GFX_FREE(pShaderSource);
+            return result;
+        }
+    }
+
+    glslang_shader_t* shader = glslang_shader_create(&input);
+    glslang_program_t* program = glslang_program_create();
+
+    if (pPreamble) {
+        glslang_shader_set_preamble(shader, pPreamble);
+    }
+
+    if (!glslang_shader_preprocess(shader, &input)) {
+        result.pError = formatString("GLSL preprocessing failed %s\n%s\n%s", pPath, glslang_shader_get_info_log(shader),
+                                     glslang_shader_get_info_debug_log(shader));
+    } else if (!glslang_shader_parse(shader, &input)) {
+        result.pError = formatString("GLSL parsing failed %s\n%s\n%s\n%s", pPath, glslang_shader_get_info_log(shader),
+                                     glslang_shader_get_info_debug_log(shader),
+                                     glslang_shader_get_preprocessed_code(shader));
+    } else {
+        glslang_program_add_shader(program, shader);
+
+        if (!glslang_program_link(program, GLSLANG_MSG_SPV_RULES_BIT | GLSLANG_MSG_VULKAN_RULES_BIT)) {
+            result.pError = formatString("GLSL linking failed %s\n%s\n%s", pPath, glslang_program_get_info_log(program),
+                                         glslang_program_get_info_debug_log(program));
+        }
+    }
+
+    if (!result.pError) {
+        glslang_program_SPIRV_generate(program, glslangStage);
+
+        result.codeSize = glslang_program_SPIRV_get_size(program) * sizeof(uint32_t);
+        result.pCode = GFX_MALLOC(result.codeSize);
+        memset(result.pCode, 0, result.codeSize);
+        glslang_program_SPIRV_get(program, result.pCode);
+
+        const char* spirvMessages = glslang_program_SPIRV_get_messages(program);
+        if (spirvMessages) {
+            result.pError = formatString("(%s) %s", pPath, spirvMessages);
+            GFX_FREE(result.pCode);
+            result.pCode = NULL;
+        } else {
+            // Cache entries hold the optimized code
+            if (GFX_SPIRV_OPTIMIZE || GFX_SPIRV_STRIP_DEBUG) {
+                optimizeSpirv(pPath, &result.pCode, &result.codeSize);
+            }
+
+            if (gfxDevice.shaderCache.pDirectory) {
+                storeCachedSpirv(key, &includes, result.pCode, result.codeSize);
+            }
+        }
+    }
+
+    glslang_program_delete(program);
+    glslang_shader_delete(shader);
+
+    for (uint32_t i = 0; i < includes.fileCount; i++) {
+        GFX_FREE(includes.pFiles[i].pPath);
+    }
+    GFX_FREE(includes.pFiles);
+
+    GFX_FREE(pShaderSource);
+
+    return result;
+}
+
+void gfxCreateShaderFromFileGLSL(const char* pPath, VkShaderStageFlagBits stage, VkShaderStageFlags nextStage,
+                                 const GfxLayout* pLayout, GfxShader* pShader)
+{
+    size_t sz = strlen(pPath) + 1;
+
+    *pShader = (GfxShader){
+        .pPath = GFX_MALLOC(sz),
     };
+
+    memcpy(pShader->pPath, pPath, sz);
+
+    struct GfxCompileResult result = compileFileGLSL(pShader->pPath, stage, NULL);
+
+    gfxDevice.shaderCache.hits += result.cacheHit;
+    gfxDevice.shaderCache.misses += result.cacheMiss;
+
+    if (result.pError) {
+        GFX_ERROR("%s", result.pError);
+        GFX_FREE(result.pError);
+        return;
+    }
+
+    createShader(pShader, result.pCode, result.codeSize, stage, nextStage, pLayout);
+
+    GFX_FREE(result.pCode);
 }
 
-void gfxCreateImage(VkExtent3D extent, uint32_t arrayLayers, uint32_t mipLevels, VkSampleCountFlagBits samples,
-                    VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkImageCreateFlags flags,
-                    VkImageType imageType, VkMemoryPropertyFlags properties, GfxImage* pImage)
+// A shader of gfxCreateShadersFromFilesGLSL(), compiled and built by a job
+struct GfxShaderJob {
+    const GfxShaderFileInfo* pInfo;
+    GfxShader* pShader;
+    struct GfxCompileResult result;
+    bool binaryCacheHit;
+    bool binaryCacheMiss;
+};
+
+static void compileAndBuildShader(void* pData)
+{
+    struct GfxShaderJob* pJob = pData;
+    const GfxShaderFileInfo* pInfo = pJob->pInfo;
+
+    pJob->result = compileFileGLSL(pInfo->pPath, pInfo->stage, NULL);
+    if (pJob->result.pError) {
+        return;
+    }
+
+    createShader(pJob->pShader, pJob->result.pCode, pJob->result.codeSize, pInfo->stage, pInfo->nextStage,
+                 pInfo->pLayout);
+
+    GFX_FREE(pJob->result.pCode);
+    pJob->result.pCode = NULL;
+
+    // Creating objects does not need external synchronization of the device
+    GfxShader* pShader = pJob->pShader;
+    VkResult result = createShaderObjects(1, &pShader->createInfo, &pShader->layoutHash, &pShader->shader,
+                                          &pJob->binaryCacheHit, &pJob->binaryCacheMiss);
+    if (result != VK_SUCCESS) {
+        pJob->result.pError = formatString("Failed to build shader %s: %s", pInfo->pPath, gfxResultString(result));
+    }
+}
+
+uint32_t gfxCreateShadersFromFilesGLSL(uint32_t count, const GfxShaderFileInfo* pInfos, GfxShader* pShaders,
+                                       char** ppErrors)
 {
     if (!gfxDevice.device) {
         GFX_ERROR("Device not initialized");
     }
 
-    *pImage = (GfxImage){
-        .width = extent.width,
-        .height = extent.height,
-        .depth = extent.depth,
-        .arrayLayers = arrayLayers,
-        .mipLevels = mipLevels,
-        .format = format,
-        .tiling = tiling,
-        .imageType = imageType,
-        .samples = samples,
-    };
+    if (!count) {
+        return 0;
+    }
+
+    GFX_INFO("Building %" PRIu32 " shaders on %" PRIu32 " threads", count, getThreadPool()->threadCount + 1);
+
+    struct GfxShaderJob* pJobs = GFX_MALLOC(count * sizeof *pJobs);
+    struct GfxJobGroup group = {0};
+
+    for (uint32_t i = 0; i < count; i++) {
+        size_t sz = strlen(pInfos[i].pPath) + 1;
+
+        pShaders[i] = (GfxShader){
+            .pPath = GFX_MALLOC(sz),
+        };
+
+        memcpy(pShaders[i].pPath, pInfos[i].pPath, sz);
+
+        pJobs[i] = (struct GfxShaderJob){
+            .pInfo = &pInfos[i],
+            .pShader = &pShaders[i],
+        };
+
+        submitJob(&group, compileAndBuildShader, &pJobs[i]);
+    }
+
+    waitJobGroup(&group);
+
+    uint32_t failedCount = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        struct GfxCompileResult* pResult = &pJobs[i].result;
+
+        gfxDevice.shaderCache.hits += pResult->cacheHit;
+        gfxDevice.shaderCache.misses += pResult->cacheMiss;
+        gfxDevice.shaderCache.binaryHits += pJobs[i].binaryCacheHit;
+        gfxDevice.shaderCache.binaryMisses += pJobs[i].binaryCacheMiss;
+
+        if (pResult->pError) {
+            failedCount++;
+
+            if (!ppErrors) {
+                GFX_WARNING("%s", pResult->pError);
+            }
+
+            // Nothing was built, so there is nothing to defer
+            GFX_FREE(pShaders[i].pCode);
+            GFX_FREE(pShaders[i].pPath);
+            GFX_FREE(pShaders[i].pPushConstantRanges);
+            GFX_RESET(&pShaders[i]);
+        }
 
-    VkImageCreateInfo ci = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .flags = flags,
-        .imageType = imageType,
-        .format = format,
-        .extent = extent,
-        .mipLevels = mipLevels,
-        .arrayLayers = arrayLayers,
-        .samples = samples,
-        .tiling = tiling,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-    };
+        if (ppErrors) {
+            ppErrors[i] = pResult->pError;
+        } else {
+            GFX_FREE(pResult->pError);
+        }
+    }
 
-    VK_CHECK(vkCreateImage(gfxDevice.device, &ci, NULL, &pImage->image));
+    GFX_FREE(pJobs);
 
-    VkMemoryRequirements memReqs;
-    vkGetImageMemoryRequirements(gfxDevice.device, pImage->image, &memReqs);
+    return failedCount;
+}
 
-    VkMemoryAllocateInfo allocInfo = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memReqs.size,
-        .memoryTypeIndex = gfxFindMemoryType(memReqs.memoryTypeBits, properties),
+void gfxFreeShaderErrors(uint32_t count, char** ppErrors)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        GFX_FREE(ppErrors[i]);
+        ppErrors[i] = NULL;
+    }
+}
+
+void gfxCreateShaderPermutations(const char* pPath, VkShaderStageFlagBits stage, VkShaderStageFlags nextStage,
+                                 const GfxLayout* pLayout, uint32_t defineCount, const char* const* ppDefines,
+                                 GfxShaderPermutations* pPermutations)
+{
+    if (defineCount > 64) {
+        GFX_ERROR("Shader permutations support at most 64 defines, %" PRIu32 " given", defineCount);
+    }
+
+    size_t sz = strlen(pPath) + 1;
+
+    *pPermutations = (GfxShaderPermutations){
+        .pPath = GFX_MALLOC(sz),
+        .stage = stage,
+        .nextStage = nextStage,
+        .pLayout = pLayout,
+        .defineCount = defineCount,
     };
 
-    VK_CHECK(vkAllocateMemory(gfxDevice.device, &allocInfo, NULL, &pImage->memory));
+    memcpy(pPermutations->pPath, pPath, sz);
+
+    if (defineCount) {
+        pPermutations->ppDefines = GFX_MALLOC(defineCount * sizeof *pPermutations->ppDefines);
+    }
 
-    VK_CHECK(vkBindImageMemory(gfxDevice.device, pImage->image, pImage->memory, 0));
+    for (uint32_t i = 0; i < defineCount; i++) {
+        size_t defineSize = strlen(ppDefines[i]) + 1;
+        pPermutations->ppDefines[i] = GFX_MALLOC(defineSize);
+        memcpy(pPermutations->ppDefines[i], ppDefines[i], defineSize);
+    }
 }
 
-void gfxDestroyImage(GfxImage* pImage)
+// Get the preamble that defines the selected defines of permutations
+static char* getPermutationPreamble(const GfxShaderPermutations* pPermutations, uint64_t defineMask)
 {
-    vkDeviceWaitIdle(gfxDevice.device);
+    size_t size = 1;
+    for (uint32_t i = 0; i < pPermutations->defineCount; i++) {
+        if (defineMask & (1ull << i)) {
+            size += strlen(pPermutations->ppDefines[i]) + sizeof "#define  1\n";
+        }
+    }
 
-    vkFreeMemory(gfxDevice.device, pImage->memory, NULL);
-    vkDestroyImageView(gfxDevice.device, pImage->imageView, NULL);
-    vkDestroyImage(gfxDevice.device, pImage->image, NULL);
+    char* pPreamble = GFX_MALLOC(size);
+    size_t length = 0;
+    pPreamble[0] = 0;
 
-    GFX_RESET(pImage);
+    for (uint32_t i = 0; i < pPermutations->defineCount; i++) {
+        if (defineMask & (1ull << i)) {
+            length += snprintf(pPreamble + length, size - length, "#define %s 1\n", pPermutations->ppDefines[i]);
+        }
+    }
+
+    return pPreamble;
 }
 
-void gfxCreateImageView(GfxImage* pImage, VkImageAspectFlags aspectFlags, VkImageViewType viewType)
+GfxShader* gfxGetShaderPermutation(GfxShaderPermutations* pPermutations, uint64_t defineMask)
 {
     if (!gfxDevice.device) {
         GFX_ERROR("Device not initialized");
     }
 
-    pImage->viewType = viewType;
+    // Bits beyond the defines select nothing
+    if (pPermutations->defineCount < 64) {
+        defineMask &= (1ull << pPermutations->defineCount) - 1;
+    }
 
-    VkImageViewCreateInfo ci = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image = pImage->image,
-        .viewType = viewType,
-        .format = pImage->format,
-        .components = {.r = VK_COMPONENT_SWIZZLE_IDENTITY,
-                       .g = VK_COMPONENT_SWIZZLE_IDENTITY,
-                       .b = VK_COMPONENT_SWIZZLE_IDENTITY,
-                       .a = VK_COMPONENT_SWIZZLE_IDENTITY},
-        .subresourceRange = {.aspectMask = aspectFlags,
-                             .baseMipLevel = 0,
-                             .levelCount = pImage->mipLevels,
-                             .baseArrayLayer = 0,
-                             .layerCount = pImage->arrayLayers},
-    };
+    for (uint32_t i = 0; i < pPermutations->variantCount; i++) {
+        if (pPermutations->pMasks[i] == defineMask) {
+            return pPermutations->ppShaders[i];
+        }
+    }
 
-    VK_CHECK(vkCreateImageView(gfxDevice.device, &ci, NULL, &pImage->imageView));
-}
+    char* pPreamble = getPermutationPreamble(pPermutations, defineMask);
+    struct GfxCompileResult result = compileFileGLSL(pPermutations->pPath, pPermutations->stage, pPreamble);
 
-static void generateMipmaps(GfxTexture* pTexture)
-{
-    VkFormatProperties props;
-    vkGetPhysicalDeviceFormatProperties(gfxDevice.physicalDevice, pTexture->image.format, &props);
+    gfxDevice.shaderCache.hits += result.cacheHit;
+    gfxDevice.shaderCache.misses += result.cacheMiss;
 
-    if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-        GFX_ERROR("Texture image format does not support linear blitting");
+    if (result.pError) {
+        GFX_WARNING("%s", result.pError);
+        GFX_FREE(result.pError);
+        GFX_FREE(pPreamble);
+        return NULL;
     }
 
-    VkCommandBuffer cmd = gfxCmdBegin();
+    size_t sz = strlen(pPermutations->pPath) + 1;
 
-    VkImageSubresourceRange subresourceRange = {
-        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .levelCount = 1,
-        .baseArrayLayer = 0,
-        .layerCount = pTexture->image.arrayLayers,
+    GfxShader* pShader = GFX_MALLOC(sizeof *pShader);
+    *pShader = (GfxShader){
+        .pPath = GFX_MALLOC(sz),
+        .pPreamble = pPreamble,
     };
 
-    int32_t mipWidth = pTexture->image.width;
-    int32_t mipHeight = pTexture->image.height;
-    int32_t mipDepth = pTexture->image.depth;
-
-    for (uint32_t i = 1; i < pTexture->image.mipLevels; i++) {
-        subresourceRange.baseMipLevel = i - 1;
+    memcpy(pShader->pPath, pPermutations->pPath, sz);
 
-        gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_TRANSFER_WRITE_BIT,
-                        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                        pTexture->image.image, &subresourceRange);
+    createShader(pShader, result.pCode, result.codeSize, pPermutations->stage, pPermutations->nextStage,
+                 pPermutations->pLayout);
+    GFX_FREE(result.pCode);
 
-        VkImageBlit2 region = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2,
-            .srcSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                               .mipLevel = i - 1,
-                               .baseArrayLayer = 0,
-                               .layerCount = pTexture->image.arrayLayers},
-            .srcOffsets = {{0, 0, 0}, {mipWidth, mipHeight, mipDepth}},
-            .dstSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                               .mipLevel = i,
-                               .baseArrayLayer = 0,
-                               .layerCount = pTexture->image.arrayLayers},
-            .dstOffsets = {{0, 0, 0},
-                           {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1,
-                            mipDepth > 1 ? mipDepth / 2 : 1}},
-        };
+    gfxBuildShader(pShader);
 
-        VkBlitImageInfo2 blitImageInfo = {
-            .sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2,
-            .srcImage = pTexture->image.image,
-            .srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            .dstImage = pTexture->image.image,
-            .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            .regionCount = 1,
-            .pRegions = &region,
-            .filter = VK_FILTER_LINEAR,
-        };
+    if (pPermutations->variantCount == pPermutations->variantCapacity) {
+        pPermutations->variantCapacity = GFX_MAX(8, 2 * pPermutations->variantCapacity);
+        pPermutations->pMasks =
+            GFX_REALLOC(pPermutations->pMasks, pPermutations->variantCapacity * sizeof *pPermutations->pMasks);
+        pPermutations->ppShaders =
+            GFX_REALLOC(pPermutations->ppShaders, pPermutations->variantCapacity * sizeof *pPermutations->ppShaders);
+    }
 
-        vkCmdBlitImage2(cmd, &blitImageInfo);
+    pPermutations->pMasks[pPermutations->variantCount] = defineMask;
+    pPermutations->ppShaders[pPermutations->variantCount] = pShader;
+    pPermutations->variantCount++;
 
-        gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT,
-                        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
-                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                        pTexture->image.image, &subresourceRange);
+    return pShader;
+}
 
-        if (mipWidth > 1) {
-            mipWidth /= 2;
-        }
-        if (mipHeight > 1) {
-            mipHeight /= 2;
-        }
-        if (mipDepth > 1) {
-            mipDepth /= 2;
-        }
+void gfxDestroyShaderPermutations(GfxShaderPermutations* pPermutations)
+{
+    for (uint32_t i = 0; i < pPermutations->variantCount; i++) {
+        gfxDestroyShader(pPermutations->ppShaders[i]);
+        GFX_FREE(pPermutations->ppShaders[i]);
     }
 
-    subresourceRange.baseMipLevel = pTexture->image.mipLevels - 1;
+    for (uint32_t i = 0; i < pPermutations->defineCount; i++) {
+        GFX_FREE(pPermutations->ppDefines[i]);
+    }
 
-    gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                    VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
-                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                    pTexture->image.image, &subresourceRange);
+    GFX_FREE(pPermutations->ppDefines);
+    GFX_FREE(pPermutations->pMasks);
+    GFX_FREE(pPermutations->ppShaders);
+    GFX_FREE(pPermutations->pPath);
 
-    gfxCmdEnd(cmd);
+    GFX_RESET(pPermutations);
 }
 
-static void createTexture(GfxTexture* pTexture, enum GfxTextureType type, VkFormat format, const void* pData,
-                          VkExtent3D extent, uint32_t channels, bool mipmaps)
+void gfxSetShaderCacheDirectory(const char* pDirectory)
 {
-    VkImageType imageType;
-    VkImageViewType viewType;
-    VkImageCreateFlags flags = 0;
-    uint32_t arrayLayers = 1;
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
 
-    switch (type) {
-    case GFX_TEXTURE_1D:
-        imageType = VK_IMAGE_TYPE_1D;
-        viewType = VK_IMAGE_VIEW_TYPE_1D;
-        break;
-    case GFX_TEXTURE_2D:
-        imageType = VK_IMAGE_TYPE_2D;
-        viewType = VK_IMAGE_VIEW_TYPE_2D;
-        break;
-    case GFX_TEXTURE_3D:
-        imageType = VK_IMAGE_TYPE_3D;
-        viewType = VK_IMAGE_VIEW_TYPE_3D;
-        break;
-    case GFX_TEXTURE_CUBE_MAP:
-        // A cube map is six 2D layers, with pData holding the faces in the
-        // order +X, -X, +Y, -Y, +Z, -Z
-        imageType = VK_IMAGE_TYPE_2D;
-        viewType = VK_IMAGE_VIEW_TYPE_CUBE;
-        flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
-        arrayLayers = 6;
-        break;
-    default:
-        GFX_ERROR("Unknown texture type");
-        return;
+    GFX_FREE(gfxDevice.shaderCache.pDirectory);
+    gfxDevice.shaderCache.pDirectory = NULL;
+
+    if (pDirectory) {
+        size_t sz = strlen(pDirectory) + 1;
+        gfxDevice.shaderCache.pDirectory = GFX_MALLOC(sz);
+        memcpy(gfxDevice.shaderCache.pDirectory, pDirectory, sz);
     }
+}
 
-    if (imageType != VK_IMAGE_TYPE_3D && extent.depth != 1) {
-        GFX_ERROR("Only 3D textures can have a depth other than 1");
+void gfxGetShaderCacheStats(uint32_t* pHits, uint32_t* pMisses)
+{
+    if (pHits) {
+        *pHits = gfxDevice.shaderCache.hits;
     }
-    if (imageType == VK_IMAGE_TYPE_1D && extent.height != 1) {
-        GFX_ERROR("1D textures must have a height of 1");
+    if (pMisses) {
+        *pMisses = gfxDevice.shaderCache.misses;
     }
+}
 
-    uint32_t mipLevels = 1;
-    if (mipmaps) {
-        uint32_t largest = GFX_MAX(extent.width, extent.height);
-        if (imageType == VK_IMAGE_TYPE_3D) {
-            largest = GFX_MAX(largest, extent.depth);
-        }
-        mipLevels = (uint32_t)floor(log2(largest)) + 1;
+void gfxGetShaderBinaryCacheStats(uint32_t* pHits, uint32_t* pMisses)
+{
+    if (pHits) {
+        *pHits = gfxDevice.shaderCache.binaryHits;
     }
+    if (pMisses) {
+        *pMisses = gfxDevice.shaderCache.binaryMisses;
+    }
+}
 
-    gfxCreateImage(extent, arrayLayers, mipLevels, VK_SAMPLE_COUNT_1_BIT, format, VK_IMAGE_TILING_OPTIMAL,
-                   VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                   flags, imageType, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pTexture->image);
-
-    if (pData) {
-        // Widen before multiplying, so large textures do not overflow. Note
-        // that this assumes one byte per channel.
-        VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * extent.depth * arrayLayers * channels;
-
-        GfxBuffer staging;
-        gfxCreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging);
+// Recompile and build a watched shader, along with the shader it is linked
+// with
+static void rebuildShaders(void* pData)
+{
+    struct GfxShaderReload* pReload = pData;
 
-        gfxCopyBufferFromHost(&staging, pData, size, 0);
+    VkShaderCreateInfoEXT createInfos[GFX_ARRAY_LEN(pReload->pShaders)];
+    uint64_t layoutHashes[GFX_ARRAY_LEN(pReload->pShaders)];
+    bool changed = false;
 
-        VkCommandBuffer cmd = gfxCmdBegin();
+    for (uint32_t i = 0; i < pReload->shaderCount; i++) {
+        const GfxShader* pShader = pReload->pShaders[i];
 
-        gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
-                        VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                        pTexture->image.image, NULL);
+        createInfos[i] = pShader->createInfo;
+        layoutHashes[i] = pShader->layoutHash;
+        if (pReload->shaderCount > 1) {
+            createInfos[i].flags |= VK_SHADER_CREATE_LINK_STAGE_BIT_EXT;
+        }
 
-        VkBufferImageCopy region = {
-            .bufferOffset = 0,
-            .bufferRowLength = 0,
-            .bufferImageHeight = 0,
-            .imageSubresource = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                                 .mipLevel = 0,
-                                 .baseArrayLayer = 0,
-                                 .layerCount = arrayLayers},
-            .imageOffset = {0, 0, 0},
-            .imageExtent = extent,
-        };
+        if (!pReload->recompile[i]) {
+            continue;
+        }
 
-        vkCmdCopyBufferToImage(cmd, staging.buffer, pTexture->image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
-                               &region);
+        struct GfxCompileResult result = compileFileGLSL(pShader->pPath, pShader->createInfo.stage, pShader->pPreamble);
+        pReload->cacheHits += result.cacheHit;
+        pReload->cacheMisses += result.cacheMiss;
 
-        gfxCmdEnd(cmd);
+        if (result.pError) {
+            pReload->pError = result.pError;
+            return;
+        }
 
-        if (mipmaps) {
-            generateMipmaps(pTexture);
-        } else {
-            cmd = gfxCmdBegin();
-            gfxImageBarrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                            VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT,
-                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                            pTexture->image.image, NULL);
-            gfxCmdEnd(cmd);
+        // Saving the file unchanged, or changing a file it does not include,
+        // results in the same code
+        if (result.codeSize == pShader->createInfo.codeSize &&
+            memcmp(result.pCode, pShader->createInfo.pCode, result.codeSize) == 0) {
+            GFX_FREE(result.pCode);
+            continue;
         }
 
-        gfxDestroyBuffer(&staging);
+        pReload->pCode[i] = result.pCode;
+        pReload->codeSize[i] = result.codeSize;
+        createInfos[i].pCode = result.pCode;
+        createInfos[i].codeSize = result.codeSize;
+        changed = true;
     }
 
-    gfxCreateImageView(&pTexture->image, VK_IMAGE_ASPECT_COLOR_BIT, viewType);
+    if (!changed) {
+        return;
+    }
 
-    pTexture->imageInfo = (VkDescriptorImageInfo){
-        .sampler = NULL,
-        .imageView = pTexture->image.imageView,
-        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-    };
+    VkResult result = createShaderObjects(pReload->shaderCount, createInfos, layoutHashes, pReload->shaders,
+                                          &pReload->binaryCacheHit, &pReload->binaryCacheMiss);
+    if (result != VK_SUCCESS) {
+        pReload->pError = formatString("Failed to build shader %s: %s", pReload->pShaders[0]->pPath,
+                                       gfxResultString(result));
+
+        for (uint32_t i = 0; i < pReload->shaderCount; i++) {
+            if (pReload->shaders[i]) {
+                gfxDevice.fn.vkDestroyShaderEXT(gfxDevice.device, pReload->shaders[i], NULL);
+                pReload->shaders[i] = VK_NULL_HANDLE;
+            }
+        }
+    }
 }
 
-static void createSampler(GfxTexture* pTexture)
+// Swap in the rebuilt shaders of a completed reload. Returns the number of
+// shaders that were recompiled.
+static uint32_t swapShaderReload(struct GfxShaderReload* pReload)
 {
-    if (pTexture->sampler) {
-        /* Delete old sampler first */
-        vkDeviceWaitIdle(gfxDevice.device);
-        vkDestroySampler(gfxDevice.device, pTexture->sampler, NULL);
-    } else {
-        /* First time, use defaults */
-        pTexture->magFilter = VK_FILTER_LINEAR;
-        pTexture->minFilter = VK_FILTER_LINEAR;
-        pTexture->addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        pTexture->addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        pTexture->addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        pTexture->mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    gfxDevice.shaderCache.hits += pReload->cacheHits;
+    gfxDevice.shaderCache.misses += pReload->cacheMisses;
+    gfxDevice.shaderCache.binaryHits += pReload->binaryCacheHit;
+    gfxDevice.shaderCache.binaryMisses += pReload->binaryCacheMiss;
+
+    uint32_t swapCount = 0;
+
+    if (pReload->pError) {
+        GFX_WARNING("%s", pReload->pError);
+    } else if (pReload->shaders[0]) {
+        for (uint32_t i = 0; i < pReload->shaderCount; i++) {
+            GfxShader* pShader = pReload->pShaders[i];
+
+            // Frames in flight may still use the previous shader object
+            deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_SHADER, .shader = pShader->shader});
+            pShader->shader = pReload->shaders[i];
+            pReload->shaders[i] = VK_NULL_HANDLE;
+
+            if (pReload->pCode[i]) {
+                GFX_FREE(pShader->pCode);
+                pShader->pCode = pReload->pCode[i];
+                pShader->createInfo.pCode = pShader->pCode;
+                pShader->createInfo.codeSize = pReload->codeSize[i];
+                pReload->pCode[i] = NULL;
+
+                GFX_INFO("Reloaded shader: %s", pShader->pPath);
+                swapCount++;
+            }
+        }
     }
-    VkSamplerCreateInfo ci = {
-        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-        .magFilter = pTexture->magFilter,
-        .minFilter = pTexture->minFilter,
-        .addressModeU = pTexture->addressModeU,
-        .addressModeV = pTexture->addressModeV,
-        .addressModeW = pTexture->addressModeW,
-        .anisotropyEnable = gfxDevice.samplerAnisotropy,
-        .maxAnisotropy =
-            gfxDevice.samplerAnisotropy ? gfxDevice.properties.physicalDevice.limits.maxSamplerAnisotropy : 1.0f,
-        .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
-        .unnormalizedCoordinates = VK_FALSE,
-        .compareEnable = VK_FALSE,
-        .compareOp = VK_COMPARE_OP_ALWAYS,
-        .mipmapMode = pTexture->mipmapMode,
-        .minLod = 0.0f,
-        .maxLod = (float)pTexture->image.mipLevels,
-        .mipLodBias = 0.0f,
-    };
-    VK_CHECK(vkCreateSampler(gfxDevice.device, &ci, NULL, &pTexture->sampler));
-    pTexture->imageInfo.sampler = pTexture->sampler;
+
+    discardShaderReload(pReload);
+
+    return swapCount;
 }
 
-void gfxCreateTexture(enum GfxTextureType type, VkFormat format, const void* pData, VkExtent3D extent,
-                      uint32_t channels, bool generateMipmaps, GfxTexture* pTexture)
+#if GFX_LINUX
+// Mark the watched shaders affected by a change to a file in a watched
+// directory: the shader compiled from the file, or otherwise all shaders in
+// the directory, since they may include it
+static void markChangedShaders(struct GfxShaderWatcher* pWatcher, int watch, const char* pName)
 {
-    GFX_RESET(pTexture);
+    bool matched = false;
+
+    for (uint32_t i = 0; i < pWatcher->shaderCount; i++) {
+        struct GfxWatchedShader* pWatched = &pWatcher->pShaders[i];
+        if (pWatched->watch != watch) {
+            continue;
+        }
+
+        char* pPath = joinRelativePath(pWatched->pShader->pPath, pName);
+        if (strcmp(pPath, pWatched->pShader->pPath) == 0) {
+            pWatched->changed = true;
+            matched = true;
+        }
+        GFX_FREE(pPath);
+    }
 
-    createTexture(pTexture, type, format, pData, extent, channels, generateMipmaps);
-    createSampler(pTexture);
+    // Skip the hidden and backup files that editors write while saving
+    size_t nameLength = strlen(pName);
+    if (matched || pName[0] == '.' || pName[nameLength - 1] == '~') {
+        return;
+    }
+
+    for (uint32_t i = 0; i < pWatcher->shaderCount; i++) {
+        if (pWatcher->pShaders[i].watch == watch) {
+            pWatcher->pShaders[i].changed = true;
+        }
+    }
 }
+#endif
 
-#ifdef GFX_USE_STB_IMAGE
-void gfxCreateTextureFromFile(enum GfxTextureType type, VkFormat format, const char* pPath, bool generateMipmaps,
-                              GfxTexture* pTexture)
+void gfxWatchShader(GfxShader* pShader)
 {
-    GFX_RESET(pTexture);
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
 
-    if (type != GFX_TEXTURE_2D) {
-        GFX_ERROR("Only GFX_TEXTURE_2D can be loaded from a single image file");
+    if (!pShader->pPath) {
+        GFX_WARNING("Only shaders created from a GLSL file can be watched");
         return;
     }
 
-    GFX_INFO("Loading texture from %s", pPath);
+    struct GfxShaderWatcher* pWatcher = gfxDevice.pShaderWatcher;
 
-    stbi_set_flip_vertically_on_load(1);
+    if (!pWatcher) {
+        pWatcher = GFX_MALLOC(sizeof *pWatcher);
+        memset(pWatcher, 0, sizeof *pWatcher);
+        pWatcher->fd = -1;
 
-    int width, height, channels;
+#if GFX_LINUX
+        pWatcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (pWatcher->fd < 0) {
+            GFX_WARNING("Unable to watch shaders for changes: %s", strerror(errno));
+        }
+#else
+        GFX_WARNING("Watching shaders for changes is not supported on this platform");
+#endif
 
-    stbi_uc* pData = stbi_load(pPath, &width, &height, &channels, STBI_rgb_alpha);
-    channels = STBI_rgb_alpha;
+        gfxDevice.pShaderWatcher = pWatcher;
+    }
 
-    if (!pData) {
-        GFX_ERROR("Failed to load texture.");
+    if (pWatcher->fd < 0) {
         return;
     }
 
-    VkExtent3D extent = {.width = (uint32_t)width, .height = (uint32_t)height, .depth = 1};
-    createTexture(pTexture, type, format, pData, extent, channels, generateMipmaps);
-
-    stbi_image_free(pData);
+    int watch = -1;
 
-    createSampler(pTexture);
-}
+#if GFX_LINUX
+    // Watch the directory rather than the file, as editors commonly save by
+    // replacing the file. Watching a directory again returns the same watch.
+    char* pDirectory = joinRelativePath(pShader->pPath, ".");
+    watch = inotify_add_watch(pWatcher->fd, pDirectory, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watch < 0) {
+        GFX_WARNING("Unable to watch %s: %s", pDirectory, strerror(errno));
+    }
+    GFX_FREE(pDirectory);
 #endif
 
-void gfxDestroyTexture(GfxTexture* pTexture)
-{
-    vkDeviceWaitIdle(gfxDevice.device);
-    vkDestroySampler(gfxDevice.device, pTexture->sampler, NULL);
-    gfxDestroyImage(&pTexture->image);
+    if (watch < 0) {
+        return;
+    }
 
-    GFX_RESET(pTexture);
-}
+    if (pWatcher->shaderCount == pWatcher->shaderCapacity) {
+        pWatcher->shaderCapacity = GFX_MAX(16, 2 * pWatcher->shaderCapacity);
+        pWatcher->pShaders = GFX_REALLOC(pWatcher->pShaders, pWatcher->shaderCapacity * sizeof *pWatcher->pShaders);
+    }
 
-VkWriteDescriptorSet gfxGetTextureDescriptor(const GfxTexture* pTexture, uint32_t binding, VkDescriptorType type)
-{
-    return (VkWriteDescriptorSet){
-        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstBinding = binding,
-        .dstArrayElement = 0,
-        .descriptorCount = 1,
-        .descriptorType = type,
-        .pImageInfo = &pTexture->imageInfo,
+    pWatcher->pShaders[pWatcher->shaderCount++] = (struct GfxWatchedShader){
+        .pShader = pShader,
+        .watch = watch,
     };
 }
 
-void gfxSetTextureMagFilter(GfxTexture* pTexture, VkFilter magFilter)
+// Stop watching a shader that is being destroyed. A pending reload of it is
+// discarded, and so is one of the shader it is linked with.
+static void unwatchShader(GfxShader* pShader)
 {
-    pTexture->magFilter = magFilter;
-    createSampler(pTexture);
-}
+    struct GfxShaderWatcher* pWatcher = gfxDevice.pShaderWatcher;
+    if (!pWatcher) {
+        return;
+    }
 
-void gfxSetTextureMinFilter(GfxTexture* pTexture, VkFilter minFilter)
-{
-    pTexture->minFilter = minFilter;
-    createSampler(pTexture);
-}
+    discardPendingReloads(pShader);
 
-void gfxSetTextureMipmapMode(GfxTexture* pTexture, VkSamplerMipmapMode mipmapMode)
-{
-    pTexture->mipmapMode = mipmapMode;
-    createSampler(pTexture);
+    // The directory stays watched, as other shaders may be in it
+    for (uint32_t i = 0; i < pWatcher->shaderCount; i++) {
+        if (pWatcher->pShaders[i].pShader == pShader) {
+            pWatcher->pShaders[i] = pWatcher->pShaders[--pWatcher->shaderCount];
+            break;
+        }
+    }
 }
 
-void gfxSetTextureAddressMode(GfxTexture* pTexture, VkSamplerAddressMode modeU, VkSamplerAddressMode modeV,
-                              VkSamplerAddressMode modeW)
+uint32_t gfxReloadShaders()
 {
-    pTexture->addressModeU = modeU;
-    pTexture->addressModeV = modeV;
-    pTexture->addressModeW = modeW;
-    createSampler(pTexture);
-}
+    struct GfxShaderWatcher* pWatcher = gfxDevice.pShaderWatcher;
+    if (!pWatcher || pWatcher->fd < 0) {
+        return 0;
+    }
 
-static void createAttachmentSet(GfxAttachment* pAttachmentSet, uint32_t colorAttachmentCount,
-                                GfxImage* pColorAttachments, GfxImage* pDepthAttachment, GfxImage* pResolveAttachment)
-{
-    *pAttachmentSet = (GfxAttachment){
-        .pRenderingAttachmentInfos = GFX_MALLOC(colorAttachmentCount * sizeof(VkRenderingAttachmentInfo)),
-        .pFormats = GFX_MALLOC(colorAttachmentCount * sizeof(VkFormat)),
-        .pColorAttachments = pColorAttachments,
-        .colorAttachmentCount = colorAttachmentCount,
-        .pDepthAttachment = pDepthAttachment,
-        .pResolveAttachment = pResolveAttachment,
-    };
+    // Keep using the current shaders until the whole batch has been rebuilt
+    if (!isJobGroupDone(&pWatcher->group)) {
+        return 0;
+    }
 
-    for (uint32_t i = 0; i < colorAttachmentCount; i++) {
-        pAttachmentSet->pRenderingAttachmentInfos[i] = (VkRenderingAttachmentInfo){
-            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-            .imageView = pAttachmentSet->pColorAttachments[i].imageView,
-            .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-            .resolveMode = pAttachmentSet->pResolveAttachment ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
-            .resolveImageView =
-                pAttachmentSet->pResolveAttachment ? pAttachmentSet->pResolveAttachment->imageView : NULL,
-            .resolveImageLayout = pAttachmentSet->pResolveAttachment ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-                                                                     : VK_IMAGE_LAYOUT_UNDEFINED,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        };
-        pAttachmentSet->pFormats[i] = pAttachmentSet->pColorAttachments[i].format;
+    uint32_t swapCount = 0;
+
+    for (uint32_t i = 0; i < pWatcher->reloadCount; i++) {
+        swapCount += swapShaderReload(&pWatcher->pReloads[i]);
     }
 
-    pAttachmentSet->pipelineRenderingCreateInfo = (VkPipelineRenderingCreateInfo){
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
-        .colorAttachmentCount = colorAttachmentCount,
-        .pColorAttachmentFormats = pAttachmentSet->pFormats,
-        .depthAttachmentFormat = pDepthAttachment ? pDepthAttachment->format : VK_FORMAT_UNDEFINED,
-    };
-}
+    GFX_FREE(pWatcher->pReloads);
+    pWatcher->pReloads = NULL;
+    pWatcher->reloadCount = 0;
 
-void gfxCreateAttachment(uint32_t colorAttachmentCount, GfxImage* pColorAttachments, GfxImage* pDepthAttachment,
-                         GfxImage* pResolveAttachment, GfxAttachment* pAttachmentSet)
-{
-    createAttachmentSet(pAttachmentSet, colorAttachmentCount, pColorAttachments, pDepthAttachment, pResolveAttachment);
-}
+#if GFX_LINUX
+    _Alignas(struct inotify_event) char buffer[4096];
+    ssize_t length;
 
-void gfxDestroyAttachment(GfxAttachment* pAttachmentSet)
-{
-    GFX_FREE(pAttachmentSet->pRenderingAttachmentInfos);
-    GFX_FREE(pAttachmentSet->pFormats);
+    while ((length = read(pWatcher->fd, buffer, sizeof buffer)) > 0) {
+        for (const char* p = buffer; p < buffer + length;) {
+            const struct inotify_event* pEvent = (const struct inotify_event*)p;
+            p += sizeof *pEvent + pEvent->len;
 
-    GFX_RESET(pAttachmentSet);
-}
+            if (pEvent->len) {
+                markChangedShaders(pWatcher, pEvent->wd, pEvent->name);
+            }
+        }
+    }
+#endif
 
-void gfxRecreateAttachment(GfxAttachment* pAttachmentSet, uint32_t colorAttachmentCount, GfxImage* pColorAttachments,
-                           GfxImage* pDepthAttachment, GfxImage* pResolveAttachment)
-{
-    GFX_FREE(pAttachmentSet->pRenderingAttachmentInfos);
-    GFX_FREE(pAttachmentSet->pFormats);
-    createAttachmentSet(pAttachmentSet, colorAttachmentCount, pColorAttachments, pDepthAttachment, pResolveAttachment);
-}
+    uint32_t changedCount = 0;
+    for (uint32_t i = 0; i < pWatcher->shaderCount; i++) {
+        changedCount += pWatcher->pShaders[i].changed;
+    }
 
-void gfxCmdBeginRendering(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet, VkClearValue clearValue,
-                          VkAttachmentLoadOp loadOp)
-{
-    for (uint32_t i = 0; i < pAttachmentSet->colorAttachmentCount; i++) {
-        pAttachmentSet->pRenderingAttachmentInfos[i].clearValue = clearValue;
-        pAttachmentSet->pRenderingAttachmentInfos[i].loadOp = loadOp;
+    if (!changedCount) {
+        return swapCount;
     }
 
-    VkRenderingAttachmentInfo depthAttachmentInfo;
-    if (pAttachmentSet->pDepthAttachment) {
-        depthAttachmentInfo = (VkRenderingAttachmentInfo){
-            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-            .imageView = pAttachmentSet->pDepthAttachment->imageView,
-            .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-            .clearValue.depthStencil = {.depth = 0.0f, .stencil = 0},
+    pWatcher->pReloads = GFX_MALLOC(changedCount * sizeof *pWatcher->pReloads);
+
+    for (uint32_t i = 0; i < pWatcher->shaderCount; i++) {
+        struct GfxWatchedShader* pWatched = &pWatcher->pShaders[i];
+        GfxShader* pLinked = pWatched->pShader->pLinkedShader;
+
+        // Shaders that are still being built are reloaded once they are ready
+        if (!pWatched->changed || pWatched->pShader->pBuild || (pLinked && pLinked->pBuild)) {
+            continue;
+        }
+
+        pWatched->changed = false;
+
+        struct GfxShaderReload* pReload = &pWatcher->pReloads[pWatcher->reloadCount++];
+        *pReload = (struct GfxShaderReload){
+            .pShaders = {pWatched->pShader},
+            .shaderCount = 1,
+            .recompile = {true},
         };
+
+        // Linked shaders can only be rebuilt together. If the other shader
+        // changed as well, it is recompiled by the same reload.
+        if (pLinked) {
+            pReload->pShaders[1] = pLinked;
+            pReload->shaderCount = 2;
+
+            for (uint32_t j = i + 1; j < pWatcher->shaderCount; j++) {
+                if (pWatcher->pShaders[j].pShader == pLinked && pWatcher->pShaders[j].changed) {
+                    pWatcher->pShaders[j].changed = false;
+                    pReload->recompile[1] = true;
+                }
+            }
+        }
+
+        submitJob(&pWatcher->group, rebuildShaders, pReload);
     }
 
-    VkExtent2D extent = {
-        .width = pAttachmentSet->pColorAttachments[0].width,
-        .height = pAttachmentSet->pColorAttachments[0].height,
-    };
+    return swapCount;
+}
 
-    VkRenderingInfo renderingInfo = {
-        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-        .renderArea = {.offset = {0, 0}, .extent = extent},
-        .layerCount = 1,
-        .colorAttachmentCount = pAttachmentSet->colorAttachmentCount,
-        .pColorAttachments = pAttachmentSet->pRenderingAttachmentInfos,
-        .pDepthAttachment = pAttachmentSet->pDepthAttachment ? &depthAttachmentInfo : NULL,
-        .pStencilAttachment = NULL,
-    };
+void gfxDestroyShader(GfxShader* pShader)
+{
+    waitShaderBuild(pShader);
+    unwatchShader(pShader);
 
-    vkCmdBeginRendering(cmd, &renderingInfo);
+    if (pShader->pLinkedShader && pShader->pLinkedShader->pLinkedShader == pShader) {
+        pShader->pLinkedShader->pLinkedShader = NULL;
+    }
+
+    deferDestroy((GfxDeferredDestroy){.type = GFX_DEFERRED_SHADER, .shader = pShader->shader});
+
+    GFX_FREE(pShader->pCode);
+    GFX_FREE(pShader->pPath);
+    GFX_FREE(pShader->pPreamble);
+    GFX_FREE(pShader->pPushConstantRanges);
+    GFX_FREE(pShader->pSpecializationEntries);
+    GFX_FREE(pShader->pSpecializationData);
+
+    GFX_RESET(pShader);
 }
 
-void gfxCmdEndRendering(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet)
+// Shaders created from SPIR-V byte code have no source path
+#define GFX_SHADER_NAME(pShader) ((pShader)->pPath ? (pShader)->pPath : "(SPIR-V)")
+
+void gfxBuildShader(GfxShader* pShader)
 {
-    GFX_UNUSED(pAttachmentSet);
-    vkCmdEndRendering(cmd);
+    waitShaderBuild(pShader);
+    discardPendingReloads(pShader);
+
+    GFX_INFO("Building shader: %s", GFX_SHADER_NAME(pShader));
+
+    pShader->pLinkedShader = NULL;
+
+    bool cacheHit, cacheMiss;
+    VK_CHECK(createShaderObjects(1, &pShader->createInfo, &pShader->layoutHash, &pShader->shader, &cacheHit,
+                                 &cacheMiss));
+
+    gfxDevice.shaderCache.binaryHits += cacheHit;
+    gfxDevice.shaderCache.binaryMisses += cacheMiss;
 }
 
-void gfxCreateLayout(uint32_t bindingCount, VkDescriptorType* pTypes, VkShaderStageFlags* pStages, uint32_t* pCounts,
-                     uint32_t pushConstantRangeCount, VkPushConstantRange* pPushConstantRanges, GfxLayout* pLayout)
+void gfxBuildLinkedShaders(GfxShader* pVertexShader, GfxShader* pFragmentShader)
 {
-    if (!gfxDevice.device) {
-        GFX_ERROR("Device not initialized");
+    if (!pVertexShader || !pFragmentShader) {
+        GFX_ERROR("Both pVertexShader and pFragmentShader need to be specified");
     }
 
-    size_t pushConstantRangeSize = pushConstantRangeCount * sizeof(VkPushConstantRange);
+    waitShaderBuild(pVertexShader);
+    waitShaderBuild(pFragmentShader);
+    discardPendingReloads(pVertexShader);
+    discardPendingReloads(pFragmentShader);
 
-    *pLayout = (GfxLayout){
-        .pushConstantRangeCount = pushConstantRangeCount,
+    GFX_INFO("Building shaders: %s", GFX_SHADER_NAME(pVertexShader));
+    GFX_INFO("                  %s", GFX_SHADER_NAME(pFragmentShader));
+
+    VkShaderCreateInfoEXT createInfos[] = {
+        pVertexShader->createInfo,
+        pFragmentShader->createInfo,
     };
 
-    if (pLayout->pushConstantRangeCount) {
-        pLayout->pPushConstantRanges = GFX_MALLOC(pushConstantRangeSize);
-        memcpy(pLayout->pPushConstantRanges, pPushConstantRanges, pushConstantRangeSize);
+    for (uint32_t i = 0; i < GFX_ARRAY_LEN(createInfos); i++) {
+        createInfos[i].flags |= VK_SHADER_CREATE_LINK_STAGE_BIT_EXT;
     }
 
-    VkDescriptorSetLayoutBinding* pBindings = GFX_MALLOC(bindingCount * sizeof *pBindings);
+    uint64_t layoutHashes[] = {
+        pVertexShader->layoutHash,
+        pFragmentShader->layoutHash,
+    };
 
-    for (uint32_t i = 0; i < bindingCount; i++) {
-        pBindings[i] = (VkDescriptorSetLayoutBinding){
-            .binding = i,
-            .descriptorType = pTypes[i],
-            .descriptorCount = pCounts[i],
-            .stageFlags = pStages[i],
-        };
+    VkShaderEXT shaders[GFX_ARRAY_LEN(createInfos)];
+
+    // Linked shaders are cached as one entry, as they can only be created
+    // together
+    bool cacheHit, cacheMiss;
+    VK_CHECK(createShaderObjects(GFX_ARRAY_LEN(createInfos), createInfos, layoutHashes, shaders, &cacheHit,
+                                 &cacheMiss));
+
+    gfxDevice.shaderCache.binaryHits += cacheHit;
+    gfxDevice.shaderCache.binaryMisses += cacheMiss;
+
+    pVertexShader->shader = shaders[0];
+    pFragmentShader->shader = shaders[1];
+    pVertexShader->pLinkedShader = pFragmentShader;
+    pFragmentShader->pLinkedShader = pVertexShader;
+}
+
+void gfxBuildShaderVariants(const GfxShader* pShader, uint32_t variantCount,
+                            const VkSpecializationInfo* const* pSpecializationInfos, GfxShader* pVariants)
+{
+    if (!variantCount) {
+        return;
     }
 
-    VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT,
-        .bindingCount = bindingCount,
-        .pBindings = pBindings,
-    };
+    if (pShader->pBuild) {
+        GFX_ERROR("Shader %s is still being built", GFX_SHADER_NAME(pShader));
+    }
 
-    VK_CHECK(vkCreateDescriptorSetLayout(gfxDevice.device, &setLayoutCreateInfo, NULL, &pLayout->setLayout));
+    GFX_INFO("Building %" PRIu32 " variants of shader: %s", variantCount, GFX_SHADER_NAME(pShader));
 
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &pLayout->setLayout,
-        .pushConstantRangeCount = pLayout->pushConstantRangeCount,
-        .pPushConstantRanges = pLayout->pPushConstantRanges,
-    };
-    VK_CHECK(vkCreatePipelineLayout(gfxDevice.device, &pipelineLayoutCreateInfo, NULL, &pLayout->pipelineLayout));
+    VkShaderCreateInfoEXT* pCreateInfos = GFX_MALLOC(variantCount * sizeof *pCreateInfos);
+    uint64_t* pLayoutHashes = GFX_MALLOC(variantCount * sizeof *pLayoutHashes);
+    VkShaderEXT* pShaders = GFX_MALLOC(variantCount * sizeof *pShaders);
+
+    for (uint32_t i = 0; i < variantCount; i++) {
+        copyShader(pShader, &pVariants[i]);
+
+        if (pSpecializationInfos[i]) {
+            gfxSetShaderSpecialization(&pVariants[i], pSpecializationInfos[i]);
+        }
 
-    GFX_FREE(pBindings);
+        pCreateInfos[i] = pVariants[i].createInfo;
+        pLayoutHashes[i] = pVariants[i].layoutHash;
+    }
+
+    // The variants are cached as one entry, like linked shaders
+    bool cacheHit, cacheMiss;
+    VK_CHECK(createShaderObjects(variantCount, pCreateInfos, pLayoutHashes, pShaders, &cacheHit, &cacheMiss));
+
+    gfxDevice.shaderCache.binaryHits += cacheHit;
+    gfxDevice.shaderCache.binaryMisses += cacheMiss;
+
+    for (uint32_t i = 0; i < variantCount; i++) {
+        pVariants[i].shader = pShaders[i];
+    }
+
+    GFX_FREE(pShaders);
+    GFX_FREE(pLayoutHashes);
+    GFX_FREE(pCreateInfos);
 }
 
-void gfxDestroyLayout(GfxLayout* pLayout)
+static void buildShadersAsync(void* pData)
 {
-    vkDeviceWaitIdle(gfxDevice.device);
-
-    vkDestroyPipelineLayout(gfxDevice.device, pLayout->pipelineLayout, NULL);
-    vkDestroyDescriptorSetLayout(gfxDevice.device, pLayout->setLayout, NULL);
+    struct GfxShaderBuild* pBuild = pData;
+
+    // The shaders belong to the calling thread, so only the build is written
+    // here
+    if (pBuild->compile) {
+        struct GfxCompileResult result = compileFileGLSL(pBuild->pShaders[0]->pPath, pBuild->stage, NULL);
+        pBuild->cacheHit = result.cacheHit;
+        pBuild->cacheMiss = result.cacheMiss;
+
+        if (result.pError) {
+            pBuild->pError = result.pError;
+            return;
+        }
 
-    if (pLayout->pPushConstantRanges) {
-        GFX_FREE(pLayout->pPushConstantRanges);
+        pBuild->pCode = result.pCode;
+        pBuild->codeSize = result.codeSize;
+
+        const GfxLayout* pLayout = pBuild->pLayout;
+        pBuild->createInfos[0] = (VkShaderCreateInfoEXT){
+            .sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
+            .stage = pBuild->stage,
+            .nextStage = pBuild->nextStage,
+            .codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT,
+            .codeSize = pBuild->codeSize,
+            .pCode = pBuild->pCode,
+            .pName = "main",
+            .setLayoutCount = 1,
+            .pSetLayouts = &pLayout->setLayout,
+            .pushConstantRangeCount = pLayout->pushConstantRangeCount,
+            .pPushConstantRanges = pLayout->pPushConstantRanges,
+        };
+        pBuild->layoutHashes[0] = pLayout->hash;
     }
 
-    GFX_RESET(pLayout);
+    VkResult result = createShaderObjects(pBuild->shaderCount, pBuild->createInfos, pBuild->layoutHashes,
+                                          pBuild->shaders, &pBuild->binaryCacheHit, &pBuild->binaryCacheMiss);
+    if (result != VK_SUCCESS) {
+        pBuild->pError = formatString("Failed to build shader %s: %s", GFX_SHADER_NAME(pBuild->pShaders[0]),
+                                      gfxResultString(result));
+
+        for (uint32_t i = 0; i < pBuild->shaderCount; i++) {
+            if (pBuild->shaders[i]) {
+                gfxDevice.fn.vkDestroyShaderEXT(gfxDevice.device, pBuild->shaders[i], NULL);
+                pBuild->shaders[i] = VK_NULL_HANDLE;
+            }
+        }
+    }
 }
 
-static void createShader(GfxShader* pShader, const void* pCode, size_t codeSize, VkShaderStageFlagBits stage,
-                         VkShaderStageFlags nextStage, const GfxLayout* pLayout)
+// Start building shaders on a worker thread. Any earlier builds of them are
+// completed first.
+static void startShaderBuild(struct GfxShaderBuild build)
 {
-    if (!gfxDevice.device) {
-        GFX_ERROR("Device not initialized");
+    for (uint32_t i = 0; i < build.shaderCount; i++) {
+        waitShaderBuild(build.pShaders[i]);
     }
 
-    pShader->pCode = GFX_MALLOC(codeSize);
-    memcpy(pShader->pCode, pCode, codeSize);
+    struct GfxShaderBuild* pBuild = GFX_MALLOC(sizeof *pBuild);
+    *pBuild = build;
 
-    // Take our own copies, so that createInfo does not point into the layout
-    // until the shader is built
-    pShader->setLayout = pLayout->setLayout;
-    if (pLayout->pushConstantRangeCount) {
-        size_t pushConstantRangeSize = pLayout->pushConstantRangeCount * sizeof *pShader->pPushConstantRanges;
-        pShader->pPushConstantRanges = GFX_MALLOC(pushConstantRangeSize);
-        memcpy(pShader->pPushConstantRanges, pLayout->pPushConstantRanges, pushConstantRangeSize);
+    for (uint32_t i = 0; i < pBuild->shaderCount; i++) {
+        GfxShader* pShader = pBuild->pShaders[i];
+        pShader->pBuild = pBuild;
+
+        if (!pBuild->compile) {
+            pBuild->createInfos[i] = pShader->createInfo;
+            pBuild->layoutHashes[i] = pShader->layoutHash;
+            if (pBuild->shaderCount > 1) {
+                pBuild->createInfos[i].flags |= VK_SHADER_CREATE_LINK_STAGE_BIT_EXT;
+            }
+        }
     }
 
-    pShader->createInfo = (VkShaderCreateInfoEXT){
-        .sType = VK_STRUCTURE_TYPE_SHADER_CREATE_INFO_EXT,
-        .flags = 0,
-        .stage = stage,
-        .nextStage = nextStage,
-        .codeType = VK_SHADER_CODE_TYPE_SPIRV_EXT,
-        .codeSize = codeSize,
-        .pCode = pShader->pCode,
-        .pName = "main",
-        .setLayoutCount = 1,
-        .pSetLayouts = &pShader->setLayout,
-        .pushConstantRangeCount = pLayout->pushConstantRangeCount,
-        .pPushConstantRanges = pShader->pPushConstantRanges,
-        .pSpecializationInfo = NULL,
-    };
+    pBuild->pNext = gfxDevice.pShaderBuilds;
+    if (pBuild->pNext) {
+        pBuild->pNext->pPrev = pBuild;
+    }
+    gfxDevice.pShaderBuilds = pBuild;
+
+    submitJob(&pBuild->group, buildShadersAsync, pBuild);
 }
 
-void gfxCreateShader(const void* pCode, size_t codeSize, VkShaderStageFlagBits stage, VkShaderStageFlags nextStage,
-                     const GfxLayout* pLayout, GfxShader* pShader)
+void gfxBuildShaderAsync(GfxShader* pShader)
 {
-    GFX_RESET(pShader);
+    GFX_INFO("Building shader in the background: %s", GFX_SHADER_NAME(pShader));
 
-    createShader(pShader, pCode, codeSize, stage, nextStage, pLayout);
+    startShaderBuild((struct GfxShaderBuild){
+        .pShaders = {pShader},
+        .shaderCount = 1,
+    });
 }
 
-void gfxCreateShaderFromFileGLSL(const char* pPath, VkShaderStageFlagBits stage, VkShaderStageFlags nextStage,
-                                 const GfxLayout* pLayout, GfxShader* pShader)
+void gfxBuildLinkedShadersAsync(GfxShader* pVertexShader, GfxShader* pFragmentShader)
+{
+    if (!pVertexShader || !pFragmentShader) {
+        GFX_ERROR("Both pVertexShader and pFragmentShader need to be specified");
+    }
+
+    GFX_INFO("Building shaders in the background: %s", GFX_SHADER_NAME(pVertexShader));
+    GFX_INFO("                                    %s", GFX_SHADER_NAME(pFragmentShader));
+
+    startShaderBuild((struct GfxShaderBuild){
+        .pShaders = {pVertexShader, pFragmentShader},
+        .shaderCount = 2,
+    });
+}
+
+void gfxCreateShaderFromFileGLSLAsync(const char* pPath, VkShaderStageFlagBits stage, VkShaderStageFlags nextStage,
+                                      const GfxLayout* pLayout, GfxShader* pShader)
 {
+    if (!gfxDevice.device) {
+        GFX_ERROR("Device not initialized");
+    }
+
     size_t sz = strlen(pPath) + 1;
 
     *pShader = (GfxShader){
@@ -2587,204 +8284,258 @@ void gfxCreateShaderFromFileGLSL(const char* pPath, VkShaderStageFlagBits stage,
 
     memcpy(pShader->pPath, pPath, sz);
 
-    // Read file
-    FILE* file = fopen(pShader->pPath, "rb");
-    if (!file) {
-        GFX_ERROR("Unable to open %s\n", pShader->pPath);
+    GFX_INFO("Building shader in the background: %s", pShader->pPath);
+
+    startShaderBuild((struct GfxShaderBuild){
+        .pShaders = {pShader},
+        .shaderCount = 1,
+        .compile = true,
+        .stage = stage,
+        .nextStage = nextStage,
+        .pLayout = pLayout,
+    });
+}
+
+bool gfxIsShaderReady(GfxShader* pShader)
+{
+    if (pShader->pBuild && isJobGroupDone(&pShader->pBuild->group)) {
+        finishShaderBuild(pShader->pBuild);
     }
 
-    long file_size;
-    fseek(file, 0, SEEK_END);
-    file_size = ftell(file);
-    rewind(file);
+    return !pShader->pBuild && pShader->shader != VK_NULL_HANDLE;
+}
 
-    char* pShaderSource = GFX_MALLOC(file_size + 1);
-    fread(pShaderSource, 1, file_size, file);
-    pShaderSource[file_size] = 0;
+void gfxCmdBindShader(VkCommandBuffer cmd, const GfxShader* pShader)
+{
+    gfxDevice.fn.vkCmdBindShadersEXT(cmd, 1, &pShader->createInfo.stage, &pShader->shader);
+}
 
-    fclose(file);
+// Bits of GfxStateTracker.recorded
+enum GfxTrackedState {
+    GFX_STATE_VIEWPORT,
+    GFX_STATE_SCISSOR,
+    GFX_STATE_VERTEX_INPUT,
+    GFX_STATE_TOPOLOGY,
+    GFX_STATE_RASTERIZATION_SAMPLES,
+    GFX_STATE_POLYGON_MODE,
+    GFX_STATE_CULL_MODE,
+    GFX_STATE_FRONT_FACE,
+    GFX_STATE_DEPTH_TEST_ENABLE,
+    GFX_STATE_DEPTH_WRITE_ENABLE,
+    GFX_STATE_DEPTH_COMPARE_OP,
+    GFX_STATE_RASTERIZER_DISCARD_ENABLE,
+    GFX_STATE_PRIMITIVE_RESTART_ENABLE,
+    GFX_STATE_ALPHA_TO_COVERAGE_ENABLE,
+    GFX_STATE_DEPTH_BOUNDS_TEST_ENABLE,
+    GFX_STATE_DEPTH_BIAS_ENABLE,
+    GFX_STATE_STENCIL_TEST_ENABLE,
+    GFX_STATE_LOGIC_OP_ENABLE,
+};
 
-    // Compile GLSL to SPIR-V
-    glslang_target_client_version_t glslangVersion = GLSLANG_TARGET_VULKAN_1_0;
-    switch (VK_VERSION_MAJOR(gfxDevice.apiVersion)) {
-    case 1:
-        switch (VK_VERSION_MINOR(gfxDevice.apiVersion)) {
-        case 0:
-            glslangVersion = GLSLANG_TARGET_VULKAN_1_0;
-            break;
-        case 1:
-            glslangVersion = GLSLANG_TARGET_VULKAN_1_1;
-            break;
-        case 2:
-            glslangVersion = GLSLANG_TARGET_VULKAN_1_2;
-            break;
-        case 3:
-            glslangVersion = GLSLANG_TARGET_VULKAN_1_3;
-            break;
-        case 4:
-            glslangVersion = GLSLANG_TARGET_VULKAN_1_4;
-            break;
-        }
-        break;
+// Store a state value and return whether it needs to be recorded, which is
+// when it has not been recorded yet or had a different value
+static bool changeState(uint32_t* pRecorded, uint32_t bit, void* pCurrent, const void* pValue, size_t size)
+{
+    if ((*pRecorded & (1u << bit)) && !memcmp(pCurrent, pValue, size)) {
+        return false;
     }
 
-    glslang_stage_t glslangStage = GLSLANG_STAGE_VERTEX;
-    switch (stage) {
-    case VK_SHADER_STAGE_VERTEX_BIT:
-        glslangStage = GLSLANG_STAGE_VERTEX;
-        break;
-    case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
-        glslangStage = GLSLANG_STAGE_TESSCONTROL;
-        break;
-    case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
-        glslangStage = GLSLANG_STAGE_TESSEVALUATION;
-        break;
-    case VK_SHADER_STAGE_GEOMETRY_BIT:
-        glslangStage = GLSLANG_STAGE_GEOMETRY;
-        break;
-    case VK_SHADER_STAGE_FRAGMENT_BIT:
-        glslangStage = GLSLANG_STAGE_FRAGMENT;
-        break;
-    case VK_SHADER_STAGE_COMPUTE_BIT:
-        glslangStage = GLSLANG_STAGE_COMPUTE;
-        break;
-    case VK_SHADER_STAGE_RAYGEN_BIT_KHR:
-        glslangStage = GLSLANG_STAGE_RAYGEN;
-        break;
-    case VK_SHADER_STAGE_INTERSECTION_BIT_KHR:
-        glslangStage = GLSLANG_STAGE_INTERSECT;
-        break;
-    case VK_SHADER_STAGE_ANY_HIT_BIT_NV:
-        glslangStage = GLSLANG_STAGE_ANYHIT;
-        break;
-    case VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR:
-        glslangStage = GLSLANG_STAGE_CLOSESTHIT;
-        break;
-    case VK_SHADER_STAGE_MISS_BIT_KHR:
-        glslangStage = GLSLANG_STAGE_MISS;
-        break;
-    case VK_SHADER_STAGE_CALLABLE_BIT_KHR:
-        glslangStage = GLSLANG_STAGE_CALLABLE;
-        break;
-    case VK_SHADER_STAGE_TASK_BIT_EXT:
-        glslangStage = GLSLANG_STAGE_TASK;
-        break;
-    case VK_SHADER_STAGE_MESH_BIT_EXT:
-        glslangStage = GLSLANG_STAGE_MESH;
-        break;
-    }
+    memcpy(pCurrent, pValue, size);
+    *pRecorded |= 1u << bit;
 
-    const glslang_input_t input = {
-        .language = GLSLANG_SOURCE_GLSL,
-        .stage = glslangStage,
-        .client = GLSLANG_CLIENT_VULKAN,
-        .client_version = glslangVersion,
-        .target_language = GLSLANG_TARGET_SPV,
-        .target_language_version = GLSLANG_TARGET_SPV_1_6,
-        .code = pShaderSource,
-        .default_version = 100,
-        .default_profile = GLSLANG_NO_PROFILE,
-        .force_default_version_and_profile = false,
-        .forward_compatible = false,
-        .messages = GLSLANG_MSG_DEFAULT_BIT,
-        .resource = glslang_default_resource(),
-    };
+    return true;
+}
 
-    glslang_shader_t* shader = glslang_shader_create(&input);
+void gfxResetStateTracker(GfxStateTracker* pTracker, VkCommandBuffer cmd)
+{
+    GFX_RESET(pTracker);
+    pTracker->cmd = cmd;
+}
 
-    if (!glslang_shader_preprocess(shader, &input)) {
-        GFX_ERROR("GLSL preprocessing failed %s\n%s\n%s", pPath, glslang_shader_get_info_log(shader),
-                  glslang_shader_get_info_debug_log(shader));
+void gfxCmdSetViewport(GfxStateTracker* pTracker, const VkViewport* pViewport)
+{
+    if (changeState(&pTracker->recorded, GFX_STATE_VIEWPORT, &pTracker->viewport, pViewport, sizeof *pViewport)) {
+        vkCmdSetViewportWithCount(pTracker->cmd, 1, pViewport);
     }
+}
 
-    if (!glslang_shader_parse(shader, &input)) {
-        GFX_ERROR("GLSL parsing failed %s\n%s\n%s\n%s", pPath, glslang_shader_get_info_log(shader),
-                  glslang_shader_get_info_debug_log(shader), glslang_shader_get_preprocessed_code(shader));
+void gfxCmdSetScissor(GfxStateTracker* pTracker, const VkRect2D* pScissor)
+{
+    if (changeState(&pTracker->recorded, GFX_STATE_SCISSOR, &pTracker->scissor, pScissor, sizeof *pScissor)) {
+        vkCmdSetScissorWithCount(pTracker->cmd, 1, pScissor);
     }
+}
 
-    glslang_program_t* program = glslang_program_create();
-    glslang_program_add_shader(program, shader);
+void gfxCmdSetVertexInput(GfxStateTracker* pTracker, uint32_t bindingCount,
+                          const VkVertexInputBindingDescription2EXT* pBindings, uint32_t attributeCount,
+                          const VkVertexInputAttributeDescription2EXT* pAttributes)
+{
+    const uint32_t bit = 1u << GFX_STATE_VERTEX_INPUT;
 
-    if (!glslang_program_link(program, GLSLANG_MSG_SPV_RULES_BIT | GLSLANG_MSG_VULKAN_RULES_BIT)) {
-        GFX_ERROR("GLSL linking failed %s\n%s\n%s", pPath, glslang_program_get_info_log(program),
-                  glslang_program_get_info_debug_log(program));
+    if (bindingCount > GFX_MAX_TRACKED_VERTEX_INPUTS || attributeCount > GFX_MAX_TRACKED_VERTEX_INPUTS) {
+        pTracker->recorded &= ~bit;
+        gfxDevice.fn.vkCmdSetVertexInputEXT(pTracker->cmd, bindingCount, pBindings, attributeCount, pAttributes);
+        return;
     }
 
-    glslang_program_SPIRV_generate(program, glslangStage);
-
-    size_t codeSize = glslang_program_SPIRV_get_size(program) * sizeof(uint32_t);
-    uint32_t* pCode = GFX_MALLOC(codeSize);
-    memset(pCode, 0, codeSize);
-    glslang_program_SPIRV_get(program, pCode);
+    bool changed = !(pTracker->recorded & bit) || bindingCount != pTracker->vertexBindingCount ||
+                   attributeCount != pTracker->vertexAttributeCount;
 
-    const char* spirvMessages = glslang_program_SPIRV_get_messages(program);
-    if (spirvMessages) {
-        GFX_ERROR("(%s) %s", pPath, spirvMessages);
+    // Compare the members rather than the structs, which have padding and pNext
+    for (uint32_t i = 0; i < bindingCount; i++) {
+        uint32_t binding[] = {pBindings[i].binding, pBindings[i].stride, pBindings[i].inputRate, pBindings[i].divisor};
+        if (memcmp(pTracker->vertexBindings[i], binding, sizeof binding)) {
+            memcpy(pTracker->vertexBindings[i], binding, sizeof binding);
+            changed = true;
+        }
     }
 
-    glslang_program_delete(program);
-    glslang_shader_delete(shader);
+    for (uint32_t i = 0; i < attributeCount; i++) {
+        uint32_t attribute[] = {pAttributes[i].location, pAttributes[i].binding, pAttributes[i].format,
+                                pAttributes[i].offset};
+        if (memcmp(pTracker->vertexAttributes[i], attribute, sizeof attribute)) {
+            memcpy(pTracker->vertexAttributes[i], attribute, sizeof attribute);
+            changed = true;
+        }
+    }
 
-    createShader(pShader, pCode, codeSize, stage, nextStage, pLayout);
+    pTracker->vertexBindingCount = bindingCount;
+    pTracker->vertexAttributeCount = attributeCount;
+    pTracker->recorded |= bit;
 
-    GFX_FREE(pCode);
-    GFX_FREE(pShaderSource);
+    if (changed) {
+        gfxDevice.fn.vkCmdSetVertexInputEXT(pTracker->cmd, bindingCount, pBindings, attributeCount, pAttributes);
+    }
 }
 
-void gfxDestroyShader(GfxShader* pShader)
+void gfxCmdSetPrimitiveTopology(GfxStateTracker* pTracker, VkPrimitiveTopology topology)
 {
-    vkDeviceWaitIdle(gfxDevice.device);
-
-    gfxDevice.fn.vkDestroyShaderEXT(gfxDevice.device, pShader->shader, NULL);
-
-    GFX_FREE(pShader->pCode);
-    GFX_FREE(pShader->pPath);
-    GFX_FREE(pShader->pPushConstantRanges);
+    if (changeState(&pTracker->recorded, GFX_STATE_TOPOLOGY, &pTracker->topology, &topology, sizeof topology)) {
+        vkCmdSetPrimitiveTopology(pTracker->cmd, topology);
+    }
+}
 
-    GFX_RESET(pShader);
+void gfxCmdSetRasterizationSamples(GfxStateTracker* pTracker, VkSampleCountFlagBits samples)
+{
+    if (changeState(&pTracker->recorded, GFX_STATE_RASTERIZATION_SAMPLES, &pTracker->rasterizationSamples, &samples,
+                    sizeof samples)) {
+        const VkSampleMask sampleMask = ~0u;
+        gfxDevice.fn.vkCmdSetRasterizationSamplesEXT(pTracker->cmd, samples);
+        gfxDevice.fn.vkCmdSetSampleMaskEXT(pTracker->cmd, samples, &sampleMask);
+    }
 }
 
-// Shaders created from SPIR-V byte code have no source path
-#define GFX_SHADER_NAME(pShader) ((pShader)->pPath ? (pShader)->pPath : "(SPIR-V)")
+void gfxCmdSetPolygonMode(GfxStateTracker* pTracker, VkPolygonMode polygonMode)
+{
+    if (changeState(&pTracker->recorded, GFX_STATE_POLYGON_MODE, &pTracker->polygonMode, &polygonMode,
+                    sizeof polygonMode)) {
+        gfxDevice.fn.vkCmdSetPolygonModeEXT(pTracker->cmd, polygonMode);
+    }
+}
 
-void gfxBuildShader(GfxShader* pShader)
+void gfxCmdSetCullMode(GfxStateTracker* pTracker, VkCullModeFlags cullMode)
 {
-    GFX_INFO("Building shader: %s", GFX_SHADER_NAME(pShader));
-    VK_CHECK(gfxDevice.fn.vkCreateShadersEXT(gfxDevice.device, 1, &pShader->createInfo, NULL, &pShader->shader));
+    if (changeState(&pTracker->recorded, GFX_STATE_CULL_MODE, &pTracker->cullMode, &cullMode, sizeof cullMode)) {
+        vkCmdSetCullMode(pTracker->cmd, cullMode);
+    }
 }
 
-void gfxBuildLinkedShaders(GfxShader* pVertexShader, GfxShader* pFragmentShader)
+void gfxCmdSetFrontFace(GfxStateTracker* pTracker, VkFrontFace frontFace)
 {
-    if (!pVertexShader || !pFragmentShader) {
-        GFX_ERROR("Both pVertexShader and pFragmentShader need to be specified");
+    if (changeState(&pTracker->recorded, GFX_STATE_FRONT_FACE, &pTracker->frontFace, &frontFace, sizeof frontFace)) {
+        vkCmdSetFrontFace(pTracker->cmd, frontFace);
     }
+}
 
-    GFX_INFO("Building shaders: %s", GFX_SHADER_NAME(pVertexShader));
-    GFX_INFO("                  %s", GFX_SHADER_NAME(pFragmentShader));
+void gfxCmdSetDepthState(GfxStateTracker* pTracker, VkBool32 testEnable, VkBool32 writeEnable,
+                         VkCompareOp compareOp)
+{
+    uint32_t* pRecorded = &pTracker->recorded;
 
-    VkShaderCreateInfoEXT createInfos[] = {
-        pVertexShader->createInfo,
-        pFragmentShader->createInfo,
-    };
+    if (changeState(pRecorded, GFX_STATE_DEPTH_TEST_ENABLE, &pTracker->depthTestEnable, &testEnable,
+                    sizeof testEnable)) {
+        vkCmdSetDepthTestEnable(pTracker->cmd, testEnable);
+    }
+    if (changeState(pRecorded, GFX_STATE_DEPTH_WRITE_ENABLE, &pTracker->depthWriteEnable, &writeEnable,
+                    sizeof writeEnable)) {
+        vkCmdSetDepthWriteEnable(pTracker->cmd, writeEnable);
+    }
+    if (changeState(pRecorded, GFX_STATE_DEPTH_COMPARE_OP, &pTracker->depthCompareOp, &compareOp, sizeof compareOp)) {
+        vkCmdSetDepthCompareOp(pTracker->cmd, compareOp);
+    }
+}
 
-    for (uint32_t i = 0; i < GFX_ARRAY_LEN(createInfos); i++) {
-        createInfos[i].flags |= VK_SHADER_CREATE_LINK_STAGE_BIT_EXT;
+void gfxCmdSetEnables(GfxStateTracker* pTracker, VkBool32 rasterizerDiscardEnable, VkBool32 primitiveRestartEnable,
+                      VkBool32 alphaToCoverageEnable, VkBool32 depthBoundsTestEnable, VkBool32 depthBiasEnable,
+                      VkBool32 stencilTestEnable, VkBool32 logicOpEnable)
+{
+    uint32_t* pRecorded = &pTracker->recorded;
+    VkCommandBuffer cmd = pTracker->cmd;
+    const size_t size = sizeof(VkBool32);
+
+    if (changeState(pRecorded, GFX_STATE_RASTERIZER_DISCARD_ENABLE, &pTracker->rasterizerDiscardEnable,
+                    &rasterizerDiscardEnable, size)) {
+        vkCmdSetRasterizerDiscardEnable(cmd, rasterizerDiscardEnable);
     }
+    if (changeState(pRecorded, GFX_STATE_PRIMITIVE_RESTART_ENABLE, &pTracker->primitiveRestartEnable,
+                    &primitiveRestartEnable, size)) {
+        vkCmdSetPrimitiveRestartEnable(cmd, primitiveRestartEnable);
+    }
+    if (changeState(pRecorded, GFX_STATE_ALPHA_TO_COVERAGE_ENABLE, &pTracker->alphaToCoverageEnable,
+                    &alphaToCoverageEnable, size)) {
+        gfxDevice.fn.vkCmdSetAlphaToCoverageEnableEXT(cmd, alphaToCoverageEnable);
+    }
+    if (changeState(pRecorded, GFX_STATE_DEPTH_BOUNDS_TEST_ENABLE, &pTracker->depthBoundsTestEnable,
+                    &depthBoundsTestEnable, size)) {
+        vkCmdSetDepthBoundsTestEnable(cmd, depthBoundsTestEnable);
+    }
+    if (changeState(pRecorded, GFX_STATE_DEPTH_BIAS_ENABLE, &pTracker->depthBiasEnable, &depthBiasEnable, size)) {
+        vkCmdSetDepthBiasEnable(cmd, depthBiasEnable);
+    }
+    if (changeState(pRecorded, GFX_STATE_STENCIL_TEST_ENABLE, &pTracker->stencilTestEnable, &stencilTestEnable,
+                    size)) {
+        vkCmdSetStencilTestEnable(cmd, stencilTestEnable);
+    }
+    if (changeState(pRecorded, GFX_STATE_LOGIC_OP_ENABLE, &pTracker->logicOpEnable, &logicOpEnable, size)) {
+        gfxDevice.fn.vkCmdSetLogicOpEnableEXT(cmd, logicOpEnable);
+    }
+}
 
-    VkShaderEXT shaders[GFX_ARRAY_LEN(createInfos)];
+void gfxCmdSetBlend(GfxStateTracker* pTracker, uint32_t attachment, VkBool32 blendEnable,
+                    const VkColorBlendEquationEXT* pEquation)
+{
+    if (attachment >= GFX_MAX_COLOR_ATTACHMENTS) {
+        GFX_ERROR("Blend state of color attachment %" PRIu32 " is not tracked, see GFX_MAX_COLOR_ATTACHMENTS",
+                  attachment);
+        return;
+    }
 
-    VK_CHECK(gfxDevice.fn.vkCreateShadersEXT(gfxDevice.device, GFX_ARRAY_LEN(createInfos), createInfos, NULL, shaders));
+    if (changeState(&pTracker->blendEnableRecorded, attachment, &pTracker->blendEnable[attachment], &blendEnable,
+                    sizeof blendEnable)) {
+        gfxDevice.fn.vkCmdSetColorBlendEnableEXT(pTracker->cmd, attachment, 1, &blendEnable);
+    }
 
-    pVertexShader->shader = shaders[0];
-    pFragmentShader->shader = shaders[1];
+    if (blendEnable && changeState(&pTracker->blendEquationRecorded, attachment,
+                                   &pTracker->blendEquation[attachment], pEquation, sizeof *pEquation)) {
+        gfxDevice.fn.vkCmdSetColorBlendEquationEXT(pTracker->cmd, attachment, 1, pEquation);
+    }
 }
 
-void gfxCmdBindShader(VkCommandBuffer cmd, const GfxShader* pShader)
+void gfxCmdSetColorWriteMask(GfxStateTracker* pTracker, uint32_t attachment, VkColorComponentFlags writeMask)
 {
-    gfxDevice.fn.vkCmdBindShadersEXT(cmd, 1, &pShader->createInfo.stage, &pShader->shader);
+    if (attachment >= GFX_MAX_COLOR_ATTACHMENTS) {
+        GFX_ERROR("Write mask of color attachment %" PRIu32 " is not tracked, see GFX_MAX_COLOR_ATTACHMENTS",
+                  attachment);
+        return;
+    }
+
+    if (changeState(&pTracker->writeMaskRecorded, attachment, &pTracker->writeMask[attachment], &writeMask,
+                    sizeof writeMask)) {
+        gfxDevice.fn.vkCmdSetColorWriteMaskEXT(pTracker->cmd, attachment, 1, &writeMask);
+    }
 }
 
-void gfxCmdSetDefaultStates(VkCommandBuffer cmd, const GfxAttachment* pAttachmentSet,
+void gfxCmdSetDefaultStates(GfxStateTracker* pTracker, const GfxAttachment* pAttachmentSet,
                             uint32_t vertexBindingDescriptionCount,
                             const VkVertexInputBindingDescription2EXT* vertexBindingDescriptions,
                             uint32_t vertexAttributeDescriptionCount,
@@ -2809,38 +8560,27 @@ void gfxCmdSetDefaultStates(VkCommandBuffer cmd, const GfxAttachment* pAttachmen
         .maxDepth = 1.0f,
     };
     const VkRect2D scissor = {.extent = extent};
-    vkCmdSetViewportWithCount(cmd, 1, &viewport);
-    vkCmdSetScissorWithCount(cmd, 1, &scissor);
-    vkCmdSetRasterizerDiscardEnable(cmd, VK_FALSE);
-
-    gfxDevice.fn.vkCmdSetVertexInputEXT(cmd, vertexBindingDescriptionCount, vertexBindingDescriptions,
-                                        vertexAttributeDescriptionCount, vertexAttributeDescriptions);
-    vkCmdSetPrimitiveTopology(cmd, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-    vkCmdSetPrimitiveRestartEnable(cmd, VK_FALSE);
-
-    const VkSampleMask sampleMask = ~0u;
-    gfxDevice.fn.vkCmdSetRasterizationSamplesEXT(cmd, samples);
-    gfxDevice.fn.vkCmdSetSampleMaskEXT(cmd, samples, &sampleMask);
-    gfxDevice.fn.vkCmdSetAlphaToCoverageEnableEXT(cmd, VK_FALSE);
-    gfxDevice.fn.vkCmdSetPolygonModeEXT(cmd, VK_POLYGON_MODE_FILL);
-    vkCmdSetCullMode(cmd, VK_CULL_MODE_NONE);
-    vkCmdSetFrontFace(cmd, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+    gfxCmdSetViewport(pTracker, &viewport);
+    gfxCmdSetScissor(pTracker, &scissor);
+
+    gfxCmdSetVertexInput(pTracker, vertexBindingDescriptionCount, vertexBindingDescriptions,
+                         vertexAttributeDescriptionCount, vertexAttributeDescriptions);
+    gfxCmdSetPrimitiveTopology(pTracker, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+
+    gfxCmdSetRasterizationSamples(pTracker, samples);
+    gfxCmdSetPolygonMode(pTracker, VK_POLYGON_MODE_FILL);
+    gfxCmdSetCullMode(pTracker, VK_CULL_MODE_NONE);
+    gfxCmdSetFrontFace(pTracker, VK_FRONT_FACE_COUNTER_CLOCKWISE);
 
     // Reverse Z: the depth attachment is cleared to 0.0 and greater wins
-    vkCmdSetDepthTestEnable(cmd, VK_TRUE);
-    vkCmdSetDepthWriteEnable(cmd, VK_TRUE);
-    vkCmdSetDepthCompareOp(cmd, VK_COMPARE_OP_GREATER);
-    vkCmdSetDepthBoundsTestEnable(cmd, VK_FALSE);
-    vkCmdSetDepthBiasEnable(cmd, VK_FALSE);
-    vkCmdSetStencilTestEnable(cmd, VK_FALSE);
-
-    const VkBool32 colorBlendEnable = VK_FALSE;
+    gfxCmdSetDepthState(pTracker, VK_TRUE, VK_TRUE, VK_COMPARE_OP_GREATER);
+    gfxCmdSetEnables(pTracker, VK_FALSE, VK_FALSE, VK_FALSE, VK_FALSE, VK_FALSE, VK_FALSE, VK_FALSE);
+
     const VkColorComponentFlags colorComponents =
         VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    gfxDevice.fn.vkCmdSetLogicOpEnableEXT(cmd, VK_FALSE);
     for (uint32_t i = 0; i < pAttachmentSet->colorAttachmentCount; i++) {
-        gfxDevice.fn.vkCmdSetColorBlendEnableEXT(cmd, i, 1, &colorBlendEnable);
-        gfxDevice.fn.vkCmdSetColorWriteMaskEXT(cmd, i, 1, &colorComponents);
+        gfxCmdSetBlend(pTracker, i, VK_FALSE, NULL);
+        gfxCmdSetColorWriteMask(pTracker, i, colorComponents);
     }
 }
 